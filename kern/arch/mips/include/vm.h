@@ -122,6 +122,8 @@ struct coremap_entry {
 };
 
 
+struct vnode;
+
 struct vm_region {
         vaddr_t start;      /* start address of region */
         size_t size;       /* size of region */
@@ -129,6 +131,9 @@ struct vm_region {
         unsigned int writeable : 1; /* region is writeable */
         unsigned int executable : 1; /* region is executable */
         unsigned int temp_write : 1; /* temporary write permission */
+        unsigned int shared : 1; /* mmap MAP_SHARED: writes go to the file */
+        struct vnode *vn; /* mapped file for mmap regions, else NULL */
+        off_t offset; /* file offset of start for mmap regions */
         struct vm_region *next; /* next region in linked list */
 };
 
@@ -145,6 +150,7 @@ struct page_table_entry {
         unsigned int writable : 1; /* read-only bit */
         unsigned int executable : 1; /* read-only bit */
 		unsigned int cow : 1; /* copy-on-write bit */
+		unsigned int shared : 1; /* page cache page of a MAP_SHARED region */
 };
 
 #define PAGE_TABLE_SIZE ((PAGE_SIZE - sizeof(struct lock*)) / sizeof(struct page_table_entry)) /* Size of the page table */
@@ -186,8 +186,23 @@ void mips_trap(struct trapframe *tf)
 			doadjust = false;
 		}
 
+		/*
+		 * Interrupts from user mode end a stretch of user
+		 * time. (The recorded spl is in sync now, so it's
+		 * safe to read the cycle counter.)
+		 */
+		if (!iskern)
+		{
+			thread_usage_charge(true);
+		}
+
 		mainbus_interrupt(tf);
 
+		if (!iskern)
+		{
+			thread_usage_charge(false);
+		}
+
 		if (doadjust)
 		{
 			KASSERT(curthread->t_curspl == IPL_HIGH);
@@ -214,6 +229,12 @@ void mips_trap(struct trapframe *tf)
 	spl = splhigh();
 	splx(spl);
 
+	/* Charge the time spent in user mode before this trap. */
+	if (!iskern)
+	{
+		thread_usage_charge(true);
+	}
+
 	/* Syscall? Call the syscall handler and return. */
 	if (code == EX_SYS)
 	{
@@ -324,6 +345,12 @@ void mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
 done:
+	/* Charge the time spent in the kernel handling this trap. */
+	if (!iskern)
+	{
+		thread_usage_charge(false);
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -382,7 +409,10 @@ void mips_usermode(struct trapframe *tf)
 	 * user mode. However, while in user mode, interrupts should
 	 * be on. To interact properly with the spl-handling logic
 	 * above, we explicitly call spl0() and then call cpu_irqoff().
+	 *
+	 * Charge the time spent getting here (in exec or fork) first.
 	 */
+	thread_usage_charge(false);
 	spl0();
 	cpu_irqoff();
 
@@ -84,6 +84,7 @@ syscall(struct trapframe *tf)
 	int err;
 	off_t offset;
 	int whence;
+	int fd;
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
 	KASSERT(curthread->t_iplhigh_count == 0);
@@ -113,6 +114,11 @@ syscall(struct trapframe *tf)
 						 (userptr_t)tf->tf_a1);
 		break;
 
+	case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+							(userptr_t)tf->tf_a1);
+		break;
+
 	case SYS_write:
 		err = sys_write((int)tf->tf_a0,
 						(const char *)tf->tf_a1,
@@ -128,6 +134,122 @@ syscall(struct trapframe *tf)
 					   &retval);
 
 		break;
+	case SYS_readv:
+		err = sys_readv((int)tf->tf_a0,
+						(const struct iovec *)tf->tf_a1,
+						(int)tf->tf_a2,
+						&retval);
+		break;
+
+	case SYS_writev:
+		err = sys_writev((int)tf->tf_a0,
+						 (const struct iovec *)tf->tf_a1,
+						 (int)tf->tf_a2,
+						 &retval);
+		break;
+
+	case SYS_mmap:
+		/* fd and the 64-bit offset are past a3, on the stack */
+		err = copyin((const_userptr_t)tf->tf_sp + 16, &fd,
+					 sizeof(fd));
+		if (err) {
+			break;
+		}
+		err = copyin((const_userptr_t)tf->tf_sp + 24, &offset,
+					 sizeof(offset));
+		if (err) {
+			break;
+		}
+		err = sys_mmap((userptr_t)tf->tf_a0,
+					   (size_t)tf->tf_a1,
+					   (int)tf->tf_a2,
+					   (int)tf->tf_a3,
+					   fd,
+					   offset,
+					   &retval);
+		break;
+
+	case SYS_munmap:
+		err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+
+	case SYS_msync:
+		err = sys_msync((userptr_t)tf->tf_a0,
+						(size_t)tf->tf_a1,
+						(int)tf->tf_a2);
+		break;
+
+	case SYS_sendfile:
+		err = sys_sendfile((int)tf->tf_a0,
+						   (int)tf->tf_a1,
+						   (userptr_t)tf->tf_a2,
+						   (size_t)tf->tf_a3,
+						   &retval);
+		break;
+
+	case SYS_pipe:
+		err = sys_pipe((userptr_t)tf->tf_a0, 0, &retval);
+		break;
+
+	case SYS_pipe2:
+		err = sys_pipe((userptr_t)tf->tf_a0, (int)tf->tf_a1, &retval);
+		break;
+
+	case SYS_poll:
+		err = sys_poll((userptr_t)tf->tf_a0,
+					   (unsigned)tf->tf_a1,
+					   (int)tf->tf_a2,
+					   &retval);
+		break;
+
+	case SYS_ioring_setup:
+		err = sys_ioring_setup((unsigned)tf->tf_a0,
+							   (userptr_t)tf->tf_a1,
+							   &retval);
+		break;
+
+	case SYS_ioring_enter:
+		err = sys_ioring_enter((int)tf->tf_a0,
+							   (unsigned)tf->tf_a1,
+							   (unsigned)tf->tf_a2,
+							   &retval);
+		break;
+
+	case SYS_getdirentries:
+		err = sys_getdirentries((int)tf->tf_a0,
+							   (userptr_t)tf->tf_a1,
+							   (size_t)tf->tf_a2,
+							   (int)tf->tf_a3,
+							   &retval);
+		break;
+
+	case SYS_pread:
+		/* The 64-bit offset doesn't fit in a3; it's on the stack */
+		err = copyin((const_userptr_t)tf->tf_sp + 16, &offset,
+					 sizeof(offset));
+		if (err) {
+			break;
+		}
+		err = sys_pread((int)tf->tf_a0,
+						(void *)tf->tf_a1,
+						(size_t)tf->tf_a2,
+						offset,
+						&retval);
+		break;
+
+	case SYS_pwrite:
+		err = copyin((const_userptr_t)tf->tf_sp + 16, &offset,
+					 sizeof(offset));
+		if (err) {
+			break;
+		}
+		err = sys_pwrite((int)tf->tf_a0,
+						 (const void *)tf->tf_a1,
+						 (size_t)tf->tf_a2,
+						 offset,
+						 &retval);
+		break;
+
 	case SYS_lseek:
 		
 		copyin((const_userptr_t)tf->tf_sp + 16, &whence, sizeof(int));
@@ -166,6 +288,10 @@ syscall(struct trapframe *tf)
 
 		break;
 
+	case SYS_fsync:
+		err = sys_fsync((int)tf->tf_a0, &retval);
+		break;
+
 	case SYS_execv:
 		err = sys_execv((char *)tf->tf_a0,
 						(char **)tf->tf_a1,
@@ -181,6 +307,11 @@ syscall(struct trapframe *tf)
 
 		break;
 
+	case SYS_getrusage:
+		err = sys_getrusage((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+
+		break;
+
 	case SYS_close:
 		err = sys_close((int)tf->tf_a0, &retval);
 
@@ -53,6 +53,16 @@
  */
 #define CPU_FREQUENCY 25000000 /* 25 MHz */
 
+/* Cycles per hardclock tick. */
+#define TICK_CYCLES (CPU_FREQUENCY / HZ)
+
+/*
+ * When rounding the timer up to the next tick boundary, skip to the
+ * one after if we're this close, so c0_count can't pass c0_compare
+ * before we've written it (it would then run all the way around).
+ */
+#define TIMER_MARGIN 100
+
 /*
  * Access to the on-chip timer.
  *
@@ -76,6 +86,55 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+/*
+ * Read the cycle counter for the current CPU.
+ *
+ * c0_count starts over from 0 each time it reaches c0_compare, which
+ * is always set to a whole number of ticks past the last timer
+ * interrupt, and c_hardclocks is brought up to date with all of them
+ * when the interrupt comes in. So the number of cycles since the CPU
+ * started ticking is c_hardclocks times the tick length plus the
+ * current count. This is only meaningful relative to other readings
+ * on the same CPU; different CPUs start their timers at different
+ * times.
+ */
+uint64_t
+cpu_cycles(void)
+{
+	uint32_t count;
+	unsigned ticks;
+	int s;
+
+	s = splhigh();
+	ticks = curcpu->c_hardclocks;
+	count = mips_timer_get();
+	splx(s);
+
+	return (uint64_t)ticks * TICK_CYCLES + count;
+}
+
+unsigned
+cpu_cycles_per_tick(void)
+{
+	return TICK_CYCLES;
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -116,7 +175,7 @@ mainbus_bootstrap(void)
 	/*
 	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
 	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+	mips_timer_set(TICK_CYCLES);
 }
 
 /*
@@ -314,8 +373,15 @@ mainbus_interrupt(struct trapframe *tf)
 		seen = true;
 	}
 	if (cause & MIPS_TIMER_BIT) {
+		unsigned ticks = curcpu->c_timerticks;
+
 		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
+		curcpu->c_timerticks = 1;
+		mips_timer_set(TICK_CYCLES);
+		/* account for any ticks we slept through while idle */
+		if (ticks > 1) {
+			hardclock_catchup(ticks - 1);
+		}
 		/* and call hardclock */
 		hardclock();
 		seen = true;
@@ -342,3 +408,72 @@ mainbus_interrupt(struct trapframe *tf)
 		}
 	}
 }
+
+/*
+ * Check if the timer has gone off and the interrupt hasn't been
+ * taken yet. If so, c0_count has started over and rewriting
+ * c0_compare would lose the tick, so leave it alone.
+ */
+static
+bool
+mips_timer_pending(void)
+{
+	uint32_t cause;
+
+	/* $13 == c0_cause */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $13;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (cause));
+	return (cause & MIPS_TIMER_BIT) != 0;
+}
+
+/*
+ * Tickless idle support. c_timerticks is how many ticks past the
+ * last timer interrupt c0_compare is set for; it is normally 1.
+ */
+void
+mainbus_timer_idle(unsigned ticks)
+{
+	KASSERT(curthread->t_curspl > 0);
+
+	if (mips_timer_pending()) {
+		return;
+	}
+
+	/* c0_compare is 32 bits; don't overflow it. */
+	if (ticks > 0xffffffff / TICK_CYCLES) {
+		ticks = 0xffffffff / TICK_CYCLES;
+	}
+	if (ticks <= curcpu->c_timerticks) {
+		return;
+	}
+	curcpu->c_timerticks = ticks;
+	mips_timer_set(ticks * TICK_CYCLES);
+}
+
+void
+mainbus_timer_wake(void)
+{
+	uint32_t count;
+	unsigned ticks;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	if (curcpu->c_timerticks == 1 || mips_timer_pending()) {
+		return;
+	}
+
+	/* Round up to the next tick boundary that isn't too close. */
+	count = mips_timer_get();
+	ticks = count / TICK_CYCLES + 1;
+	if (ticks * TICK_CYCLES - count < TIMER_MARGIN) {
+		ticks++;
+	}
+	if (ticks < curcpu->c_timerticks) {
+		curcpu->c_timerticks = ticks;
+		mips_timer_set(ticks * TICK_CYCLES);
+	}
+}
@@ -39,6 +39,14 @@
  * supported, although such support could be added without undue
  * difficulty.
  *
+ * Output goes through a ring buffer. Writers put characters in it and
+ * only wait if it's full; each write-done interrupt from the device
+ * (con_start) sends the next character. So a thread printing a line
+ * doesn't sleep and get woken once per character, and it can get on
+ * with other work while the console catches up. Polled output drains
+ * the ring first, so it doesn't jump ahead of (or, in a panic, lose)
+ * output that was already queued.
+ *
  * Note that nothing happens until we have a device to write to. A
  * buffer of size DELAYBUFSIZE is used to hold output that is
  * generated before this point. This means that (1) using kprintf for
@@ -55,6 +63,8 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
+#include <clock.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -109,14 +119,86 @@ flush_delay_buf(void)
 
 //////////////////////////////////////////////////
 
+/*
+ * Start sending the next character in the output ring, if there is
+ * one; otherwise mark the device idle.
+ */
+static
+void
+con_startoutput(struct con_softc *cs)
+{
+	unsigned char ch;
+
+	KASSERT(spinlock_do_i_hold(&cs->cs_outlock));
+
+	if (cs->cs_outhead == cs->cs_outtail) {
+		cs->cs_outbusy = false;
+		return;
+	}
+	ch = cs->cs_outbuf[cs->cs_outtail % CONSOLE_OUTPUT_BUFFER_SIZE];
+	cs->cs_outtail++;
+	cs->cs_outbusy = true;
+	cs->cs_send(cs->cs_devdata, ch);
+}
+
+/*
+ * Put LEN characters in the output ring, waiting for room as needed,
+ * and get the device going if it isn't already.
+ */
+static
+void
+con_queue(struct con_softc *cs, const char *data, size_t len)
+{
+	size_t i;
+
+	spinlock_acquire(&cs->cs_outlock);
+	for (i=0; i<len; i++) {
+		while (cs->cs_outhead - cs->cs_outtail ==
+		       CONSOLE_OUTPUT_BUFFER_SIZE) {
+			cs->cs_outwaits++;
+			if (!cs->cs_outbusy) {
+				con_startoutput(cs);
+			}
+			wchan_sleep(cs->cs_outwchan, &cs->cs_outlock);
+		}
+		cs->cs_outbuf[cs->cs_outhead % CONSOLE_OUTPUT_BUFFER_SIZE] =
+			data[i];
+		cs->cs_outhead++;
+		cs->cs_outbytes++;
+	}
+	if (!cs->cs_outbusy) {
+		con_startoutput(cs);
+	}
+	spinlock_release(&cs->cs_outlock);
+}
+
+//////////////////////////////////////////////////
+
 /*
  * Print a character, using polling instead of interrupts to wait for
  * I/O completion.
+ *
+ * Send anything still in the output ring first, unless we're already
+ * inside the console code holding its lock (e.g. panicking in it).
  */
 static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+	unsigned char qch;
+
+	if (!spinlock_do_i_hold(&cs->cs_outlock)) {
+		spinlock_acquire(&cs->cs_outlock);
+		while (cs->cs_outhead != cs->cs_outtail) {
+			qch = cs->cs_outbuf[cs->cs_outtail %
+					    CONSOLE_OUTPUT_BUFFER_SIZE];
+			cs->cs_outtail++;
+			cs->cs_sendpolled(cs->cs_devdata, qch);
+		}
+		cs->cs_outbytes++;	/* for CH, sent below */
+		wchan_wakeall(cs->cs_outwchan, &cs->cs_outlock);
+		spinlock_release(&cs->cs_outlock);
+	}
 	cs->cs_sendpolled(cs->cs_devdata, ch);
 }
 
@@ -129,8 +211,9 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	char c = ch;
+
+	con_queue(cs, &c, 1);
 }
 
 /*
@@ -174,17 +257,26 @@ con_input(void *vcs, int ch)
 	cs->cs_gotchars_head = nexthead;
 
 	V(cs->cs_rsem);
+	pollqueue_wakeup(&cs->cs_pollq);
 }
 
 /*
  * Called from underlying device when a write-done interrupt occurs.
+ * Send the next character, and once the ring is down to half full,
+ * wake anyone waiting to add more.
  */
 void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
 
-	V(cs->cs_wsem);
+	spinlock_acquire(&cs->cs_outlock);
+	cs->cs_outintrs++;
+	con_startoutput(cs);
+	if (cs->cs_outhead - cs->cs_outtail <= CONSOLE_OUTPUT_BUFFER_SIZE/2) {
+		wchan_wakeall(cs->cs_outwchan, &cs->cs_outlock);
+	}
+	spinlock_release(&cs->cs_outlock);
 }
 
 //////////////////////////////////////////////////
@@ -225,6 +317,68 @@ getch(void)
 	return getch_intr(cs);
 }
 
+/*
+ * Output statistics, for the constats menu command. The rates are
+ * per second since the counts were last reset. On a serial console
+ * the device takes one character at a time, so there's one write-done
+ * interrupt per byte; what the ring saves is a thread sleep and
+ * wakeup per byte.
+ */
+void
+console_printstats(void)
+{
+	struct con_softc *cs = the_console;
+	struct timespec now, elapsed;
+	unsigned bytes, intrs, waits, queued;
+	uint64_t ms;
+
+	if (cs == NULL) {
+		return;
+	}
+
+	gettime(&now);
+	spinlock_acquire(&cs->cs_outlock);
+	bytes = cs->cs_outbytes;
+	intrs = cs->cs_outintrs;
+	waits = cs->cs_outwaits;
+	queued = cs->cs_outhead - cs->cs_outtail;
+	timespec_sub(&now, &cs->cs_statstart, &elapsed);
+	spinlock_release(&cs->cs_outlock);
+
+	ms = (uint64_t)elapsed.tv_sec * 1000 + elapsed.tv_nsec / 1000000;
+	if (ms == 0) {
+		ms = 1;
+	}
+
+	kprintf("Console: %u of %u bytes queued\n",
+		queued, CONSOLE_OUTPUT_BUFFER_SIZE);
+	kprintf("    %u bytes, %u interrupts in %llu ms "
+		"(%llu bytes/s, %llu interrupts/s)\n",
+		bytes, intrs, (unsigned long long)ms,
+		(unsigned long long)(bytes * 1000ULL / ms),
+		(unsigned long long)(intrs * 1000ULL / ms));
+	kprintf("    %u waits for room\n", waits);
+}
+
+void
+console_resetstats(void)
+{
+	struct con_softc *cs = the_console;
+	struct timespec now;
+
+	if (cs == NULL) {
+		return;
+	}
+
+	gettime(&now);
+	spinlock_acquire(&cs->cs_outlock);
+	cs->cs_outbytes = 0;
+	cs->cs_outintrs = 0;
+	cs->cs_outwaits = 0;
+	cs->cs_statstart = now;
+	spinlock_release(&cs->cs_outlock);
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -240,16 +394,51 @@ con_eachopen(struct device *dev, int openflags)
 	return 0;
 }
 
+/*
+ * Copy a write into the output ring a chunk at a time, turning \n
+ * into \r\n on the way. This returns once the data is queued, which
+ * only waits if the ring fills up, not once it's been printed.
+ */
+static
+int
+con_write(struct con_softc *cs, struct uio *uio)
+{
+	char in[CONSOLE_WRITE_CHUNK];
+	char out[CONSOLE_WRITE_CHUNK * 2];
+	size_t len, i, n;
+	int result;
+
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid;
+		if (len > sizeof(in)) {
+			len = sizeof(in);
+		}
+		result = uiomove(in, len, uio);
+		if (result) {
+			return result;
+		}
+
+		n = 0;
+		for (i=0; i<len; i++) {
+			if (in[i]=='\n') {
+				out[n++] = '\r';
+			}
+			out[n++] = in[i];
+		}
+		con_queue(cs, out, n);
+	}
+	return 0;
+}
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
 {
+	struct con_softc *cs = dev->d_data;
 	int result;
 	char ch;
 	struct lock *lk;
 
-	(void)dev;  // unused
-
 	if (uio->uio_rw==UIO_READ) {
 		lk = con_userlock_read;
 	}
@@ -260,31 +449,24 @@ con_io(struct device *dev, struct uio *uio)
 	KASSERT(lk != NULL);
 	lock_acquire(lk);
 
+	if (uio->uio_rw==UIO_WRITE) {
+		result = con_write(cs, uio);
+		lock_release(lk);
+		return result;
+	}
+
 	while (uio->uio_resid > 0) {
-		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
-			if (ch=='\r') {
-				ch = '\n';
-			}
-			result = uiomove(&ch, 1, uio);
-			if (result) {
-				lock_release(lk);
-				return result;
-			}
-			if (ch=='\n') {
-				break;
-			}
+		ch = getch();
+		if (ch=='\r') {
+			ch = '\n';
 		}
-		else {
-			result = uiomove(&ch, 1, uio);
-			if (result) {
-				lock_release(lk);
-				return result;
-			}
-			if (ch=='\n') {
-				putch('\r');
-			}
-			putch(ch);
+		result = uiomove(&ch, 1, uio);
+		if (result) {
+			lock_release(lk);
+			return result;
+		}
+		if (ch=='\n') {
+			break;
 		}
 	}
 	lock_release(lk);
@@ -302,10 +484,32 @@ con_ioctl(struct device *dev, int op, userptr_t data)
 	return EINVAL;
 }
 
+/*
+ * Input is ready once a character has arrived. (A read then returns
+ * at least that character, though it may wait for more up to the end
+ * of the line.) Output is always ready.
+ */
+static
+int
+con_poll(struct device *dev, int events, struct pollwait *pw)
+{
+	struct con_softc *cs = dev->d_data;
+	int revents;
+
+	pollqueue_register(&cs->cs_pollq, pw);
+
+	revents = events & POLLOUT;
+	if (cs->cs_gotchars_head != cs->cs_gotchars_tail) {
+		revents |= events & POLLIN;
+	}
+	return revents;
+}
+
 static const struct device_ops console_devops = {
 	.devop_eachopen = con_eachopen,
 	.devop_io = con_io,
 	.devop_ioctl = con_ioctl,
+	.devop_poll = con_poll,
 };
 
 static
@@ -343,7 +547,8 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct semaphore *rsem;
+	struct wchan *outwchan;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -363,29 +568,39 @@ config_con(struct con_softc *cs, int unit)
 	if (rsem == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
+	outwchan = wchan_create("console write");
+	if (outwchan == NULL) {
 		sem_destroy(rsem);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(outwchan);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(outwchan);
 		return ENOMEM;
 	}
 
 	cs->cs_rsem = rsem;
-	cs->cs_wsem = wsem;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	pollqueue_init(&cs->cs_pollq);
+
+	spinlock_init(&cs->cs_outlock);
+	cs->cs_outwchan = outwchan;
+	cs->cs_outhead = 0;
+	cs->cs_outtail = 0;
+	cs->cs_outbusy = false;
+	cs->cs_outbytes = 0;
+	cs->cs_outintrs = 0;
+	cs->cs_outwaits = 0;
+	gettime(&cs->cs_statstart);
 
 	the_console = cs;
 	con_userlock_read = rlk;
@@ -30,6 +30,10 @@
 #ifndef _GENERIC_CONSOLE_H_
 #define _GENERIC_CONSOLE_H_
 
+#include <kern/time.h>
+#include <spinlock.h>
+#include <poll.h>
+
 /*
  * Device data for the hardware-independent system console.
  *
@@ -38,6 +42,8 @@
  */
 
 #define CONSOLE_INPUT_BUFFER_SIZE 32
+#define CONSOLE_OUTPUT_BUFFER_SIZE 1024	/* must be a power of 2 */
+#define CONSOLE_WRITE_CHUNK 128		/* bytes copied in at a time */
 
 struct con_softc {
 	/* initialized by attach routine */
@@ -47,10 +53,24 @@ struct con_softc {
 
 	/* initialized by config routine */
 	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+	struct pollqueue cs_pollq;	/* poll() waiting for input */
+
+	/* output ring; the counters run freely and wrap */
+	struct spinlock cs_outlock;	/* protects the output fields */
+	struct wchan *cs_outwchan;	/* writers waiting for room */
+	unsigned char cs_outbuf[CONSOLE_OUTPUT_BUFFER_SIZE];
+	unsigned cs_outhead;		/* count of chars put in */
+	unsigned cs_outtail;		/* count of chars sent */
+	bool cs_outbusy;		/* device is sending a char */
+
+	/* output statistics, also protected by cs_outlock */
+	unsigned cs_outbytes;		/* chars written */
+	unsigned cs_outintrs;		/* write-done interrupts */
+	unsigned cs_outwaits;		/* times a writer found it full */
+	struct timespec cs_statstart;	/* when counting began */
 };
 
 /*
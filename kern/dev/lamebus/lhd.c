@@ -37,6 +37,9 @@
 #include <uio.h>
 #include <membar.h>
 #include <synch.h>
+#include <clock.h>
+#include <callout.h>
+#include <bio.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -96,41 +99,209 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Request scheduling. Requests are served in C-SCAN order: the head
+ * sweeps upward through the queue, then goes back to the lowest
+ * request and sweeps up again. So that a steady stream of requests
+ * in one area of the disk can't starve the rest, a request that has
+ * waited past its deadline goes first regardless. Reads get the
+ * shorter deadline because usually someone is waiting for them.
+ */
+#define LHD_READDEADLINE	(HZ/2)
+#define LHD_WRITEDEADLINE	(5*HZ)
+
+/* Most sectors we'll merge into one request. */
+#define LHD_MAXMERGE		64
+
+/* How many times to retry a sector that gets a media error. */
+#define LHD_RETRIES		10
+
+/* Most sectors lhd_io transfers per request when it has to copy. */
+#define LHD_MAXXFER		8
+
+/*
+ * Start the current sector of the active request. The hardware only
+ * has one sector's worth of buffer (the rest of the buffer window
+ * is unused) and takes one sector per command, so each sector is a
+ * separate operation.
+ */
+static
+void
+lhd_startsect(struct lhd_softc *lh)
+{
+	struct bio *bio = lh->lh_cur;
+	uint32_t statval = LHD_WORKING;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_qlock));
+
+	if (bio->bio_rw == UIO_WRITE) {
+		/* Transfer the data to the on-card buffer. */
+		memcpy(lh->lh_buf,
+		       (char *)bio->bio_data + lh->lh_curoff * LHD_SECTSIZE,
+		       LHD_SECTSIZE);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, bio->bio_block + lh->lh_curoff);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Pick the next request to serve.
+ */
+static
+struct bio *
+lhd_choose(struct lhd_softc *lh)
+{
+	struct bio *bio, *oldest, *next, *lowest;
+
+	oldest = next = lowest = NULL;
+	for (bio = lh->lh_queue; bio != NULL; bio = bio->bio_qnext) {
+		if (oldest == NULL ||
+		    bio->bio_deadline < oldest->bio_deadline) {
+			oldest = bio;
+		}
+		if (bio->bio_block >= lh->lh_headpos &&
+		    (next == NULL || bio->bio_block < next->bio_block)) {
+			next = bio;
+		}
+		if (lowest == NULL || bio->bio_block < lowest->bio_block) {
+			lowest = bio;
+		}
+	}
+
+	if (oldest == NULL) {
+		return NULL;
+	}
+	if (callout_ticks() >= oldest->bio_deadline) {
+		return oldest;
+	}
+	return next != NULL ? next : lowest;
+}
+
+/*
+ * If the device is idle, start the next request, if any. Called with
+ * the queue lock held.
  */
 static
 void
-lhd_iodone(struct lhd_softc *lh, int err)
+lhd_dispatch(struct lhd_softc *lh)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct bio **pp, *bio;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_qlock));
+
+	if (lh->lh_active != NULL) {
+		return;
+	}
+	bio = lhd_choose(lh);
+	if (bio == NULL) {
+		return;
+	}
+
+	for (pp = &lh->lh_queue; *pp != bio; pp = &(*pp)->bio_qnext) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = bio->bio_qnext;
+	bio->bio_qnext = NULL;
+
+	lh->lh_active = bio;
+	lh->lh_cur = bio;
+	lh->lh_curoff = 0;
+	lh->lh_tries = 0;
+	lhd_startsect(lh);
 }
 
 /*
  * Interrupt handler for lhd.
  * Read the status register; if an operation finished, clear the status
- * register and report completion.
+ * register, and then either start the next sector of the request or
+ * report completion and start the next request.
+ *
+ * The completion functions are called after dropping the queue lock,
+ * since they may well submit more I/O.
  */
 void
 lhd_irq(void *vlh)
 {
 	struct lhd_softc *lh = vlh;
+	struct bio *bio, *next;
 	uint32_t val;
+	int result;
 
 	val = lhd_rdreg(lh, LHD_REG_STAT);
 
 	switch (val & LHD_STATEMASK) {
 	    case LHD_IDLE:
 	    case LHD_WORKING:
-		break;
+		return;
 	    case LHD_OK:
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
 		break;
+	    default:
+		return;
+	}
+	result = lhd_code_to_errno(lh, val);
+
+	spinlock_acquire(&lh->lh_qlock);
+
+	bio = lh->lh_cur;
+	if (bio == NULL) {
+		/* Not ours; ignore it. */
+		spinlock_release(&lh->lh_qlock);
+		return;
+	}
+
+	if (result == EIO && lh->lh_tries < LHD_RETRIES) {
+		lh->lh_tries++;
+		lhd_startsect(lh);
+		spinlock_release(&lh->lh_qlock);
+		return;
+	}
+	lh->lh_tries = 0;
+	lh->lh_headpos = bio->bio_block + lh->lh_curoff + 1;
+
+	if (result == 0) {
+		if (bio->bio_rw == UIO_READ) {
+			/* Transfer the data out of the on-card buffer. */
+			membar_load_load();
+			memcpy((char *)bio->bio_data +
+			       lh->lh_curoff * LHD_SECTSIZE,
+			       lh->lh_buf, LHD_SECTSIZE);
+		}
+		lh->lh_curoff++;
+		if (lh->lh_curoff < bio->bio_nblocks) {
+			lhd_startsect(lh);
+			spinlock_release(&lh->lh_qlock);
+			return;
+		}
 	}
+
+	/*
+	 * BIO is finished, one way or the other. Carry on with whatever
+	 * was merged after it either way; the requests in a merged run
+	 * are unrelated, so one failing says nothing about the rest.
+	 */
+	next = bio->bio_chain;
+	if (next != NULL) {
+		lh->lh_cur = next;
+		lh->lh_curoff = 0;
+		lhd_startsect(lh);
+	}
+	else {
+		lh->lh_active = NULL;
+		lh->lh_cur = NULL;
+		lhd_dispatch(lh);
+	}
+
+	spinlock_release(&lh->lh_qlock);
+
+	bio->bio_done(bio, result);
 }
 
 /*
@@ -179,8 +350,96 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * Queue a request. If it continues (or is continued by) a request
+ * that's waiting, in the same direction, merge the two so they go
+ * as one run.
+ */
+static
+int
+lhd_submit(struct device *d, struct bio *bio)
+{
+	struct lhd_softc *lh = d->d_data;
+	struct bio **pp, *q;
+
+	/* Don't allow I/O past the end of the disk. */
+	if (bio->bio_nblocks == 0 ||
+	    bio->bio_block > lh->lh_dev.d_blocks ||
+	    bio->bio_nblocks > lh->lh_dev.d_blocks - bio->bio_block) {
+		return EINVAL;
+	}
+
+	bio->bio_qnext = NULL;
+	bio->bio_chain = NULL;
+	bio->bio_chaintail = bio;
+	bio->bio_chainblocks = bio->bio_nblocks;
+	bio->bio_deadline = callout_ticks() +
+		(bio->bio_rw == UIO_READ ? LHD_READDEADLINE :
+		 LHD_WRITEDEADLINE);
+
+	spinlock_acquire(&lh->lh_qlock);
+
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->bio_qnext) {
+		q = *pp;
+		if (q->bio_rw != bio->bio_rw ||
+		    q->bio_chainblocks + bio->bio_nblocks > LHD_MAXMERGE) {
+			continue;
+		}
+		if (q->bio_block + q->bio_chainblocks == bio->bio_block) {
+			/* Goes on the end of Q. */
+			q->bio_chaintail->bio_chain = bio;
+			q->bio_chaintail = bio;
+			q->bio_chainblocks += bio->bio_nblocks;
+			break;
+		}
+		if (bio->bio_block + bio->bio_nblocks == q->bio_block) {
+			/* Goes on the front of Q, in its place. */
+			bio->bio_chain = q;
+			bio->bio_chaintail = q->bio_chaintail;
+			bio->bio_chainblocks += q->bio_chainblocks;
+			bio->bio_deadline = q->bio_deadline;
+			bio->bio_qnext = q->bio_qnext;
+			*pp = bio;
+			break;
+		}
+	}
+	if (*pp == NULL) {
+		/* Not merged; add it. The order doesn't matter. */
+		*pp = bio;
+	}
+
+	lhd_dispatch(lh);
+
+	spinlock_release(&lh->lh_qlock);
+	return 0;
+}
+
+/*
+ * State for lhd_io waiting for its request.
+ */
+struct lhd_sync {
+	struct semaphore *ls_sem;
+	int ls_result;
+};
+
+static
+void
+lhd_syncdone(struct bio *bio, int result)
+{
+	struct lhd_sync *ls = bio->bio_arg;
+
+	ls->ls_result = result;
+	V(ls->ls_sem);
+}
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * This goes through the request queue like everything else and
+ * waits. If the uio is a single kernel buffer (as it is for the
+ * filesystem) the transfer is done directly in and out of it;
+ * otherwise it's copied through a bounce buffer a few sectors at a
+ * time.
  */
 static
 int
@@ -192,9 +451,13 @@ lhd_io(struct device *d, struct uio *uio)
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
-	int result;
+	uint32_t n;
+	size_t bytes;
+	bool direct;
+	void *bounce = NULL;
+	struct lhd_sync ls;
+	struct bio bio;
+	int result = 0;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -202,72 +465,88 @@ lhd_io(struct device *d, struct uio *uio)
 	}
 
 	/* Don't allow I/O past the end of the disk. */
-	/* XXX this check can overflow */
-	if (sector+len > lh->lh_dev.d_blocks) {
+	if (sector > lh->lh_dev.d_blocks ||
+	    len > lh->lh_dev.d_blocks - sector) {
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
+	ls.ls_sem = sem_create("lhd-io", 0);
+	if (ls.ls_sem == NULL) {
+		return ENOMEM;
+	}
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	direct = uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1;
+	if (!direct) {
+		bounce = kmalloc(LHD_MAXXFER * LHD_SECTSIZE);
+		if (bounce == NULL) {
+			sem_destroy(ls.ls_sem);
+			return ENOMEM;
+		}
+	}
+
+	while (len > 0) {
+		n = direct ? len : (len < LHD_MAXXFER ? len : LHD_MAXXFER);
+		bytes = n * LHD_SECTSIZE;
 
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
+		if (!direct && uio->uio_rw == UIO_WRITE) {
+			result = uiomove(bounce, bytes, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
 
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
+		bio.bio_block = sector;
+		bio.bio_nblocks = n;
+		bio.bio_rw = uio->uio_rw;
+		bio.bio_data = direct ? uio->uio_iov->iov_kbase : bounce;
+		bio.bio_done = lhd_syncdone;
+		bio.bio_arg = &ls;
 
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		result = lhd_submit(d, &bio);
+		if (result) {
+			break;
 		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
+		P(ls.ls_sem);
+		result = ls.ls_result;
 		if (result) {
-			return result;
+			break;
+		}
+
+		if (direct) {
+			/* Advance the uio past what we did. */
+			uio->uio_iov->iov_kbase =
+				(char *)uio->uio_iov->iov_kbase + bytes;
+			uio->uio_iov->iov_len -= bytes;
+			uio->uio_resid -= bytes;
+			uio->uio_offset += bytes;
+		}
+		else if (uio->uio_rw == UIO_READ) {
+			result = uiomove(bounce, bytes, uio);
+			if (result) {
+				break;
+			}
 		}
+
+		sector += n;
+		len -= n;
 	}
 
-	return 0;
+	if (bounce != NULL) {
+		kfree(bounce);
+	}
+	sem_destroy(ls.ls_sem);
+	return result;
 }
 
 static const struct device_ops lhd_devops = {
 	.devop_eachopen = lhd_eachopen,
 	.devop_io = lhd_io,
 	.devop_ioctl = lhd_ioctl,
+	.devop_submit = lhd_submit,
 };
 
 /*
@@ -284,17 +563,14 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
-		return ENOMEM;
-	}
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_qlock);
+	lh->lh_queue = NULL;
+	lh->lh_active = NULL;
+	lh->lh_cur = NULL;
+	lh->lh_curoff = 0;
+	lh->lh_tries = 0;
+	lh->lh_headpos = 0;
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_ops = &lhd_devops;
@@ -30,6 +30,7 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include <spinlock.h>
 #include <device.h>
 
 /*
@@ -51,9 +52,18 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+
+	/*
+	 * Request queue. lh_qlock is also taken by the interrupt
+	 * handler, which starts each sector after the last one.
+	 */
+	struct spinlock lh_qlock;	/* Protects the rest of this */
+	struct bio *lh_queue;		/* Requests waiting to start */
+	struct bio *lh_active;		/* Request in progress */
+	struct bio *lh_cur;		/* Part of it being transferred */
+	unsigned lh_curoff;		/* Block within lh_cur */
+	unsigned lh_tries;		/* Retries of the current sector */
+	uint32_t lh_headpos;		/* Sector after the last one done */
 
 	struct device lh_dev;		/* VFS device structure */
 };
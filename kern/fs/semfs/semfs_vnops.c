@@ -38,6 +38,7 @@
 #include <current.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <poll.h>
 
 #include "semfs.h"
 
@@ -136,7 +137,7 @@ semfs_getsem(struct semfs_vnode *semv)
  * Wakeup helper. We only need to wake up if there are sleepers, which
  * should only be the case if the old count is 0; and we only
  * potentially need to wake more than one sleeper if the new count
- * will be more than 1.
+ * will be more than 1. Pollers are waiting for the same thing.
  */
 static
 void
@@ -145,6 +146,7 @@ semfs_wakeup(struct semfs_sem *sem, unsigned newcount)
 	if (sem->sems_count > 0 || newcount == 0) {
 		return;
 	}
+	pollqueue_wakeup(&sem->sems_pollq);
 	if (newcount == 1) {
 		cv_signal(sem->sems_cv, sem->sems_lock);
 	}
@@ -255,6 +257,31 @@ semfs_write(struct vnode *vn, struct uio *uio)
 	return 0;
 }
 
+/*
+ * Poll. Reading (P) is ready when the count is nonzero; writing (V)
+ * never blocks.
+ */
+static
+int
+semfs_poll(struct vnode *vn, int events, struct pollwait *pw)
+{
+	struct semfs_vnode *semv = vn->vn_data;
+	struct semfs_sem *sem;
+	int revents;
+
+	sem = semfs_getsem(semv);
+
+	revents = events & POLLOUT;
+	lock_acquire(sem->sems_lock);
+	pollqueue_register(&sem->sems_pollq, pw);
+	if (sem->sems_count > 0) {
+		revents |= events & POLLIN;
+	}
+	lock_release(sem->sems_lock);
+
+	return revents;
+}
+
 /*
  * Truncate. Set the count to the specified value.
  *
@@ -657,6 +684,7 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_read = vopfail_uio_isdir,
 	.vop_readlink = vopfail_uio_isdir,
 	.vop_getdirentry = semfs_getdirentry,
+	.vop_getdirentries = vopgeneric_getdirentries,
 	.vop_write = vopfail_uio_isdir,
 	.vop_ioctl = semfs_ioctl,
 	.vop_stat = semfs_dirstat,
@@ -664,6 +692,7 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_isseekable = semfs_isseekable,
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_isdir,
+	.vop_poll = vopready_poll,
 	.vop_truncate = vopfail_truncate_isdir,
 	.vop_namefile = semfs_namefile,
 
@@ -690,6 +719,7 @@ static const struct vnode_ops semfs_semops = {
 	.vop_read = semfs_read,
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_dirents_notdir,
 	.vop_write = semfs_write,
 	.vop_ioctl = semfs_ioctl,
 	.vop_stat = semfs_semstat,
@@ -697,6 +727,7 @@ static const struct vnode_ops semfs_semops = {
 	.vop_isseekable = semfs_isseekable,
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_perm,
+	.vop_poll = semfs_poll,
 	.vop_truncate = semfs_truncate,
 	.vop_namefile = vopfail_uio_notdir,
 
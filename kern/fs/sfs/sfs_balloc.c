@@ -33,59 +33,372 @@
  * Block allocation.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
+#include <synch.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 /*
- * Zero out a disk block.
+ * Zero out a disk block. This is done in the buffer cache; the zeros
+ * reach the disk whenever the buffer is written back.
  */
 static
 int
 sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
+	struct buf *buf;
+	int result;
 
-	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
+	result = buffer_get(&sfs->sfs_absfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	bzero(buffer_map(buf), SFS_BLOCKSIZE);
+	buffer_mark_valid(buf);
+	buffer_mark_dirty(buf);
+	buffer_release(buf);
+	return 0;
 }
 
 /*
- * Allocate a block.
+ * Count the free blocks covered by each block of the freemap, so the
+ * allocator can skip over regions that are full without looking at
+ * every bit. Called at mount time after the freemap is loaded.
  */
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_freemap_summarize(struct sfs_fs *sfs)
+{
+	uint32_t fmblocks, j;
+	daddr_t block, end;
+
+	fmblocks = SFS_FS_FREEMAPBLOCKS(sfs);
+	sfs->sfs_freecounts = kmalloc(fmblocks * sizeof(uint16_t));
+	if (sfs->sfs_freecounts == NULL) {
+		return ENOMEM;
+	}
+
+	block = 0;
+	for (j=0; j<fmblocks; j++) {
+		end = (j+1) * SFS_BITSPERBLOCK;
+		if (end > sfs->sfs_sb.sb_nblocks) {
+			end = sfs->sfs_sb.sb_nblocks;
+		}
+		sfs->sfs_freecounts[j] = 0;
+		for (; block < end; block++) {
+			if (!bitmap_isset(sfs->sfs_freemap, block)) {
+				sfs->sfs_freecounts[j]++;
+			}
+		}
+		block = (j+1) * SFS_BITSPERBLOCK;
+	}
+	return 0;
+}
+
+/*
+ * Mark BLOCK in use or free in the freemap, keeping the per-block
+ * free counts up to date and noting that the freemap block holding
+ * the bit needs to be written out.
+ */
+static
+void
+sfs_freemap_set(struct sfs_fs *sfs, daddr_t block, bool inuse)
+{
+	unsigned fmblock = block / SFS_BITSPERBLOCK;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	if (inuse) {
+		bitmap_mark(sfs->sfs_freemap, block);
+		KASSERT(sfs->sfs_freecounts[fmblock] > 0);
+		sfs->sfs_freecounts[fmblock]--;
+	}
+	else {
+		bitmap_unmark(sfs->sfs_freemap, block);
+		sfs->sfs_freecounts[fmblock]++;
+	}
+
+	if (!bitmap_isset(sfs->sfs_freemapdirtyblocks, fmblock)) {
+		bitmap_mark(sfs->sfs_freemapdirtyblocks, fmblock);
+	}
+	sfs->sfs_freemapdirty = true;
+}
+
+/*
+ * Find a free block, starting at GOAL and working forward, wrapping
+ * around at the end of the disk. Freemap blocks with nothing free
+ * are skipped using the free counts, and full bytes of the bitmap
+ * are skipped eight blocks at a time.
+ */
+static
+int
+sfs_findfree(struct sfs_fs *sfs, daddr_t goal, daddr_t *ret)
+{
+	const unsigned char *map;
+	uint32_t fmblocks, fmblock, i;
+	daddr_t block, end;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	map = bitmap_getdata(sfs->sfs_freemap);
+	fmblocks = SFS_FS_FREEMAPBLOCKS(sfs);
+
+	if (goal >= sfs->sfs_sb.sb_nblocks) {
+		goal = 0;
+	}
+	block = goal;
+	fmblock = goal / SFS_BITSPERBLOCK;
+
+	/*
+	 * Go around one extra time so we also look at the part of
+	 * the first freemap block that comes before the goal.
+	 */
+	for (i=0; i<=fmblocks; i++) {
+		if (sfs->sfs_freecounts[fmblock] > 0) {
+			end = (fmblock+1) * SFS_BITSPERBLOCK;
+			while (block < end) {
+				if (block % 8 == 0 && map[block / 8] == 0xff) {
+					block += 8;
+					continue;
+				}
+				if (!bitmap_isset(sfs->sfs_freemap, block)) {
+					*ret = block;
+					return 0;
+				}
+				block++;
+			}
+		}
+		fmblock = (fmblock + 1) % fmblocks;
+		block = fmblock * SFS_BITSPERBLOCK;
+	}
+	return ENOSPC;
+}
+
+/*
+ * Give back the blocks set aside for SV. Must hold sfs_freemaplock.
+ */
+static
+void
+sfs_prealloc_discard_locked(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **svp;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	/* sv_prealloc is nonzero exactly when we're on the list */
+	if (sv->sv_prealloc == 0) {
+		KASSERT(sv->sv_nprealloc == 0);
+		return;
+	}
+	while (sv->sv_nprealloc > 0) {
+		sfs_freemap_set(sfs, sv->sv_prealloc, false);
+		sv->sv_prealloc++;
+		sv->sv_nprealloc--;
+	}
+	sv->sv_prealloc = 0;
+
+	/* Take it off the list of vnodes with blocks set aside */
+	for (svp = &sfs->sfs_preallocs; *svp != sv;
+	     svp = &(*svp)->sv_preallocnext) {
+		KASSERT(*svp != NULL);
+	}
+	*svp = sv->sv_preallocnext;
+	sv->sv_preallocnext = NULL;
+}
+
+/*
+ * Give back the blocks set aside for every file. Used when the disk
+ * is otherwise full.
+ */
+static
+void
+sfs_prealloc_discard_all(struct sfs_fs *sfs)
+{
+	while (sfs->sfs_preallocs != NULL) {
+		sfs_prealloc_discard_locked(sfs, sfs->sfs_preallocs);
+	}
+}
+
+/*
+ * Find a free block near GOAL and mark it in use. Must hold
+ * sfs_freemaplock.
+ */
+static
+int
+sfs_balloc_locked(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
 {
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	result = sfs_findfree(sfs, goal, diskblock);
+	if (result == ENOSPC) {
+		/* Take back any blocks being held for appends and retry */
+		sfs_prealloc_discard_all(sfs);
+		result = sfs_findfree(sfs, goal, diskblock);
+	}
 	if (result) {
 		return result;
 	}
-	sfs->sfs_freemapdirty = true;
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
 		      sfs->sfs_sb.sb_volname, *diskblock);
 	}
+	sfs_freemap_set(sfs, *diskblock, true);
+	return 0;
+}
+
+/*
+ * Allocate a block. If GOAL is nonzero, prefer that block, or failing
+ * that the next free block after it, so that blocks allocated in
+ * sequence for the same file end up next to each other.
+ */
+int
+sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
+{
+	int result;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	result = sfs_balloc_locked(sfs, goal, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	if (result) {
+		return result;
+	}
 
-	/* Clear block before returning it */
+	/*
+	 * Clear block before returning it. Nobody else can get at it,
+	 * so we don't need the freemap lock for this.
+	 */
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
-		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		sfs_bfree(sfs, *diskblock);
 	}
 	return result;
 }
 
+/*
+ * How many blocks to set aside past the end of a file that is being
+ * allocated in order.
+ */
+#define SFS_PREALLOC	8
+
+/*
+ * Set aside up to SFS_PREALLOC free blocks following BLOCK for SV.
+ * They're marked in use in the freemap so nobody else takes them;
+ * the next allocations for SV that ask for them get them, and
+ * whatever is left is given back by sfs_prealloc_discard.
+ *
+ * If the system crashes the blocks will be in use but not in any
+ * file; sfsck gives them back.
+ */
+static
+void
+sfs_prealloc(struct sfs_fs *sfs, struct sfs_vnode *sv, daddr_t block)
+{
+	daddr_t next;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+	KASSERT(sv->sv_prealloc == 0 && sv->sv_nprealloc == 0);
+
+	sv->sv_prealloc = block + 1;
+	for (next = block + 1;
+	     next < sfs->sfs_sb.sb_nblocks &&
+		     sv->sv_nprealloc < SFS_PREALLOC &&
+		     !bitmap_isset(sfs->sfs_freemap, next);
+	     next++) {
+		sfs_freemap_set(sfs, next, true);
+		sv->sv_nprealloc++;
+	}
+
+	if (sv->sv_nprealloc > 0) {
+		sv->sv_preallocnext = sfs->sfs_preallocs;
+		sfs->sfs_preallocs = sv;
+	}
+	else {
+		sv->sv_prealloc = 0;
+	}
+}
+
+/*
+ * Give back the blocks set aside for SV.
+ */
+void
+sfs_prealloc_discard(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	sfs_prealloc_discard_locked(sfs, sv);
+	lock_release(sfs->sfs_freemaplock);
+}
+
+/*
+ * Allocate a data block for the file SV, preferring GOAL.
+ *
+ * If GOAL directly follows the last block we allocated for the file,
+ * the file is being laid down in order. The block comes out of the
+ * run set aside for the file if there is one; otherwise we set aside
+ * a new run after the block we get. This keeps files written at the
+ * same time by different processes from interleaving block by block.
+ * A jump anywhere else gives the run back.
+ */
+int
+sfs_balloc_data(struct sfs_vnode *sv, daddr_t goal, daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	bool sequential;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	sequential = sv->sv_lastblock != 0 && goal == sv->sv_lastblock + 1;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sv->sv_nprealloc > 0 && sequential && goal == sv->sv_prealloc) {
+		/* Already marked in use */
+		sv->sv_prealloc++;
+		sv->sv_nprealloc--;
+		if (sv->sv_nprealloc == 0) {
+			sfs_prealloc_discard_locked(sfs, sv);
+		}
+		*diskblock = goal;
+	}
+	else {
+		sfs_prealloc_discard_locked(sfs, sv);
+		result = sfs_balloc_locked(sfs, goal, diskblock);
+		if (result) {
+			lock_release(sfs->sfs_freemaplock);
+			return result;
+		}
+		if (sequential) {
+			sfs_prealloc(sfs, sv, *diskblock);
+		}
+	}
+	lock_release(sfs->sfs_freemaplock);
+
+	/* Clear it before returning it */
+	result = sfs_clearblock(sfs, *diskblock);
+	if (result) {
+		sfs_bfree(sfs, *diskblock);
+		return result;
+	}
+
+	sv->sv_lastblock = *diskblock;
+	return 0;
+}
+
 /*
  * Free a block.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
-	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	lock_acquire(sfs->sfs_freemaplock);
+	sfs_freemap_set(sfs, diskblock, false);
+	lock_release(sfs->sfs_freemaplock);
 }
 
 /*
@@ -94,10 +407,14 @@ sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 int
 sfs_bused(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	int ret;
+
 	if (diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: sfs_bused called on out of range block %u\n",
 		      sfs->sfs_sb.sb_volname, diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	ret = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	return ret;
 }
-
@@ -31,101 +31,149 @@
  * SFS filesystem
  *
  * Block mapping logic.
+ *
+ * A file's blocks are mapped by the extents in the inode and, for
+ * blocks that didn't fit in an extent, by a tree of indirect blocks
+ * (see kern/sfs.h). When a block is allocated we try, in order: to
+ * extend an extent that ends just before it, by taking the disk
+ * block right after the extent; to start a new extent; and only
+ * when all the extents are used up, to put it in the tree.
  */
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/* File blocks mapped by each level of the indirect block tree */
+#define SFS_RANGE_I	SFS_DBPERIDB
+#define SFS_RANGE_II	(SFS_RANGE_I * SFS_DBPERIDB)
+#define SFS_RANGE_III	(SFS_RANGE_II * SFS_DBPERIDB)
+
 /*
- * Look up the disk block number (from 0 up to the number of blocks on
- * the disk) given a file and the logical block number within that
- * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * Look FILEBLOCK up in the extents. Returns the disk block, or 0.
  */
-int
-sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
-	 daddr_t *diskblock)
+static
+daddr_t
+sfs_extent_lookup(struct sfs_vnode *sv, uint32_t fileblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	struct sfs_extent *ext;
+	unsigned i;
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sv->sv_i.sfi_extents[i];
+		if (fileblock >= ext->sfe_fileblock &&
+		    fileblock - ext->sfe_fileblock < ext->sfe_nblocks) {
+			return ext->sfe_diskblock +
+				(fileblock - ext->sfe_fileblock);
+		}
+	}
+	return 0;
+}
 
+/*
+ * Allocate a block for FILEBLOCK (which isn't mapped) and put it in
+ * an extent, if we can. Sets *DISKBLOCK to 0 if all the extents are
+ * in use and the block couldn't be added to one.
+ */
+static
+int
+sfs_extent_alloc(struct sfs_vnode *sv, uint32_t fileblock,
+		 daddr_t *diskblock)
+{
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-	daddr_t block;
-	daddr_t idblock;
-	uint32_t idnum, idoff;
+	struct sfs_extent *ext, *prev, *unused;
+	daddr_t block, goal;
+	unsigned i;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/*
-	 * If the block we want is one of the direct blocks...
+	 * Find the extent that comes before FILEBLOCK, to extend it
+	 * or allocate near it, and an unused one in case we need it.
 	 */
-	if (fileblock < SFS_NDIRECT) {
-		/*
-		 * Get the block number
-		 */
-		block = sv->sv_i.sfi_direct[fileblock];
-
-		/*
-		 * Do we need to allocate?
-		 */
-		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
-			if (result) {
-				return result;
+	prev = unused = NULL;
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sv->sv_i.sfi_extents[i];
+		if (ext->sfe_nblocks == 0) {
+			if (unused == NULL) {
+				unused = ext;
 			}
-
-			/* Remember what we allocated; mark inode dirty */
-			sv->sv_i.sfi_direct[fileblock] = block;
-			sv->sv_dirty = true;
 		}
-
-		/*
-		 * Hand back the block
-		 */
-		if (block != 0 && !sfs_bused(sfs, block)) {
-			panic("sfs: %s: Data block %u (block %u of file %u) "
-			      "marked free\n", sfs->sfs_sb.sb_volname,
-			      block, fileblock, sv->sv_ino);
+		else if (ext->sfe_fileblock < fileblock &&
+			 (prev == NULL ||
+			  ext->sfe_fileblock > prev->sfe_fileblock)) {
+			prev = ext;
 		}
-		*diskblock = block;
-		return 0;
 	}
 
-	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
-	 */
+	/* Aim for where the block would be if the file were contiguous */
+	if (prev != NULL) {
+		goal = prev->sfe_diskblock +
+			(fileblock - prev->sfe_fileblock);
+	}
+	else {
+		goal = sv->sv_ino + 1 + fileblock;
+	}
 
-	fileblock -= SFS_NDIRECT;
+	if (unused == NULL &&
+	    (prev == NULL ||
+	     prev->sfe_fileblock + prev->sfe_nblocks != fileblock)) {
+		/* No extent to put it in */
+		*diskblock = 0;
+		return 0;
+	}
 
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
+	result = sfs_balloc_data(sv, goal, &block);
+	if (result) {
+		return result;
+	}
 
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
-	 */
-	if (idnum >= SFS_NINDIRECT) {
-		return EFBIG;
+	if (prev != NULL &&
+	    prev->sfe_fileblock + prev->sfe_nblocks == fileblock &&
+	    prev->sfe_diskblock + prev->sfe_nblocks == block) {
+		/* It's contiguous with PREV; just lengthen it. */
+		prev->sfe_nblocks++;
+	}
+	else if (unused != NULL) {
+		unused->sfe_fileblock = fileblock;
+		unused->sfe_diskblock = block;
+		unused->sfe_nblocks = 1;
 	}
+	else {
+		/* The goal wasn't free after all, and nowhere else to go */
+		sfs_bfree(sfs, block);
+		*diskblock = 0;
+		return 0;
+	}
+	sv->sv_dirty = true;
+
+	*diskblock = block;
+	return 0;
+}
+
+/*
+ * Look up INDEX in the indirect block tree rooted at *ROOTP, which
+ * has LEVELS levels. If DOALLOC is set, allocate the block if it
+ * isn't there, along with any indirect blocks needed on the way.
+ */
+static
+int
+sfs_bmap_tree(struct sfs_vnode *sv, uint32_t *rootp, unsigned levels,
+	      uint32_t index, bool doalloc, daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *idbuffer;
+	uint32_t *idbuf;
+	daddr_t idblock, block, goal;
+	uint32_t span, idoff;
+	unsigned i;
+	int result;
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Get the disk block number of the top indirect block. */
+	idblock = *rootp;
 
 	if (idblock==0 && !doalloc) {
 		/*
@@ -138,53 +186,150 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	}
 	else if (idblock==0) {
 		/*
-		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
+		 * Allocate it, and remember it in the inode.
+		 * (sfs_balloc zeroes it for us.)
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		result = sfs_balloc(sfs, sv->sv_ino + 1, &idblock);
 		if (result) {
 			return result;
 		}
-
-		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
-
-		/* Mark the inode dirty */
+		*rootp = idblock;
 		sv->sv_dirty = true;
+	}
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+	/* File blocks mapped by each entry in the top indirect block */
+	span = 1;
+	for (i=1; i<levels; i++) {
+		span *= SFS_DBPERIDB;
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+
+	/* Walk down the tree. */
+	for (i=levels; i>0; i--) {
+		idoff = (index / span) % SFS_DBPERIDB;
+
+		/* Load the indirect block (usually from the buffer cache) */
+		result = buffer_read(&sfs->sfs_absfs, idblock, &idbuffer);
 		if (result) {
 			return result;
 		}
+		idbuf = buffer_map(idbuffer);
+
+		/* Get the next block out of the indirect block buffer */
+		block = idbuf[idoff];
+
+		/*
+		 * If there's no block there, allocate one. Put it after
+		 * the last block we gave the file, if there is one.
+		 */
+		if (block==0 && doalloc) {
+			goal = sv->sv_lastblock != 0 ?
+				sv->sv_lastblock + 1 : idblock + 1;
+			if (i == 1) {
+				result = sfs_balloc_data(sv, goal, &block);
+			}
+			else {
+				result = sfs_balloc(sfs, goal, &block);
+			}
+			if (result) {
+				buffer_release(idbuffer);
+				return result;
+			}
+
+			/* Remember the block we allocated */
+			idbuf[idoff] = block;
+
+			/* The indirect block is now dirty */
+			buffer_mark_dirty(idbuffer);
+		}
+		buffer_release(idbuffer);
+
+		if (block == 0) {
+			*diskblock = 0;
+			return 0;
+		}
+		idblock = block;
+		span /= SFS_DBPERIDB;
 	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	*diskblock = idblock;
+	return 0;
+}
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
-		if (result) {
+/*
+ * Look up FILEBLOCK in the indirect block tree.
+ */
+static
+int
+sfs_bmap_indirect(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+		  daddr_t *diskblock)
+{
+	if (fileblock < SFS_RANGE_I) {
+		return sfs_bmap_tree(sv, &sv->sv_i.sfi_indirect, 1,
+				     fileblock, doalloc, diskblock);
+	}
+	fileblock -= SFS_RANGE_I;
+
+	if (fileblock < SFS_RANGE_II) {
+		return sfs_bmap_tree(sv, &sv->sv_i.sfi_dindirect, 2,
+				     fileblock, doalloc, diskblock);
+	}
+	fileblock -= SFS_RANGE_II;
+
+	if (fileblock < SFS_RANGE_III) {
+		return sfs_bmap_tree(sv, &sv->sv_i.sfi_tindirect, 3,
+				     fileblock, doalloc, diskblock);
+	}
+
+	/*
+	 * We only have one triple indirect block. If the offset we
+	 * were asked for is too large, we can't handle it, so fail.
+	 */
+	return EFBIG;
+}
+
+/*
+ * Look up the disk block number (from 0 up to the number of blocks on
+ * the disk) given a file and the logical block number within that
+ * file. If DOALLOC is set, and no such block exists, one will be
+ * allocated.
+ */
+int
+sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+	 daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t block;
+	int result;
+
+	COMPILE_ASSERT(SFS_DBPERIDB * sizeof(uint32_t) == BUFFER_SIZE);
+
+	/* We modify the inode; we'd better be locked. */
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	/* Most blocks are in an extent. */
+	block = sfs_extent_lookup(sv, fileblock);
+
+	/* If not, try the indirect blocks. */
+	if (block == 0) {
+		result = sfs_bmap_indirect(sv, fileblock, false, &block);
+		if (result && !(result == EFBIG && doalloc)) {
 			return result;
 		}
+	}
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
-
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
+	/* If it's not anywhere and we're asked to, allocate it. */
+	if (block == 0 && doalloc) {
+		result = sfs_extent_alloc(sv, fileblock, &block);
 		if (result) {
 			return result;
 		}
+		if (block == 0) {
+			result = sfs_bmap_indirect(sv, fileblock, true,
+						   &block);
+			if (result) {
+				return result;
+			}
+		}
 	}
 
 	/* Hand back the result and return. */
@@ -198,97 +343,162 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Free the blocks in the indirect block tree under *BLOCKP (which
+ * has LEVELS levels and maps file blocks starting at BASE) that are
+ * at or past file block BLOCKLEN. If that leaves the indirect block
+ * empty, free it too and clear *BLOCKP, setting *CHANGED.
  */
+static
 int
-sfs_itrunc(struct sfs_vnode *sv, off_t len)
+sfs_itrunc_tree(struct sfs_vnode *sv, uint32_t *blockp, unsigned levels,
+		uint32_t base, uint32_t blocklen, bool *changed)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *idbuffer;
+	uint32_t *idbuf;
+	uint32_t span, j;
+	unsigned i;
+	bool hasnonzero, iddirty;
+	int result;
 
-	/* Length in blocks (divide rounding up) */
-	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
+	if (*blockp == 0) {
+		return 0;
+	}
 
-	uint32_t i, j;
-	daddr_t block, idblock;
-	uint32_t baseblock, highblock;
-	int result;
-	int hasnonzero, iddirty;
+	/* File blocks mapped by each entry */
+	span = 1;
+	for (i=1; i<levels; i++) {
+		span *= SFS_DBPERIDB;
+	}
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	if (blocklen >= base && blocklen - base >= span * SFS_DBPERIDB) {
+		/* All of it is before the proposed EOF */
+		return 0;
+	}
 
-	vfs_biglock_acquire();
+	/* Read the indirect block */
+	result = buffer_read(&sfs->sfs_absfs, *blockp, &idbuffer);
+	if (result) {
+		return result;
+	}
+	idbuf = buffer_map(idbuffer);
 
-	/*
-	 * Go through the direct blocks. Discard any that are
-	 * past the limit we're truncating to.
-	 */
-	for (i=0; i<SFS_NDIRECT; i++) {
-		block = sv->sv_i.sfi_direct[i];
-		if (i >= blocklen && block != 0) {
-			sfs_bfree(sfs, block);
-			sv->sv_i.sfi_direct[i] = 0;
-			sv->sv_dirty = true;
+	hasnonzero = false;
+	iddirty = false;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		if (idbuf[j] == 0) {
+			continue;
+		}
+		if (levels > 1) {
+			/* Recurse */
+			result = sfs_itrunc_tree(sv, &idbuf[j], levels - 1,
+						 base + j*span, blocklen,
+						 &iddirty);
+			if (result) {
+				if (iddirty) {
+					buffer_mark_dirty(idbuffer);
+				}
+				buffer_release(idbuffer);
+				return result;
+			}
+		}
+		else if (base + j >= blocklen) {
+			/* Discard any blocks that are past the new EOF */
+			sfs_bfree(sfs, idbuf[j]);
+			idbuf[j] = 0;
+			iddirty = true;
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idbuf[j] != 0) {
+			hasnonzero = true;
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
+	if (!hasnonzero) {
+		/*
+		 * The whole indirect block is empty now; free it. Its
+		 * contents no longer matter, so drop the buffer rather
+		 * than write it back.
+		 */
+		buffer_release_and_invalidate(idbuffer);
+		sfs_bfree(sfs, *blockp);
+		*blockp = 0;
+		*changed = true;
+	}
+	else {
+		/* The indirect block is dirty; it'll be written back */
+		if (iddirty) {
+			buffer_mark_dirty(idbuffer);
+		}
+		buffer_release(idbuffer);
+	}
+	return 0;
+}
+
+/*
+ * Called for ftruncate() and when a deleted file is destroyed. The
+ * vnode must be locked.
+ */
+int
+sfs_itrunc(struct sfs_vnode *sv, off_t len)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_extent *ext;
 
-	/* The lowest block in the indirect block */
-	baseblock = SFS_NDIRECT;
+	/* Length in blocks (divide rounding up) */
+	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
+	uint32_t i, j, keep;
+	bool changed = false;
+	int result;
 
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
-		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			vfs_biglock_release();
-			return result;
-		}
+	/* Forget about appending where we were. */
+	sfs_prealloc_discard(sv);
+	sv->sv_lastblock = 0;
 
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
+	/*
+	 * Go through the extents. Discard any blocks that are past
+	 * the limit we're truncating to, and any extents that end
+	 * up empty.
+	 */
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sv->sv_i.sfi_extents[i];
+		if (ext->sfe_nblocks == 0 ||
+		    ext->sfe_fileblock + ext->sfe_nblocks <= blocklen) {
+			continue;
 		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = true;
+		keep = ext->sfe_fileblock < blocklen ?
+			blocklen - ext->sfe_fileblock : 0;
+		for (j=keep; j<ext->sfe_nblocks; j++) {
+			sfs_bfree(sfs, ext->sfe_diskblock + j);
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
+		ext->sfe_nblocks = keep;
+		if (keep == 0) {
+			ext->sfe_fileblock = 0;
+			ext->sfe_diskblock = 0;
 		}
+		sv->sv_dirty = true;
+	}
+
+	/* Then the indirect blocks. */
+	result = sfs_itrunc_tree(sv, &sv->sv_i.sfi_indirect, 1,
+				 0, blocklen, &changed);
+	if (result == 0) {
+		result = sfs_itrunc_tree(sv, &sv->sv_i.sfi_dindirect, 2,
+					 SFS_RANGE_I, blocklen, &changed);
+	}
+	if (result == 0) {
+		result = sfs_itrunc_tree(sv, &sv->sv_i.sfi_tindirect, 3,
+					 SFS_RANGE_I + SFS_RANGE_II,
+					 blocklen, &changed);
+	}
+	if (changed) {
+		sv->sv_dirty = true;
+	}
+	if (result) {
+		return result;
 	}
 
 	/* Set the file size */
@@ -297,7 +507,5 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
-
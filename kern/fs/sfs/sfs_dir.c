@@ -35,6 +35,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
@@ -95,6 +96,393 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+/*
+ * Read the slots from SLOT to the end of the directory block SLOT is
+ * in (or the end of the directory, if sooner) into SDS, which must
+ * have room for SFS_DIRPERBLOCK entries, and return how many that was
+ * in NUMRET. This is zero at the end of the directory.
+ */
+int
+sfs_dir_readblock(struct sfs_vnode *sv, off_t slot,
+		  struct sfs_direntry *sds, unsigned *numret)
+{
+	off_t nentries;
+	unsigned num;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+	KASSERT(slot >= 0);
+
+	nentries = sfs_dir_nentries(sv);
+	if (slot >= nentries) {
+		*numret = 0;
+		return 0;
+	}
+
+	num = SFS_DIRPERBLOCK - slot % SFS_DIRPERBLOCK;
+	if (num > nentries - slot) {
+		num = nentries - slot;
+	}
+
+	result = sfs_metaio(sv, slot * sizeof(struct sfs_direntry),
+			    sds, num * sizeof(struct sfs_direntry), UIO_READ);
+	if (result) {
+		return result;
+	}
+	*numret = num;
+	return 0;
+}
+
+/*
+ * In-memory index of the entries in a directory.
+ *
+ * Searching a directory by reading every slot makes each lookup,
+ * create, and remove O(n) in the size of the directory, and creating
+ * n files O(n^2). So the first time a directory is searched, we read
+ * it through once and hash every name in it. Each slot in use is on
+ * the hash chain for its name; each empty slot is on the free list.
+ * Only the hash is kept, not the name, so a lookup still reads the
+ * entries on its chain to compare names, but that's normally just
+ * the one it's looking for.
+ *
+ * The index is kept up to date by sfs_dir_link and sfs_dir_unlink,
+ * which are the only things that change directory entries, and is
+ * thrown away when the vnode is reclaimed. If we can't get memory
+ * for it, we go back to searching the directory the slow way.
+ */
+struct sfs_dirindex {
+	unsigned di_nbuckets;		/* number of chains; power of 2 */
+	int *di_buckets;		/* first slot on each chain, or -1 */
+	unsigned di_nused;		/* number of slots on chains */
+	unsigned di_nslots;		/* number of slots in the directory */
+	unsigned di_maxslots;		/* allocated size of next/hash */
+	int *di_next;			/* next slot on chain or free list */
+	uint32_t *di_hash;		/* hash of the name in each slot */
+	int di_free;			/* first empty slot, or -1 */
+};
+
+#define SFS_DIRINDEX_MINBUCKETS	64
+#define SFS_DIRINDEX_MINSLOTS	32
+
+/*
+ * Hash a filename. (FNV-1a.)
+ */
+static
+uint32_t
+sfs_dir_hashname(const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*name != 0) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/*
+ * Destroy an index.
+ */
+static
+void
+sfs_dirindex_destroy(struct sfs_dirindex *di)
+{
+	kfree(di->di_buckets);
+	kfree(di->di_next);
+	kfree(di->di_hash);
+	kfree(di);
+}
+
+/*
+ * Throw away the index for SV, if it has one.
+ */
+void
+sfs_dir_dropindex(struct sfs_vnode *sv)
+{
+	if (sv->sv_dirindex != NULL) {
+		sfs_dirindex_destroy(sv->sv_dirindex);
+		sv->sv_dirindex = NULL;
+	}
+}
+
+/*
+ * Replace the hash chains with NBUCKETS new ones. If there's no
+ * memory, keep the old ones; they still work, just more slowly.
+ */
+static
+void
+sfs_dirindex_rehash(struct sfs_dirindex *di, unsigned nbuckets)
+{
+	int *buckets;
+	unsigned i, b;
+	int slot;
+
+	buckets = kmalloc(nbuckets * sizeof(int));
+	if (buckets == NULL) {
+		return;
+	}
+	for (b=0; b<nbuckets; b++) {
+		buckets[b] = -1;
+	}
+
+	for (i=0; i<di->di_nbuckets; i++) {
+		while (di->di_buckets[i] >= 0) {
+			slot = di->di_buckets[i];
+			di->di_buckets[i] = di->di_next[slot];
+			b = di->di_hash[slot] & (nbuckets - 1);
+			di->di_next[slot] = buckets[b];
+			buckets[b] = slot;
+		}
+	}
+
+	kfree(di->di_buckets);
+	di->di_buckets = buckets;
+	di->di_nbuckets = nbuckets;
+}
+
+/*
+ * Make room in the index for at least NSLOTS slots.
+ */
+static
+int
+sfs_dirindex_grow(struct sfs_dirindex *di, unsigned nslots)
+{
+	unsigned newmax;
+	int *next;
+	uint32_t *hash;
+
+	if (nslots <= di->di_maxslots) {
+		return 0;
+	}
+	newmax = di->di_maxslots;
+	while (newmax < nslots) {
+		newmax *= 2;
+	}
+
+	next = kmalloc(newmax * sizeof(int));
+	hash = kmalloc(newmax * sizeof(uint32_t));
+	if (next == NULL || hash == NULL) {
+		kfree(next);
+		kfree(hash);
+		return ENOMEM;
+	}
+	memcpy(next, di->di_next, di->di_nslots * sizeof(int));
+	memcpy(hash, di->di_hash, di->di_nslots * sizeof(uint32_t));
+	kfree(di->di_next);
+	kfree(di->di_hash);
+	di->di_next = next;
+	di->di_hash = hash;
+	di->di_maxslots = newmax;
+	return 0;
+}
+
+/*
+ * Put SLOT, which holds a name whose hash is HASH, on its chain.
+ */
+static
+void
+sfs_dirindex_add(struct sfs_dirindex *di, int slot, uint32_t hash)
+{
+	unsigned b;
+
+	b = hash & (di->di_nbuckets - 1);
+	di->di_hash[slot] = hash;
+	di->di_next[slot] = di->di_buckets[b];
+	di->di_buckets[b] = slot;
+	di->di_nused++;
+
+	/* Keep the chains short */
+	if (di->di_nused > 2 * di->di_nbuckets) {
+		sfs_dirindex_rehash(di, di->di_nbuckets * 4);
+	}
+}
+
+/*
+ * Put the empty slot SLOT on the free list.
+ */
+static
+void
+sfs_dirindex_addfree(struct sfs_dirindex *di, int slot)
+{
+	di->di_next[slot] = di->di_free;
+	di->di_free = slot;
+}
+
+/*
+ * Take SLOT off the list starting at *HEADP.
+ */
+static
+void
+sfs_dirindex_remove(struct sfs_dirindex *di, int *headp, int slot)
+{
+	while (*headp != slot) {
+		KASSERT(*headp >= 0);
+		headp = &di->di_next[*headp];
+	}
+	*headp = di->di_next[slot];
+}
+
+/*
+ * Read directory SV and build an index for it.
+ */
+static
+int
+sfs_dirindex_build(struct sfs_vnode *sv)
+{
+	struct sfs_dirindex *di;
+	struct sfs_direntry tsd;
+	unsigned nbuckets;
+	int nentries, i, result;
+
+	nentries = sfs_dir_nentries(sv);
+
+	nbuckets = SFS_DIRINDEX_MINBUCKETS;
+	while (nbuckets < (unsigned)nentries / 2) {
+		nbuckets *= 2;
+	}
+
+	di = kmalloc(sizeof(*di));
+	if (di == NULL) {
+		return ENOMEM;
+	}
+	di->di_nbuckets = nbuckets;
+	di->di_buckets = kmalloc(nbuckets * sizeof(int));
+	di->di_nused = 0;
+	di->di_nslots = 0;
+	di->di_maxslots = SFS_DIRINDEX_MINSLOTS;
+	while (di->di_maxslots < (unsigned)nentries) {
+		di->di_maxslots *= 2;
+	}
+	di->di_next = kmalloc(di->di_maxslots * sizeof(int));
+	di->di_hash = kmalloc(di->di_maxslots * sizeof(uint32_t));
+	di->di_free = -1;
+	if (di->di_buckets == NULL || di->di_next == NULL ||
+	    di->di_hash == NULL) {
+		sfs_dirindex_destroy(di);
+		return ENOMEM;
+	}
+	for (i=0; i<(int)nbuckets; i++) {
+		di->di_buckets[i] = -1;
+	}
+
+	/* Go backwards so the free list comes out in slot order. */
+	for (i=nentries-1; i>=0; i--) {
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			sfs_dirindex_destroy(di);
+			return result;
+		}
+		if (tsd.sfd_ino == SFS_NOINO) {
+			sfs_dirindex_addfree(di, i);
+		}
+		else {
+			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+			sfs_dirindex_add(di, i, sfs_dir_hashname(tsd.sfd_name));
+		}
+	}
+	di->di_nslots = nentries;
+
+	sv->sv_dirindex = di;
+	return 0;
+}
+
+/*
+ * Update the index of SV after NAME is written into SLOT.
+ */
+static
+void
+sfs_dirindex_link(struct sfs_vnode *sv, int slot, const char *name)
+{
+	struct sfs_dirindex *di = sv->sv_dirindex;
+
+	if (di == NULL) {
+		return;
+	}
+
+	if ((unsigned)slot < di->di_nslots) {
+		/* Reusing an empty slot */
+		sfs_dirindex_remove(di, &di->di_free, slot);
+	}
+	else {
+		/* Adding to the end; any slots in between are empty */
+		if (sfs_dirindex_grow(di, slot + 1)) {
+			sfs_dir_dropindex(sv);
+			return;
+		}
+		while (di->di_nslots < (unsigned)slot) {
+			sfs_dirindex_addfree(di, di->di_nslots++);
+		}
+		di->di_nslots++;
+	}
+	sfs_dirindex_add(di, slot, sfs_dir_hashname(name));
+}
+
+/*
+ * Update the index of SV after SLOT is emptied.
+ */
+static
+void
+sfs_dirindex_unlink(struct sfs_vnode *sv, int slot)
+{
+	struct sfs_dirindex *di = sv->sv_dirindex;
+	unsigned b;
+
+	if (di == NULL) {
+		return;
+	}
+
+	KASSERT((unsigned)slot < di->di_nslots);
+	b = di->di_hash[slot] & (di->di_nbuckets - 1);
+	sfs_dirindex_remove(di, &di->di_buckets[b], slot);
+	di->di_nused--;
+	sfs_dirindex_addfree(di, slot);
+}
+
+/*
+ * Search a directory for a particular filename using its index.
+ */
+static
+int
+sfs_dir_findname_indexed(struct sfs_vnode *sv, const char *name,
+			 uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_dirindex *di = sv->sv_dirindex;
+	struct sfs_direntry tsd;
+	uint32_t hash;
+	int i, result;
+
+	hash = sfs_dir_hashname(name);
+	for (i = di->di_buckets[hash & (di->di_nbuckets - 1)];
+	     i >= 0;
+	     i = di->di_next[i]) {
+		if (di->di_hash[i] != hash) {
+			continue;
+		}
+
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			return result;
+		}
+		KASSERT(tsd.sfd_ino != SFS_NOINO);
+
+		tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+		if (!strcmp(tsd.sfd_name, name)) {
+			if (slot != NULL) {
+				*slot = i;
+			}
+			if (ino != NULL) {
+				*ino = tsd.sfd_ino;
+			}
+			return 0;
+		}
+	}
+
+	if (emptyslot != NULL && di->di_free >= 0) {
+		*emptyslot = di->di_free;
+	}
+	return ENOENT;
+}
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
@@ -107,6 +495,21 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	struct sfs_direntry tsd;
 	int found, nentries, i, result;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	/* Use the index, building it if we haven't yet. */
+	if (sv->sv_dirindex == NULL) {
+		result = sfs_dirindex_build(sv);
+		if (result && result != ENOMEM) {
+			return result;
+		}
+	}
+	if (sv->sv_dirindex != NULL) {
+		return sfs_dir_findname_indexed(sv, name, ino, slot,
+						emptyslot);
+	}
+
+	/* Out of memory; do it the hard way. */
 	nentries = sfs_dir_nentries(sv);
 
 	/* For each slot... */
@@ -157,6 +560,8 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	int result;
 	struct sfs_direntry sd;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	/* Look up the name. We want to make sure it *doesn't* exist. */
 	result = sfs_dir_findname(sv, name, NULL, NULL, &emptyslot);
 	if (result!=0 && result!=ENOENT) {
@@ -186,7 +591,14 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	}
 
 	/* Write the entry. */
-	return sfs_writedir(sv, emptyslot, &sd);
+	result = sfs_writedir(sv, emptyslot, &sd);
+	if (result) {
+		return result;
+	}
+
+	/* Update the index. */
+	sfs_dirindex_link(sv, emptyslot, name);
+	return 0;
 }
 
 /*
@@ -196,13 +608,23 @@ int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
 	struct sfs_direntry sd;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, slot, &sd);
+	result = sfs_writedir(sv, slot, &sd);
+	if (result) {
+		return result;
+	}
+
+	/* Update the index. */
+	sfs_dirindex_unlink(sv, slot);
+	return 0;
 }
 
 /*
@@ -38,22 +38,19 @@
 #include <lib.h>
 #include <array.h>
 #include <bitmap.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
-/* Shortcuts for the size macros in kern/sfs.h */
-#define SFS_FS_NBLOCKS(sfs)        ((sfs)->sfs_sb.sb_nblocks)
-#define SFS_FS_FREEMAPBITS(sfs)    SFS_FREEMAPBITS(SFS_FS_NBLOCKS(sfs))
-#define SFS_FS_FREEMAPBLOCKS(sfs)  SFS_FREEMAPBLOCKS(SFS_FS_NBLOCKS(sfs))
-
 /*
- * Routine for doing I/O (reads or writes) on the free block bitmap.
- * We always do the whole bitmap at once; writing individual sectors
- * might or might not be a worthwhile optimization.
+ * Routine for reading the free block bitmap in at mount time. (It is
+ * written back a block at a time, as blocks of it change, by
+ * sfs_sync_freemap.)
  *
  * The free block bitmap consists of SFS_FREEMAPBLOCKS 512-byte
  * sectors of bits, one bit for each sector on the filesystem. The
@@ -69,7 +66,7 @@
  */
 static
 int
-sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
+sfs_freemapread(struct sfs_fs *sfs)
 {
 	uint32_t j, freemapblocks;
 	char *freemapdata;
@@ -87,15 +84,9 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 		/* Get a pointer to its data */
 		void *ptr = freemapdata + j*SFS_BLOCKSIZE;
 
-		/* and read or write it. The freemap starts at sector 2. */
-		if (rw == UIO_READ) {
-			result = sfs_readblock(sfs, SFS_FREEMAP_START+j, ptr,
-					       SFS_BLOCKSIZE);
-		}
-		else {
-			result = sfs_writeblock(sfs, SFS_FREEMAP_START+j, ptr,
-						SFS_BLOCKSIZE);
-		}
+		/* and read it. The freemap starts at sector 2. */
+		result = sfs_readblock(sfs, SFS_FREEMAP_START+j, ptr,
+				       SFS_BLOCKSIZE);
 
 		/* If we failed, stop. */
 		if (result) {
@@ -112,33 +103,113 @@ static
 int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
+	struct sfs_vnode *sv, **svs;
 	unsigned i, num;
+	int result, ret;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
+	/*
+	 * Take a reference to each of the loaded vnodes, so they
+	 * don't go away, and then sync them with the table unlocked.
+	 * (The vnode locks come after sfs_vnlock in the lock order,
+	 * but we can't hold it while waiting for them anyway; they
+	 * can be held for a long time.)
+	 */
+	lock_acquire(sfs->sfs_vnlock);
+	if (sfs->sfs_nvnodes == 0) {
+		lock_release(sfs->sfs_vnlock);
+		return 0;
+	}
+	svs = kmalloc(sfs->sfs_nvnodes * sizeof(*svs));
+	if (svs == NULL) {
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+	num = 0;
+	for (i=0; i<SFS_VNHASHSIZE; i++) {
+		for (sv = sfs->sfs_vnhash[i];
+		     sv != NULL;
+		     sv = sv->sv_hashnext) {
+			KASSERT(num < sfs->sfs_nvnodes);
+			VOP_INCREF(&sv->sv_absvn);
+			svs[num++] = sv;
+		}
+	}
+	lock_release(sfs->sfs_vnlock);
+
+	/*
+	 * Sync them. This only gets the inodes into the buffer cache;
+	 * sfs_flush does the rest. (So don't use VOP_FSYNC, which
+	 * would flush the whole cache for each vnode.)
+	 */
+	ret = 0;
 	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+		lock_acquire(svs[i]->sv_lock);
+		result = sfs_sync_inode(svs[i]);
+		lock_release(svs[i]->sv_lock);
+		if (result && ret == 0) {
+			ret = result;
+		}
+		VOP_DECREF(&svs[i]->sv_absvn);
+	}
+	kfree(svs);
+	return ret;
+}
+
+/*
+ * Copy a block's worth of in-memory data into the buffer cache (to
+ * be written back with everything else).
+ */
+static
+int
+sfs_writecached(struct sfs_fs *sfs, daddr_t block, const void *data)
+{
+	struct buf *buf;
+	int result;
+
+	result = buffer_get(&sfs->sfs_absfs, block, &buf);
+	if (result) {
+		return result;
 	}
+	memcpy(buffer_map(buf), data, SFS_BLOCKSIZE);
+	buffer_mark_valid(buf);
+	buffer_mark_dirty(buf);
+	buffer_release(buf);
 	return 0;
 }
 
 /*
- * Sync routine for the freemap.
+ * Sync routine for the freemap. Only the blocks of it that have
+ * changed are written.
  */
 static
 int
 sfs_sync_freemap(struct sfs_fs *sfs)
 {
+	uint32_t j, freemapblocks;
+	char *freemapdata;
 	int result;
 
-	if (sfs->sfs_freemapdirty) {
-		result = sfs_freemapio(sfs, UIO_WRITE);
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	if (!sfs->sfs_freemapdirty) {
+		return 0;
+	}
+
+	freemapblocks = SFS_FS_FREEMAPBLOCKS(sfs);
+	freemapdata = bitmap_getdata(sfs->sfs_freemap);
+
+	for (j=0; j<freemapblocks; j++) {
+		if (!bitmap_isset(sfs->sfs_freemapdirtyblocks, j)) {
+			continue;
+		}
+		result = sfs_writecached(sfs, SFS_FREEMAP_START+j,
+					 freemapdata + j*SFS_BLOCKSIZE);
 		if (result) {
 			return result;
 		}
-		sfs->sfs_freemapdirty = false;
+		bitmap_unmark(sfs->sfs_freemapdirtyblocks, j);
 	}
+	sfs->sfs_freemapdirty = false;
 
 	return 0;
 }
@@ -152,9 +223,10 @@ sfs_sync_superblock(struct sfs_fs *sfs)
 {
 	int result;
 
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
 	if (sfs->sfs_superdirty) {
-		result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
-					sizeof(sfs->sfs_sb));
+		result = sfs_writecached(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb);
 		if (result) {
 			return result;
 		}
@@ -163,6 +235,38 @@ sfs_sync_superblock(struct sfs_fs *sfs)
 	return 0;
 }
 
+/*
+ * Get the freemap and superblock into the buffer cache and write
+ * back everything dirty. Used by sync and fsync. No vnode locks may
+ * be held, as the freemap lock is needed.
+ */
+int
+sfs_flush(struct sfs_fs *sfs)
+{
+	int result;
+
+	lock_acquire(sfs->sfs_freemaplock);
+
+	/* If the free block map needs to be written, write it. */
+	result = sfs_sync_freemap(sfs);
+	if (result) {
+		lock_release(sfs->sfs_freemaplock);
+		return result;
+	}
+
+	/* If the superblock needs to be written, write it. */
+	result = sfs_sync_superblock(sfs);
+	if (result) {
+		lock_release(sfs->sfs_freemaplock);
+		return result;
+	}
+
+	lock_release(sfs->sfs_freemaplock);
+
+	/* Write back the buffer cache, in block order. */
+	return buffer_sync_fs(&sfs->sfs_absfs);
+}
+
 /*
  * Sync routine. This is what gets invoked if you do FS_SYNC on the
  * sfs filesystem structure.
@@ -174,8 +278,6 @@ sfs_sync(struct fs *fs)
 	struct sfs_fs *sfs;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -211,26 +313,11 @@ sfs_sync(struct fs *fs)
 	/* If any vnodes need to be written, write them. */
 	result = sfs_sync_vnodes(sfs);
 	if (result) {
-		vfs_biglock_release();
-		return result;
-	}
-
-	/* If the free block map needs to be written, write it. */
-	result = sfs_sync_freemap(sfs);
-	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	/* If the superblock needs to be written, write it. */
-	result = sfs_sync_superblock(sfs);
-	if (result) {
-		vfs_biglock_release();
-		return result;
-	}
-
-	vfs_biglock_release();
-	return 0;
+	/* Then everything else, and get it all to disk. */
+	return sfs_flush(sfs);
 }
 
 /*
@@ -245,9 +332,8 @@ sfs_getvolname(struct fs *fs)
 	struct sfs_fs *sfs = fs->fs_data;
 	const char *ret;
 
-	vfs_biglock_acquire();
+	/* This never changes once we're mounted, so needs no lock. */
 	ret = sfs->sfs_sb.sb_volname;
-	vfs_biglock_release();
 
 	return ret;
 }
@@ -262,7 +348,21 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
-	vnodearray_destroy(sfs->sfs_vnodes);
+	if (sfs->sfs_freemapdirtyblocks != NULL) {
+		bitmap_destroy(sfs->sfs_freemapdirtyblocks);
+	}
+	if (sfs->sfs_freecounts != NULL) {
+		kfree(sfs->sfs_freecounts);
+	}
+	KASSERT(sfs->sfs_nvnodes == 0);
+	KASSERT(sfs->sfs_preallocs == NULL);
+	kfree(sfs->sfs_vnhash);
+	if (sfs->sfs_vnlock != NULL) {
+		lock_destroy(sfs->sfs_vnlock);
+	}
+	if (sfs->sfs_freemaplock != NULL) {
+		lock_destroy(sfs->sfs_freemaplock);
+	}
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -277,19 +377,43 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sfs->sfs_vnlock);
+
+	/* Get rid of the vnodes nobody is using. */
+	result = sfs_drop_inactive(sfs);
+	if (result) {
+		lock_release(sfs->sfs_vnlock);
+		return result;
+	}
 
 	/* Do we have any files open? If so, can't unmount. */
-	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+	if (sfs->sfs_nvnodes > 0) {
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
 
+	lock_release(sfs->sfs_vnlock);
+
+	/*
+	 * Write out whatever dropping the inactive vnodes changed.
+	 * (Nothing new can get loaded now; the vfs layer holds the
+	 * big lock, so there are no lookups on this volume in
+	 * progress that could find it.)
+	 */
+	result = sfs_flush(sfs);
+	if (result) {
+		return result;
+	}
+
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Drop our (clean) blocks from the buffer cache. */
+	buffer_drop_fs(&sfs->sfs_absfs);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -297,10 +421,33 @@ sfs_unmount(struct fs *fs)
 	sfs_fs_destroy(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
+/*
+ * Block I/O for the buffer cache.
+ */
+static
+int
+sfs_fsop_readblock(struct fs *fs, daddr_t block, void *data, size_t len)
+{
+	return sfs_readblock(fs->fs_data, block, data, len);
+}
+
+static
+int
+sfs_fsop_writeblock(struct fs *fs, daddr_t block, void *data, size_t len)
+{
+	return sfs_writeblock(fs->fs_data, block, data, len);
+}
+
+static
+int
+sfs_fsop_submitblock(struct fs *fs, struct bio *bio)
+{
+	return sfs_submitblock(fs->fs_data, bio);
+}
+
 /*
  * File system operations table.
  */
@@ -309,6 +456,9 @@ static const struct fs_ops sfs_fsops = {
 	.fsop_getvolname = sfs_getvolname,
 	.fsop_getroot = sfs_getroot,
 	.fsop_unmount = sfs_unmount,
+	.fsop_readblock = sfs_fsop_readblock,
+	.fsop_writeblock = sfs_fsop_writeblock,
+	.fsop_submitblock = sfs_fsop_submitblock,
 };
 
 /*
@@ -321,6 +471,7 @@ struct sfs_fs *
 sfs_fs_create(void)
 {
 	struct sfs_fs *sfs;
+	unsigned i;
 
 	/*
 	 * Make sure our on-disk structures aren't messed up
@@ -351,17 +502,40 @@ sfs_fs_create(void)
 	sfs->sfs_device = NULL;
 
 	/* vnode table */
-	sfs->sfs_vnodes = vnodearray_create();
-	if (sfs->sfs_vnodes == NULL) {
+	sfs->sfs_vnhash = kmalloc(SFS_VNHASHSIZE * sizeof(struct sfs_vnode *));
+	if (sfs->sfs_vnhash == NULL) {
 		goto cleanup_object;
 	}
+	for (i=0; i<SFS_VNHASHSIZE; i++) {
+		sfs->sfs_vnhash[i] = NULL;
+	}
+	sfs->sfs_nvnodes = 0;
+	sfs->sfs_lruhead = sfs->sfs_lrutail = NULL;
+	sfs->sfs_ninactive = 0;
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_freemapdirtyblocks = NULL;
+	sfs->sfs_freecounts = NULL;
+	sfs->sfs_preallocs = NULL;
+
+	/* locks */
+	sfs->sfs_vnlock = lock_create("sfs_vnlock");
+	if (sfs->sfs_vnlock == NULL) {
+		goto cleanup_vnhash;
+	}
+	sfs->sfs_freemaplock = lock_create("sfs_freemaplock");
+	if (sfs->sfs_freemaplock == NULL) {
+		goto cleanup_vnlock;
+	}
 
 	return sfs;
 
+cleanup_vnlock:
+	lock_destroy(sfs->sfs_vnlock);
+cleanup_vnhash:
+	kfree(sfs->sfs_vnhash);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -388,8 +562,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	int result;
 	struct sfs_fs *sfs;
 
-	vfs_biglock_acquire();
-
 	/* We don't pass any options through mount */
 	(void)options;
 
@@ -402,7 +574,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * don't do that in sfs.)
 	 */
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
 		kprintf("sfs: Cannot mount on device with blocksize %zu\n",
 			dev->d_blocksize);
 		return ENXIO;
@@ -410,7 +581,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
@@ -423,7 +593,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -436,7 +605,14 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			SFS_MAGIC);
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
+		return EINVAL;
+	}
+
+	if (sfs->sfs_sb.sb_version != SFS_VERSION) {
+		kprintf("sfs: Unsupported format version %u (should be %u); "
+			"rerun mksfs\n", sfs->sfs_sb.sb_version, SFS_VERSION);
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
 		return EINVAL;
 	}
 
@@ -450,24 +626,25 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 
 	/* Load free block bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
-	if (sfs->sfs_freemap == NULL) {
+	sfs->sfs_freemapdirtyblocks = bitmap_create(SFS_FS_FREEMAPBLOCKS(sfs));
+	if (sfs->sfs_freemap == NULL || sfs->sfs_freemapdirtyblocks == NULL) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
-	result = sfs_freemapio(sfs, UIO_READ);
+	result = sfs_freemapread(sfs);
+	if (result == 0) {
+		result = sfs_freemap_summarize(sfs);
+	}
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -35,108 +35,356 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
 /*
- * Write an on-disk inode structure back out to disk.
+ * Write an on-disk inode structure back out. It goes to the buffer
+ * cache, which takes care of getting it to disk. The vnode must be
+ * locked.
  */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
 	int result;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	if (sv->sv_dirty) {
-		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
-					sizeof(sv->sv_i));
+		/* The inode fills the block, so there's no need to read it */
+		result = buffer_get(&sfs->sfs_absfs, sv->sv_ino, &buf);
 		if (result) {
 			return result;
 		}
+		memcpy(buffer_map(buf), &sv->sv_i, sizeof(sv->sv_i));
+		buffer_mark_valid(buf);
+		buffer_mark_dirty(buf);
+		buffer_release(buf);
 		sv->sv_dirty = false;
 	}
 	return 0;
 }
 
 /*
- * Called when the vnode refcount (in-memory usage count) hits zero.
+ * Statistics for sfs_loadvnode, for all volumes.
+ */
+static struct spinlock sfs_stats_lock = SPINLOCK_INITIALIZER;
+static struct {
+	unsigned lookups;		/* calls to sfs_loadvnode */
+	unsigned probes;		/* hash chain entries looked at */
+	unsigned hits;			/* found in use */
+	unsigned inactivehits;		/* found on the inactive list */
+	unsigned loads;			/* read in from disk */
+	unsigned evictions;		/* inactive vnodes destroyed */
+} sfs_stats;
+
+#define SFS_STAT_ADD(field, n) do {		\
+		spinlock_acquire(&sfs_stats_lock);	\
+		sfs_stats.field += (n);			\
+		spinlock_release(&sfs_stats_lock);	\
+	} while (0)
+
+void
+sfs_resetstats(void)
+{
+	spinlock_acquire(&sfs_stats_lock);
+	bzero(&sfs_stats, sizeof(sfs_stats));
+	spinlock_release(&sfs_stats_lock);
+}
+
+void
+sfs_printstats(void)
+{
+	unsigned lookups, probes, hits, inactivehits, loads, evictions;
+
+	spinlock_acquire(&sfs_stats_lock);
+	lookups = sfs_stats.lookups;
+	probes = sfs_stats.probes;
+	hits = sfs_stats.hits;
+	inactivehits = sfs_stats.inactivehits;
+	loads = sfs_stats.loads;
+	evictions = sfs_stats.evictions;
+	spinlock_release(&sfs_stats_lock);
+
+	kprintf("SFS vnodes: %u lookups, %u.%02u chain entries per lookup\n",
+		lookups,
+		lookups == 0 ? 0 : probes / lookups,
+		lookups == 0 ? 0 : (probes * 100 / lookups) % 100);
+	kprintf("    %u in use, %u inactive, %u loaded from disk; "
+		"%u evicted\n", hits, inactivehits, loads, evictions);
+}
+
+/*
+ * Put SV on the hash table of vnodes in memory.
+ */
+static
+void
+sfs_vnhash_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **chain = &sfs->sfs_vnhash[SFS_VNHASH(sv->sv_ino)];
+
+	sv->sv_hashnext = *chain;
+	*chain = sv;
+	sfs->sfs_nvnodes++;
+}
+
+/*
+ * Take SV off the hash table.
+ */
+static
+void
+sfs_vnhash_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **svp = &sfs->sfs_vnhash[SFS_VNHASH(sv->sv_ino)];
+
+	while (*svp != sv) {
+		if (*svp == NULL) {
+			panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
+			      sfs->sfs_sb.sb_volname, sv->sv_ino);
+		}
+		svp = &(*svp)->sv_hashnext;
+	}
+	*svp = sv->sv_hashnext;
+	sv->sv_hashnext = NULL;
+	KASSERT(sfs->sfs_nvnodes > 0);
+	sfs->sfs_nvnodes--;
+}
+
+/*
+ * Put SV on the end (most recently used) of the inactive list.
+ */
+static
+void
+sfs_lru_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(!sv->sv_inactive);
+	sv->sv_inactive = true;
+	sv->sv_lrunext = NULL;
+	sv->sv_lruprev = sfs->sfs_lrutail;
+	if (sfs->sfs_lrutail != NULL) {
+		sfs->sfs_lrutail->sv_lrunext = sv;
+	}
+	else {
+		sfs->sfs_lruhead = sv;
+	}
+	sfs->sfs_lrutail = sv;
+	sfs->sfs_ninactive++;
+}
+
+/*
+ * Take SV off the inactive list.
+ */
+static
+void
+sfs_lru_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(sv->sv_inactive);
+	if (sv->sv_lruprev != NULL) {
+		sv->sv_lruprev->sv_lrunext = sv->sv_lrunext;
+	}
+	else {
+		sfs->sfs_lruhead = sv->sv_lrunext;
+	}
+	if (sv->sv_lrunext != NULL) {
+		sv->sv_lrunext->sv_lruprev = sv->sv_lruprev;
+	}
+	else {
+		sfs->sfs_lrutail = sv->sv_lruprev;
+	}
+	sv->sv_lrunext = sv->sv_lruprev = NULL;
+	sv->sv_inactive = false;
+	KASSERT(sfs->sfs_ninactive > 0);
+	sfs->sfs_ninactive--;
+}
+
+/*
+ * Get rid of a vnode nobody is using: erase the file if it has no
+ * links left, write the inode back to the buffer cache, and free the
+ * memory.
  *
- * This function should try to avoid returning errors other than EBUSY.
+ * The table lock must be held and the caller must have the only
+ * reference, so nobody else can be waiting for the vnode lock.
  */
+static
 int
-sfs_reclaim(struct vnode *v)
+sfs_vnode_destroy(struct sfs_vnode *sv)
 {
-	struct sfs_vnode *sv = v->vn_data;
-	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	bool deleted;
 	int result;
 
-	vfs_biglock_acquire();
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+	KASSERT(!sv->sv_inactive);
 
-	/*
-	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
-	 */
-	spinlock_acquire(&v->vn_countlock);
-	if (v->vn_refcount != 1) {
+	/* Give back any blocks we set aside for appending. */
+	sfs_prealloc_discard(sv);
 
-		/* consume the reference VOP_DECREF gave us */
-		KASSERT(v->vn_refcount>1);
-		v->vn_refcount--;
-
-		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
-		return EBUSY;
-	}
-	spinlock_release(&v->vn_countlock);
+	lock_acquire(sv->sv_lock);
+	deleted = sv->sv_i.sfi_linkcount == 0;
 
 	/* If there are no on-disk references to the file either, erase it. */
-	if (sv->sv_i.sfi_linkcount == 0) {
+	if (deleted) {
 		result = sfs_itrunc(sv, 0);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sv->sv_lock);
 			return result;
 		}
 	}
 
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
+	lock_release(sv->sv_lock);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* If there are no on-disk references, discard the inode */
-	if (sv->sv_i.sfi_linkcount==0) {
+	if (deleted) {
 		sfs_bfree(sfs, sv->sv_ino);
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
+	sfs_vnhash_remove(sfs, sv);
+
+	vnode_cleanup(&sv->sv_absvn);
+
+	/* Release the storage for the vnode structure itself. */
+	sfs_dir_dropindex(sv);
+	lock_destroy(sv->sv_lock);
+	kfree(sv);
+
+	return 0;
+}
+
+/*
+ * Destroy the least recently used inactive vnode. Returns EBUSY if
+ * they're all being looked at (by sync) right now.
+ */
+static
+int
+sfs_evict_one(struct sfs_fs *sfs)
+{
+	struct sfs_vnode *sv;
+	int refcount;
+	int result;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	for (sv = sfs->sfs_lruhead; sv != NULL; sv = sv->sv_lrunext) {
+		spinlock_acquire(&sv->sv_absvn.vn_countlock);
+		refcount = sv->sv_absvn.vn_refcount;
+		spinlock_release(&sv->sv_absvn.vn_countlock);
+		if (refcount == 1) {
+			/* Only the inactive list has it */
 			break;
 		}
 	}
-	if (ix == num) {
-		panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
-		      sfs->sfs_sb.sb_volname, sv->sv_ino);
+	if (sv == NULL) {
+		return EBUSY;
 	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
+	sfs_lru_remove(sfs, sv);
+	result = sfs_vnode_destroy(sv);
+	if (result) {
+		/* Keep it for now */
+		sfs_lru_add(sfs, sv);
+		return result;
+	}
+	SFS_STAT_ADD(evictions, 1);
+	return 0;
+}
 
-	vnode_cleanup(&sv->sv_absvn);
+/*
+ * Destroy all the inactive vnodes. Used when unmounting; the table
+ * lock must be held.
+ */
+int
+sfs_drop_inactive(struct sfs_fs *sfs)
+{
+	int result;
 
-	vfs_biglock_release();
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
 
-	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	while (sfs->sfs_ninactive > 0) {
+		result = sfs_evict_one(sfs);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Called when the vnode refcount (in-memory usage count) hits zero.
+ *
+ * Unless the file has been deleted, we don't destroy the vnode right
+ * away; it goes on the inactive list, holding the last reference, so
+ * if it's looked up again soon (which is common) it needn't be read
+ * back in. Only the oldest ones beyond SFS_MAXINACTIVE are destroyed.
+ *
+ * This function should try to avoid returning errors other than EBUSY.
+ */
+int
+sfs_reclaim(struct vnode *v)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	bool deleted;
+	int result;
+
+	lock_acquire(sfs->sfs_vnlock);
+
+	/*
+	 * Make sure someone else hasn't picked up the vnode since the
+	 * decision was made to reclaim it. New references only come
+	 * from sfs_loadvnode, which holds the table lock, so once
+	 * we've checked, it stays ours.
+	 */
+	spinlock_acquire(&v->vn_countlock);
+	if (v->vn_refcount != 1) {
+
+		/* consume the reference VOP_DECREF gave us */
+		KASSERT(v->vn_refcount>1);
+		v->vn_refcount--;
+
+		spinlock_release(&v->vn_countlock);
+		lock_release(sfs->sfs_vnlock);
+		return EBUSY;
+	}
+	spinlock_release(&v->vn_countlock);
+
+	lock_acquire(sv->sv_lock);
+	deleted = sv->sv_i.sfi_linkcount == 0;
+	lock_release(sv->sv_lock);
+
+	if (deleted) {
+		/* Deleted; get rid of it now. */
+		result = sfs_vnode_destroy(sv);
+		lock_release(sfs->sfs_vnlock);
+		return result;
+	}
+
+	/* Give back any blocks we set aside for appending. */
+	sfs_prealloc_discard(sv);
+
+	/* Keep it, but make room if we have too many. */
+	sfs_lru_add(sfs, sv);
+	if (sfs->sfs_ninactive > SFS_MAXINACTIVE) {
+		result = sfs_evict_one(sfs);
+		if (result && result != EBUSY) {
+			kprintf("sfs: %s: Warning: could not evict vnode: "
+				"%s\n", sfs->sfs_sb.sb_volname,
+				strerror(result));
+		}
+	}
+
+	lock_release(sfs->sfs_vnlock);
 
 	/* Done */
 	return 0;
@@ -144,25 +392,27 @@ sfs_reclaim(struct vnode *v)
 
 /*
  * Function to load a inode into memory as a vnode, or dig up one
- * that's already resident.
+ * that's already resident. Takes the table lock; the caller may hold
+ * a directory lock but no file vnode locks.
  */
 int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
+	struct buf *buf;
 	const struct vnode_ops *ops;
-	unsigned i, num;
+	unsigned probes;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
+	lock_acquire(sfs->sfs_vnlock);
 
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
+	/* Look in the vnode hash table */
+	probes = 0;
+	for (sv = sfs->sfs_vnhash[SFS_VNHASH(ino)];
+	     sv != NULL;
+	     sv = sv->sv_hashnext) {
+		probes++;
 
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
@@ -171,21 +421,46 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		}
 
 		if (sv->sv_ino==ino) {
-			/* Found */
+			break;
+		}
+	}
+
+	spinlock_acquire(&sfs_stats_lock);
+	sfs_stats.lookups++;
+	sfs_stats.probes += probes;
+	spinlock_release(&sfs_stats_lock);
 
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
+	if (sv != NULL) {
+		/* Found */
 
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
+
+		if (sv->sv_inactive) {
+			/* We get the reference the inactive list had */
+			sfs_lru_remove(sfs, sv);
+			SFS_STAT_ADD(inactivehits, 1);
+		}
+		else {
 			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
+			SFS_STAT_ADD(hits, 1);
 		}
+		lock_release(sfs->sfs_vnlock);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
 
 	sv = kmalloc(sizeof(struct sfs_vnode));
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+	sv->sv_lock = lock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -196,15 +471,38 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	}
 
 	/* Read the block the inode is in */
-	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
+	result = buffer_read(&sfs->sfs_absfs, ino, &buf);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
+	memcpy(&sv->sv_i, buffer_map(buf), sizeof(sv->sv_i));
+	buffer_release(buf);
 
 	/* Not dirty yet */
 	sv->sv_dirty = false;
 
+	/* No reads yet */
+	sv->sv_raoff = 0;
+	sv->sv_rawindow = 0;
+	sv->sv_ramark = 0;
+
+	/* No allocation history yet */
+	sv->sv_lastblock = 0;
+	sv->sv_prealloc = 0;
+	sv->sv_nprealloc = 0;
+	sv->sv_preallocnext = NULL;
+
+	/* Directory index is built when first needed */
+	sv->sv_dirindex = NULL;
+
+	/* Not on any lists yet */
+	sv->sv_hashnext = NULL;
+	sv->sv_lrunext = sv->sv_lruprev = NULL;
+	sv->sv_inactive = false;
+
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
 	 * block on disk will have been zeroed out by sfs_balloc and
@@ -235,7 +533,9 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -243,12 +543,10 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	sv->sv_ino = ino;
 
 	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
-	if (result) {
-		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
-		return result;
-	}
+	sfs_vnhash_add(sfs, sv);
+	SFS_STAT_ADD(loads, 1);
+
+	lock_release(sfs->sfs_vnlock);
 
 	/* Hand it back */
 	*ret = sv;
@@ -269,7 +567,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, 0, &ino);
 	if (result) {
 		return result;
 	}
@@ -296,25 +594,20 @@ sfs_getroot(struct fs *fs, struct vnode **ret)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		kprintf("sfs: %s: getroot: Cannot load root vnode\n",
 			sfs->sfs_sb.sb_volname);
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
 		kprintf("sfs: %s: getroot: not directory (type %u)\n",
 			sfs->sfs_sb.sb_volname, sv->sv_i.sfi_type);
-		vfs_biglock_release();
+		VOP_DECREF(&sv->sv_absvn);
 		return EINVAL;
 	}
 
-	vfs_biglock_release();
-
 	*ret = &sv->sv_absvn;
 	return 0;
 }
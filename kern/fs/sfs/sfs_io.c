@@ -38,6 +38,8 @@
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <bio.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -46,6 +48,11 @@
 // Basic block-level I/O routines
 
 /*
+ * These go straight to the device. The superblock and freemap are
+ * kept in memory by sfs itself and use them directly; everything
+ * else goes through the buffer cache, which calls back here (via
+ * FSOP_READBLOCK and FSOP_WRITEBLOCK) to do the I/O.
+ *
  * Note: sfs_readblock is used to read the superblock
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
@@ -62,7 +69,11 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	int result;
 	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	/*
+	 * No need for the big lock here: the device does its own
+	 * locking, and the buffer cache may call us (to write back a
+	 * buffer it is evicting) on behalf of some other filesystem.
+	 */
 
 	DEBUG(DB_SFS, "sfs: %s %llu\n",
 	      uio->uio_rw == UIO_READ ? "read" : "write",
@@ -131,6 +142,42 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 	return sfs_rwblock(sfs, &ku);
 }
 
+/*
+ * Start an asynchronous transfer. Our blocks are the device's
+ * sectors, so the bio goes to the device as it is. If the device
+ * can't queue requests, do it synchronously instead.
+ */
+int
+sfs_submitblock(struct sfs_fs *sfs, struct bio *bio)
+{
+	struct iovec iov;
+	struct uio ku;
+	unsigned i;
+	int result;
+
+	KASSERT(sfs->sfs_device->d_blocksize == SFS_BLOCKSIZE);
+
+	if (DEVOP_CANSUBMIT(sfs->sfs_device)) {
+		result = DEVOP_SUBMIT(sfs->sfs_device, bio);
+		if (result == EINVAL) {
+			/* As in sfs_rwblock, this is our fault. */
+			panic("sfs: %s: DEVOP_SUBMIT returned EINVAL\n",
+			      sfs->sfs_sb.sb_volname);
+		}
+		return result;
+	}
+
+	result = 0;
+	for (i=0; i<bio->bio_nblocks && result == 0; i++) {
+		SFSUIO(&iov, &ku,
+		       (char *)bio->bio_data + i*SFS_BLOCKSIZE,
+		       bio->bio_block + i, bio->bio_rw);
+		result = sfs_rwblock(sfs, &ku);
+	}
+	bio->bio_done(bio, result);
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // File-level I/O
@@ -150,16 +197,9 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
+	char *iobuf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -169,9 +209,6 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -184,40 +221,34 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block from the buffer cache. Even if we're writing,
+	 * it has to be read in so we don't clobber the rest of it.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = buffer_read(&sfs->sfs_absfs, diskblock, &buf);
 	if (result) {
 		return result;
 	}
+	iobuf = buffer_map(buf);
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * Now perform the requested operation into/out of the buffer.
+	 * If it was a write, the buffer now needs writing back, even
+	 * if uiomove failed partway.
 	 */
+	result = uiomove(iobuf+skipstart, len, uio);
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		buffer_mark_dirty(buf);
 	}
+	buffer_release(buf);
 
-	return 0;
+	return result;
 }
 
 /*
@@ -228,14 +259,11 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
@@ -258,31 +286,103 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	}
 
 	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
+	 * Copy through the buffer cache. When writing, the whole
+	 * block is being replaced, so there's no need to read it in
+	 * first.
 	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
+	if (uio->uio_rw == UIO_READ) {
+		result = buffer_read(&sfs->sfs_absfs, diskblock, &buf);
+	}
+	else {
+		result = buffer_get(&sfs->sfs_absfs, diskblock, &buf);
+	}
+	if (result) {
+		return result;
+	}
 
-	/*
-	 * Temporarily set the residue to be one block size.
-	 */
-	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
+	result = uiomove(buffer_map(buf), SFS_BLOCKSIZE, uio);
+	if (uio->uio_rw == UIO_WRITE) {
+		/*
+		 * If the buffer wasn't valid and the copy failed,
+		 * release will discard it. If it was valid, a
+		 * partial copy is still a partial write.
+		 */
+		if (result == 0) {
+			buffer_mark_valid(buf);
+		}
+		if (buffer_is_valid(buf)) {
+			buffer_mark_dirty(buf);
+		}
+	}
+	buffer_release(buf);
 
-	result = sfs_rwblock(sfs, uio);
+	return result;
+}
 
-	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
-	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+/*
+ * Readahead. Each vnode remembers where its last read ended. A read
+ * that starts there is taken to be sequential; each one doubles the
+ * readahead window, up to SFS_RAMAX blocks, and we start reading
+ * that far past its end in the background. A read that starts
+ * anywhere else shuts readahead off until it looks sequential again.
+ *
+ * sv_ramark remembers how far we've already asked for, so each read
+ * only queues the blocks newly inside the window.
+ */
+#define SFS_RAMIN	4
+#define SFS_RAMAX	32
 
-	return result;
+static
+void
+sfs_readahead(struct sfs_vnode *sv, off_t pos, off_t endpos)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t blocks[SFS_RAMAX];
+	uint32_t fileblock, first, last, fileblocks;
+	unsigned num;
+	daddr_t diskblock;
+	int result;
+
+	if (pos != sv->sv_raoff) {
+		/* Not sequential */
+		sv->sv_raoff = endpos;
+		sv->sv_rawindow = 0;
+		sv->sv_ramark = 0;
+		return;
+	}
+	sv->sv_raoff = endpos;
+
+	if (sv->sv_rawindow == 0) {
+		sv->sv_rawindow = SFS_RAMIN;
+	}
+	else if (sv->sv_rawindow < SFS_RAMAX) {
+		sv->sv_rawindow *= 2;
+	}
+
+	fileblocks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	first = DIVROUNDUP(endpos, SFS_BLOCKSIZE);
+	last = first + sv->sv_rawindow;
+	if (first < sv->sv_ramark) {
+		first = sv->sv_ramark;
+	}
+	if (last > fileblocks) {
+		last = fileblocks;
+	}
+	if (first >= last) {
+		return;
+	}
+	sv->sv_ramark = last;
+
+	num = 0;
+	for (fileblock = first; fileblock < last; fileblock++) {
+		result = sfs_bmap(sv, fileblock, false, &diskblock);
+		if (result || diskblock == 0) {
+			/* Error or hole; nothing to read */
+			continue;
+		}
+		blocks[num++] = diskblock;
+	}
+	buffer_readahead(&sfs->sfs_absfs, blocks, num);
 }
 
 /*
@@ -316,7 +416,10 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 			extraresid = endpos - size;
 			KASSERT(uio->uio_resid > extraresid);
 			uio->uio_resid -= extraresid;
+			endpos = size;
 		}
+
+		sfs_readahead(sv, uio->uio_offset, endpos);
 	}
 
 	/*
@@ -407,6 +510,8 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
+	char *metaiobuf;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -414,18 +519,6 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
 	blockoffset = actualpos % SFS_BLOCKSIZE;
@@ -446,26 +539,23 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = buffer_read(&sfs->sfs_absfs, diskblock, &buf);
 	if (result) {
 		return result;
 	}
+	metaiobuf = buffer_map(buf);
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
 		memcpy(data, metaiobuf + blockoffset, len);
+		buffer_release(buf);
 	}
 	else {
-		/* Update the selected region */
+		/* Update the selected region; it gets written back later */
 		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		buffer_mark_dirty(buf);
+		buffer_release(buf);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
@@ -55,6 +55,7 @@ struct addrspace {
         struct vm_region *regions; /* linked list of special memory regions for mmap and shared segments */
         struct vm_region *stack_region; /* linked list of stack regions */
         struct vm_region *heap_region; /* linked list of heap regions */
+        vaddr_t mmap_base; /* lowest address handed out to mmap so far */
 
         uint8_t asid; /* address space identifier */
 
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BIO_H_
+#define _BIO_H_
+
+/*
+ * Asynchronous block I/O requests.
+ *
+ * A struct bio describes a transfer of one or more contiguous blocks
+ * between a block device and kernel memory. It is handed to the
+ * device with DEVOP_SUBMIT (or, from the buffer cache, to the
+ * filesystem with FSOP_SUBMITBLOCK), which returns at once; when the
+ * transfer finishes, bio_done is called with the result.
+ *
+ * bio_done may be called from an interrupt handler, so it must not
+ * sleep. Typically it does a V() or a wakeup. It may also be called
+ * before the submit function returns.
+ *
+ * The driver may queue requests, reorder them, and merge requests
+ * for adjacent blocks into one; the fields at the bottom are for
+ * that and belong to the driver until bio_done is called.
+ */
+
+#include <uio.h>
+
+struct bio {
+	/* Set by the submitter */
+	daddr_t bio_block;		/* First block on the device */
+	unsigned bio_nblocks;		/* Number of blocks */
+	enum uio_rw bio_rw;		/* UIO_READ or UIO_WRITE */
+	void *bio_data;			/* Kernel buffer, bio_nblocks long */
+	void (*bio_done)(struct bio *, int result);
+	void *bio_arg;			/* For bio_done's use */
+
+	/* Private to the driver while the request is outstanding */
+	struct bio *bio_qnext;		/* Next request in the queue */
+	struct bio *bio_chain;		/* Next request merged onto us */
+	struct bio *bio_chaintail;	/* Last request merged onto us */
+	unsigned bio_chainblocks;	/* Blocks in us and the merged ones */
+	uint64_t bio_deadline;		/* Tick by which to start us */
+};
+
+
+#endif /* _BIO_H_ */
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BUF_H_
+#define _BUF_H_
+
+/*
+ * Buffer cache.
+ *
+ * Filesystems do their block I/O through here instead of going to
+ * the device directly. Blocks are cached by (fs, block number) in a
+ * fixed pool of buffers, sized as a fraction of physical memory at
+ * boot, and recycled in LRU order.
+ *
+ * Each buffer holds one BUFFER_SIZE block. The cache calls back into
+ * the filesystem with FSOP_READBLOCK and FSOP_WRITEBLOCK to do the
+ * actual I/O.
+ *
+ * Functions:
+ *     buffer_read  - get the buffer for a block, reading it in from
+ *                    disk if it isn't cached.
+ *     buffer_get   - same, but don't read; if the buffer comes back
+ *                    not valid, the caller must fill in the whole
+ *                    block and call buffer_mark_valid.
+ *     buffer_map   - get a pointer to the buffer's data.
+ *     buffer_is_valid - check whether the data is good.
+ *     buffer_mark_valid - say the caller has filled in the data.
+ *     buffer_mark_dirty - say the data needs to be written back.
+ *     buffer_release - done with the buffer. If it was never made
+ *                    valid, it is discarded.
+ *     buffer_release_and_invalidate - done with the buffer, and
+ *                    discard its contents (dirty or not), e.g.
+ *                    because the block has been freed.
+ *     buffer_sync_fs - write back all dirty buffers for a filesystem.
+ *     buffer_drop_fs - discard all buffers for a filesystem (which
+ *                    must have been synced). For unmount.
+ *     buffer_readahead - start reading blocks in the background,
+ *                    because they'll probably be wanted soon.
+ *
+ * Dirty buffers are written back when evicted, when the filesystem
+ * is synced, and every few seconds by the syncer thread. Syncing
+ * submits all the writes at once in block order, through
+ * fsop_submitblock if the filesystem has it, so the device can
+ * queue them up. Readahead is done the same way by a reader thread.
+ * buffer_start_threads starts both threads.
+ *
+ * A buffer obtained from buffer_read or buffer_get is held
+ * exclusively until released; anyone else asking for the same block
+ * waits. Don't ask for a block you already hold.
+ */
+
+#include <kern/types.h>
+
+struct fs;
+struct buf;
+
+/* Size of each buffer; the same as the disk sector size. */
+#define BUFFER_SIZE 512
+
+/* Statistics. */
+struct bufstats {
+	unsigned bs_hits;		/* Lookups found in the cache */
+	unsigned bs_misses;		/* Lookups not found */
+	unsigned bs_reads;		/* Blocks read from disk */
+	unsigned bs_writes;		/* Blocks written to disk */
+	unsigned bs_evictions;		/* Cached blocks recycled */
+	unsigned bs_raissued;		/* Blocks read ahead */
+	unsigned bs_rahits;		/* ...and then asked for */
+	unsigned bs_rawasted;		/* ...and evicted unused */
+	unsigned bs_numbufs;		/* Buffers allocated */
+	unsigned bs_maxbufs;		/* Size of the pool */
+};
+
+void buffer_bootstrap(void);
+void buffer_start_threads(void);
+
+int buffer_read(struct fs *fs, daddr_t block, struct buf **ret);
+int buffer_get(struct fs *fs, daddr_t block, struct buf **ret);
+void *buffer_map(struct buf *b);
+bool buffer_is_valid(struct buf *b);
+void buffer_mark_valid(struct buf *b);
+void buffer_mark_dirty(struct buf *b);
+void buffer_release(struct buf *b);
+void buffer_release_and_invalidate(struct buf *b);
+
+int buffer_sync_fs(struct fs *fs);
+void buffer_drop_fs(struct fs *fs);
+
+void buffer_readahead(struct fs *fs, const daddr_t *blocks, unsigned num);
+
+void buffer_getstats(struct bufstats *bs);
+void buffer_resetstats(void);
+void buffer_printstats(void);
+
+
+#endif /* _BUF_H_ */
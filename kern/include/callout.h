@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: functions to be called a given number of hardclock ticks
+ * in the future.
+ *
+ * Pending callouts live in a hierarchical timing wheel that CPU 0
+ * advances from hardclock(), so arming and cancelling are constant
+ * time and a tick with nothing due costs almost nothing.
+ *
+ * Callout functions are run from the timer interrupt. They must not
+ * sleep and should be short; the usual thing to do is wake somebody
+ * up.
+ *
+ * The structure is public so callouts can live inside other objects
+ * or on the stack, but nothing outside callout.c should look inside.
+ */
+
+struct callout {
+	struct callout *co_next;	/* next in wheel bucket */
+	struct callout **co_pprev;	/* pointer to us in bucket */
+	void (*co_func)(void *);	/* function to call */
+	void *co_data;			/* argument for co_func */
+	uint64_t co_expire;		/* tick at which to fire */
+	bool co_pending;		/* true if on the wheel */
+};
+
+/*
+ * Callout functions.
+ *
+ * init		Set up a callout to call FUNC(DATA) when it fires.
+ * arm		Fire after TICKS hardclocks (at least 1). If already
+ *		pending, it is moved to the new time.
+ * cancel	Stop a pending callout. Returns true if it was pending
+ *		and so will now not run. If the function is running on
+ *		another CPU, waits for it to finish first, so the
+ *		callout may be freed once this returns; therefore do
+ *		not call it while holding any spinlock the callout
+ *		function takes.
+ * pending	Returns true if the callout is armed and hasn't fired.
+ *
+ * callout_hardclock is called by hardclock() on CPU 0 each tick.
+ * callout_ticks returns the number of ticks processed so far.
+ */
+void callout_init(struct callout *c, void (*func)(void *), void *data);
+void callout_arm(struct callout *c, unsigned ticks);
+bool callout_cancel(struct callout *c);
+bool callout_pending(struct callout *c);
+
+void callout_hardclock(void);
+uint64_t callout_ticks(void);
+
+
+#endif /* _CALLOUT_H_ */
@@ -48,6 +48,15 @@
 void hardclock_bootstrap(void);
 void hardclock(void);
 
+/*
+ * clock_idle() idles the current CPU (see cpu_idle()) with the
+ * hardclock turned off if possible, and adds the time spent to the
+ * CPU's idle count. When the timer next goes off, the ticks skipped
+ * are passed to hardclock_catchup().
+ */
+void clock_idle(void);
+void hardclock_catchup(unsigned ticks);
+
 /*
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
@@ -79,5 +88,11 @@ void timespec_sub(const struct timespec *t1,
  */
 void clocksleep(int seconds);
 
+/*
+ * thread_sleep_ticks() suspends the current thread for the requested
+ * number of hardclock ticks (HZ per second).
+ */
+void thread_sleep_ticks(unsigned ticks);
+
 
 #endif /* _CLOCK_H_ */
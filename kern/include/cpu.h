@@ -62,6 +62,8 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	unsigned c_timerticks;		/* Ticks the timer is set to run */
+	uint64_t c_idlecycles;		/* Cycles spent in cpu_idle() */
 
 	/*
 	 * Accessed by other cpus.
@@ -69,7 +71,7 @@ struct cpu {
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
-	struct spinlock c_runqueue_lock;
+	struct ticketlock c_runqueue_lock;
 
 	/*
 	 * Accessed by other cpus.
@@ -143,6 +145,14 @@ void cpu_irqon(void);
 void cpu_idle(void);
 void cpu_halt(void);
 
+/*
+ * Fetch the current CPU's cycle counter. Readings are only
+ * comparable with other readings taken on the same CPU.
+ * cpu_cycles_per_tick gives the number of cycles per hardclock.
+ */
+uint64_t cpu_cycles(void);
+unsigned cpu_cycles_per_tick(void);
+
 /*
  * Interprocessor interrupts.
  *
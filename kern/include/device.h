@@ -36,6 +36,8 @@
 
 
 struct uio;  /* in <uio.h> */
+struct bio;  /* in <bio.h> */
+struct pollwait;  /* in <poll.h> */
 
 /*
  * Filesystem-namespace-accessible device.
@@ -56,11 +58,25 @@ struct device {
  *      devop_eachopen - called on each open call to allow denying the open
  *      devop_io - for both reads and writes (the uio indicates the direction)
  *      devop_ioctl - miscellaneous control operations
+ *      devop_submit - start an asynchronous block transfer (see bio.h)
+ *      devop_poll - readiness check for poll(); see VOP_POLL in vnode.h
+ *
+ * devop_submit is only provided by block devices that queue requests
+ * and is NULL otherwise; check DEVOP_CANSUBMIT first. It returns an
+ * error only if the request is invalid, in which case bio_done is
+ * not called.
+ *
+ * devop_poll is only provided by devices whose I/O can block waiting
+ * for something other than the device finishing a transfer (e.g. the
+ * console waiting for a keypress), and is NULL otherwise, meaning the
+ * device is always ready.
  */
 struct device_ops {
 	int (*devop_eachopen)(struct device *, int flags_from_open);
 	int (*devop_io)(struct device *, struct uio *);
 	int (*devop_ioctl)(struct device *, int op, userptr_t data);
+	int (*devop_submit)(struct device *, struct bio *);
+	int (*devop_poll)(struct device *, int events, struct pollwait *);
 };
 
 /*
@@ -69,6 +85,10 @@ struct device_ops {
 #define DEVOP_EACHOPEN(d, f)	((d)->d_ops->devop_eachopen(d, f))
 #define DEVOP_IO(d, u)		((d)->d_ops->devop_io(d, u))
 #define DEVOP_IOCTL(d, op, p)	((d)->d_ops->devop_ioctl(d, op, p))
+#define DEVOP_CANSUBMIT(d)	((d)->d_ops->devop_submit != NULL)
+#define DEVOP_SUBMIT(d, b)	((d)->d_ops->devop_submit(d, b))
+#define DEVOP_CANPOLL(d)	((d)->d_ops->devop_poll != NULL)
+#define DEVOP_POLL(d, e, pw)	((d)->d_ops->devop_poll(d, e, pw))
 
 
 /* Create vnode for a vfs-level device. */
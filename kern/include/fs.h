@@ -31,6 +31,7 @@
 #define _FS_H_
 
 struct vnode; /* in vnode.h */
+struct bio;   /* in bio.h */
 
 
 /*
@@ -51,6 +52,9 @@ struct fs {
  *      fsop_getvolname - Return volume name of filesystem.
  *      fsop_getroot    - Return root vnode of filesystem.
  *      fsop_unmount    - Attempt unmount of filesystem.
+ *      fsop_readblock  - Read a block from the underlying device.
+ *      fsop_writeblock - Write a block to the underlying device.
+ *      fsop_submitblock - Start an asynchronous block transfer.
  *
  * fsop_getvolname may return NULL on filesystem types that don't
  * support the concept of a volume name. The string returned is
@@ -68,12 +72,22 @@ struct fs {
  * consequently the struct fs instance should remain valid. On success,
  * however, the filesystem object and all storage associated with the
  * filesystem should have been discarded/released.
+ *
+ * fsop_readblock and fsop_writeblock are called by the buffer cache
+ * (see buf.h) and need only be provided by filesystems that use it.
+ * They transfer exactly one block and do no caching of their own.
+ * fsop_submitblock is the asynchronous version (see bio.h); it is
+ * optional, and the buffer cache falls back to the other two if it
+ * is NULL.
  */
 struct fs_ops {
 	int           (*fsop_sync)(struct fs *);
 	const char   *(*fsop_getvolname)(struct fs *);
 	int           (*fsop_getroot)(struct fs *, struct vnode **);
 	int           (*fsop_unmount)(struct fs *);
+	int           (*fsop_readblock)(struct fs *, daddr_t, void *, size_t);
+	int           (*fsop_writeblock)(struct fs *, daddr_t, void *, size_t);
+	int           (*fsop_submitblock)(struct fs *, struct bio *);
 };
 
 /*
@@ -83,6 +97,9 @@ struct fs_ops {
 #define FSOP_GETVOLNAME(fs)  ((fs)->fs_ops->fsop_getvolname(fs))
 #define FSOP_GETROOT(fs, ret) ((fs)->fs_ops->fsop_getroot(fs, ret))
 #define FSOP_UNMOUNT(fs)     ((fs)->fs_ops->fsop_unmount(fs))
+#define FSOP_READBLOCK(fs, b, p, l)  ((fs)->fs_ops->fsop_readblock(fs, b, p, l))
+#define FSOP_WRITEBLOCK(fs, b, p, l) ((fs)->fs_ops->fsop_writeblock(fs, b, p, l))
+#define FSOP_SUBMITBLOCK(fs, bio)    ((fs)->fs_ops->fsop_submitblock(fs, bio))
 
 /* Initialization functions for builtin fake file systems. */
 void semfs_bootstrap(void);
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_DIRENT_H_
+#define _KERN_DIRENT_H_
+
+/*
+ * Directory entries as returned by getdirentries().
+ *
+ * Each call fills the buffer with as many whole records as fit. Each
+ * record is a struct dirent followed by the NUL-terminated name, and
+ * is padded so the next record starts 8-byte aligned; d_reclen is
+ * the distance to the next record. If DIRENT_STAT is passed, d_mode,
+ * d_size, d_nlink, and d_blocks are filled in as stat() would; if
+ * not, they are zero. d_ino is the inode number if the filesystem
+ * has inode numbers, and zero otherwise.
+ */
+struct dirent {
+	__u32 d_ino;            /* inode number */
+	__u32 d_mode;           /* file type and mode */
+	__off_t d_size;         /* file size in bytes */
+	__u32 d_blocks;         /* number of blocks file is using */
+	__u16 d_nlink;          /* number of hard links */
+	__u16 d_reclen;         /* length of this record */
+	char d_name[];          /* name, NUL-terminated */
+};
+
+/* Length of the record for a name of length NAMELEN */
+#define _DIRENT_RECLEN(namelen) \
+	((sizeof(struct dirent) + (namelen) + 1 + 7) & ~(__size_t)7)
+
+/* Flags for getdirentries() */
+#define DIRENT_STAT     1       /* also return type, size, etc. */
+
+
+#endif /* _KERN_DIRENT_H_ */
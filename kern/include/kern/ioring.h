@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _KERN_IORING_H_
+#define _KERN_IORING_H_
+
+/*
+ * Definitions for the asynchronous I/O ring, ioring_setup() and
+ * ioring_enter().
+ *
+ * ioring_setup returns a file descriptor and fills in a struct
+ * ioring_params. Mapping ring_size bytes of the descriptor with
+ * mmap(MAP_SHARED, PROT_READ|PROT_WRITE) gives the ring: a struct
+ * ioring_ctl at offset 0, an array of sq_entries struct io_sqe at
+ * sq_off, and an array of cq_entries struct io_cqe at cq_off. Both
+ * entry counts are powers of two; positions are free-running and
+ * indexes are taken modulo the count.
+ *
+ * To submit, fill in sq[sq_tail % sq_entries], advance sq_tail, and
+ * call ioring_enter. The kernel copies the entries out and advances
+ * sq_head; worker threads then run the requests and post a struct
+ * io_cqe for each at cq_tail. Take completions from cq_head and
+ * advance it. ioring_enter can also wait for completions, and the
+ * descriptor polls readable while any are waiting.
+ */
+
+/*
+ * Operations. On a descriptor that isn't seekable (a pipe, the
+ * console) READ and WRITE ignore the offset, like read and write.
+ */
+#define IORING_OP_NOP      0    /* Does nothing; completes with 0 */
+#define IORING_OP_READ     1    /* pread(fd, buf, len, offset) */
+#define IORING_OP_WRITE    2    /* pwrite(fd, buf, len, offset) */
+#define IORING_OP_FSYNC    3    /* fsync(fd) */
+
+/* Largest number of submission entries */
+#define IORING_MAX_ENTRIES 256
+
+/* Submission entry */
+struct io_sqe {
+	int sqe_op;                     /* IORING_OP_* */
+	int sqe_fd;                     /* File to operate on */
+	__off_t sqe_offset;             /* File position */
+	void *sqe_buf;                  /* User buffer */
+	__u32 sqe_len;                  /* Buffer length */
+	__u32 sqe_userdata;             /* Returned in the completion */
+	__u32 sqe_pad;
+};
+
+/* Completion entry */
+struct io_cqe {
+	__u32 cqe_userdata;             /* From the submission */
+	__i32 cqe_res;                  /* Bytes transferred, or -errno */
+};
+
+/* Ring positions, at the start of the mapping */
+struct ioring_ctl {
+	volatile __u32 sq_head;         /* Next entry the kernel will take */
+	volatile __u32 sq_tail;         /* Next entry the user will fill */
+	volatile __u32 cq_head;         /* Next completion the user will take */
+	volatile __u32 cq_tail;         /* Next completion the kernel will post */
+	volatile __u32 cq_overflow;     /* Completions lost because cq was full */
+};
+
+/* Returned by ioring_setup */
+struct ioring_params {
+	__u32 sq_entries;               /* Submission entries */
+	__u32 cq_entries;               /* Completion entries */
+	__u32 sq_off;                   /* Offset of the io_sqe array */
+	__u32 cq_off;                   /* Offset of the io_cqe array */
+	__u32 ring_size;                /* Bytes to mmap */
+};
+
+
+#endif /* _KERN_IORING_H_ */
@@ -37,12 +37,14 @@
  */
 
 #define SFS_MAGIC         0xabadf001    /* magic number identifying us */
+#define SFS_VERSION       2             /* on-disk format version */
 #define SFS_BLOCKSIZE     512           /* size of our blocks */
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
-#define SFS_NDIRECT       15            /* # of direct blocks in inode */
+#define SFS_NEXTENTS      32            /* # of extents in inode */
+#define SFS_NDIRECT       0             /* # of direct blocks in inode */
 #define SFS_NINDIRECT     1             /* # of indirect blocks in inode */
-#define SFS_NDINDIRECT    0             /* # of 2x indirect blocks in inode */
-#define SFS_NTINDIRECT    0             /* # of 3x indirect blocks in inode */
+#define SFS_NDINDIRECT    1             /* # of 2x indirect blocks in inode */
+#define SFS_NTINDIRECT    1             /* # of 3x indirect blocks in inode */
 #define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SUPER_BLOCK   0             /* block the superblock lives in */
@@ -74,19 +76,40 @@ struct sfs_superblock {
 	uint32_t sb_magic;		/* Magic number; should be SFS_MAGIC */
 	uint32_t sb_nblocks;			/* Number of blocks in fs */
 	char sb_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];			/* unused, set to 0 */
+	uint32_t sb_version;		/* Format; should be SFS_VERSION */
+	uint32_t reserved[117];			/* unused, set to 0 */
+};
+
+/*
+ * On-disk extent: a run of blocks of a file that are contiguous on
+ * disk. Unused extents have sfe_nblocks == 0 (and the rest 0 too).
+ */
+struct sfs_extent {
+	uint32_t sfe_fileblock;			/* First block in the file */
+	uint32_t sfe_diskblock;			/* First block on disk */
+	uint32_t sfe_nblocks;			/* Length of the run */
 };
 
 /*
  * On-disk inode
+ *
+ * A file's blocks are found first in the extents, which are in no
+ * particular order. Blocks that couldn't be put in an extent (because
+ * they weren't contiguous and all the extents were used) are found
+ * through the indirect blocks instead: the single indirect block maps
+ * file blocks 0 to SFS_DBPERIDB-1, the double indirect block the next
+ * SFS_DBPERIDB^2, and the triple indirect block the rest. No file
+ * block is mapped both ways.
  */
 struct sfs_dinode {
 	uint32_t sfi_size;			/* Size of this file (bytes) */
 	uint16_t sfi_type;			/* One of SFS_TYPE_* above */
 	uint16_t sfi_linkcount;			/* # hard links to this file */
-	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
+	struct sfs_extent sfi_extents[SFS_NEXTENTS];	/* Extents */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dindirect;			/* Double indirect block */
+	uint32_t sfi_tindirect;			/* Triple indirect block */
+	uint32_t sfi_waste[128-5-3*SFS_NEXTENTS]; /* unused space, set to 0 */
 };
 
 /*
@@ -168,6 +168,8 @@ const char *strerror(int errcode);
 void putch(int ch);
 int getch(void);
 void beep(void);
+void console_printstats(void);
+void console_resetstats(void);
 
 /*
  * Higher-level console output.
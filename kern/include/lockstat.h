@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics. Enable with "options lockstat" in the
+ * kernel config; when disabled all of this compiles away to nothing.
+ *
+ * Each spinlock, ticket lock, sleep lock, and rwlock carries a
+ * LOCKSTAT_HOOK. On first acquire the hook is bound to a struct
+ * lockstat slot in a fixed table, and from then on every acquire and
+ * release adds to that slot. Sleep locks and rwlocks are keyed by
+ * name, so e.g. all the per-file "fd lock"s add up together.
+ * Spinlocks have no names; those set up with spinlock_init are keyed
+ * by the address spinlock_init was called from, and statically
+ * initialized ones by the address of the lock itself. Look either up
+ * in the kernel symbol table.
+ *
+ * Times are in cycles as returned by cpu_cycles(). Sleep locks can
+ * be released on a different CPU from the one they were acquired on,
+ * so their hold times are approximate.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+/* Note: this uses spinlock_data_t and so is included by <spinlock.h>. */
+
+/* Names longer than this are truncated in the report. */
+#define LOCKSTAT_NAMELEN	32
+
+/* Report slot: accumulated statistics for one lock (or lock name). */
+struct lockstat {
+	const char *ls_kind;		/* "spinlock", "lock", etc. */
+	char ls_name[LOCKSTAT_NAMELEN];		/* name, if keyed by name */
+	const void *ls_key;		/* address, if not */
+	volatile spinlock_data_t ls_lock; /* protects the counters */
+	uint64_t ls_acquires;		/* total acquisitions */
+	uint64_t ls_contended;		/* acquisitions that had to wait */
+	uint64_t ls_waitcycles;		/* total cycles spent waiting */
+	uint64_t ls_holdcycles;		/* total cycles held */
+	uint64_t ls_maxhold;		/* longest single hold */
+};
+
+/* Per-lock hook. */
+struct lockstat_hook {
+	const char *lh_kind;		/* kind of lock */
+	const char *lh_name;		/* name to key on, or NULL */
+	const void *lh_key;		/* address to key on, or NULL */
+	struct lockstat *lh_stat;	/* slot, once bound */
+	uint64_t lh_start;		/* cycle count at acquire */
+};
+
+/* Per-acquire wait state; lives on the acquirer's stack. */
+struct lockstat_wait {
+	uint64_t lw_start;		/* cycle count when we began */
+	bool lw_contended;		/* true if we had to wait */
+};
+
+void lockstat_hookinit(struct lockstat_hook *h, const char *kind,
+		       const char *name, const void *key);
+void lockstat_waitbegin(struct lockstat_wait *w);
+void lockstat_acquire(struct lockstat_hook *h, struct lockstat_wait *w);
+void lockstat_release(struct lockstat_hook *h);
+
+void lockstat_report(unsigned maxlines);
+void lockstat_reset(void);
+
+#define LOCKSTAT_HOOK(sym)		struct lockstat_hook sym
+#define LOCKSTAT_WAIT(sym)		struct lockstat_wait sym
+
+/* Note: these include a leading comma; see SPINLOCK_INITIALIZER. */
+#define LOCKSTAT_HOOK_INITIALIZER(kind)	, { kind, NULL, NULL, NULL, 0 }
+
+#define LOCKSTAT_HOOKINIT(h, kind, name, key) \
+	lockstat_hookinit(h, kind, name, key)
+#define LOCKSTAT_WAITBEGIN(w)		lockstat_waitbegin(w)
+#define LOCKSTAT_CONTENDED(w)		((w)->lw_contended = true)
+#define LOCKSTAT_ACQUIRE(h, w)		lockstat_acquire(h, w)
+#define LOCKSTAT_RELEASE(h)		lockstat_release(h)
+
+#else
+
+#define LOCKSTAT_HOOK(sym)
+#define LOCKSTAT_WAIT(sym)
+
+#define LOCKSTAT_HOOK_INITIALIZER(kind)
+
+#define LOCKSTAT_HOOKINIT(h, kind, name, key)
+#define LOCKSTAT_WAITBEGIN(w)
+#define LOCKSTAT_CONTENDED(w)
+#define LOCKSTAT_ACQUIRE(h, w)
+#define LOCKSTAT_RELEASE(h)
+
+#endif
+
+#endif /* _LOCKSTAT_H_ */
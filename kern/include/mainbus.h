@@ -52,6 +52,15 @@ void mainbus_interrupt(struct trapframe *);
 /* XXX this interface is not adequately MI */
 size_t mainbus_ramsize(void);
 
+/*
+ * Stretch the current CPU's hardclock timer to fire after up to
+ * TICKS ticks (for idling), or put it back to firing at the next
+ * tick boundary. Skipped ticks are made up with hardclock_catchup()
+ * when the timer goes off. Interrupts must be off.
+ */
+void mainbus_timer_idle(unsigned ticks);
+void mainbus_timer_wake(void);
+
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Kernel support for poll().
+ *
+ * Anything that can block a read or a write (a pipe, the console, a
+ * semaphore) has a pollqueue. A thread in poll() has a pollwait, and
+ * VOP_POLL hooks the pollwait onto the queue of each file it checks
+ * with pollqueue_register. When the object's state changes in a way
+ * that could make a blocked read or write succeed, it calls
+ * pollqueue_wakeup, which wakes every pollwait registered there.
+ *
+ * To avoid lost wakeups, VOP_POLL registers before checking, and the
+ * poller clears pw_woken before each round of checks and only sleeps
+ * if it is still clear afterwards.
+ *
+ * pollqueue_wakeup only takes spinlocks, so it may be called from an
+ * interrupt handler.
+ */
+
+#include <spinlock.h>
+#include <kern/poll.h>
+
+struct wchan;
+struct pollwait;
+
+/* One pollwait's registration on one pollqueue. */
+struct pollentry {
+	struct pollentry *pe_next;	/* next on the queue */
+	struct pollqueue *pe_queue;	/* queue we're on */
+	struct pollwait *pe_wait;	/* who to wake */
+};
+
+struct pollqueue {
+	struct spinlock pq_lock;	/* protects pq_entries */
+	struct pollentry *pq_entries;	/* registered pollwaits */
+};
+
+struct pollwait {
+	struct spinlock pw_lock;	/* protects pw_woken and pw_wchan */
+	struct wchan *pw_wchan;		/* poller sleeps here */
+	bool pw_woken;			/* a queue was woken since reset */
+	bool pw_timedout;		/* the timeout went off */
+	struct pollentry *pw_entries;	/* registrations */
+	unsigned pw_numentries;		/* registrations in use */
+	unsigned pw_maxentries;		/* size of pw_entries */
+};
+
+/*
+ * Object side.
+ *
+ * init/cleanup  Set up and tear down a queue. Nobody may be
+ *               registered at cleanup; since pollers hold a reference
+ *               to the file, that's normally automatic.
+ * register      Register PW on the queue. PW may be NULL, which does
+ *               nothing, so VOP_POLL can pass its argument straight
+ *               through.
+ * wakeup        Wake everyone registered.
+ */
+void pollqueue_init(struct pollqueue *pq);
+void pollqueue_cleanup(struct pollqueue *pq);
+void pollqueue_register(struct pollqueue *pq, struct pollwait *pw);
+void pollqueue_wakeup(struct pollqueue *pq);
+
+/*
+ * Poller side.
+ *
+ * init     Set up PW to be registered on at most MAXENTRIES queues
+ *          (one per VOP_POLL call made with it).
+ * cleanup  Unregister from everything and tear down.
+ * reset    Clear pw_woken; call before each round of VOP_POLL.
+ * sleep    Sleep until some queue is woken (or the timeout, which the
+ *          caller arranges with pollwait_timeout, goes off), unless
+ *          that already happened since the last reset.
+ * timeout  Callout function: mark PW timed out and wake it.
+ */
+int pollwait_init(struct pollwait *pw, unsigned maxentries);
+void pollwait_cleanup(struct pollwait *pw);
+void pollwait_reset(struct pollwait *pw);
+void pollwait_sleep(struct pollwait *pw);
+void pollwait_timeout(void *pw);
+
+
+#endif /* _POLL_H_ */
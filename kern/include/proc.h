@@ -42,10 +42,12 @@
 #include <bitmap.h>
 #include <array.h>
 #include <limits.h>
+#include <thread.h>
 
 struct addrspace;
 struct thread;
 struct vnode;
+struct ioring;
 
 struct lock *console_lock;
 struct lock* pid_lock;
@@ -103,23 +105,40 @@ struct proc {
 	struct lock *cv_lock;
 	/* child it is waiting for and its status */
 	int child_status;
+
+	/* Asynchronous I/O ring we own, if any (see ioring.h) */
+	struct ioring *p_ioring;
+
+	/* Accounting (protected by p_lock) */
+	struct threadusage p_usage;	/* Threads that have exited */
+	struct threadusage p_cusage;	/* Children that have been reaped */
 	/* add more material here as needed */
 };
 
+/*
+ * File table. Looking up an fd (fd_get) takes no table-wide lock: it
+ * reads the slot and takes a reference on the entry found, which is
+ * safe because fd entries are never freed, only recycled (see
+ * fd_entry_decref), and fd_get checks the slot still holds the entry
+ * once it has it. The table lock only serializes changes to the
+ * table: open, close, dup2, and copying at fork.
+ */
 struct file_table {
-	struct array* entries; /* File descriptor table */
+	struct fd_entry *entries[MAX_FD]; /* Open files by fd; NULL if none */
 	struct bitmap* bitmap; /* Bitmap for file descriptors */
-	struct lock* lock; /* Lock for the file table */
+	struct lock* lock; /* Lock for changing the file table */
 };
 
 struct fd_entry {
 	struct vnode *vnode; /* Vnode for the file */
 	off_t pos; /* Position in the file */
 	struct lock *lock; /* Lock for this file */
-	unsigned int count; /* Reference count for this file */
+	struct spinlock count_lock; /* Protects count */
+	unsigned int count; /* References: table slots plus calls using it */
 	mode_t mode; /* Mode of the file */
 	int flags; /* Flags for the file */
 	char *path; /* Path to the file */
+	struct fd_entry *next_free; /* Free list link */
 };
 
 
@@ -141,6 +160,9 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/* Move a thread's usage counts into its process. */
+void proc_collectusage(struct thread *t);
+
 /* Fetch the address space of the current process. */
 struct addrspace *proc_getas(void);
 
@@ -149,6 +171,22 @@ struct addrspace *proc_setas(struct addrspace *);
 
 void file_table_destroy(struct file_table *ft);
 
+/* Close every descriptor, keeping the table. */
+void file_table_closeall(struct file_table *ft);
+
 struct file_table *file_table_create(void);
 
+/* Get a fresh fd_entry, holding one reference and no file yet. */
+struct fd_entry *fd_entry_create(void);
+
+/* Add or drop a reference; dropping the last one closes the file. */
+void fd_entry_incref(struct fd_entry *fde);
+void fd_entry_decref(struct fd_entry *fde);
+
+/* Look up fd in the current process, returning a referenced entry. */
+int fd_get(int fd, struct fd_entry **ret);
+
+/* Get an open file's vnode (referenced) and open flags, for mmap. */
+int file_getvnode(int fd, struct vnode **ret, int *flags);
+
 #endif /* _PROC_H_ */
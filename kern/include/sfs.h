@@ -48,14 +48,49 @@
  */
 #include <kern/sfs.h>
 
+struct lock;         /* from <synch.h> */
+struct sfs_dirindex; /* Opaque; in sfs_dir.c */
+
+/*
+ * Locking.
+ *
+ * Each vnode has a lock, sv_lock, that covers its inode and the rest
+ * of its state, except as noted. Each volume has sfs_vnlock for its
+ * table of vnodes in memory and the inactive list, and
+ * sfs_freemaplock for the freemap, the superblock, and blocks set
+ * aside for appending. The buffer cache does its own locking, one
+ * buffer at a time.
+ *
+ * The lock order is: directory vnode, sfs_vnlock, file vnode,
+ * sfs_freemaplock, buffers. (A directory lock may be held while
+ * dropping the last reference to a file, which may destroy it.)
+ */
+
 /*
  * In-memory inode
  */
 struct sfs_vnode {
 	struct vnode sv_absvn;          /* abstract vnode structure */
+	struct lock *sv_lock;           /* protects this vnode */
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
-	uint32_t sv_ino;                /* inode number */
+	uint32_t sv_ino;                /* inode number (constant) */
 	bool sv_dirty;                  /* true if sv_i modified */
+	off_t sv_raoff;                 /* where the last read ended */
+	uint32_t sv_rawindow;           /* readahead window, in blocks */
+	uint32_t sv_ramark;             /* read ahead up to this block */
+	daddr_t sv_lastblock;           /* last data block allocated */
+	struct sfs_dirindex *sv_dirindex; /* name index, for directories */
+
+	/* These are protected by sfs_freemaplock */
+	daddr_t sv_prealloc;            /* first block set aside for us */
+	uint32_t sv_nprealloc;          /* number of blocks set aside */
+	struct sfs_vnode *sv_preallocnext; /* next vnode with blocks aside */
+
+	/* These are protected by sfs_vnlock */
+	struct sfs_vnode *sv_hashnext;  /* next vnode on our hash chain */
+	struct sfs_vnode *sv_lrunext;   /* next newer inactive vnode */
+	struct sfs_vnode *sv_lruprev;   /* next older inactive vnode */
+	bool sv_inactive;               /* unused, kept in memory anyway */
 };
 
 /*
@@ -66,9 +101,18 @@ struct sfs_fs {
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct lock *sfs_vnlock;        /* protects the vnode table */
+	struct sfs_vnode **sfs_vnhash;  /* vnodes in memory, by inode */
+	unsigned sfs_nvnodes;           /* number of vnodes in memory */
+	struct sfs_vnode *sfs_lruhead;  /* least recently used inactive */
+	struct sfs_vnode *sfs_lrutail;  /* most recently used inactive */
+	unsigned sfs_ninactive;         /* number of inactive vnodes */
+	struct lock *sfs_freemaplock;   /* protects freemap and superblock */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct bitmap *sfs_freemapdirtyblocks; /* which freemap blocks */
+	uint16_t *sfs_freecounts;       /* free blocks per freemap block */
+	struct sfs_vnode *sfs_preallocs; /* vnodes with blocks set aside */
 };
 
 /*
@@ -76,5 +120,11 @@ struct sfs_fs {
  */
 int sfs_mount(const char *device);
 
+/*
+ * Statistics for finding vnodes in memory (for all sfs volumes)
+ */
+void sfs_printstats(void);
+void sfs_resetstats(void);
+
 
 #endif /* _SFS_H_ */
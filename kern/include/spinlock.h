@@ -46,6 +46,9 @@
 /* Get the machine-dependent bits. */
 #include <machine/spinlock.h>
 
+/* Lock statistics hooks; these need spinlock_data_t. */
+#include <lockstat.h>
+
 /*
  * Basic spinlock.
  *
@@ -59,16 +62,19 @@ struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
+	LOCKSTAT_HOOK(splk_stat);	    /* Contention statistics. */
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
-#ifdef OPT_HANGMAN
+#if OPT_HANGMAN
 #define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
-				  HANGMAN_LOCKABLE_INITIALIZER }
+				  HANGMAN_LOCKABLE_INITIALIZER \
+				  LOCKSTAT_HOOK_INITIALIZER("spinlock") }
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL \
+				  LOCKSTAT_HOOK_INITIALIZER("spinlock") }
 #endif
 
 /*
@@ -91,5 +97,47 @@ void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
 
+/*
+ * Ticket spinlock.
+ *
+ * Same rules as the basic spinlock (held by CPUs, disables
+ * interrupts, counts in c_spinlocks) but waiters are served in FIFO
+ * order. Each acquirer atomically takes a ticket from tkl_next and
+ * then only *reads* tkl_serving until its number comes up, so a
+ * release costs one store rather than a storm of failed
+ * test-and-sets from every waiting CPU. Use this for hot global
+ * locks that many CPUs fight over.
+ */
+struct ticketlock {
+	volatile spinlock_data_t tkl_next;	/* Next ticket to hand out. */
+	volatile spinlock_data_t tkl_serving;	/* Ticket now being served. */
+	struct cpu *tkl_holder;			/* CPU holding this lock. */
+	HANGMAN_LOCKABLE(tkl_hangman);		/* Deadlock detector hook. */
+	LOCKSTAT_HOOK(tkl_stat);		/* Contention statistics. */
+};
+
+#if OPT_HANGMAN
+#define TICKETLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, \
+				  HANGMAN_LOCKABLE_INITIALIZER \
+				  LOCKSTAT_HOOK_INITIALIZER("ticketlock") }
+#else
+#define TICKETLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL \
+				  LOCKSTAT_HOOK_INITIALIZER("ticketlock") }
+#endif
+
+/*
+ * Ticket spinlock functions; same semantics as the spinlock ones.
+ */
+
+void ticketlock_init(struct ticketlock *tkl);
+void ticketlock_cleanup(struct ticketlock *tkl);
+
+void ticketlock_acquire(struct ticketlock *tkl);
+void ticketlock_release(struct ticketlock *tkl);
+
+bool ticketlock_do_i_hold(struct ticketlock *tkl);
+
 
 #endif /* _SPINLOCK_H_ */
@@ -76,6 +76,7 @@ void V(struct semaphore *);
 struct lock {
         char *lk_name;
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
+        LOCKSTAT_HOOK(lk_stat);         /* Contention statistics. */
         struct wchan *mutex_wchan;
         struct spinlock mutex_lock;
         struct thread *holder;
@@ -134,8 +135,11 @@ void cv_destroy(struct cv *);
  *                   waking up again, re-acquire the lock.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *    cv_timedwait - Like cv_wait, but give up after TICKS hardclocks.
+ *                   Returns 0 if woken, or ETIMEDOUT. Either way the
+ *                   lock is held again on return.
  *
- * For all three operations, the current thread must hold the lock passed
+ * For all of these operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
@@ -144,6 +148,7 @@ void cv_destroy(struct cv *);
 void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks);
 
 /*
  * Reader-writer locks.
@@ -159,6 +164,7 @@ void cv_broadcast(struct cv *cv, struct lock *lock);
 
 struct rwlock {
         char *rwlock_name;
+        LOCKSTAT_HOOK(rwlock_stat);     /* Contention statistics. */
         // add what you need here
         struct semaphore *reader_sem;
         struct lock *read_write_lock;
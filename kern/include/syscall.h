@@ -69,17 +69,37 @@ int open_copy_prog(char *progname, struct addrspace **as, vaddr_t *entrypoint);
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t user_req, userptr_t user_rem);
 
 int sys_write(int fd, const void *buf, size_t buflen, int *retval);
 int sys_read(int fd, void *buf, size_t buflen, int *retval);
 int sys_lseek(int fd, off_t pos, int whence, int *retval1, int *retval);
+int sys_readv(int fd, const struct iovec *iov, int iovcnt, int *retval);
+int sys_writev(int fd, const struct iovec *iov, int iovcnt, int *retval);
+int sys_pread(int fd, void *buf, size_t buflen, off_t pos, int *retval);
+int sys_pwrite(int fd, const void *buf, size_t buflen, off_t pos, int *retval);
+int sys_sendfile(int outfd, int infd, userptr_t offset, size_t count,
+                 int *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+             off_t offset, int *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_msync(userptr_t addr, size_t len, int flags);
+int sys_pipe(userptr_t fds, int flags, int *retval);
+int sys_poll(userptr_t fds, unsigned nfds, int timeout, int *retval);
+int sys_ioring_setup(unsigned entries, userptr_t params, int *retval);
+int sys_ioring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                     int *retval);
+int sys_getdirentries(int fd, userptr_t buf, size_t buflen, int flags,
+                      int *retval);
 int sys_remove(const char *pathname, int *retval);
 int sys_open(char *filename, int flags, mode_t mode, int *retval);
 int sys_exit(int status);
 int sys_dup2(int oldfd, int newfd, int *retval);
 int sys_fstat(int fd, struct stat *statbuf, int *retval);
+int sys_fsync(int fd, int *retval);
 int sys_execv(const char *program, char **args, int *retval);
 int sys_wait(pid_t pid, int *status, int options, int *retval);
+int sys_getrusage(int who, userptr_t usage);
 int sys_close(pid_t pid, int *retval);
 int sys_getpid(void);
 int sys_fork(struct trapframe *tf, int *retval);
@@ -65,6 +65,17 @@ typedef enum {
 	S_ZOMBIE,	/* zombie; exited but not yet deleted */
 } threadstate_t;
 
+/*
+ * CPU usage. Kept per thread, and rolled up into the process when
+ * the thread exits (see proc.h). Times are in cycles (cpu_cycles()).
+ */
+struct threadusage {
+	uint64_t tu_utime;		/* Time spent in user mode */
+	uint64_t tu_stime;		/* Time spent in the kernel */
+	unsigned tu_nvcsw;		/* Voluntary context switches */
+	unsigned tu_nivcsw;		/* Involuntary (preemptions) */
+};
+
 /* Thread structure. */
 struct thread {
 	/*
@@ -112,6 +123,14 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Accounting. t_usagestamp is the cycle count when time was
+	 * last charged to t_usage; it is reset whenever the thread
+	 * starts running on a CPU.
+	 */
+	struct threadusage t_usage;
+	uint64_t t_usagestamp;
+
 	/*
 	 * Public fields
 	 */
@@ -179,6 +198,16 @@ void schedule(void);
  */
 void thread_consider_migration(void);
 
+/*
+ * Charge the current thread for the time since it was last charged,
+ * as user time if USER is true and system time otherwise. Called
+ * from the trap code on entry to and exit from the kernel.
+ */
+void thread_usage_charge(bool user);
+
+/* Add the counts in FROM to TO. */
+void threadusage_add(struct threadusage *to, const struct threadusage *from);
+
 extern unsigned thread_count;
 void thread_wait_for_count(unsigned);
 
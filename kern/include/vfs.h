@@ -81,6 +81,38 @@ int vfs_lookup(char *path, struct vnode **result);
 int vfs_lookparent(char *path, struct vnode **result,
 		   char *buf, size_t buflen);
 
+/*
+ * Name lookup cache (vfscache.c), used by vfs_lookup and
+ * vfs_lookparent to skip VOP_LOOKUP for path components seen before.
+ *
+ *    vfs_dcache_lookup     - Check the cache for NAME in DIR. Returns
+ *                            true on a hit, with *RET the vnode
+ *                            (incref'd) or NULL if NAME is known not
+ *                            to exist.
+ *    vfs_dcache_enter      - Record the result of VOP_LOOKUP; VN is
+ *                            NULL for "no such file". GEN is from the
+ *                            vfs_dcache_lookup call that missed.
+ *    vfs_dcache_begin      - Forget NAME in DIR and keep it out of
+ *                            the cache until vfs_dcache_end. Must
+ *                            bracket anything that creates, removes,
+ *                            or renames names.
+ *    vfs_dcache_end        - Finish a change begun with
+ *                            vfs_dcache_begin.
+ *    vfs_dcache_purge      - Forget everything on FS (or everything,
+ *                            if FS is NULL). Used before unmounting.
+ */
+
+void vfs_dcache_bootstrap(void);
+bool vfs_dcache_lookup(struct vnode *dir, const char *name,
+		       struct vnode **ret, unsigned *gen);
+void vfs_dcache_enter(struct vnode *dir, const char *name, struct vnode *vn,
+		      unsigned gen);
+void vfs_dcache_begin(struct vnode *dir, const char *name);
+void vfs_dcache_end(struct vnode *dir, const char *name);
+void vfs_dcache_purge(struct fs *fs);
+void vfs_dcache_printstats(void);
+void vfs_dcache_resetstats(void);
+
 /*
  * VFS layer high-level operations on pathnames
  * Because lookup may destroy pathnames, these all may too.
@@ -194,8 +226,11 @@ DECLARRAY(vnode, VFSINLINE);
 DEFARRAY(vnode, VFSINLINE);
 
 /*
- * Global one-big-lock for all filesystem operations.
- * You must remove this for the filesystem assignment.
+ * Global one-big-lock for filesystem operations. This now covers only
+ * the device/mount list and the boot filesystem vnode (and emufs,
+ * which still uses it for everything). SFS does its own locking; if
+ * a filesystem needs the big lock, it must be taken before any of
+ * the filesystem's own locks.
  */
 void vfs_biglock_acquire(void);
 void vfs_biglock_release(void);
@@ -41,6 +41,9 @@
 #include <mips/tlb.h>
 #include <synch.h>
 
+struct addrspace;
+struct uio;
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
@@ -104,4 +107,39 @@ void print_memory_contents(vaddr_t start_addr, int count);
 
 struct page_table *create_page_table(void);
 
+/* Last-level page table for vaddr, or NULL if there isn't one yet */
+struct page_table *find_last_level_pt(vaddr_t vaddr, struct addrspace *as);
+
+/* User page allocation and reference counts */
+unsigned int coremap_alloc_userpage(void);
+void coremap_incref(unsigned int frame);
+unsigned int coremap_getref(unsigned int frame);
+
+/*
+ * Functions in mmap.c: file-backed mappings and their page cache.
+ *
+ *    mmap_bootstrap - set up the page cache.
+ *    mmap_fault     - fill in the page table entry for a fault in a
+ *                     file-backed region (called with the page table
+ *                     locked; the lock is dropped while reading the
+ *                     page in).
+ *    mmap_destroy   - write back and remove all file-backed regions of
+ *                     an address space that's going away.
+ *    mmap_pinpage   - hold a page of a file in the cache for the kernel
+ *                     to use, and return its kernel address; mappings
+ *                     of that page share it with the kernel.
+ *    mmap_unpinpage - let go of a pinned page once nothing maps it.
+ *    mmap_prefault  - fault in the mapped file pages a user uio
+ *                     covers; call before VOP_READ or VOP_WRITE, so
+ *                     the filesystem never faults one in itself.
+ */
+void mmap_bootstrap(void);
+int mmap_fault(struct vm_region *region, struct lock *ptlock,
+               struct page_table_entry *pte, int faulttype,
+               vaddr_t faultaddress);
+void mmap_destroy(struct addrspace *as);
+int mmap_pinpage(struct vnode *vn, off_t pageno, vaddr_t *ret);
+void mmap_unpinpage(struct vnode *vn, off_t pageno);
+void mmap_prefault(struct uio *uio);
+
 #endif /* _VM_H_ */
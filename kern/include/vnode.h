@@ -33,6 +33,7 @@
 #include <spinlock.h>
 struct uio;
 struct stat;
+struct pollwait;
 
 
 /*
@@ -98,6 +99,15 @@ struct vnode {
  *                      handled in the normal fashion.
  *                      On non-directory objects, return ENOTDIR.
  *
+ *    vop_getdirentries - Like vop_getdirentry, but read as many names
+ *                      as fit, each as a struct dirent record (see
+ *                      kern/dirent.h), leaving the offset field at the
+ *                      first name not returned. With DIRENT_STAT in
+ *                      FLAGS, also fill in the type, size, and link
+ *                      count of each. Fail with EINVAL if the first
+ *                      record doesn't fit. Filesystems with nothing
+ *                      better to do can use vopgeneric_getdirentries.
+ *
  *    vop_write       - Write data from uio to file at offset specified
  *                      in the uio, updating uio_resid to reflect the
  *                      amount written, and updating uio_offset to match.
@@ -120,9 +130,17 @@ struct vnode {
  *    vop_fsync       - Force any dirty buffers associated with this file
  *                      to stable storage.
  *
- *    vop_mmap        - Map file into memory. If you implement this
- *                      feature, you're responsible for choosing the
- *                      arguments for this operation.
+ *    vop_mmap        - Check whether the file can be mapped into
+ *                      memory. The VM system does the mapping itself,
+ *                      moving pages with vop_read and vop_write; this
+ *                      returns 0 if that's allowed.
+ *
+ *    vop_poll        - Return which of the POLL* events (kern/poll.h)
+ *                      in EVENTS the file is ready for right now. If
+ *                      PW is not NULL and the answer can change, first
+ *                      register PW on a pollqueue that is woken when
+ *                      it does (see poll.h). Objects that never block
+ *                      can use vopready_poll.
  *
  *    vop_truncate    - Forcibly set size of file to the length passed
  *                      in, discarding any excess blocks.
@@ -187,6 +205,8 @@ struct vnode_ops {
 	int (*vop_read)(struct vnode *file, struct uio *uio);
 	int (*vop_readlink)(struct vnode *link, struct uio *uio);
 	int (*vop_getdirentry)(struct vnode *dir, struct uio *uio);
+	int (*vop_getdirentries)(struct vnode *dir, struct uio *uio,
+				 int flags);
 	int (*vop_write)(struct vnode *file, struct uio *uio);
 	int (*vop_ioctl)(struct vnode *object, int op, userptr_t data);
 	int (*vop_stat)(struct vnode *object, struct stat *statbuf);
@@ -194,6 +214,8 @@ struct vnode_ops {
 	bool (*vop_isseekable)(struct vnode *object);
 	int (*vop_fsync)(struct vnode *object);
 	int (*vop_mmap)(struct vnode *file /* add stuff */);
+	int (*vop_poll)(struct vnode *object, int events,
+			struct pollwait *pw);
 	int (*vop_truncate)(struct vnode *file, off_t len);
 	int (*vop_namefile)(struct vnode *file, struct uio *uio);
 
@@ -231,6 +253,7 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
+#define VOP_GETDIRENTRIES(vn, uio, fl)  (__VOP(vn,getdirentries)(vn, uio, fl))
 #define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
@@ -238,6 +261,7 @@ struct vnode_ops {
 #define VOP_ISSEEKABLE(vn)              (__VOP(vn, isseekable)(vn))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
+#define VOP_POLL(vn, events, pw)        (__VOP(vn, poll)(vn, events, pw))
 #define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
@@ -286,6 +310,7 @@ int vopfail_uio_notdir(struct vnode *vn, struct uio *uio);
 int vopfail_uio_isdir(struct vnode *vn, struct uio *uio);
 int vopfail_uio_inval(struct vnode *vn, struct uio *uio);
 int vopfail_uio_nosys(struct vnode *vn, struct uio *uio);
+int vopfail_dirents_notdir(struct vnode *vn, struct uio *uio, int flags);
 int vopfail_mmap_isdir(struct vnode *vn /* add stuff */);
 int vopfail_mmap_perm(struct vnode *vn /* add stuff */);
 int vopfail_mmap_nosys(struct vnode *vn /* add stuff */);
@@ -312,5 +337,20 @@ int vopfail_lookup_notdir(struct vnode *vn, char *path, struct vnode **result);
 int vopfail_lookparent_notdir(struct vnode *vn, char *path,
 			      struct vnode **result, char *buf, size_t len);
 
+/*
+ * VOP_POLL for objects that are always ready to read and write.
+ */
+int vopready_poll(struct vnode *vn, int events, struct pollwait *pw);
+
+/*
+ * VOP_GETDIRENTRIES done with VOP_GETDIRENTRY, one name at a time,
+ * and VOP_LOOKUP and VOP_STAT for DIRENT_STAT. vfs_putdirent appends
+ * one record to a getdirentries uio, or returns ENOSPC if it doesn't
+ * fit; ST may be NULL. Both are in vfs/vfsdirent.c.
+ */
+int vopgeneric_getdirentries(struct vnode *dir, struct uio *uio, int flags);
+int vfs_putdirent(struct uio *uio, const char *name, ino_t ino,
+		  const struct stat *st);
+
 
 #endif /* _VNODE_H_ */
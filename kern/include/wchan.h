@@ -36,6 +36,7 @@
 
 
 struct spinlock; /* in spinlock.h */
+struct thread; /* in thread.h */
 struct wchan; /* Opaque */
 
 /*
@@ -76,5 +77,13 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Wake up a particular thread, if it is sleeping on the wait channel.
+ * Returns true if it was (and so has been woken). The associated
+ * spinlock should be locked. This is for timeouts.
+ */
+bool wchan_wakethread(struct wchan *wc, struct thread *t,
+		      struct spinlock *lk);
+
 
 #endif /* _WCHAN_H_ */
@@ -45,6 +45,7 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <vfs.h>
+#include <buf.h>
 #include <device.h>
 #include <syscall.h>
 #include <test.h>
@@ -109,10 +110,12 @@ boot(void)
 	/* Early initialization. */
 	ram_bootstrap();
 	vm_bootstrap();
+	mmap_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
+	buffer_bootstrap();
 	kheap_nextgeneration();
 
 	/* Probe and initialize devices. Interrupts should come on. */
@@ -128,6 +131,7 @@ boot(void)
 	/* Late phase of initialization. */
 	kprintf_bootstrap();
 	thread_start_cpus();
+	buffer_start_threads();
 	test161_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
@@ -35,12 +35,14 @@
 #include <lib.h>
 #include <uio.h>
 #include <clock.h>
+#include <cpu.h>
 #include <mainbus.h>
 #include <synch.h>
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <buf.h>
 #include <syscall.h>
 #include <test.h>
 #include <prompt.h>
@@ -202,6 +204,55 @@ cmd_prog(int nargs, char **args)
 	return common_prog(nargs, args);
 }
 
+/*
+ * Command for benchmarking the buffer cache: run a program (as with
+ * "p") from a cold start of the statistics, sync, and report how
+ * long it took and how the cache did. For example:
+ *     bufbench /testbin/bigfile bigf 200000
+ *     bufbench /testbin/dirtest
+ */
+static
+int
+cmd_bufbench(int nargs, char **args)
+{
+	struct timespec before, after, duration;
+	int result;
+
+	if (nargs < 2) {
+		kprintf("Usage: bufbench program [arguments]\n");
+		return EINVAL;
+	}
+
+	/* drop the leading "bufbench" */
+	args++;
+	nargs--;
+
+	vfs_sync();
+	buffer_resetstats();
+#if OPT_SFS
+	sfs_resetstats();
+#endif
+	gettime(&before);
+
+	result = common_prog(nargs, args);
+	if (result) {
+		return result;
+	}
+	vfs_sync();
+
+	gettime(&after);
+	timespec_sub(&after, &before, &duration);
+	kprintf("%s: %llu.%09lu seconds\n", args[0],
+		(unsigned long long) duration.tv_sec,
+		(unsigned long) duration.tv_nsec);
+	buffer_printstats();
+#if OPT_SFS
+	sfs_printstats();
+#endif
+
+	return 0;
+}
+
 /*
  * Command for starting the system shell.
  */
@@ -548,6 +599,127 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Print how much of its time each CPU has spent idle. The elapsed
+ * time is reckoned from the hardclock count, which includes ticks a
+ * CPU slept through.
+ */
+static
+int
+cmd_cpustats(int nargs, char **args)
+{
+	struct cpu *c;
+	uint64_t total;
+	unsigned i, pct;
+
+	(void)nargs;
+	(void)args;
+
+	for (i=0; i<num_cpus; i++) {
+		c = cpu_get_by_number(i);
+		total = (uint64_t)c->c_hardclocks * cpu_cycles_per_tick();
+		pct = total == 0 ? 0 : (unsigned)(c->c_idlecycles * 100 / total);
+		kprintf("cpu%u: %u ticks, %llu idle cycles (%u%% idle)\n",
+			i, c->c_hardclocks,
+			(unsigned long long)c->c_idlecycles, pct);
+	}
+
+	return 0;
+}
+
+/*
+ * Print the buffer cache statistics and start counting again.
+ */
+static
+int
+cmd_bufstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	buffer_printstats();
+	buffer_resetstats();
+
+	return 0;
+}
+
+/*
+ * Print the name cache statistics and start counting again.
+ */
+static
+int
+cmd_dcstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vfs_dcache_printstats();
+	vfs_dcache_resetstats();
+
+	return 0;
+}
+
+/*
+ * Print the console output statistics and start counting again.
+ */
+static
+int
+cmd_constats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	console_printstats();
+	console_resetstats();
+
+	return 0;
+}
+
+#if OPT_SFS
+/*
+ * Print the statistics for finding SFS vnodes and start counting
+ * again.
+ */
+static
+int
+cmd_vnstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	sfs_printstats();
+	sfs_resetstats();
+
+	return 0;
+}
+#endif
+
+#if OPT_LOCKSTAT
+/*
+ * Print the locks with the most contention, then start counting
+ * again from zero.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	int maxlines = 20;
+
+	if (nargs == 2) {
+		maxlines = atoi(args[1]);
+	}
+	if (nargs > 2 || maxlines <= 0) {
+		kprintf("Usage: lockstat [count]\n");
+		return EINVAL;
+	}
+
+	lockstat_report(maxlines);
+	lockstat_reset();
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -580,6 +752,7 @@ showmenu(const char *name, const char *x[])
 static const char *opsmenu[] = {
 	"[s]       Shell                     ",
 	"[p]       Other program             ",
+	"[bufbench] Program with cache stats ",
 	"[mount]   Mount a filesystem        ",
 	"[unmount] Unmount a filesystem      ",
 	"[bootfs]  Set \"boot\" filesystem     ",
@@ -615,6 +788,9 @@ static const char *testmenu[] = {
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
 	"[km5] kmalloc coremap alloc test    ",
+	"[slt1] Spinlock fairness test       ",
+	"[clt1] Callout/timed sleep test     ",
+	"[buf1] Buffer cache test            ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -699,6 +875,16 @@ static const char *mainmenu[] = {
 	"[khu] Kernel heap usage             ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[cpus] CPU idle stats               ",
+	"[bufstats] Buffer cache stats       ",
+	"[dcstats] Name cache stats          ",
+	"[constats] Console output stats     ",
+#if OPT_SFS
+	"[vnstats] SFS vnode lookup stats    ",
+#endif
+#if OPT_LOCKSTAT
+	"[lockstat] Lock contention report   ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -735,6 +921,7 @@ static struct {
 	/* operations */
 	{ "s",		cmd_shell },
 	{ "p",		cmd_prog },
+	{ "bufbench",	cmd_bufbench },
 	{ "mount",	cmd_mount },
 	{ "unmount",	cmd_unmount },
 	{ "bootfs",	cmd_bootfs },
@@ -754,6 +941,16 @@ static struct {
 	{ "khu",        cmd_kheapused },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "cpus",	cmd_cpustats },
+	{ "bufstats",	cmd_bufstats },
+	{ "dcstats",	cmd_dcstats },
+	{ "constats",	cmd_constats },
+#if OPT_SFS
+	{ "vnstats",	cmd_vnstats },
+#endif
+#if OPT_LOCKSTAT
+	{ "lockstat",	cmd_lockstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -768,6 +965,9 @@ static struct {
 #if OPT_NET
 	{ "net",	nettest },
 #endif
+	{ "slt1",	spinlocktest },
+	{ "clt1",	callouttest },
+	{ "buf1",	buftest },
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
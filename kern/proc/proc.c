@@ -42,6 +42,7 @@
  * process that will have more than one thread is the kernel process.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
@@ -91,6 +92,9 @@ static struct proc *proc_create(const char *name)
     proc->stderr = STDERR_FILENO;
     proc->exited = false;
     proc->child_status = 0;
+    proc->p_ioring = NULL;
+    bzero(&proc->p_usage, sizeof(proc->p_usage));
+    bzero(&proc->p_cusage, sizeof(proc->p_cusage));
 
     /* Create file table */
     proc->fd_table = NULL;
@@ -102,27 +106,11 @@ static struct proc *proc_create(const char *name)
             return NULL;
         }
         
-		/* Initialize file descriptor bitmap */
-		proc->fd_table->bitmap = bitmap_create(MAX_FD);
-		if (proc->fd_table->bitmap == NULL) {
-			file_table_destroy(proc->fd_table);
-			kfree(proc->p_name);
-			kfree(proc);
-			return NULL;
-		}
         /* Initialize stdin, stdout, stderr */
         for (int i = 0; i < 3; i++) {
             struct fd_entry *fde = create_console_fd(i);
             if (fde == NULL) {
-                /* Cleanup on failure */
-                for (int j = 0; j < i; j++) {
-                    struct fd_entry *prev = array_get(proc->fd_table->entries, j);
-                    if (prev) {
-                        vfs_close(prev->vnode);
-                        kfree(prev->path);
-                        kfree(prev);
-                    }
-                }
+                /* Cleanup on failure; this closes any already open */
                 file_table_destroy(proc->fd_table);
                 kfree(proc->p_name);
                 kfree(proc);
@@ -131,7 +119,7 @@ static struct proc *proc_create(const char *name)
             
             /* Add to file table */
             lock_acquire(proc->fd_table->lock);
-            array_add(proc->fd_table->entries, fde, NULL);
+            proc->fd_table->entries[i] = fde;
             bitmap_mark(proc->fd_table->bitmap, i);
             lock_release(proc->fd_table->lock);
         }
@@ -414,6 +402,8 @@ proc_remthread(struct thread *t)
 	proc = t->t_proc;
 	KASSERT(proc != NULL);
 
+	proc_collectusage(t);
+
 	spinlock_acquire(&proc->p_lock);
 	KASSERT(proc->p_numthreads > 0);
 	proc->p_numthreads--;
@@ -427,6 +417,29 @@ proc_remthread(struct thread *t)
 	splx(spl);
 }
 
+/*
+ * Add a thread's usage counts to its process's and clear them, so
+ * the thread can't be counted twice. If T is the current thread,
+ * charge it for the time up to now first.
+ */
+void
+proc_collectusage(struct thread *t)
+{
+	struct proc *proc;
+
+	proc = t->t_proc;
+	KASSERT(proc != NULL);
+
+	if (t == curthread) {
+		thread_usage_charge(false);
+	}
+
+	spinlock_acquire(&proc->p_lock);
+	threadusage_add(&proc->p_usage, &t->t_usage);
+	bzero(&t->t_usage, sizeof(t->t_usage));
+	spinlock_release(&proc->p_lock);
+}
+
 /*
  * Fetch the address space of (the current) process.
  *>
@@ -479,15 +492,12 @@ struct file_table *file_table_create(void) {
         return NULL;
     }
     
-    ft->entries = array_create();
-    if (ft->entries == NULL) {
-        kfree(ft);
-        return NULL;
+    for (int i = 0; i < MAX_FD; i++) {
+        ft->entries[i] = NULL;
     }
     
     ft->bitmap = bitmap_create(MAX_FD);
     if (ft->bitmap == NULL) {
-        array_destroy(ft->entries);
         kfree(ft);
         return NULL;
     }
@@ -495,7 +505,6 @@ struct file_table *file_table_create(void) {
     ft->lock = lock_create("file_table");
     if (ft->lock == NULL) {
         bitmap_destroy(ft->bitmap);
-        array_destroy(ft->entries);
         kfree(ft);
         return NULL;
     }
@@ -503,45 +512,154 @@ struct file_table *file_table_create(void) {
     return ft;
 }
 
+/*
+ * Close every descriptor in a file table, leaving the table itself
+ * in place, so threads still looking things up in it just get EBADF.
+ */
+void file_table_closeall(struct file_table *ft) {
+    /* Drop each slot's reference to its file */
+    lock_acquire(ft->lock);
+    for (int i = MAX_FD - 1; i >= 0; i--) {
+        struct fd_entry *fde = ft->entries[i];
+        if (fde != NULL) {
+            ft->entries[i] = NULL;
+            bitmap_unmark(ft->bitmap, i);
+            fd_entry_decref(fde);
+        }
+    }
+    lock_release(ft->lock);
+}
+
 /* Destroy a file table */
 void file_table_destroy(struct file_table *ft) {
     if (ft == NULL) return;
     
-    /* Clean up all file descriptors */
-    lock_acquire(ft->lock);
-	int array_size = array_num(ft->entries);
-    for (int i = array_size - 1; i >= 0; i--) {
-        struct fd_entry *fde = array_get(ft->entries, i);
-        if (fde != NULL) {
-            if (fde->vnode != NULL) {
-                vfs_close(fde->vnode);
-				/* Maybe we will change it later */
-				fde->count--;
-            }
-			if (fde->count == 0) {
-				if (fde->path != NULL)
-				{
-					kfree(fde->path);
-				}
-				if (fde->lock != NULL && fde->lock != console_lock)
-				{
-					lock_destroy(fde->lock);
-				}
-				kfree(fde);
-			}
-		}
-		array_remove(ft->entries, i);
-	}
-	array_destroy(ft->entries);
-    lock_release(ft->lock);
+    file_table_closeall(ft);
     bitmap_destroy(ft->bitmap);
     lock_destroy(ft->lock);
     kfree(ft);
 }
 
+/*
+ * Unused fd entries. Entries are recycled through here instead of
+ * being freed, so a pointer to one read out of a file table always
+ * points at an fd_entry (possibly a different file by now, which
+ * fd_get checks for) and never at freed memory. That's what lets
+ * fd_get skip the table lock.
+ */
+static struct fd_entry *fd_freelist = NULL;
+static struct spinlock fd_freelist_lock = SPINLOCK_INITIALIZER;
+
+struct fd_entry *fd_entry_create(void) {
+    struct fd_entry *fde;
+    
+    spinlock_acquire(&fd_freelist_lock);
+    fde = fd_freelist;
+    if (fde != NULL) {
+        fd_freelist = fde->next_free;
+    }
+    spinlock_release(&fd_freelist_lock);
+    
+    if (fde == NULL) {
+        fde = kmalloc(sizeof(struct fd_entry));
+        if (fde == NULL) {
+            return NULL;
+        }
+        /* Stays initialized for good; the entry is never freed */
+        spinlock_init(&fde->count_lock);
+    }
+    
+    fde->vnode = NULL;
+    fde->pos = 0;
+    fde->lock = NULL;
+    fde->mode = 0;
+    fde->flags = 0;
+    fde->path = NULL;
+    fde->next_free = NULL;
+    
+    spinlock_acquire(&fde->count_lock);
+    fde->count = 1;
+    spinlock_release(&fde->count_lock);
+    return fde;
+}
+
+void fd_entry_incref(struct fd_entry *fde) {
+    spinlock_acquire(&fde->count_lock);
+    KASSERT(fde->count > 0);
+    fde->count++;
+    spinlock_release(&fde->count_lock);
+}
+
+/*
+ * Drop a reference. The last one closes the file and puts the entry
+ * on the free list.
+ */
+void fd_entry_decref(struct fd_entry *fde) {
+    unsigned int count;
+    
+    spinlock_acquire(&fde->count_lock);
+    KASSERT(fde->count > 0);
+    count = --fde->count;
+    spinlock_release(&fde->count_lock);
+    if (count > 0) {
+        return;
+    }
+    
+    if (fde->vnode != NULL) {
+        vfs_close(fde->vnode);
+        fde->vnode = NULL;
+    }
+    if (fde->path != NULL) {
+        kfree(fde->path);
+        fde->path = NULL;
+    }
+    if (fde->lock != NULL && fde->lock != console_lock) {
+        lock_destroy(fde->lock);
+    }
+    fde->lock = NULL;
+    
+    spinlock_acquire(&fd_freelist_lock);
+    fde->next_free = fd_freelist;
+    fd_freelist = fde;
+    spinlock_release(&fd_freelist_lock);
+}
+
+/*
+ * Look up fd in the current process's file table without taking the
+ * table lock. The slot is read once; the entry found is referenced
+ * under its own count lock, and only if it's still live and still in
+ * the slot (a close may have raced with us, and the entry may even
+ * have been recycled for another file). The caller drops the
+ * reference with fd_entry_decref.
+ */
+int fd_get(int fd, struct fd_entry **ret) {
+    struct file_table *ft = curproc->fd_table;
+    struct fd_entry *fde;
+    
+    if (fd < 0 || fd >= MAX_FD || ft == NULL) {
+        return EBADF;
+    }
+    
+    fde = ft->entries[fd];
+    if (fde == NULL) {
+        return EBADF;
+    }
+    
+    spinlock_acquire(&fde->count_lock);
+    if (fde->count == 0 || ft->entries[fd] != fde) {
+        spinlock_release(&fde->count_lock);
+        return EBADF;
+    }
+    fde->count++;
+    spinlock_release(&fde->count_lock);
+    
+    *ret = fde;
+    return 0;
+}
+
 /* Create fd_entry for console */
 static struct fd_entry *create_console_fd(int fd_num) {
-    struct fd_entry *fde = kmalloc(sizeof(struct fd_entry));
+    struct fd_entry *fde = fd_entry_create();
     if (fde == NULL) return NULL;
     
     const char *console = "con:";
@@ -549,13 +667,13 @@ static struct fd_entry *create_console_fd(int fd_num) {
     
     int ret = vfs_open(kstrdup(console), flag, 0, &fde->vnode);
     if (ret) {
-        kfree(fde);
+        fde->vnode = NULL;
+        fd_entry_decref(fde);
         return NULL;
     }
     
     fde->pos = 0;
     fde->lock = console_lock;  /* Shared console lock */
-    fde->count = 1;
     fde->mode = 0;
     fde->flags = flag;
     fde->path = kstrdup(console);
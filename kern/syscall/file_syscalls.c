@@ -5,10 +5,16 @@
 #include <stat.h>
 #include <kern/stattypes.h>
 #include <kern/seek.h>
+#include <kern/dirent.h>
 #include <vfs.h>
 #include <copyinout.h>
 #include <kern/fcntl.h>
 #include <proc.h>
+#include <vm.h>
+#include <pipe.h>
+#include <poll.h>
+#include <clock.h>
+#include <callout.h>
 
 /*
  *
@@ -63,7 +69,7 @@ int sys_open(char *filename, int flags, mode_t mode, int *retval) {
     }
     
     /* Create new fd_entry */
-    struct fd_entry *fde = kmalloc(sizeof(struct fd_entry));
+    struct fd_entry *fde = fd_entry_create();
     if (fde == NULL) {
         vfs_close(v);
         kfree(fname);
@@ -72,16 +78,13 @@ int sys_open(char *filename, int flags, mode_t mode, int *retval) {
     }
     
     fde->vnode = v;
-    fde->pos = 0;
     fde->lock = lock_create("fd_lock");
     if (fde->lock == NULL) {
-        vfs_close(v);
-        kfree(fde);
-        kfree(fname);
+        fde->path = fname;
+        fd_entry_decref(fde);
         *retval = -1;
         return ENOMEM;
     }
-    fde->count = 1;
     fde->mode = mode;
     fde->flags = flags;
     fde->path = fname;  /* Transfer ownership of fname */
@@ -93,22 +96,13 @@ int sys_open(char *filename, int flags, mode_t mode, int *retval) {
     err = bitmap_alloc(curproc->fd_table->bitmap, &fd);
     if (err == ENOSPC || fd >= MAX_FD) {
         lock_release(curproc->fd_table->lock);
-        lock_destroy(fde->lock);
-        vfs_close(v);
-        kfree(fde->path);
-        kfree(fde);
+        fd_entry_decref(fde);
         *retval = -1;
         return EMFILE;
     }
     
-    /* Ensure array is large enough
-	 * Might need to changed this to use preallocate
-	*/
-    while (array_num(curproc->fd_table->entries) <= fd) {
-        array_add(curproc->fd_table->entries, NULL, NULL);
-    }
-    
-    array_set(curproc->fd_table->entries, fd, fde);
+    /* Publishing the pointer makes the fd usable by fd_get */
+    curproc->fd_table->entries[fd] = fde;
     
     lock_release(curproc->fd_table->lock);
     
@@ -131,13 +125,7 @@ int sys_close(int fd, int *retval) {
     lock_acquire(curproc->fd_table->lock);
     
     /* Check if fd is valid */
-    if (!bitmap_isset(curproc->fd_table->bitmap, fd)) {
-        lock_release(curproc->fd_table->lock);
-        *retval = -1;
-        return EBADF;
-    }
-    
-    struct fd_entry *fde = array_get(curproc->fd_table->entries, fd);
+    struct fd_entry *fde = curproc->fd_table->entries[fd];
     if (fde == NULL) {
         lock_release(curproc->fd_table->lock);
         *retval = -1;
@@ -146,24 +134,16 @@ int sys_close(int fd, int *retval) {
     
     /* Clear the fd slot */
     bitmap_unmark(curproc->fd_table->bitmap, fd);
-    array_set(curproc->fd_table->entries, fd, NULL);
+    curproc->fd_table->entries[fd] = NULL;
     
     lock_release(curproc->fd_table->lock);
     
-    /* Clean up fd_entry outside of table lock */
-    fde->count--;
-    if (fde->count == 0) {
-        if (fde->vnode != NULL) {
-            vfs_close(fde->vnode);
-        }
-        if (fde->path != NULL) {
-            kfree(fde->path);
-        }
-        if (fde->lock != NULL && fde->lock != console_lock) {
-            lock_destroy(fde->lock);
-        }
-        kfree(fde);
-    }
+    /*
+     * Drop the slot's reference outside of table lock. Calls still
+     * using the entry hold references of their own, so it only goes
+     * away when the last of them finishes.
+     */
+    fd_entry_decref(fde);
     
     *retval = 0;
     return 0;
@@ -182,36 +162,22 @@ int sys_close(int fd, int *retval) {
 int sys_write(int fd, const void *buf, size_t buflen, int *retval) {
     int err;
     
-    if (fd < 0 || fd >= MAX_FD) {
-        *retval = -1;
-        return EBADF;
-    }
-    
-    lock_acquire(curproc->fd_table->lock);
-    
-    if (!bitmap_isset(curproc->fd_table->bitmap, fd)) {
-        lock_release(curproc->fd_table->lock);
-        *retval = -1;
-        return EBADF;
-    }
-    
-    struct fd_entry *fde = array_get(curproc->fd_table->entries, fd);
-    if (fde == NULL) {
-        lock_release(curproc->fd_table->lock);
+    struct fd_entry *fde;
+    err = fd_get(fd, &fde);
+    if (err) {
         *retval = -1;
-        return EBADF;
+        return err;
     }
     
     /* Check write permission */
     if (!(fde->flags & (O_RDWR | O_WRONLY))) {
-        lock_release(curproc->fd_table->lock);
+        fd_entry_decref(fde);
         *retval = -1;
         return EBADF;
     }
     
     /* Hold the fd lock while writing */
     lock_acquire(fde->lock);
-    lock_release(curproc->fd_table->lock);
     
     struct iovec iov;
     struct uio u;
@@ -226,10 +192,13 @@ int sys_write(int fd, const void *buf, size_t buflen, int *retval) {
     u.uio_rw = UIO_WRITE;
     u.uio_space = curproc->p_addrspace;
     
+    /* Not under the vnode lock; see mmap_prefault */
+    mmap_prefault(&u);
     err = VOP_WRITE(fde->vnode, &u);
     
     if (err) {
         lock_release(fde->lock);
+        fd_entry_decref(fde);
         *retval = -1;
         return err;
     }
@@ -238,6 +207,7 @@ int sys_write(int fd, const void *buf, size_t buflen, int *retval) {
     *retval = buflen - u.uio_resid;
     
     lock_release(fde->lock);
+    fd_entry_decref(fde);
     return 0;
 }
 
@@ -260,36 +230,22 @@ int sys_write(int fd, const void *buf, size_t buflen, int *retval) {
 int sys_read(int fd, void *buf, size_t buflen, int *retval) {
     int err = 0;
     
-    if (fd < 0 || fd >= MAX_FD) {
-        *retval = -1;
-        return EBADF;
-    }
-    
-    lock_acquire(curproc->fd_table->lock);
-    
-    if (!bitmap_isset(curproc->fd_table->bitmap, fd)) {
-        lock_release(curproc->fd_table->lock);
-        *retval = -1;
-        return EBADF;
-    }
-    
-    struct fd_entry *fde = array_get(curproc->fd_table->entries, fd);
-    if (fde == NULL) {
-        lock_release(curproc->fd_table->lock);
+    struct fd_entry *fde;
+    err = fd_get(fd, &fde);
+    if (err) {
         *retval = -1;
-        return EBADF;
+        return err;
     }
     
     /* Check read permission */
     if (fde->flags & O_WRONLY) {
-        lock_release(curproc->fd_table->lock);
+        fd_entry_decref(fde);
         *retval = -1;
         return EBADF;
     }
     
     /* Hold the fd lock while reading */
     lock_acquire(fde->lock);
-    lock_release(curproc->fd_table->lock);
     
     struct iovec iov;
     struct uio u;
@@ -304,10 +260,13 @@ int sys_read(int fd, void *buf, size_t buflen, int *retval) {
     u.uio_rw = UIO_READ;
     u.uio_space = curproc->p_addrspace;
     
+    /* Not under the vnode lock; see mmap_prefault */
+    mmap_prefault(&u);
     err = VOP_READ(fde->vnode, &u);
     
     if (err) {
         lock_release(fde->lock);
+        fd_entry_decref(fde);
         *retval = -1;
         return err;
     }
@@ -316,6 +275,328 @@ int sys_read(int fd, void *buf, size_t buflen, int *retval) {
     *retval = buflen - u.uio_resid;
     
     lock_release(fde->lock);
+    fd_entry_decref(fde);
+    return 0;
+}
+
+/*
+ * Look up fd and check that it is open for reading (rw == UIO_READ)
+ * or writing. On success the caller has a reference to the entry
+ * and must drop it with fd_entry_decref when done.
+ */
+static int fd_lookup(int fd, enum uio_rw rw, struct fd_entry **ret) {
+    struct fd_entry *fde;
+    bool ok;
+    int err;
+
+    err = fd_get(fd, &fde);
+    if (err) {
+        return err;
+    }
+
+    if (rw == UIO_READ) {
+        ok = !(fde->flags & O_WRONLY);
+    } else {
+        ok = (fde->flags & (O_RDWR | O_WRONLY)) != 0;
+    }
+    if (!ok) {
+        fd_entry_decref(fde);
+        return EBADF;
+    }
+
+    *ret = fde;
+    return 0;
+}
+
+/*
+ * Common code for readv and writev: like read and write, but the data
+ * goes to or comes from iovcnt separate buffers, filled or drained in
+ * order, in one operation at the current seek position.
+ */
+static int sys_rwv(int fd, const struct iovec *user_iov, int iovcnt,
+                   enum uio_rw rw, int *retval) {
+    struct fd_entry *fde;
+    struct iovec *iov;
+    struct uio u;
+    size_t total;
+    int i, err;
+
+    if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+        *retval = -1;
+        return EINVAL;
+    }
+
+    iov = kmalloc(iovcnt * sizeof(struct iovec));
+    if (iov == NULL) {
+        *retval = -1;
+        return ENOMEM;
+    }
+
+    err = copyin((const_userptr_t)user_iov, iov, iovcnt * sizeof(struct iovec));
+    if (err) {
+        kfree(iov);
+        *retval = -1;
+        return err;
+    }
+
+    /* The total has to fit in the return value. */
+    total = 0;
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > 0x7fffffff - total) {
+            kfree(iov);
+            *retval = -1;
+            return EINVAL;
+        }
+        total += iov[i].iov_len;
+    }
+
+    err = fd_lookup(fd, rw, &fde);
+    if (err) {
+        kfree(iov);
+        *retval = -1;
+        return err;
+    }
+
+    /* Hold the fd lock for the whole transfer, as read and write do */
+    lock_acquire(fde->lock);
+
+    u.uio_iov = iov;
+    u.uio_iovcnt = iovcnt;
+    u.uio_resid = total;
+    u.uio_offset = fde->pos;
+    u.uio_segflg = UIO_USERSPACE;
+    u.uio_rw = rw;
+    u.uio_space = curproc->p_addrspace;
+
+    mmap_prefault(&u);
+    if (rw == UIO_READ) {
+        err = VOP_READ(fde->vnode, &u);
+    } else {
+        err = VOP_WRITE(fde->vnode, &u);
+    }
+
+    if (err) {
+        lock_release(fde->lock);
+        fd_entry_decref(fde);
+        kfree(iov);
+        *retval = -1;
+        return err;
+    }
+
+    fde->pos += (total - u.uio_resid);
+    *retval = total - u.uio_resid;
+
+    lock_release(fde->lock);
+    fd_entry_decref(fde);
+    kfree(iov);
+    return 0;
+}
+
+int sys_readv(int fd, const struct iovec *iov, int iovcnt, int *retval) {
+    return sys_rwv(fd, iov, iovcnt, UIO_READ, retval);
+}
+
+int sys_writev(int fd, const struct iovec *iov, int iovcnt, int *retval) {
+    return sys_rwv(fd, iov, iovcnt, UIO_WRITE, retval);
+}
+
+/*
+ * Common code for pread and pwrite: like read and write, but at the
+ * offset given rather than the seek position, which is neither used
+ * nor changed. So there's no need for the fd lock; threads sharing
+ * the fd can do positional I/O at the same time.
+ */
+static int sys_prw(int fd, void *buf, size_t buflen, off_t pos,
+                   enum uio_rw rw, int *retval) {
+    struct fd_entry *fde;
+    struct iovec iov;
+    struct uio u;
+    int err;
+
+    if (pos < 0) {
+        *retval = -1;
+        return EINVAL;
+    }
+
+    err = fd_lookup(fd, rw, &fde);
+    if (err) {
+        *retval = -1;
+        return err;
+    }
+
+    if (!VOP_ISSEEKABLE(fde->vnode)) {
+        fd_entry_decref(fde);
+        *retval = -1;
+        return ESPIPE;
+    }
+
+    iov.iov_ubase = (userptr_t)buf;
+    iov.iov_len = buflen;
+    u.uio_iov = &iov;
+    u.uio_iovcnt = 1;
+    u.uio_resid = buflen;
+    u.uio_offset = pos;
+    u.uio_segflg = UIO_USERSPACE;
+    u.uio_rw = rw;
+    u.uio_space = curproc->p_addrspace;
+
+    mmap_prefault(&u);
+    if (rw == UIO_READ) {
+        err = VOP_READ(fde->vnode, &u);
+    } else {
+        err = VOP_WRITE(fde->vnode, &u);
+    }
+    fd_entry_decref(fde);
+
+    if (err) {
+        *retval = -1;
+        return err;
+    }
+
+    *retval = buflen - u.uio_resid;
+    return 0;
+}
+
+int sys_pread(int fd, void *buf, size_t buflen, off_t pos, int *retval) {
+    return sys_prw(fd, buf, buflen, pos, UIO_READ, retval);
+}
+
+int sys_pwrite(int fd, const void *buf, size_t buflen, off_t pos, int *retval) {
+    return sys_prw(fd, (void *)buf, buflen, pos, UIO_WRITE, retval);
+}
+
+/* Size of the kernel buffer sendfile moves data through */
+#define SENDFILE_BUFSIZE (4 * PAGE_SIZE)
+
+/*
+ * sendfile copies up to count bytes from infd to outfd inside the
+ * kernel, through a kernel buffer, so the data never crosses into
+ * user space and back. It reads at *offset if offset isn't NULL
+ * (and updates *offset, leaving infd's seek position alone), or
+ * else at infd's seek position. It writes at outfd's seek position.
+ * Returns the number of bytes copied; 0 means infd was at EOF.
+ *
+ * Both fd locks are held for the whole copy, as read and write each
+ * hold theirs, taken in address order so two sendfiles going in
+ * opposite directions can't deadlock. If something fails after some
+ * data was copied, the count so far is returned instead. A write
+ * that accepts nothing fails with EIO, so 0 only ever means EOF.
+ */
+int sys_sendfile(int outfd, int infd, userptr_t offset, size_t count,
+                 int *retval) {
+    struct fd_entry *in, *out;
+    struct lock *first, *second;
+    struct iovec iov;
+    struct uio ku;
+    off_t inpos;
+    size_t done, len, got, wrote;
+    char *kbuf;
+    int err;
+
+    if (offset != NULL) {
+        err = copyin(offset, &inpos, sizeof(inpos));
+        if (err) {
+            *retval = -1;
+            return err;
+        }
+        if (inpos < 0) {
+            *retval = -1;
+            return EINVAL;
+        }
+    }
+
+    /* The count copied has to fit in the return value */
+    if (count > 0x7fffffff) {
+        count = 0x7fffffff;
+    }
+
+    kbuf = kmalloc(SENDFILE_BUFSIZE);
+    if (kbuf == NULL) {
+        *retval = -1;
+        return ENOMEM;
+    }
+
+    err = fd_lookup(infd, UIO_READ, &in);
+    if (err) {
+        kfree(kbuf);
+        *retval = -1;
+        return err;
+    }
+    err = fd_lookup(outfd, UIO_WRITE, &out);
+    if (err) {
+        fd_entry_decref(in);
+        kfree(kbuf);
+        *retval = -1;
+        return err;
+    }
+
+    /* The input's fd lock is only needed if its seek position is used */
+    first = offset == NULL ? in->lock : NULL;
+    second = out->lock;
+    if (first == second) {
+        first = NULL;
+    } else if (first != NULL && first > second) {
+        second = first;
+        first = out->lock;
+    }
+    if (first != NULL) {
+        lock_acquire(first);
+    }
+    lock_acquire(second);
+
+    if (offset == NULL) {
+        inpos = in->pos;
+    }
+
+    done = 0;
+    while (done < count) {
+        len = count - done < SENDFILE_BUFSIZE ? count - done : SENDFILE_BUFSIZE;
+
+        uio_kinit(&iov, &ku, kbuf, len, inpos, UIO_READ);
+        err = VOP_READ(in->vnode, &ku);
+        if (err) {
+            break;
+        }
+        got = len - ku.uio_resid;
+        if (got == 0) {
+            break;
+        }
+
+        uio_kinit(&iov, &ku, kbuf, got, out->pos, UIO_WRITE);
+        err = VOP_WRITE(out->vnode, &ku);
+        wrote = got - ku.uio_resid;
+        out->pos += wrote;
+        inpos += wrote;
+        done += wrote;
+        if (!err && wrote == 0) {
+            /* Returning 0 would look like EOF on infd */
+            err = EIO;
+        }
+        if (err || wrote < got) {
+            break;
+        }
+    }
+
+    if (offset == NULL) {
+        in->pos = inpos;
+    }
+    lock_release(second);
+    if (first != NULL) {
+        lock_release(first);
+    }
+    fd_entry_decref(out);
+    fd_entry_decref(in);
+    kfree(kbuf);
+
+    if (err && done == 0) {
+        *retval = -1;
+        return err;
+    }
+    if (offset != NULL) {
+        /* Any error here is too late to matter; the data was copied */
+        (void)copyout(&inpos, offset, sizeof(inpos));
+    }
+    *retval = done;
     return 0;
 }
 
@@ -329,28 +610,14 @@ int sys_lseek(int fd, off_t pos, int whence, int *retval1, int *retval) {
     struct stat stat;
     off_t new_pos;
     
-    if (fd < 0 || fd >= MAX_FD) {
-        *retval = -1;
-        return EBADF;
-    }
-    
-    lock_acquire(curproc->fd_table->lock);
-    
-    if (!bitmap_isset(curproc->fd_table->bitmap, fd)) {
-        lock_release(curproc->fd_table->lock);
-        *retval = -1;
-        return EBADF;
-    }
-    
-    struct fd_entry *fde = array_get(curproc->fd_table->entries, fd);
-    if (fde == NULL) {
-        lock_release(curproc->fd_table->lock);
+    struct fd_entry *fde;
+    int err = fd_get(fd, &fde);
+    if (err) {
         *retval = -1;
-        return EBADF;
+        return err;
     }
     
     lock_acquire(fde->lock);
-    lock_release(curproc->fd_table->lock);
     
     /* Get file stats */
     VOP_STAT(fde->vnode, &stat);
@@ -359,6 +626,7 @@ int sys_lseek(int fd, off_t pos, int whence, int *retval1, int *retval) {
     /* Check if seekable */
     if (file_type != 1 && file_type != 7) {
         lock_release(fde->lock);
+        fd_entry_decref(fde);
         *retval = -1;
         return ESPIPE;
     }
@@ -375,12 +643,14 @@ int sys_lseek(int fd, off_t pos, int whence, int *retval1, int *retval) {
             break;
         default:
             lock_release(fde->lock);
+            fd_entry_decref(fde);
             *retval = -1;
             return EINVAL;
     }
     
     if (new_pos < 0) {
         lock_release(fde->lock);
+        fd_entry_decref(fde);
         *retval = -1;
         return EINVAL;
     }
@@ -391,6 +661,7 @@ int sys_lseek(int fd, off_t pos, int whence, int *retval1, int *retval) {
     *retval1 = (int)(new_pos >> 32);
     
     lock_release(fde->lock);
+    fd_entry_decref(fde);
     return 0;
 }
 
@@ -425,67 +696,39 @@ int sys_dup2(int oldfd, int newfd, int *retval) {
         return EBADF;
     }
     
-    if (oldfd == newfd) {
-        *retval = newfd;
-        return 0;
-    }
-    
     lock_acquire(curproc->fd_table->lock);
     
-    if (!bitmap_isset(curproc->fd_table->bitmap, oldfd)) {
+    struct fd_entry *old_fde = curproc->fd_table->entries[oldfd];
+    if (old_fde == NULL) {
         lock_release(curproc->fd_table->lock);
         *retval = -1;
         return EBADF;
     }
     
-    struct fd_entry *old_fde = array_get(curproc->fd_table->entries, oldfd);
-    if (old_fde == NULL) {
+    if (oldfd == newfd) {
         lock_release(curproc->fd_table->lock);
-        *retval = -1;
-        return EBADF;
+        *retval = newfd;
+        return 0;
     }
     
-    /* Close newfd if it's open */
-    if (bitmap_isset(curproc->fd_table->bitmap, newfd)) {
-        struct fd_entry *new_fde = array_get(curproc->fd_table->entries, newfd);
-        if (new_fde != NULL) {
-            /* Mark as closed but don't clean up yet */
-            bitmap_unmark(curproc->fd_table->bitmap, newfd);
-            array_set(curproc->fd_table->entries, newfd, NULL);
-            
-            /* Clean up after releasing table lock */
-            lock_release(curproc->fd_table->lock);
-            
-            new_fde->count--;
-            if (new_fde->count == 0) {
-                if (new_fde->vnode != NULL) vfs_close(new_fde->vnode);
-                if (new_fde->path != NULL) kfree(new_fde->path);
-                if (new_fde->lock != NULL && new_fde->lock != console_lock) {
-                    lock_destroy(new_fde->lock);
-                }
-                kfree(new_fde);
-            }
-            
-            lock_acquire(curproc->fd_table->lock);
-        }
+    /*
+     * The new slot gets a reference of its own to the same entry.
+     * Whatever was open on newfd before loses its slot reference,
+     * dropped after releasing the table lock.
+     */
+    fd_entry_incref(old_fde);
+    struct fd_entry *new_fde = curproc->fd_table->entries[newfd];
+    curproc->fd_table->entries[newfd] = old_fde;
+    if (new_fde == NULL) {
+        bitmap_mark(curproc->fd_table->bitmap, newfd);
     }
     
-    /* Ensure array is large enough */
-    while (array_num(curproc->fd_table->entries) <= (unsigned)newfd) {
-        array_add(curproc->fd_table->entries, NULL, NULL);
-    }
+    lock_release(curproc->fd_table->lock);
     
-    /* Increment reference count and copy */
-    old_fde->count++;
-    if (old_fde->vnode != NULL) {
-        VOP_INCREF(old_fde->vnode);
+    if (new_fde != NULL) {
+        fd_entry_decref(new_fde);
     }
     
-    array_set(curproc->fd_table->entries, newfd, old_fde);
-    bitmap_mark(curproc->fd_table->bitmap, newfd);
-    
-    lock_release(curproc->fd_table->lock);
-    
     *retval = newfd;
     return 0;
 }
@@ -500,35 +743,23 @@ int sys_dup2(int oldfd, int newfd, int *retval) {
  * TODO: Not sure about stability tests
  */
 int sys_fstat(int fd, struct stat *statbuf, int *retval) {
-    int err = 0;
     struct stat stat;
     
-    if (fd < 0 || fd >= MAX_FD) {
-        *retval = -1;
-        return EBADF;
-    }
-    
-    lock_acquire(curproc->fd_table->lock);
-    
-    if (!bitmap_isset(curproc->fd_table->bitmap, fd)) {
-        lock_release(curproc->fd_table->lock);
-        *retval = -1;
-        return EBADF;
-    }
+    struct fd_entry *fde;
+    int err;
     
-    struct fd_entry *fde = array_get(curproc->fd_table->entries, fd);
-    if (fde == NULL) {
-        lock_release(curproc->fd_table->lock);
+    err = fd_get(fd, &fde);
+    if (err) {
         *retval = -1;
-        return EBADF;
+        return err;
     }
     
     lock_acquire(fde->lock);
-    lock_release(curproc->fd_table->lock);
     
     VOP_STAT(fde->vnode, &stat);
     
     lock_release(fde->lock);
+    fd_entry_decref(fde);
     
     err = copyout((void *)&stat, (userptr_t)statbuf, sizeof(struct stat));
     if (err) {
@@ -538,4 +769,319 @@ int sys_fstat(int fd, struct stat *statbuf, int *retval) {
     
     *retval = 0;
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * getdirentries reads as many names from the directory open on fd as
+ * fit in buf, as struct dirent records (see kern/dirent.h), and
+ * returns the number of bytes filled, or 0 at the end of the
+ * directory. With DIRENT_STAT each record also carries what fstat
+ * would say, so ls needs one call per buffer rather than an open,
+ * fstat, and close per name. Like getdirentry, the seek position is
+ * the filesystem's directory position, not a byte count.
+ */
+int sys_getdirentries(int fd, userptr_t buf, size_t buflen, int flags,
+                      int *retval) {
+    struct fd_entry *fde;
+    struct iovec iov;
+    struct uio u;
+    int err;
+
+    if ((flags & ~DIRENT_STAT) != 0 || buflen > 0x7fffffff) {
+        *retval = -1;
+        return EINVAL;
+    }
+
+    err = fd_lookup(fd, UIO_READ, &fde);
+    if (err) {
+        *retval = -1;
+        return err;
+    }
+
+    lock_acquire(fde->lock);
+
+    iov.iov_ubase = buf;
+    iov.iov_len = buflen;
+    u.uio_iov = &iov;
+    u.uio_iovcnt = 1;
+    u.uio_resid = buflen;
+    u.uio_offset = fde->pos;
+    u.uio_segflg = UIO_USERSPACE;
+    u.uio_rw = UIO_READ;
+    u.uio_space = curproc->p_addrspace;
+
+    mmap_prefault(&u);
+    err = VOP_GETDIRENTRIES(fde->vnode, &u, flags);
+    if (err == 0) {
+        fde->pos = u.uio_offset;
+    }
+
+    lock_release(fde->lock);
+    fd_entry_decref(fde);
+
+    if (err) {
+        *retval = -1;
+        return err;
+    }
+
+    *retval = buflen - u.uio_resid;
+    return 0;
+}
+
+int sys_fsync(int fd, int *retval) {
+    struct fd_entry *fde;
+    int err = fd_get(fd, &fde);
+    if (err) {
+        *retval = -1;
+        return err;
+    }
+
+    lock_acquire(fde->lock);
+
+    err = VOP_FSYNC(fde->vnode);
+
+    lock_release(fde->lock);
+    fd_entry_decref(fde);
+
+    if (err) {
+        *retval = -1;
+        return err;
+    }
+
+    *retval = 0;
+    return 0;
+}
+
+/*
+ * pipe creates a pipe and stores the descriptors for its read and
+ * write ends in fds[0] and fds[1]. The only flag accepted is
+ * O_NONBLOCK, which makes both ends nonblocking.
+ */
+int sys_pipe(userptr_t fds, int flags, int *retval) {
+    struct vnode *rv, *wv;
+    struct fd_entry *rfde, *wfde;
+    unsigned int rfd, wfd;
+    int kfds[2];
+    int err;
+
+    *retval = -1;
+
+    if (flags & ~O_NONBLOCK) {
+        return EINVAL;
+    }
+
+    err = pipe_create((flags & O_NONBLOCK) != 0, &rv, &wv);
+    if (err) {
+        return err;
+    }
+
+    /* From here on the fd entries own the vnodes */
+    rfde = fd_entry_create();
+    if (rfde == NULL) {
+        vfs_close(rv);
+        vfs_close(wv);
+        return ENOMEM;
+    }
+    rfde->vnode = rv;
+    wfde = fd_entry_create();
+    if (wfde == NULL) {
+        fd_entry_decref(rfde);
+        vfs_close(wv);
+        return ENOMEM;
+    }
+    wfde->vnode = wv;
+
+    rfde->lock = lock_create("fd_lock");
+    wfde->lock = lock_create("fd_lock");
+    if (rfde->lock == NULL || wfde->lock == NULL) {
+        err = ENOMEM;
+        goto fail;
+    }
+    rfde->flags = O_RDONLY | flags;
+    wfde->flags = O_WRONLY | flags;
+
+    lock_acquire(curproc->fd_table->lock);
+    err = bitmap_alloc(curproc->fd_table->bitmap, &rfd);
+    if (err) {
+        lock_release(curproc->fd_table->lock);
+        err = EMFILE;
+        goto fail;
+    }
+    err = bitmap_alloc(curproc->fd_table->bitmap, &wfd);
+    if (err) {
+        bitmap_unmark(curproc->fd_table->bitmap, rfd);
+        lock_release(curproc->fd_table->lock);
+        err = EMFILE;
+        goto fail;
+    }
+    curproc->fd_table->entries[rfd] = rfde;
+    curproc->fd_table->entries[wfd] = wfde;
+    lock_release(curproc->fd_table->lock);
+
+    kfds[0] = rfd;
+    kfds[1] = wfd;
+    err = copyout(kfds, fds, sizeof(kfds));
+    if (err) {
+        /*
+         * Take them back out again, as close would. Another thread
+         * may already have closed or replaced them; then the slot's
+         * reference is already gone.
+         */
+        lock_acquire(curproc->fd_table->lock);
+        if (curproc->fd_table->entries[rfd] == rfde) {
+            curproc->fd_table->entries[rfd] = NULL;
+            bitmap_unmark(curproc->fd_table->bitmap, rfd);
+        }
+        else {
+            rfde = NULL;
+        }
+        if (curproc->fd_table->entries[wfd] == wfde) {
+            curproc->fd_table->entries[wfd] = NULL;
+            bitmap_unmark(curproc->fd_table->bitmap, wfd);
+        }
+        else {
+            wfde = NULL;
+        }
+        lock_release(curproc->fd_table->lock);
+        if (rfde != NULL) {
+            fd_entry_decref(rfde);
+        }
+        if (wfde != NULL) {
+            fd_entry_decref(wfde);
+        }
+        return err;
+    }
+
+    *retval = 0;
+    return 0;
+
+fail:
+    fd_entry_decref(rfde);
+    fd_entry_decref(wfde);
+    return err;
+}
+
+/*
+ * poll waits until at least one of the nfds files in fds is ready for
+ * one of the events asked for, or until timeout milliseconds have
+ * passed (forever if timeout is negative, not at all if it's 0), and
+ * fills in each revents. Returns the number of entries with revents
+ * set. Negative fds are skipped; closed ones get POLLNVAL.
+ *
+ * Each file's VOP_POLL registers us on its wait queue the first time
+ * round, so after that we sleep until one of them is woken instead of
+ * checking again and again.
+ */
+int sys_poll(userptr_t ufds, unsigned nfds, int timeout, int *retval) {
+    struct pollfd *fds;
+    struct fd_entry **fdes;
+    struct pollwait pw;
+    struct callout timer;
+    uint64_t ticks;
+    unsigned i, nready;
+    bool registered;
+    int err;
+
+    *retval = -1;
+
+    if (nfds > MAX_FD) {
+        return EINVAL;
+    }
+
+    /* Allocate at least one of each so kmalloc(0) isn't an issue */
+    fds = kmalloc((nfds > 0 ? nfds : 1) * sizeof(struct pollfd));
+    if (fds == NULL) {
+        return ENOMEM;
+    }
+    fdes = kmalloc((nfds > 0 ? nfds : 1) * sizeof(struct fd_entry *));
+    if (fdes == NULL) {
+        kfree(fds);
+        return ENOMEM;
+    }
+    err = copyin(ufds, fds, nfds * sizeof(struct pollfd));
+    if (err) {
+        kfree(fdes);
+        kfree(fds);
+        return err;
+    }
+
+    for (i = 0; i < nfds; i++) {
+        fdes[i] = NULL;
+        fds[i].revents = 0;
+        if (fds[i].fd >= 0 && fd_get(fds[i].fd, &fdes[i])) {
+            fdes[i] = NULL;
+            fds[i].revents = POLLNVAL;
+        }
+    }
+
+    err = pollwait_init(&pw, nfds);
+    if (err) {
+        goto out;
+    }
+    if (timeout > 0) {
+        ticks = ((uint64_t)timeout * HZ + 999) / 1000;
+        callout_init(&timer, pollwait_timeout, &pw);
+        callout_arm(&timer, ticks > 0x7fffffff ? 0x7fffffff : ticks);
+    }
+
+    registered = false;
+    for (;;) {
+        pollwait_reset(&pw);
+        nready = 0;
+        for (i = 0; i < nfds; i++) {
+            if (fdes[i] != NULL) {
+                fds[i].revents = VOP_POLL(fdes[i]->vnode, fds[i].events,
+                                          registered ? NULL : &pw);
+            }
+            if (fds[i].revents != 0) {
+                nready++;
+            }
+        }
+        registered = true;
+
+        if (nready > 0 || timeout == 0 || pw.pw_timedout) {
+            break;
+        }
+        pollwait_sleep(&pw);
+    }
+
+    if (timeout > 0) {
+        callout_cancel(&timer);
+    }
+    pollwait_cleanup(&pw);
+
+    err = copyout(fds, ufds, nfds * sizeof(struct pollfd));
+    if (!err) {
+        *retval = nready;
+    }
+
+out:
+    for (i = 0; i < nfds; i++) {
+        if (fdes[i] != NULL) {
+            fd_entry_decref(fdes[i]);
+        }
+    }
+    kfree(fdes);
+    kfree(fds);
+    return err;
+}
+
+/*
+ * Look up an open file for mmap: hand back its vnode, with a reference
+ * of its own, and the flags it was opened with.
+ */
+int file_getvnode(int fd, struct vnode **ret, int *flags) {
+    struct fd_entry *fde;
+    int err;
+
+    err = fd_get(fd, &fde);
+    if (err) {
+        return err;
+    }
+
+    VOP_INCREF(fde->vnode);
+    *ret = fde->vnode;
+    *flags = fde->flags;
+    fd_entry_decref(fde);
+    return 0;
+}
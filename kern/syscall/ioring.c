@@ -0,0 +1,815 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Asynchronous I/O rings.
+ *
+ * A ring is an anonymous vnode whose "contents" are the shared ring
+ * memory (see <kern/ioring.h> for the layout). Its pages are pinned
+ * in the mmap page cache at setup (mmap_pinpage), so when the process
+ * maps the descriptor it gets the very pages the kernel reads
+ * submissions from and posts completions to, through their kernel
+ * addresses.
+ *
+ * ioring_enter copies submissions out of the ring into requests on a
+ * queue and wakes a worker. The workers are kernel threads forked
+ * into the owning process, so they can use the ordinary pread, pwrite
+ * and fsync code on its descriptors and buffers. The number of
+ * requests in flight is limited to the size of the completion queue,
+ * so it only overflows if the process doesn't take its completions.
+ *
+ * The kernel keeps its own copies of the positions it advances
+ * (sq_head, cq_tail) and only ever writes them to the shared page, so
+ * the process can't confuse it by scribbling there.
+ *
+ * Reads and writes on descriptors that aren't seekable (pipes, the
+ * console) ignore the offset and behave like read and write. Those
+ * can block indefinitely, so before starting one a worker polls the
+ * descriptor until it is ready, along with ir_stopq, which
+ * ioring_stop wakes; a request still waiting when the ring stops
+ * completes with EINTR.
+ *
+ * The owning process holds a reference to the ring until it exits or
+ * execs; ioring_procexit then stops the workers, waiting for requests
+ * already running, and drops the ones still queued. Only one ring per
+ * process. Other processes that inherit the descriptor can map and
+ * poll it, but not submit.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/ioring.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <membar.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <poll.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <ioring.h>
+
+/* Worker threads per ring */
+#define IORING_NWORKERS	4
+
+struct ioreq {
+	struct ioreq *iq_next;		/* queue or free list */
+	struct io_sqe iq_sqe;		/* private copy of the submission */
+};
+
+struct ioring {
+	struct vnode ir_vnode;
+
+	/* ring memory */
+	vaddr_t *ir_pages;		/* kernel address of each page */
+	unsigned ir_npages;
+	unsigned ir_sqentries;
+	unsigned ir_cqentries;
+	unsigned ir_sqoff;
+	unsigned ir_cqoff;
+
+	struct lock *ir_lock;		/* protects everything below */
+	struct cv *ir_workcv;		/* workers wait for requests */
+	struct cv *ir_donecv;		/* completions, and workers exiting */
+	struct pollqueue ir_pollq;	/* poll() waiting for completions */
+	struct pollqueue ir_stopq;	/* workers waiting for readiness */
+	struct proc *ir_owner;		/* NULL once stopped */
+	unsigned ir_sqhead;		/* kernel's copy of sq_head */
+	unsigned ir_cqtail;		/* kernel's copy of cq_tail */
+	struct ioreq *ir_reqs;		/* ir_cqentries of them */
+	struct ioreq *ir_free;		/* requests not in flight */
+	struct ioreq *ir_queue;		/* submitted, not yet taken */
+	struct ioreq **ir_queuetail;	/* end of ir_queue */
+	unsigned ir_inflight;		/* queued or running */
+	unsigned ir_nworkers;		/* worker threads running */
+	bool ir_stopping;		/* workers should exit */
+};
+
+static const struct vnode_ops ioring_vnode_ops;
+
+/*
+ * Kernel address of byte OFF of the ring memory. The arrays start on
+ * page boundaries and their entries divide the page size, so nothing
+ * straddles two pages.
+ */
+static
+void *
+ioring_addr(struct ioring *ir, unsigned off)
+{
+	KASSERT(off / PAGE_SIZE < ir->ir_npages);
+	return (void *)(ir->ir_pages[off / PAGE_SIZE] + off % PAGE_SIZE);
+}
+
+static
+struct ioring_ctl *
+ioring_ctl(struct ioring *ir)
+{
+	return ioring_addr(ir, 0);
+}
+
+/*
+ * Post a completion. Called with the ring locked.
+ */
+static
+void
+ioring_post(struct ioring *ir, unsigned userdata, int res)
+{
+	struct ioring_ctl *ctl = ioring_ctl(ir);
+	struct io_cqe *cqe;
+
+	KASSERT(lock_do_i_hold(ir->ir_lock));
+
+	if (ir->ir_cqtail - ctl->cq_head >= ir->ir_cqentries) {
+		ctl->cq_overflow++;
+		return;
+	}
+	cqe = ioring_addr(ir, ir->ir_cqoff + (ir->ir_cqtail &
+		(ir->ir_cqentries - 1)) * sizeof(struct io_cqe));
+	cqe->cqe_userdata = userdata;
+	cqe->cqe_res = res;
+	/* The entry must be visible before the new tail is */
+	membar_store_store();
+	ctl->cq_tail = ++ir->ir_cqtail;
+
+	cv_broadcast(ir->ir_donecv, ir->ir_lock);
+	pollqueue_wakeup(&ir->ir_pollq);
+}
+
+/*
+ * Wait until a read or write on a descriptor that isn't seekable
+ * could go ahead without blocking, or until the ring is stopped, in
+ * which case fail with EINTR. Seekable files never block, and a bad
+ * descriptor is left for the I/O call to report.
+ */
+static
+int
+ioring_waitready(struct ioring *ir, const struct io_sqe *sqe)
+{
+	struct fd_entry *fde;
+	struct pollwait pw;
+	bool registered;
+	int events, result;
+
+	switch (sqe->sqe_op) {
+	    case IORING_OP_READ:
+		events = POLLIN;
+		break;
+	    case IORING_OP_WRITE:
+		events = POLLOUT;
+		break;
+	    default:
+		return 0;
+	}
+
+	if (fd_get(sqe->sqe_fd, &fde)) {
+		return 0;
+	}
+	if (VOP_ISSEEKABLE(fde->vnode)) {
+		fd_entry_decref(fde);
+		return 0;
+	}
+	result = pollwait_init(&pw, 2);
+	if (result) {
+		fd_entry_decref(fde);
+		return result;
+	}
+
+	/* ir_stopping is set before ir_stopq is woken, so check after reset */
+	pollqueue_register(&ir->ir_stopq, &pw);
+	registered = false;
+	for (;;) {
+		pollwait_reset(&pw);
+		if (ir->ir_stopping) {
+			result = EINTR;
+			break;
+		}
+		if (VOP_POLL(fde->vnode, events, registered ? NULL : &pw)) {
+			result = 0;
+			break;
+		}
+		registered = true;
+		pollwait_sleep(&pw);
+	}
+	pollwait_cleanup(&pw);
+	fd_entry_decref(fde);
+	return result;
+}
+
+/*
+ * Carry out one request, in the owner's context. Returns what goes in
+ * cqe_res.
+ */
+static
+int
+ioring_execute(struct ioring *ir, const struct io_sqe *sqe)
+{
+	int result, ret;
+
+	result = ioring_waitready(ir, sqe);
+	if (result) {
+		return -result;
+	}
+
+	switch (sqe->sqe_op) {
+	    case IORING_OP_NOP:
+		result = 0;
+		ret = 0;
+		break;
+	    case IORING_OP_READ:
+		result = sys_pread(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len,
+				   sqe->sqe_offset, &ret);
+		if (result == ESPIPE) {
+			result = sys_read(sqe->sqe_fd, sqe->sqe_buf,
+					  sqe->sqe_len, &ret);
+		}
+		break;
+	    case IORING_OP_WRITE:
+		result = sys_pwrite(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len,
+				    sqe->sqe_offset, &ret);
+		if (result == ESPIPE) {
+			result = sys_write(sqe->sqe_fd, sqe->sqe_buf,
+					   sqe->sqe_len, &ret);
+		}
+		break;
+	    case IORING_OP_FSYNC:
+		result = sys_fsync(sqe->sqe_fd, &ret);
+		break;
+	    default:
+		result = EINVAL;
+		break;
+	}
+	return result ? -result : ret;
+}
+
+/*
+ * Worker thread.
+ */
+static
+void
+ioring_worker(void *data, unsigned long unused)
+{
+	struct ioring *ir = data;
+	struct ioreq *req;
+	int res;
+
+	(void)unused;
+
+	lock_acquire(ir->ir_lock);
+	while (1) {
+		while (ir->ir_queue == NULL && !ir->ir_stopping) {
+			cv_wait(ir->ir_workcv, ir->ir_lock);
+		}
+		if (ir->ir_stopping) {
+			break;
+		}
+		req = ir->ir_queue;
+		ir->ir_queue = req->iq_next;
+		if (ir->ir_queue == NULL) {
+			ir->ir_queuetail = &ir->ir_queue;
+		}
+		lock_release(ir->ir_lock);
+
+		res = ioring_execute(ir, &req->iq_sqe);
+
+		lock_acquire(ir->ir_lock);
+		ioring_post(ir, req->iq_sqe.sqe_userdata, res);
+		req->iq_next = ir->ir_free;
+		ir->ir_free = req;
+		ir->ir_inflight--;
+	}
+
+	/*
+	 * Leave the process before saying we're gone, so once
+	 * ioring_procexit sees no workers the process has no threads
+	 * but its own.
+	 */
+	proc_remthread(curthread);
+	ir->ir_nworkers--;
+	cv_broadcast(ir->ir_donecv, ir->ir_lock);
+	lock_release(ir->ir_lock);
+	thread_exit();
+}
+
+/*
+ * Stop the workers, waiting for running requests to finish (or, if
+ * they're waiting for a pipe or the console, give up) and dropping
+ * the queued ones.
+ */
+static
+void
+ioring_stop(struct ioring *ir)
+{
+	struct ioreq *req;
+
+	lock_acquire(ir->ir_lock);
+	ir->ir_stopping = true;
+	cv_broadcast(ir->ir_workcv, ir->ir_lock);
+	pollqueue_wakeup(&ir->ir_stopq);
+	while (ir->ir_nworkers > 0) {
+		cv_wait(ir->ir_donecv, ir->ir_lock);
+	}
+	while (ir->ir_queue != NULL) {
+		req = ir->ir_queue;
+		ir->ir_queue = req->iq_next;
+		req->iq_next = ir->ir_free;
+		ir->ir_free = req;
+		ir->ir_inflight--;
+	}
+	ir->ir_queuetail = &ir->ir_queue;
+	KASSERT(ir->ir_inflight == 0);
+	ir->ir_owner = NULL;
+	pollqueue_wakeup(&ir->ir_pollq);
+	lock_release(ir->ir_lock);
+}
+
+void
+ioring_procexit(void)
+{
+	struct ioring *ir = curproc->p_ioring;
+
+	if (ir == NULL) {
+		return;
+	}
+	curproc->p_ioring = NULL;
+	ioring_stop(ir);
+	VOP_DECREF(&ir->ir_vnode);
+}
+
+////////////////////////////////////////////////////////////
+// vnode ops
+
+/*
+ * Nothing is left by the time the last reference goes: the owner's
+ * was dropped after stopping the workers, and mappings hold one each.
+ */
+static
+int
+ioring_reclaim(struct vnode *v)
+{
+	struct ioring *ir = v->vn_data;
+	unsigned i;
+
+	KASSERT(ir->ir_owner == NULL);
+	KASSERT(ir->ir_nworkers == 0);
+
+	for (i=0; i<ir->ir_npages; i++) {
+		mmap_unpinpage(v, i);
+	}
+	vnode_cleanup(v);
+	pollqueue_cleanup(&ir->ir_stopq);
+	pollqueue_cleanup(&ir->ir_pollq);
+	cv_destroy(ir->ir_donecv);
+	cv_destroy(ir->ir_workcv);
+	lock_destroy(ir->ir_lock);
+	kfree(ir->ir_reqs);
+	kfree(ir->ir_pages);
+	kfree(ir);
+	return 0;
+}
+
+/*
+ * The page cache fills pages with VOP_READ; ring pages start out
+ * zeroed, so there's nothing to supply. It's also all read() sees.
+ */
+static
+int
+ioring_read(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return 0;
+}
+
+static
+int
+ioring_write(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static
+int
+ioring_eachopen(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return 0;
+}
+
+static
+int
+ioring_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+/*
+ * The size is 0 so msync and munmap never try to write the ring
+ * "back"; the memory is all there is.
+ */
+static
+int
+ioring_stat(struct vnode *v, struct stat *statbuf)
+{
+	(void)v;
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFCHR | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PAGE_SIZE;
+	return 0;
+}
+
+static
+int
+ioring_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFCHR;
+	return 0;
+}
+
+static
+bool
+ioring_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+static
+int
+ioring_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+ioring_mmap(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+/*
+ * Readable when completions are waiting; hung up once stopped.
+ */
+static
+int
+ioring_poll(struct vnode *v, int events, struct pollwait *pw)
+{
+	struct ioring *ir = v->vn_data;
+	int revents = 0;
+
+	lock_acquire(ir->ir_lock);
+	pollqueue_register(&ir->ir_pollq, pw);
+	if (ir->ir_cqtail != ioring_ctl(ir)->cq_head) {
+		revents |= events & POLLIN;
+	}
+	if (ir->ir_owner == NULL) {
+		revents |= POLLHUP;
+	}
+	lock_release(ir->ir_lock);
+	return revents;
+}
+
+static
+int
+ioring_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+ioring_lookup(struct vnode *dir, char *pathname, struct vnode **result)
+{
+	(void)dir;
+	(void)pathname;
+	(void)result;
+	return ENOTDIR;
+}
+
+static const struct vnode_ops ioring_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = ioring_eachopen,
+	.vop_reclaim = ioring_reclaim,
+	.vop_read = ioring_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_dirents_notdir,
+	.vop_write = ioring_write,
+	.vop_ioctl = ioring_ioctl,
+	.vop_stat = ioring_stat,
+	.vop_gettype = ioring_gettype,
+	.vop_isseekable = ioring_isseekable,
+	.vop_fsync = ioring_fsync,
+	.vop_mmap = ioring_mmap,
+	.vop_poll = ioring_poll,
+	.vop_truncate = ioring_truncate,
+	.vop_namefile = vopfail_uio_nosys,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = ioring_lookup,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+////////////////////////////////////////////////////////////
+// setup
+
+/*
+ * Create a ring with SQENTRIES submission slots (a power of two) and
+ * twice as many completion slots. No workers yet.
+ */
+static
+int
+ioring_create(unsigned sqentries, struct ioring **ret)
+{
+	struct ioring *ir;
+	unsigned i;
+	int result;
+
+	ir = kmalloc(sizeof(*ir));
+	if (ir == NULL) {
+		return ENOMEM;
+	}
+	ir->ir_sqentries = sqentries;
+	ir->ir_cqentries = 2 * sqentries;
+	ir->ir_sqoff = PAGE_SIZE;
+	ir->ir_cqoff = ir->ir_sqoff +
+		ROUNDUP(sqentries * sizeof(struct io_sqe), PAGE_SIZE);
+	ir->ir_npages = (ir->ir_cqoff + ROUNDUP(ir->ir_cqentries *
+		sizeof(struct io_cqe), PAGE_SIZE)) / PAGE_SIZE;
+
+	ir->ir_pages = kmalloc(ir->ir_npages * sizeof(vaddr_t));
+	ir->ir_reqs = kmalloc(ir->ir_cqentries * sizeof(struct ioreq));
+	ir->ir_lock = lock_create("ioring");
+	ir->ir_workcv = cv_create("ioring work");
+	ir->ir_donecv = cv_create("ioring done");
+	if (ir->ir_pages == NULL || ir->ir_reqs == NULL ||
+	    ir->ir_lock == NULL || ir->ir_workcv == NULL ||
+	    ir->ir_donecv == NULL) {
+		goto fail;
+	}
+	pollqueue_init(&ir->ir_pollq);
+	pollqueue_init(&ir->ir_stopq);
+	ir->ir_owner = curproc;
+	ir->ir_sqhead = 0;
+	ir->ir_cqtail = 0;
+	ir->ir_free = NULL;
+	for (i=0; i<ir->ir_cqentries; i++) {
+		ir->ir_reqs[i].iq_next = ir->ir_free;
+		ir->ir_free = &ir->ir_reqs[i];
+	}
+	ir->ir_queue = NULL;
+	ir->ir_queuetail = &ir->ir_queue;
+	ir->ir_inflight = 0;
+	ir->ir_nworkers = 0;
+	ir->ir_stopping = false;
+
+	result = vnode_init(&ir->ir_vnode, &ioring_vnode_ops, NULL, ir);
+	if (result) {
+		pollqueue_cleanup(&ir->ir_stopq);
+		pollqueue_cleanup(&ir->ir_pollq);
+		goto fail;
+	}
+
+	/* From here on, reclaim cleans up */
+	for (i=0; i<ir->ir_npages; i++) {
+		result = mmap_pinpage(&ir->ir_vnode, i, &ir->ir_pages[i]);
+		if (result) {
+			ir->ir_npages = i;
+			ir->ir_owner = NULL;
+			VOP_DECREF(&ir->ir_vnode);
+			return result;
+		}
+	}
+
+	*ret = ir;
+	return 0;
+
+ fail:
+	if (ir->ir_donecv != NULL) {
+		cv_destroy(ir->ir_donecv);
+	}
+	if (ir->ir_workcv != NULL) {
+		cv_destroy(ir->ir_workcv);
+	}
+	if (ir->ir_lock != NULL) {
+		lock_destroy(ir->ir_lock);
+	}
+	kfree(ir->ir_reqs);
+	kfree(ir->ir_pages);
+	kfree(ir);
+	return ENOMEM;
+}
+
+/*
+ * ioring_setup: make a ring with at least ENTRIES submission slots
+ * for the current process, fill in *params, and return a descriptor
+ * for it.
+ */
+int
+sys_ioring_setup(unsigned entries, userptr_t params, int *retval)
+{
+	struct ioring_params p;
+	struct ioring *ir;
+	struct fd_entry *fde;
+	unsigned sqentries, fd, i;
+	int result;
+
+	if (entries == 0 || entries > IORING_MAX_ENTRIES) {
+		return EINVAL;
+	}
+	if (curproc->p_ioring != NULL) {
+		return EBUSY;
+	}
+	for (sqentries = 1; sqentries < entries; sqentries *= 2) {
+		/* nothing */
+	}
+
+	result = ioring_create(sqentries, &ir);
+	if (result) {
+		return result;
+	}
+
+	for (i=0; i<IORING_NWORKERS; i++) {
+		lock_acquire(ir->ir_lock);
+		ir->ir_nworkers++;
+		lock_release(ir->ir_lock);
+		result = thread_fork("ioring", curproc, ioring_worker, ir, 0);
+		if (result) {
+			lock_acquire(ir->ir_lock);
+			ir->ir_nworkers--;
+			lock_release(ir->ir_lock);
+			goto fail;
+		}
+	}
+
+	fde = fd_entry_create();
+	if (fde == NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+	fde->lock = lock_create("fd_lock");
+	if (fde->lock == NULL) {
+		fd_entry_decref(fde);
+		result = ENOMEM;
+		goto fail;
+	}
+	fde->flags = O_RDWR;
+
+	lock_acquire(curproc->fd_table->lock);
+	result = bitmap_alloc(curproc->fd_table->bitmap, &fd);
+	if (result) {
+		lock_release(curproc->fd_table->lock);
+		fd_entry_decref(fde);
+		result = EMFILE;
+		goto fail;
+	}
+	/* The descriptor gets a reference; ours goes to the process */
+	VOP_INCREF(&ir->ir_vnode);
+	fde->vnode = &ir->ir_vnode;
+	curproc->fd_table->entries[fd] = fde;
+	lock_release(curproc->fd_table->lock);
+	curproc->p_ioring = ir;
+
+	p.sq_entries = ir->ir_sqentries;
+	p.cq_entries = ir->ir_cqentries;
+	p.sq_off = ir->ir_sqoff;
+	p.cq_off = ir->ir_cqoff;
+	p.ring_size = ir->ir_npages * PAGE_SIZE;
+	result = copyout(&p, params, sizeof(p));
+	if (result) {
+		/* The process won't learn the descriptor; take it back */
+		lock_acquire(curproc->fd_table->lock);
+		bitmap_unmark(curproc->fd_table->bitmap, fd);
+		curproc->fd_table->entries[fd] = NULL;
+		lock_release(curproc->fd_table->lock);
+		fd_entry_decref(fde);
+		curproc->p_ioring = NULL;
+		goto fail;
+	}
+
+	*retval = fd;
+	return 0;
+
+ fail:
+	ioring_stop(ir);
+	VOP_DECREF(&ir->ir_vnode);
+	return result;
+}
+
+/*
+ * ioring_enter: submit up to TO_SUBMIT entries from the submission
+ * queue, then wait until at least MIN_COMPLETE completions are waiting
+ * (or nothing is left in flight that could make that true). Returns
+ * the number submitted, which is less than asked for if the queue
+ * had fewer or too many requests are already in flight.
+ */
+int
+sys_ioring_enter(int fd, unsigned to_submit, unsigned min_complete,
+		 int *retval)
+{
+	struct fd_entry *fde;
+	struct ioring *ir;
+	struct ioring_ctl *ctl;
+	struct io_sqe *sqe;
+	struct ioreq *req;
+	unsigned n;
+	int result;
+
+	result = fd_get(fd, &fde);
+	if (result) {
+		return result;
+	}
+	if (fde->vnode->vn_ops != &ioring_vnode_ops) {
+		fd_entry_decref(fde);
+		return EINVAL;
+	}
+	ir = fde->vnode->vn_data;
+	ctl = ioring_ctl(ir);
+
+	lock_acquire(ir->ir_lock);
+	if (ir->ir_owner != curproc) {
+		lock_release(ir->ir_lock);
+		fd_entry_decref(fde);
+		return EPERM;
+	}
+
+	for (n = 0; n < to_submit; n++) {
+		if (ir->ir_sqhead == ctl->sq_tail || ir->ir_free == NULL) {
+			break;
+		}
+		/* Read the tail before the entry it covers */
+		membar_load_load();
+		sqe = ioring_addr(ir, ir->ir_sqoff + (ir->ir_sqhead &
+			(ir->ir_sqentries - 1)) * sizeof(struct io_sqe));
+		req = ir->ir_free;
+		ir->ir_free = req->iq_next;
+		req->iq_sqe = *sqe;
+		req->iq_next = NULL;
+		*ir->ir_queuetail = req;
+		ir->ir_queuetail = &req->iq_next;
+		ir->ir_inflight++;
+		ctl->sq_head = ++ir->ir_sqhead;
+		cv_signal(ir->ir_workcv, ir->ir_lock);
+	}
+
+	while (ir->ir_cqtail - ctl->cq_head < min_complete &&
+	       ir->ir_inflight > 0) {
+		cv_wait(ir->ir_donecv, ir->ir_lock);
+	}
+	lock_release(ir->ir_lock);
+	fd_entry_decref(fde);
+
+	*retval = n;
+	return 0;
+}
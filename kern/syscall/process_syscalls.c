@@ -6,6 +6,11 @@
 #include <mips/trapframe.h>
 #include <kern/wait.h>
 #include <copyinout.h>
+#include <cpu.h>
+#include <clock.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <ioring.h>
 
 
 static int copy_file_descriptors(struct proc *src, struct proc *dst); 
@@ -142,6 +147,9 @@ int sys_execv(const char *program, char *argv[], int *retval){
     
 
 
+    /* Ring workers run in the old image; stop them first */
+    ioring_procexit();
+
     // show_valid_tlb_entries();
     // kprintf("before destroy--------------\n");
     as_destroy(old_as);
@@ -377,6 +385,19 @@ int sys_getpid(){
  */
 int sys_exit(int status) {
     struct proc *parent = curproc->parent;
+
+    /*
+     * Close our files before stopping any ring workers (they're
+     * threads of this process), so a request blocked on a pipe whose
+     * other end we hold sees EOF or EPIPE and finishes.
+     */
+    if (curproc->fd_table != NULL) {
+        file_table_closeall(curproc->fd_table);
+    }
+    ioring_procexit();
+
+    /* Settle our usage before the parent can reap us */
+    proc_collectusage(curthread);
     
     /* If we have a parent, signal it */
     if (parent != NULL) {
@@ -387,12 +408,6 @@ int sys_exit(int status) {
         lock_release(parent->cv_lock);
     }
     
-    /* 
-     * File descriptors will be cleaned up automatically when 
-     * proc_destroy() calls file_table_destroy()
-     * No need to manually close them here
-     */
-    
     DEBUG(DB_PROC, "Proc Exited %p (%d)\n", curproc, curproc->pid);
     
     /* Detach from our process */
@@ -479,6 +494,13 @@ int sys_wait(pid_t pid, int *status, int options, int *retval){
     while (proc->exited != true)
         cv_wait(curproc->cv, curproc->cv_lock);
     DEBUG(DB_GEN, "\nProc %p (%d) done waiting on %p (%d) \n", curproc, curproc->pid, proc, proc->pid);
+
+    /* The child's usage, and its children's, become ours */
+    spinlock_acquire(&curproc->p_lock);
+    threadusage_add(&curproc->p_cusage, &proc->p_usage);
+    threadusage_add(&curproc->p_cusage, &proc->p_cusage);
+    spinlock_release(&curproc->p_lock);
+
     lock_acquire(pid_lock);	
     proc_destroy(proc);
 	lock_release(pid_lock);	
@@ -513,6 +535,50 @@ int sys_wait(pid_t pid, int *status, int options, int *retval){
 }
 
 
+/* Convert a cycle count to a timeval */
+static void cycles_to_timeval(uint64_t cycles, struct timeval *tv) {
+    uint64_t freq = (uint64_t)cpu_cycles_per_tick() * HZ;
+
+    tv->tv_sec = cycles / freq;
+    tv->tv_usec = (cycles % freq) * 1000000 / freq;
+}
+
+/*
+ * getrusage reports the CPU time and context switches of the calling
+ * process (RUSAGE_SELF) or of all its children that have been
+ * reaped with waitpid (RUSAGE_CHILDREN). The other rusage fields
+ * aren't tracked and come back as zero.
+ */
+int sys_getrusage(int who, userptr_t usage) {
+    struct threadusage tu;
+    struct rusage ru;
+
+    switch (who) {
+        case RUSAGE_SELF:
+            thread_usage_charge(false);
+            spinlock_acquire(&curproc->p_lock);
+            tu = curproc->p_usage;
+            threadusage_add(&tu, &curthread->t_usage);
+            spinlock_release(&curproc->p_lock);
+            break;
+        case RUSAGE_CHILDREN:
+            spinlock_acquire(&curproc->p_lock);
+            tu = curproc->p_cusage;
+            spinlock_release(&curproc->p_lock);
+            break;
+        default:
+            return EINVAL;
+    }
+
+    bzero(&ru, sizeof(ru));
+    cycles_to_timeval(tu.tu_utime, &ru.ru_utime);
+    cycles_to_timeval(tu.tu_stime, &ru.ru_stime);
+    ru.ru_nvcsw = tu.tu_nvcsw;
+    ru.ru_nivcsw = tu.tu_nivcsw;
+
+    return copyout(&ru, usage, sizeof(ru));
+}
+
 
 /* Helper function to copy file descriptors during fork */
 static int copy_file_descriptors(struct proc *src, struct proc *dst) {
@@ -520,34 +586,17 @@ static int copy_file_descriptors(struct proc *src, struct proc *dst) {
     KASSERT(dst != NULL);
     KASSERT(src->fd_table != NULL);
     KASSERT(dst->fd_table != NULL);
-    uint32_t ret;
-    ret = 0; 
     lock_acquire(src->fd_table->lock);
     lock_acquire(dst->fd_table->lock);
-    /* Shallow copy all the file table entries 
-     * and increment the reference count
-     * for each file descriptor.
+    /* Shallow copy all the file table entries; each slot in the
+     * child holds a reference of its own to the shared entry.
      */
-    int array_size = array_num(src->fd_table->entries); 
-    for (uint32_t i = 0; i < (uint32_t)array_size; i++) {
-        struct fd_entry *src_fde = array_get(src->fd_table->entries, i);
+    for (int i = 0; i < MAX_FD; i++) {
+        struct fd_entry *src_fde = src->fd_table->entries[i];
         if (src_fde != NULL) {
-            lock_acquire(src_fde->lock);
-            src_fde->count++;
-            array_add(dst->fd_table->entries, src_fde, &ret);
-
-            KASSERT(ret == i);
-            if (!bitmap_isset(dst->fd_table->bitmap, i))
-                /* Mark the bitmap */
-                bitmap_mark(dst->fd_table->bitmap, i);
-            lock_release(src_fde->lock);
-        }
-        else {
-            /* If the source file descriptor is NULL, we can set the destination to NULL */
-            array_add(dst->fd_table->entries, NULL, &ret);
-            if (bitmap_isset(dst->fd_table->bitmap, i))
-                /* Unmark the bitmap */
-                bitmap_unmark(dst->fd_table->bitmap, i);
+            fd_entry_incref(src_fde);
+            dst->fd_table->entries[i] = src_fde;
+            bitmap_mark(dst->fd_table->bitmap, i);
         }
     }
     
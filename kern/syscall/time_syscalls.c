@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +57,49 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the requested time, rounded up to whole hardclock ticks.
+ * Nothing can interrupt the sleep, so the remaining time (if asked
+ * for) is always zero.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec req, rem;
+	uint64_t ticks;
+	int result;
+
+	result = copyin(user_req, &req, sizeof(req));
+	if (result) {
+		return result;
+	}
+	if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	ticks = (uint64_t)req.tv_sec * HZ;
+	ticks += (req.tv_nsec + (1000000000 / HZ) - 1) / (1000000000 / HZ);
+	while (ticks > 0) {
+		/* Sleep in chunks in case someone asks for centuries. */
+		if (ticks > 0x7fffffff) {
+			thread_sleep_ticks(0x7fffffff);
+			ticks -= 0x7fffffff;
+		}
+		else {
+			thread_sleep_ticks(ticks);
+			ticks = 0;
+		}
+	}
+
+	if (user_rem != NULL) {
+		rem.tv_sec = 0;
+		rem.tv_nsec = 0;
+		result = copyout(&rem, user_rem, sizeof(rem));
+		if (result) {
+			return result;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Buffer cache test.
+ *
+ * buf1 runs the buffer cache against a fake filesystem whose "disk"
+ * is generated on the fly: block N at version V is filled with the
+ * word N*BT_VERSIONS+V, and writing a block records its version. It
+ * checks that repeated reads hit, that dirty data isn't written
+ * until sync or eviction, that buffer_get doesn't read, and that
+ * going through more blocks than the cache holds evicts in LRU order
+ * and writes back what was dirty. Finally it reads some blocks ahead
+ * and checks that reading them afterwards hits.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <thread.h>
+#include <fs.h>
+#include <buf.h>
+#include <test.h>
+#include <kern/test161.h>
+
+#define BT_VERSIONS	1000
+#define BT_WORDS	(BUFFER_SIZE / sizeof(uint32_t))
+
+static unsigned *bt_disk;		/* version of each block */
+static unsigned bt_nblocks;
+static unsigned bt_reads, bt_writes;
+
+static
+void
+bt_fill(void *data, daddr_t block, unsigned version)
+{
+	uint32_t *words = data;
+	unsigned i;
+
+	for (i=0; i<BT_WORDS; i++) {
+		words[i] = block * BT_VERSIONS + version;
+	}
+}
+
+static
+bool
+bt_check(void *data, daddr_t block, unsigned version)
+{
+	uint32_t *words = data;
+	unsigned i;
+
+	for (i=0; i<BT_WORDS; i++) {
+		if (words[i] != block * BT_VERSIONS + version) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static
+int
+bt_readblock(struct fs *fs, daddr_t block, void *data, size_t len)
+{
+	(void)fs;
+	KASSERT(len == BUFFER_SIZE);
+	KASSERT(block < bt_nblocks);
+	bt_fill(data, block, bt_disk[block]);
+	bt_reads++;
+	return 0;
+}
+
+static
+int
+bt_writeblock(struct fs *fs, daddr_t block, void *data, size_t len)
+{
+	uint32_t *words = data;
+
+	(void)fs;
+	KASSERT(len == BUFFER_SIZE);
+	KASSERT(block < bt_nblocks);
+	KASSERT(words[0] / BT_VERSIONS == block);
+	bt_disk[block] = words[0] % BT_VERSIONS;
+	KASSERT(bt_check(data, block, bt_disk[block]));
+	bt_writes++;
+	return 0;
+}
+
+static const struct fs_ops bt_fsops = {
+	.fsop_readblock = bt_readblock,
+	.fsop_writeblock = bt_writeblock,
+};
+
+static struct fs bt_fs = {
+	.fs_data = NULL,
+	.fs_ops = &bt_fsops,
+};
+
+/*
+ * Read BLOCK and check it's at VERSION.
+ */
+static
+bool
+bt_expect(daddr_t block, unsigned version)
+{
+	struct buf *b;
+	bool ok;
+	int result;
+
+	result = buffer_read(&bt_fs, block, &b);
+	if (result) {
+		kprintf("block %u: read failed: %s\n", block,
+			strerror(result));
+		return false;
+	}
+	ok = bt_check(buffer_map(b), block, version);
+	if (!ok) {
+		kprintf("block %u: wrong contents (expected version %u)\n",
+			block, version);
+	}
+	buffer_release(b);
+	return ok;
+}
+
+/*
+ * Replace the contents of BLOCK with VERSION, read-modify-write style
+ * if READFIRST, otherwise with buffer_get.
+ */
+static
+void
+bt_update(daddr_t block, unsigned version, bool readfirst)
+{
+	struct buf *b;
+	int result;
+
+	if (readfirst) {
+		result = buffer_read(&bt_fs, block, &b);
+	}
+	else {
+		result = buffer_get(&bt_fs, block, &b);
+	}
+	if (result) {
+		panic("buftest: block %u: %s\n", block, strerror(result));
+	}
+	bt_fill(buffer_map(b), block, version);
+	buffer_mark_valid(b);
+	buffer_mark_dirty(b);
+	buffer_release(b);
+}
+
+static
+bool
+bt_counts(const char *what, unsigned reads, unsigned writes)
+{
+	if (bt_reads != reads || bt_writes != writes) {
+		kprintf("%s: %u reads, %u writes (expected %u and %u)\n",
+			what, bt_reads, bt_writes, reads, writes);
+		return false;
+	}
+	return true;
+}
+
+int
+buftest(int nargs, char **args)
+{
+	struct bufstats bs;
+	struct buf *b;
+	unsigned i, reads, rahits;
+	daddr_t rablocks[4];
+	bool ok = true;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting buffer cache test...\n");
+
+	buffer_getstats(&bs);
+	bt_nblocks = bs.bs_maxbufs + 8;
+	bt_disk = kmalloc(bt_nblocks * sizeof(bt_disk[0]));
+	if (bt_disk == NULL) {
+		panic("buftest: out of memory\n");
+	}
+	for (i=0; i<bt_nblocks; i++) {
+		bt_disk[i] = 0;
+	}
+	bt_reads = bt_writes = 0;
+
+	/* A miss and then a hit. */
+	ok &= bt_expect(0, 0);
+	ok &= bt_expect(0, 0);
+	ok &= bt_counts("reread", 1, 0);
+
+	/* Dirtying doesn't write; sync does. */
+	bt_update(0, 1, true);
+	ok &= bt_counts("dirty", 1, 0);
+	ok &= bt_expect(0, 1);
+	if (buffer_sync_fs(&bt_fs)) {
+		kprintf("sync failed\n");
+		ok = false;
+	}
+	ok &= bt_counts("sync", 1, 1);
+	if (bt_disk[0] != 1) {
+		kprintf("block 0 not written by sync\n");
+		ok = false;
+	}
+
+	/* buffer_get of an uncached block doesn't read it. */
+	bt_update(1, 2, false);
+	ok &= bt_counts("get", 1, 1);
+
+	/*
+	 * Go through more blocks than fit. Block 1 (dirty) gets
+	 * evicted and written back along the way, and block 0 has to
+	 * be read in again afterwards.
+	 */
+	for (i=2; i<bt_nblocks; i++) {
+		ok &= bt_expect(i, 0);
+	}
+	if (bt_disk[1] != 2) {
+		kprintf("block 1 not written back on eviction\n");
+		ok = false;
+	}
+	ok &= bt_counts("sweep", bt_nblocks - 1, 2);
+	ok &= bt_expect(0, 1);
+	ok &= bt_counts("evicted", bt_nblocks, 2);
+
+	/* Invalidated buffers are dropped, not written. */
+	bt_update(0, 3, true);
+	if (buffer_read(&bt_fs, 0, &b) == 0) {
+		buffer_release_and_invalidate(b);
+	}
+	ok &= bt_expect(0, 1);
+
+	/*
+	 * Readahead. Blocks 2-5 were evicted in the sweep; queue
+	 * them, wait for the reader thread to load them, and then
+	 * reading them should hit without going to "disk" again.
+	 */
+	reads = bt_reads;
+	buffer_getstats(&bs);
+	rahits = bs.bs_rahits;
+	for (i=0; i<4; i++) {
+		rablocks[i] = 2 + i;
+	}
+	buffer_readahead(&bt_fs, rablocks, 4);
+	for (i=0; i<1000 && bt_reads < reads + 4; i++) {
+		thread_yield();
+	}
+	ok &= bt_counts("readahead", reads + 4, 2);
+	for (i=0; i<4; i++) {
+		ok &= bt_expect(2 + i, 0);
+	}
+	ok &= bt_counts("read after readahead", reads + 4, 2);
+	buffer_getstats(&bs);
+	if (bs.bs_rahits != rahits + 4) {
+		kprintf("readahead: %u hits (expected %u)\n",
+			bs.bs_rahits - rahits, 4);
+		ok = false;
+	}
+
+	if (buffer_sync_fs(&bt_fs)) {
+		kprintf("sync failed\n");
+		ok = false;
+	}
+	buffer_drop_fs(&bt_fs);
+	kfree(bt_disk);
+	bt_disk = NULL;
+
+	success(ok ? TEST161_SUCCESS : TEST161_FAIL, SECRET, "buf1");
+	return 0;
+}
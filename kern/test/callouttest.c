@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Callout and timed sleep tests.
+ *
+ * clt1 arms a handful of callouts at delays that land on different
+ * levels of the wheel, cancels one, and checks that the rest fire
+ * on the tick they were due. It then checks thread_sleep_ticks and
+ * both outcomes of cv_timedwait.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <callout.h>
+#include <test.h>
+#include <kern/test161.h>
+
+#define CLT_NCALLOUTS	6
+#define CLT_CANCELLED	3
+
+static const unsigned clt_delays[CLT_NCALLOUTS] = { 1, 5, 63, 64, 65, 200 };
+
+static struct callout clt_callouts[CLT_NCALLOUTS];
+static volatile uint64_t clt_firedat[CLT_NCALLOUTS];
+static struct semaphore *clt_sem;
+static struct lock *clt_lock;
+static struct cv *clt_cv;
+
+static
+void
+clt_fire(void *data)
+{
+	unsigned n = (uintptr_t)data;
+
+	clt_firedat[n] = callout_ticks();
+	V(clt_sem);
+}
+
+static
+void
+clt_signaller(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	thread_sleep_ticks(5);
+	lock_acquire(clt_lock);
+	cv_signal(clt_cv, clt_lock);
+	lock_release(clt_lock);
+}
+
+int
+callouttest(int nargs, char **args)
+{
+	uint64_t start;
+	unsigned i;
+	int result;
+	bool ok = true;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting callout test...\n");
+
+	clt_sem = sem_create("clt_sem", 0);
+	clt_lock = lock_create("clt_lock");
+	clt_cv = cv_create("clt_cv");
+	if (clt_sem == NULL || clt_lock == NULL || clt_cv == NULL) {
+		panic("callouttest: out of memory\n");
+	}
+
+	/* Callouts at assorted delays, with one cancelled. */
+	start = callout_ticks();
+	for (i=0; i<CLT_NCALLOUTS; i++) {
+		clt_firedat[i] = 0;
+		callout_init(&clt_callouts[i], clt_fire, (void *)(uintptr_t)i);
+		callout_arm(&clt_callouts[i], clt_delays[i]);
+	}
+	if (!callout_cancel(&clt_callouts[CLT_CANCELLED])) {
+		kprintf("callout %u: cancel failed\n", CLT_CANCELLED);
+		ok = false;
+	}
+	for (i=0; i<CLT_NCALLOUTS - 1; i++) {
+		P(clt_sem);
+	}
+	for (i=0; i<CLT_NCALLOUTS; i++) {
+		if (i == CLT_CANCELLED) {
+			if (clt_firedat[i] != 0) {
+				kprintf("callout %u: fired after cancel\n", i);
+				ok = false;
+			}
+			continue;
+		}
+		/* We may have armed just before a tick went by. */
+		if (clt_firedat[i] < start + clt_delays[i] ||
+		    clt_firedat[i] > start + clt_delays[i] + 1) {
+			kprintf("callout %u: due at %llu, fired at %llu\n",
+				i, start + clt_delays[i], clt_firedat[i]);
+			ok = false;
+		}
+	}
+
+	/* Timed sleep. */
+	start = callout_ticks();
+	thread_sleep_ticks(10);
+	if (callout_ticks() < start + 10) {
+		kprintf("thread_sleep_ticks(10) returned after %llu ticks\n",
+			callout_ticks() - start);
+		ok = false;
+	}
+
+	/* cv_timedwait, first timing out and then being signalled. */
+	lock_acquire(clt_lock);
+	result = cv_timedwait(clt_cv, clt_lock, 5);
+	if (result != ETIMEDOUT) {
+		kprintf("cv_timedwait: expected timeout, got %d\n", result);
+		ok = false;
+	}
+	result = thread_fork("clt_signaller", NULL, clt_signaller, NULL, 0);
+	if (result) {
+		panic("callouttest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	result = cv_timedwait(clt_cv, clt_lock, 10 * HZ);
+	if (result != 0) {
+		kprintf("cv_timedwait: expected wakeup, got %d\n", result);
+		ok = false;
+	}
+	lock_release(clt_lock);
+
+	cv_destroy(clt_cv);
+	lock_destroy(clt_lock);
+	sem_destroy(clt_sem);
+
+	success(ok ? TEST161_SUCCESS : TEST161_FAIL, SECRET, "clt1");
+	return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Spinlock fairness/throughput test.
+ *
+ * A pile of threads (two per CPU, so that every CPU has somebody
+ * spinning) each take the lock a fixed number of times and bump a
+ * shared counter inside it. The bump is a deliberately slow
+ * read-modify-write, so if the lock ever lets two threads in at once
+ * updates get lost and the final count comes up short; that fails
+ * the test. We do this once with a plain spinlock and once with a
+ * ticket lock and report elapsed time and how evenly the acquisitions
+ * were spread among the threads: the per-thread counts are sampled
+ * when the first thread finishes, and with a fair lock the min/max
+ * should be close together.
+ *
+ * Run this on a multi-CPU sys161.conf for the numbers to mean much.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <synch.h>
+#include <spinlock.h>
+#include <test.h>
+#include <kern/test161.h>
+
+#define SLT_MAXTHREADS	64
+#define SLT_ITERS	2000
+
+static struct spinlock slt_spinlock;
+static struct ticketlock slt_ticketlock;
+static bool slt_useticket;
+static volatile unsigned slt_counter;
+static unsigned slt_counts[SLT_MAXTHREADS];
+static unsigned slt_snap[SLT_MAXTHREADS];
+static bool slt_snapped;
+static unsigned slt_nthreads;
+static struct semaphore *slt_startsem;
+static struct semaphore *slt_donesem;
+
+static
+void
+slt_lock(void)
+{
+	if (slt_useticket) {
+		ticketlock_acquire(&slt_ticketlock);
+	}
+	else {
+		spinlock_acquire(&slt_spinlock);
+	}
+}
+
+static
+void
+slt_unlock(void)
+{
+	if (slt_useticket) {
+		ticketlock_release(&slt_ticketlock);
+	}
+	else {
+		spinlock_release(&slt_spinlock);
+	}
+}
+
+static
+void
+slt_thread(void *junk, unsigned long num)
+{
+	unsigned n, j, val;
+	volatile unsigned i;
+
+	(void)junk;
+
+	P(slt_startsem);
+
+	for (n=0; n<SLT_ITERS; n++) {
+		slt_lock();
+		/* Read, hold it briefly like a real critical section, write. */
+		val = slt_counter;
+		for (i=0; i<8; i++) {
+			/* nothing */
+		}
+		slt_counter = val + 1;
+		slt_counts[num]++;
+		slt_unlock();
+	}
+
+	slt_lock();
+	if (!slt_snapped) {
+		for (j=0; j<slt_nthreads; j++) {
+			slt_snap[j] = slt_counts[j];
+		}
+		slt_snapped = true;
+	}
+	slt_unlock();
+
+	V(slt_donesem);
+}
+
+static
+bool
+slt_run(const char *what, bool useticket, unsigned nthreads)
+{
+	struct timespec before, after;
+	unsigned i, min, max, total, expected;
+	uint64_t nsecs;
+	int result;
+
+	slt_useticket = useticket;
+	slt_nthreads = nthreads;
+	slt_snapped = false;
+	slt_counter = 0;
+	for (i=0; i<nthreads; i++) {
+		slt_counts[i] = 0;
+	}
+	expected = nthreads * SLT_ITERS;
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("spinlocktest", NULL, slt_thread,
+				     NULL, i);
+		if (result) {
+			panic("spinlocktest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	gettime(&before);
+	for (i=0; i<nthreads; i++) {
+		V(slt_startsem);
+	}
+	for (i=0; i<nthreads; i++) {
+		P(slt_donesem);
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &after);
+
+	min = max = slt_snap[0];
+	total = slt_counts[0];
+	for (i=1; i<nthreads; i++) {
+		if (slt_snap[i] < min) {
+			min = slt_snap[i];
+		}
+		if (slt_snap[i] > max) {
+			max = slt_snap[i];
+		}
+		total += slt_counts[i];
+	}
+
+	nsecs = after.tv_sec * 1000000000ULL + after.tv_nsec;
+	kprintf("%s: %u acquisitions in %llu.%09lu s",
+		what, expected, (unsigned long long)after.tv_sec,
+		(unsigned long)after.tv_nsec);
+	if (nsecs > 0) {
+		kprintf(" (%llu/s)",
+			(unsigned long long)(expected * 1000000000ULL / nsecs));
+	}
+	kprintf("\n");
+	kprintf("%s: per-thread min %u max %u\n", what, min, max);
+
+	if (slt_counter != expected || total != expected) {
+		kprintf("%s: FAIL: counter %u, per-thread total %u, "
+			"expected %u (%u threads x %u)\n", what, slt_counter,
+			total, expected, nthreads, SLT_ITERS);
+		return false;
+	}
+	return true;
+}
+
+int
+spinlocktest(int nargs, char **args)
+{
+	unsigned nthreads;
+	bool ok;
+
+	(void)nargs;
+	(void)args;
+
+	nthreads = 2 * num_cpus;
+	if (nthreads > SLT_MAXTHREADS) {
+		nthreads = SLT_MAXTHREADS;
+	}
+
+	spinlock_init(&slt_spinlock);
+	ticketlock_init(&slt_ticketlock);
+	slt_startsem = sem_create("slt_start", 0);
+	slt_donesem = sem_create("slt_done", 0);
+	if (slt_startsem == NULL || slt_donesem == NULL) {
+		panic("spinlocktest: sem_create failed\n");
+	}
+
+	kprintf("Starting spinlock test with %u threads on %u cpus...\n",
+		nthreads, num_cpus);
+	ok = slt_run("spinlock", false, nthreads);
+	ok = slt_run("ticketlock", true, nthreads) && ok;
+
+	sem_destroy(slt_donesem);
+	sem_destroy(slt_startsem);
+	ticketlock_cleanup(&slt_ticketlock);
+	spinlock_cleanup(&slt_spinlock);
+
+	success(ok ? TEST161_SUCCESS : TEST161_FAIL, SECRET, "slt1");
+	return 0;
+}
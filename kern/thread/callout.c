@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Hierarchical timing wheel.
+ *
+ * There are CALLOUT_LEVELS wheels of CALLOUT_SLOTS buckets each.
+ * Level 0 has one bucket per tick; each bucket of level N covers a
+ * whole turn of level N-1. A callout is filed at the lowest level
+ * whose span covers the time until it expires. Whenever level N-1
+ * wraps around, the next bucket of level N is emptied and its
+ * callouts refiled ("cascaded") one level down, so by the time a
+ * callout is due it is sitting in the level-0 bucket for its tick.
+ *
+ * Everything is protected by callout_lock, which is dropped while
+ * the functions of expired callouts run.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <current.h>
+#include <callout.h>
+
+#define CALLOUT_SLOTBITS	6
+#define CALLOUT_SLOTS		(1 << CALLOUT_SLOTBITS)
+#define CALLOUT_SLOTMASK	(CALLOUT_SLOTS - 1)
+#define CALLOUT_LEVELS		4
+
+/* Longest delay the wheel can represent directly. */
+#define CALLOUT_MAXDELTA \
+	(((uint64_t)1 << (CALLOUT_SLOTBITS * CALLOUT_LEVELS)) - 1)
+
+static struct spinlock callout_lock = SPINLOCK_INITIALIZER;
+static struct callout *callout_wheel[CALLOUT_LEVELS][CALLOUT_SLOTS];
+static uint64_t callout_now;		/* last tick processed */
+static struct callout *volatile callout_running;	/* now firing */
+static struct cpu *callout_runcpu;		/* where it's firing */
+
+/*
+ * Put a callout in the right bucket. Lock must be held.
+ */
+static
+void
+callout_insert(struct callout *c)
+{
+	uint64_t expire, delta;
+	unsigned level, slot;
+	struct callout **bucket;
+
+	KASSERT(spinlock_do_i_hold(&callout_lock));
+
+	expire = c->co_expire;
+	delta = (expire > callout_now) ? expire - callout_now : 0;
+	if (delta > CALLOUT_MAXDELTA) {
+		/* Park it as far out as we can; it'll be refiled later. */
+		delta = CALLOUT_MAXDELTA;
+		expire = callout_now + delta;
+	}
+
+	for (level = 0; level < CALLOUT_LEVELS - 1; level++) {
+		if (delta < ((uint64_t)1 << (CALLOUT_SLOTBITS * (level+1)))) {
+			break;
+		}
+	}
+	if (delta == 0) {
+		/* already due; run it on the tick now being processed */
+		expire = callout_now;
+	}
+	slot = (expire >> (CALLOUT_SLOTBITS * level)) & CALLOUT_SLOTMASK;
+
+	bucket = &callout_wheel[level][slot];
+	c->co_next = *bucket;
+	if (c->co_next != NULL) {
+		c->co_next->co_pprev = &c->co_next;
+	}
+	c->co_pprev = bucket;
+	*bucket = c;
+	c->co_pending = true;
+}
+
+/*
+ * Take a callout out of its bucket. Lock must be held.
+ */
+static
+void
+callout_remove(struct callout *c)
+{
+	KASSERT(spinlock_do_i_hold(&callout_lock));
+	KASSERT(c->co_pending);
+
+	*c->co_pprev = c->co_next;
+	if (c->co_next != NULL) {
+		c->co_next->co_pprev = c->co_pprev;
+	}
+	c->co_next = NULL;
+	c->co_pprev = NULL;
+	c->co_pending = false;
+}
+
+/*
+ * Refile everything in one bucket of a higher level.
+ */
+static
+void
+callout_cascade(unsigned level)
+{
+	unsigned slot;
+	struct callout *list, *c;
+
+	slot = (callout_now >> (CALLOUT_SLOTBITS * level)) & CALLOUT_SLOTMASK;
+	list = callout_wheel[level][slot];
+	callout_wheel[level][slot] = NULL;
+
+	while (list != NULL) {
+		c = list;
+		list = c->co_next;
+		c->co_pending = false;
+		callout_insert(c);
+	}
+}
+
+void
+callout_init(struct callout *c, void (*func)(void *), void *data)
+{
+	c->co_next = NULL;
+	c->co_pprev = NULL;
+	c->co_func = func;
+	c->co_data = data;
+	c->co_expire = 0;
+	c->co_pending = false;
+}
+
+void
+callout_arm(struct callout *c, unsigned ticks)
+{
+	if (ticks == 0) {
+		/* The current tick may already have been processed. */
+		ticks = 1;
+	}
+
+	spinlock_acquire(&callout_lock);
+	if (c->co_pending) {
+		callout_remove(c);
+	}
+	c->co_expire = callout_now + ticks;
+	callout_insert(c);
+	spinlock_release(&callout_lock);
+}
+
+bool
+callout_cancel(struct callout *c)
+{
+	bool wasarmed;
+
+	spinlock_acquire(&callout_lock);
+	wasarmed = c->co_pending;
+	if (wasarmed) {
+		callout_remove(c);
+	}
+	while (callout_running == c && callout_runcpu != curcpu->c_self) {
+		/* It's firing right now on another CPU; wait for it. */
+		spinlock_release(&callout_lock);
+		spinlock_acquire(&callout_lock);
+	}
+	spinlock_release(&callout_lock);
+
+	return wasarmed;
+}
+
+bool
+callout_pending(struct callout *c)
+{
+	return c->co_pending;
+}
+
+uint64_t
+callout_ticks(void)
+{
+	return callout_now;
+}
+
+/*
+ * Advance the wheel by one tick and run whatever is due.
+ */
+void
+callout_hardclock(void)
+{
+	unsigned level, slot;
+	struct callout *c;
+
+	KASSERT(curthread->t_in_interrupt);
+
+	spinlock_acquire(&callout_lock);
+	callout_now++;
+
+	/*
+	 * Find the highest level whose lower neighbour just wrapped,
+	 * and cascade from there downwards so that callouts refiled
+	 * from a high level can be refiled again on the same tick.
+	 */
+	for (level = 1; level < CALLOUT_LEVELS; level++) {
+		if ((callout_now &
+		     (((uint64_t)1 << (CALLOUT_SLOTBITS * level)) - 1)) != 0) {
+			break;
+		}
+	}
+	while (--level > 0) {
+		callout_cascade(level);
+	}
+
+	/*
+	 * Run the level-0 bucket for this tick. Take callouts off one
+	 * at a time, since a callout function may cancel or rearm
+	 * others (or itself) while the lock is dropped.
+	 */
+	slot = callout_now & CALLOUT_SLOTMASK;
+	while ((c = callout_wheel[0][slot]) != NULL) {
+		KASSERT(c->co_expire <= callout_now);
+		callout_remove(c);
+		callout_running = c;
+		callout_runcpu = curcpu->c_self;
+		spinlock_release(&callout_lock);
+
+		c->co_func(c->co_data);
+
+		spinlock_acquire(&callout_lock);
+		callout_running = NULL;
+		callout_runcpu = NULL;
+	}
+	spinlock_release(&callout_lock);
+}
@@ -34,13 +34,15 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <callout.h>
+#include <mainbus.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Callbacks at specific points in the future are handled by the
+ * callout wheel (callout.c), which CPU 0 advances from hardclock().
+ * Sleeping for a number of ticks is built on top of that.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -52,6 +54,7 @@
  */
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define IDLE_HARDCLOCKS		(10*HZ)	/* Longest tickless idle stretch. */
 
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
@@ -59,6 +62,13 @@
 static struct wchan *lbolt;
 static struct spinlock lbolt_lock;
 
+/*
+ * Threads in thread_sleep_ticks wait here until their callout wakes
+ * them individually.
+ */
+static struct wchan *tsleep;
+static struct spinlock tsleep_lock;
+
 /*
  * Setup.
  */
@@ -70,6 +80,11 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	spinlock_init(&tsleep_lock);
+	tsleep = wchan_create("tsleep");
+	if (tsleep == NULL) {
+		panic("Couldn't create tsleep\n");
+	}
 }
 
 /*
@@ -97,6 +112,9 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	if (curcpu->c_number == 0) {
+		callout_hardclock();
+	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
@@ -106,16 +124,102 @@ hardclock(void)
 	thread_yield();
 }
 
+/*
+ * Called instead of hardclock() for ticks the current CPU slept
+ * through in clock_idle(). Nothing was running, so there's no
+ * scheduling to do; just keep the count straight.
+ */
+void
+hardclock_catchup(unsigned ticks)
+{
+	curcpu->c_hardclocks += ticks;
+	if (curcpu->c_number == 0) {
+		while (ticks-- > 0) {
+			callout_hardclock();
+		}
+	}
+}
+
+/*
+ * Idle the current CPU until something happens, and account for the
+ * time. Called from thread_switch with interrupts off and nothing on
+ * the run queue.
+ *
+ * An idle CPU has no use for hardclock, so stretch the timer out and
+ * let an IPI (which is what makes a CPU unidle) or device interrupt
+ * wake us. CPU 0 is the exception: it drives the callout wheel, and
+ * the wheel's notion of the current tick must stay current so that
+ * other CPUs can arm callouts against it, so CPU 0 keeps ticking.
+ */
+void
+clock_idle(void)
+{
+	uint64_t start, end;
+
+	start = cpu_cycles();
+	if (curcpu->c_number != 0) {
+		mainbus_timer_idle(IDLE_HARDCLOCKS);
+	}
+	cpu_idle();
+	mainbus_timer_wake();
+	end = cpu_cycles();
+
+	/*
+	 * If the timer went off, the cycle count won't catch up with
+	 * the ticks until the interrupt is taken; don't count those.
+	 */
+	if (end > start) {
+		curcpu->c_idlecycles += end - start;
+	}
+}
+
+/*
+ * Callout function for thread_sleep_ticks.
+ */
+static
+void
+tsleep_wakeup(void *data)
+{
+	struct thread *t = data;
+
+	spinlock_acquire(&tsleep_lock);
+	wchan_wakethread(tsleep, t, &tsleep_lock);
+	spinlock_release(&tsleep_lock);
+}
+
+/*
+ * Suspend execution for a number of hardclock ticks.
+ */
+void
+thread_sleep_ticks(unsigned ticks)
+{
+	struct callout co;
+
+	if (ticks == 0) {
+		return;
+	}
+
+	callout_init(&co, tsleep_wakeup, curthread);
+
+	/* Hold tsleep_lock across the arm so the wakeup can't be lost. */
+	spinlock_acquire(&tsleep_lock);
+	callout_arm(&co, ticks);
+	while (callout_pending(&co)) {
+		wchan_sleep(tsleep, &tsleep_lock);
+	}
+	spinlock_release(&tsleep_lock);
+
+	/* Wait for the callout function to be done with CO. */
+	callout_cancel(&co);
+}
+
 /*
  * Suspend execution for n seconds.
  */
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
+	if (num_secs > 0) {
+		thread_sleep_ticks(num_secs * HZ);
 	}
-	spinlock_release(&lbolt_lock);
 }
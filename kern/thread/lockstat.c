@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention statistics.
+ *
+ * Slots live in a fixed open-hashed table so that nothing here has to
+ * call kmalloc (which takes locks of its own). The table itself, and
+ * each slot's counters, are protected by raw spinlock words rather
+ * than struct spinlock so that we don't end up profiling ourselves.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <current.h>
+#include <lockstat.h>
+
+#define LOCKSTAT_NSLOTS		256
+
+static struct lockstat lockstat_table[LOCKSTAT_NSLOTS];
+static struct lockstat lockstat_overflow = { "(overflow)", "", NULL,
+					     SPINLOCK_DATA_INITIALIZER,
+					     0, 0, 0, 0, 0 };
+static volatile spinlock_data_t lockstat_tablelock =
+	SPINLOCK_DATA_INITIALIZER;
+
+/*
+ * Raw lock on a spinlock word. Callers must be at splhigh.
+ */
+static
+void
+lockstat_lock(volatile spinlock_data_t *sd)
+{
+	while (spinlock_data_get(sd) != 0 ||
+	       spinlock_data_testandset(sd) != 0) {
+		/* spin */
+	}
+	membar_store_any();
+}
+
+static
+void
+lockstat_unlock(volatile spinlock_data_t *sd)
+{
+	membar_any_store();
+	spinlock_data_set(sd, 0);
+}
+
+/*
+ * Hash a hook's key.
+ */
+static
+unsigned
+lockstat_hash(const char *kind, const char *name, const void *key)
+{
+	unsigned h;
+
+	h = 0;
+	for (; *kind; kind++) {
+		h = h*31 + (unsigned char)*kind;
+	}
+	if (name != NULL) {
+		for (; *name; name++) {
+			h = h*31 + (unsigned char)*name;
+		}
+	}
+	else {
+		h ^= (uintptr_t)key >> 2;
+	}
+	return h % LOCKSTAT_NSLOTS;
+}
+
+/*
+ * Compare NAME against a slot's (possibly truncated) copy of it.
+ */
+static
+bool
+lockstat_samename(const char *slotname, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NAMELEN - 1; i++) {
+		if (slotname[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			return true;
+		}
+	}
+	return true;
+}
+
+/*
+ * Check if slot LS belongs to hook H.
+ */
+static
+bool
+lockstat_match(struct lockstat *ls, struct lockstat_hook *h)
+{
+	if (strcmp(ls->ls_kind, h->lh_kind) != 0) {
+		return false;
+	}
+	if (h->lh_name != NULL) {
+		return ls->ls_key == NULL &&
+			lockstat_samename(ls->ls_name, h->lh_name);
+	}
+	return ls->ls_key == h->lh_key;
+}
+
+/*
+ * Find (or create) the slot for a hook. Called with interrupts off.
+ */
+static
+struct lockstat *
+lockstat_bind(struct lockstat_hook *h)
+{
+	struct lockstat *ls;
+	unsigned start, i;
+
+	if (h->lh_name == NULL && h->lh_key == NULL) {
+		/* statically initialized; key on the hook itself */
+		h->lh_key = h;
+	}
+
+	lockstat_lock(&lockstat_tablelock);
+	start = lockstat_hash(h->lh_kind, h->lh_name, h->lh_key);
+	i = start;
+	while (1) {
+		ls = &lockstat_table[i];
+		if (ls->ls_kind == NULL) {
+			/* free slot; claim it */
+			ls->ls_kind = h->lh_kind;
+			if (h->lh_name != NULL) {
+				snprintf(ls->ls_name, sizeof(ls->ls_name),
+					 "%s", h->lh_name);
+				ls->ls_key = NULL;
+			}
+			else {
+				ls->ls_key = h->lh_key;
+			}
+			break;
+		}
+		if (lockstat_match(ls, h)) {
+			break;
+		}
+		i = (i + 1) % LOCKSTAT_NSLOTS;
+		if (i == start) {
+			/* table is full */
+			ls = &lockstat_overflow;
+			break;
+		}
+	}
+	lockstat_unlock(&lockstat_tablelock);
+
+	h->lh_stat = ls;
+	return ls;
+}
+
+/*
+ * Set up a hook. NAME is used if not NULL; otherwise KEY.
+ */
+void
+lockstat_hookinit(struct lockstat_hook *h, const char *kind,
+		  const char *name, const void *key)
+{
+	h->lh_kind = kind;
+	h->lh_name = name;
+	h->lh_key = key;
+	h->lh_stat = NULL;
+	h->lh_start = 0;
+}
+
+/*
+ * Note that we are about to start waiting for a lock.
+ */
+void
+lockstat_waitbegin(struct lockstat_wait *w)
+{
+	w->lw_contended = false;
+	w->lw_start = CURCPU_EXISTS() ? cpu_cycles() : 0;
+}
+
+/*
+ * We got the lock; charge the wait and start the hold clock.
+ */
+void
+lockstat_acquire(struct lockstat_hook *h, struct lockstat_wait *w)
+{
+	struct lockstat *ls;
+	uint64_t now;
+	int s;
+
+	if (!CURCPU_EXISTS()) {
+		return;
+	}
+
+	s = splhigh();
+	now = cpu_cycles();
+	h->lh_start = now;
+
+	ls = h->lh_stat;
+	if (ls == NULL) {
+		ls = lockstat_bind(h);
+	}
+
+	lockstat_lock(&ls->ls_lock);
+	ls->ls_acquires++;
+	if (w->lw_contended) {
+		ls->ls_contended++;
+	}
+	/* The thread may have migrated while waiting; don't go negative. */
+	if (now > w->lw_start) {
+		ls->ls_waitcycles += now - w->lw_start;
+	}
+	lockstat_unlock(&ls->ls_lock);
+	splx(s);
+}
+
+/*
+ * We are letting go of the lock; charge the hold time.
+ */
+void
+lockstat_release(struct lockstat_hook *h)
+{
+	struct lockstat *ls;
+	uint64_t now, held;
+	int s;
+
+	ls = h->lh_stat;
+	if (ls == NULL || !CURCPU_EXISTS()) {
+		/* acquired before we were counting */
+		return;
+	}
+
+	s = splhigh();
+	now = cpu_cycles();
+	held = (now > h->lh_start) ? now - h->lh_start : 0;
+
+	lockstat_lock(&ls->ls_lock);
+	ls->ls_holdcycles += held;
+	if (held > ls->ls_maxhold) {
+		ls->ls_maxhold = held;
+	}
+	lockstat_unlock(&ls->ls_lock);
+	splx(s);
+}
+
+/*
+ * Print the top MAXLINES slots by total wait time.
+ *
+ * This is a simple selection, picking the largest remaining slot each
+ * time around; we print few enough lines that it doesn't matter.
+ * The counters are read without locking, so the report is a
+ * snapshot that may be slightly inconsistent on a busy system.
+ */
+void
+lockstat_report(unsigned maxlines)
+{
+	static bool printed[LOCKSTAT_NSLOTS];
+	struct lockstat *ls, *best;
+	unsigned i, line, bestindex;
+
+	for (i=0; i<LOCKSTAT_NSLOTS; i++) {
+		printed[i] = false;
+	}
+
+	kprintf("%-11s %-24s %10s %9s %12s %12s %10s\n",
+		"kind", "name", "acquires", "contended",
+		"wait", "hold", "maxhold");
+
+	for (line=0; line<maxlines; line++) {
+		best = NULL;
+		bestindex = 0;
+		for (i=0; i<LOCKSTAT_NSLOTS; i++) {
+			ls = &lockstat_table[i];
+			if (printed[i] || ls->ls_kind == NULL ||
+			    ls->ls_acquires == 0) {
+				continue;
+			}
+			if (best == NULL ||
+			    ls->ls_waitcycles > best->ls_waitcycles ||
+			    (ls->ls_waitcycles == best->ls_waitcycles &&
+			     ls->ls_contended > best->ls_contended)) {
+				best = ls;
+				bestindex = i;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		printed[bestindex] = true;
+
+		if (best->ls_key == NULL) {
+			kprintf("%-11s %-24s", best->ls_kind, best->ls_name);
+		}
+		else {
+			kprintf("%-11s %-24p", best->ls_kind, best->ls_key);
+		}
+		kprintf(" %10llu %9llu %12llu %12llu %10llu\n",
+			best->ls_acquires, best->ls_contended,
+			best->ls_waitcycles, best->ls_holdcycles,
+			best->ls_maxhold);
+	}
+
+	if (lockstat_overflow.ls_acquires > 0) {
+		kprintf("(%llu acquires of locks that did not fit in "
+			"the table)\n", lockstat_overflow.ls_acquires);
+	}
+}
+
+/*
+ * Zero all the counters. Slots stay bound to their locks.
+ */
+void
+lockstat_reset(void)
+{
+	struct lockstat *ls;
+	unsigned i;
+	int s;
+
+	s = splhigh();
+	for (i=0; i<=LOCKSTAT_NSLOTS; i++) {
+		ls = (i < LOCKSTAT_NSLOTS) ?
+			&lockstat_table[i] : &lockstat_overflow;
+		lockstat_lock(&ls->ls_lock);
+		ls->ls_acquires = 0;
+		ls->ls_contended = 0;
+		ls->ls_waitcycles = 0;
+		ls->ls_holdcycles = 0;
+		ls->ls_maxhold = 0;
+		lockstat_unlock(&ls->ls_lock);
+	}
+	splx(s);
+}
@@ -43,6 +43,32 @@
  * Spinlocks.
  */
 
+/*
+ * Backoff bounds, in iterations of spinlock_backoff(). A test-and-set
+ * spinner that loses doubles its delay up to SPINLOCK_BACKOFF_MAX; a
+ * ticket waiter delays SPINLOCK_BACKOFF_TICKET per CPU ahead of it in
+ * line, capped the same way.
+ */
+#define SPINLOCK_BACKOFF_MIN	4
+#define SPINLOCK_BACKOFF_MAX	1024
+#define SPINLOCK_BACKOFF_TICKET	32
+
+/*
+ * Wait a while without touching the bus. Reading the (cached) lock
+ * word each time around keeps the compiler from throwing the loop
+ * away.
+ */
+static
+void
+spinlock_backoff(volatile spinlock_data_t *sd, unsigned count)
+{
+	unsigned i;
+
+	for (i=0; i<count; i++) {
+		(void)spinlock_data_get(sd);
+	}
+}
+
 
 /*
  * Initialize spinlock.
@@ -53,6 +79,9 @@ spinlock_init(struct spinlock *splk)
 	spinlock_data_set(&splk->splk_lock, 0);
 	splk->splk_holder = NULL;
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
+	/* No name; charge all locks set up from the same place together */
+	LOCKSTAT_HOOKINIT(&splk->splk_stat, "spinlock", NULL,
+			  __builtin_return_address(0));
 }
 
 /*
@@ -76,6 +105,8 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	unsigned backoff;
+	LOCKSTAT_WAIT(wait);
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -93,6 +124,8 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
+	LOCKSTAT_WAITBEGIN(&wait);
+	backoff = SPINLOCK_BACKOFF_MIN;
 	while (1) {
 		/*
 		 * Do test-test-and-set, that is, read first before
@@ -103,11 +136,22 @@ spinlock_acquire(struct spinlock *splk)
 		 * previous value. If that value was 0, the lock was
 		 * previously unheld and we now own it. If it was 1,
 		 * we don't.
+		 *
+		 * If we lose the race for the test-and-set, somebody
+		 * else just got the lock; back off exponentially so
+		 * that all the losers don't pile onto the bus again
+		 * the moment it is released.
 		 */
 		if (spinlock_data_get(&splk->splk_lock) != 0) {
+			LOCKSTAT_CONTENDED(&wait);
 			continue;
 		}
 		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
+			LOCKSTAT_CONTENDED(&wait);
+			spinlock_backoff(&splk->splk_lock, backoff);
+			if (backoff < SPINLOCK_BACKOFF_MAX) {
+				backoff *= 2;
+			}
 			continue;
 		}
 		break;
@@ -115,6 +159,7 @@ spinlock_acquire(struct spinlock *splk)
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
+	LOCKSTAT_ACQUIRE(&splk->splk_stat, &wait);
 
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
@@ -135,6 +180,7 @@ spinlock_release(struct spinlock *splk)
 		HANGMAN_RELEASE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
 
+	LOCKSTAT_RELEASE(&splk->splk_stat);
 	splk->splk_holder = NULL;
 	membar_any_store();
 	spinlock_data_set(&splk->splk_lock, 0);
@@ -154,3 +200,125 @@ spinlock_do_i_hold(struct spinlock *splk)
 	/* Assume we can read splk_holder atomically enough for this to work */
 	return (splk->splk_holder == curcpu->c_self);
 }
+
+////////////////////////////////////////////////////////////
+//
+// Ticket spinlocks.
+
+/*
+ * Initialize ticket lock.
+ */
+void
+ticketlock_init(struct ticketlock *tkl)
+{
+	spinlock_data_set(&tkl->tkl_next, 0);
+	spinlock_data_set(&tkl->tkl_serving, 0);
+	tkl->tkl_holder = NULL;
+	HANGMAN_LOCKABLEINIT(&tkl->tkl_hangman, "ticketlock");
+	LOCKSTAT_HOOKINIT(&tkl->tkl_stat, "ticketlock", NULL,
+			  __builtin_return_address(0));
+}
+
+/*
+ * Clean up ticket lock.
+ */
+void
+ticketlock_cleanup(struct ticketlock *tkl)
+{
+	KASSERT(tkl->tkl_holder == NULL);
+	KASSERT(spinlock_data_get(&tkl->tkl_next) ==
+		spinlock_data_get(&tkl->tkl_serving));
+}
+
+/*
+ * Get the lock.
+ *
+ * As with spinlock_acquire, interrupts go off first. Then take a
+ * ticket and wait for it to be served. The only atomic operation is
+ * the fetch-and-increment; after that we just read tkl_serving,
+ * backing off in proportion to the number of CPUs ahead of us.
+ */
+void
+ticketlock_acquire(struct ticketlock *tkl)
+{
+	struct cpu *mycpu;
+	spinlock_data_t ticket, serving;
+	unsigned backoff;
+	LOCKSTAT_WAIT(wait);
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		mycpu = curcpu->c_self;
+		if (tkl->tkl_holder == mycpu) {
+			panic("Deadlock on ticketlock %p\n", tkl);
+		}
+		mycpu->c_spinlocks++;
+
+		HANGMAN_WAIT(&curcpu->c_hangman, &tkl->tkl_hangman);
+	}
+	else {
+		mycpu = NULL;
+	}
+
+	LOCKSTAT_WAITBEGIN(&wait);
+	ticket = spinlock_data_fetchinc(&tkl->tkl_next);
+	while (1) {
+		serving = spinlock_data_get(&tkl->tkl_serving);
+		if (serving == ticket) {
+			break;
+		}
+		LOCKSTAT_CONTENDED(&wait);
+		/* Unsigned arithmetic copes with the counters wrapping. */
+		backoff = (ticket - serving) * SPINLOCK_BACKOFF_TICKET;
+		if (backoff > SPINLOCK_BACKOFF_MAX) {
+			backoff = SPINLOCK_BACKOFF_MAX;
+		}
+		spinlock_backoff(&tkl->tkl_serving, backoff);
+	}
+
+	membar_store_any();
+	tkl->tkl_holder = mycpu;
+	LOCKSTAT_ACQUIRE(&tkl->tkl_stat, &wait);
+
+	if (CURCPU_EXISTS()) {
+		HANGMAN_ACQUIRE(&curcpu->c_hangman, &tkl->tkl_hangman);
+	}
+}
+
+/*
+ * Release the lock by serving the next ticket. Only the holder
+ * writes tkl_serving, so this need not be atomic.
+ */
+void
+ticketlock_release(struct ticketlock *tkl)
+{
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		KASSERT(tkl->tkl_holder == curcpu->c_self);
+		KASSERT(curcpu->c_spinlocks > 0);
+		curcpu->c_spinlocks--;
+		HANGMAN_RELEASE(&curcpu->c_hangman, &tkl->tkl_hangman);
+	}
+
+	LOCKSTAT_RELEASE(&tkl->tkl_stat);
+	tkl->tkl_holder = NULL;
+	membar_any_store();
+	spinlock_data_set(&tkl->tkl_serving,
+			  spinlock_data_get(&tkl->tkl_serving) + 1);
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+/*
+ * Check if the current cpu holds the lock.
+ */
+bool
+ticketlock_do_i_hold(struct ticketlock *tkl)
+{
+	if (!CURCPU_EXISTS()) {
+		return true;
+	}
+
+	return (tkl->tkl_holder == curcpu->c_self);
+}
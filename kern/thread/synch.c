@@ -33,8 +33,10 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <callout.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
@@ -157,6 +159,7 @@ lock_create(const char *name)
 	}
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
+	LOCKSTAT_HOOKINIT(&lock->lk_stat, "lock", lock->lk_name, NULL);
 
 	lock ->mutex_wchan = wchan_create(lock->lk_name);
 	if (lock->mutex_wchan == NULL){
@@ -188,6 +191,7 @@ lock_destroy(struct lock *lock)
 void
 lock_acquire(struct lock *lock)
 {
+	LOCKSTAT_WAIT(wait);
 
 	KASSERT(lock != NULL);
 	/*
@@ -199,6 +203,7 @@ lock_acquire(struct lock *lock)
 	KASSERT(curthread->t_in_interrupt == false);
 	/* Call this (atomically) before waiting for a lock */
 	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+	LOCKSTAT_WAITBEGIN(&wait);
 	/*
 	 *	This spinlock is to ensure that no two threads would 
 	 *  actually get the lock 
@@ -208,9 +213,11 @@ lock_acquire(struct lock *lock)
 		/*
 			Make sure we have the lock, and if not just make the thread sleep
 		*/
+		LOCKSTAT_CONTENDED(&wait);
 		wchan_sleep(lock->mutex_wchan, &lock->mutex_lock);
 	}
 	lock -> holder = curthread;
+	LOCKSTAT_ACQUIRE(&lock->lk_stat, &wait);
 	DEBUG(DB_SEMFS, "Lock %p - %s Aquired By %p\n",lock, lock -> lk_name, lock -> holder);	
 	KASSERT(lock_do_i_hold(lock));
 	spinlock_release(&lock->mutex_lock);
@@ -229,6 +236,7 @@ lock_release(struct lock *lock)
 	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
 	spinlock_acquire(&lock->mutex_lock);
 	DEBUG(DB_SEMFS, "Lock %p - %s Released By %p\n",lock, lock -> lk_name, lock -> holder);
+	LOCKSTAT_RELEASE(&lock->lk_stat);
 	lock -> holder = NULL;
 	wchan_wakeone(lock->mutex_wchan, &lock->mutex_lock);
 	spinlock_release(&lock->mutex_lock);		
@@ -335,6 +343,61 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	spinlock_release(&cv->cv_lock);
 }
 
+/*
+ * Timeout state for cv_timedwait; lives on the waiter's stack.
+ */
+struct cv_timeout {
+	struct cv *ct_cv;
+	struct thread *ct_thread;
+	bool ct_fired;
+};
+
+static
+void
+cv_timeout(void *data)
+{
+	struct cv_timeout *ct = data;
+
+	spinlock_acquire(&ct->ct_cv->cv_lock);
+	if (wchan_wakethread(ct->ct_cv->cv_wchan, ct->ct_thread,
+			     &ct->ct_cv->cv_lock)) {
+		ct->ct_fired = true;
+	}
+	spinlock_release(&ct->ct_cv->cv_lock);
+}
+
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks)
+{
+	struct cv_timeout ct;
+	struct callout co;
+
+	KASSERT(cv != NULL);
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	ct.ct_cv = cv;
+	ct.ct_thread = curthread;
+	ct.ct_fired = false;
+	callout_init(&co, cv_timeout, &ct);
+
+	/*
+	 * Arm the timeout while holding cv_lock so it can't go off
+	 * before we're on the wait channel.
+	 */
+	spinlock_acquire(&cv->cv_lock);
+	callout_arm(&co, ticks);
+	lock_release(lock);
+	wchan_sleep(cv->cv_wchan, &cv->cv_lock);
+	spinlock_release(&cv->cv_lock);
+
+	/* Make sure the callout is gone before CO and CT go away. */
+	callout_cancel(&co);
+
+	lock_acquire(lock);
+	return ct.ct_fired ? ETIMEDOUT : 0;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // RW
@@ -439,6 +502,8 @@ struct rwlock * rwlock_create(const char *name){
 	rwlock->writers = 0;
 	rwlock->seen_readers = 0;
 	rwlock->reader_has_lock = false;
+	LOCKSTAT_HOOKINIT(&rwlock->rwlock_stat, "rwlock",
+			  rwlock->rwlock_name, NULL);
 	return rwlock;
 };
 void rwlock_destroy(struct rwlock * lock){
@@ -458,9 +523,15 @@ void rwlock_destroy(struct rwlock * lock){
 };
 
 void rwlock_acquire_read(struct rwlock *lock){
+	LOCKSTAT_WAIT(wait);
+
 	KASSERT(lock != NULL);
+	LOCKSTAT_WAITBEGIN(&wait);
 	P(lock->reader_sem);
 	spinlock_acquire(&lock->read_lock);
+	if (lock->writers > 0) {
+		LOCKSTAT_CONTENDED(&wait);
+	}
 	
 	/*
      *		If we have seen a certain number of 
@@ -489,6 +560,11 @@ void rwlock_acquire_read(struct rwlock *lock){
 	}
 	lock->readers ++;
 	lock->seen_readers ++;
+	/*
+	 * Readers overlap, so only the wait is charged for them; hold
+	 * times are tracked for writers only.
+	 */
+	LOCKSTAT_ACQUIRE(&lock->rwlock_stat, &wait);
 	spinlock_release(&lock->read_lock);
 };
 
@@ -536,16 +612,24 @@ void rwlock_release_read(struct rwlock *lock){
 };
 
 void rwlock_acquire_write(struct rwlock *lock){
+	LOCKSTAT_WAIT(wait);
+
+	LOCKSTAT_WAITBEGIN(&wait);
 	spinlock_acquire(&lock->read_lock);
+	if (lock->writers > 0 || lock->reader_has_lock) {
+		LOCKSTAT_CONTENDED(&wait);
+	}
 	lock->writers ++;
 	spinlock_release(&lock->read_lock);
 	lock_acquire(lock->read_write_lock);
 	cv_broadcast(lock->writer_condvar, lock->read_write_lock);
 	KASSERT(!lock->reader_has_lock);
+	LOCKSTAT_ACQUIRE(&lock->rwlock_stat, &wait);
 };
 
 void rwlock_release_write(struct rwlock *lock){
 	KASSERT(!lock->reader_has_lock);
+	LOCKSTAT_RELEASE(&lock->rwlock_stat);
 	lock->writers --;	
 	lock_release(lock->read_write_lock);
 };
\ No newline at end of file
@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <array.h>
 #include <cpu.h>
+#include <clock.h>
 #include <spl.h>
 #include <spinlock.h>
 #include <wchan.h>
@@ -152,6 +153,10 @@ thread_create(const char *name)
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Accounting fields */
+	bzero(&thread->t_usage, sizeof(thread->t_usage));
+	thread->t_usagestamp = 0;
+
 	/* If you add to struct thread, be sure to initialize here */
 
 	return thread;
@@ -184,10 +189,12 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_timerticks = 1;
+	c->c_idlecycles = 0;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	ticketlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -472,10 +479,10 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
-		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+		KASSERT(ticketlock_do_i_hold(&targetcpu->c_runqueue_lock));
 	}
 	else {
-		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		ticketlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
 	/* Target thread is now ready to run; put it on the run queue. */
@@ -491,7 +498,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	if (!already_have_lock) {
-		spinlock_release(&targetcpu->c_runqueue_lock);
+		ticketlock_release(&targetcpu->c_runqueue_lock);
 	}
 }
 
@@ -604,15 +611,29 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	thread_checkstack(cur);
 
 	/* Lock the run queue. */
-	spinlock_acquire(&curcpu->c_runqueue_lock);
+	ticketlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
 	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
-		spinlock_release(&curcpu->c_runqueue_lock);
+		ticketlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
 
+	/*
+	 * Charge the time up to here to the outgoing thread. Going to
+	 * sleep is a voluntary switch; so is yielding, unless we're
+	 * being preempted from the timer interrupt.
+	 */
+	thread_usage_charge(false);
+	if (newstate == S_SLEEP ||
+	    (newstate == S_READY && !cur->t_in_interrupt)) {
+		cur->t_usage.tu_nvcsw++;
+	}
+	else if (newstate == S_READY) {
+		cur->t_usage.tu_nivcsw++;
+	}
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
@@ -641,7 +662,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call cpu_idle().
+	 * Get the next thread. While there isn't one, call clock_idle(),
+	 * which calls cpu_idle() with the timer tick turned down.
 	 * curcpu->c_isidle must be true when cpu_idle is
 	 * called. Unlock the runqueue while idling too, to make sure
 	 * things can be added to it.
@@ -662,9 +684,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	do {
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
-			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
-			spinlock_acquire(&curcpu->c_runqueue_lock);
+			ticketlock_release(&curcpu->c_runqueue_lock);
+			clock_idle();
+			ticketlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
@@ -733,8 +755,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/* Start the accounting clock on this cpu. */
+	cur->t_usagestamp = cpu_cycles();
+
 	/* Unlock the run queue. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	ticketlock_release(&curcpu->c_runqueue_lock);
 
 	/* Activate our address space in the MMU. */
 	as_activate();
@@ -766,8 +791,11 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/* Start the accounting clock on this cpu. */
+	cur->t_usagestamp = cpu_cycles();
+
 	/* Release the runqueue lock acquired in thread_switch. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	ticketlock_release(&curcpu->c_runqueue_lock);
 
 	/* Activate our address space in the MMU. */
 	as_activate();
@@ -846,6 +874,49 @@ thread_yield(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Accounting.
+ *
+ * Time is charged to the current thread at kernel entry and exit
+ * (as user and system time respectively) and when it switches out
+ * (as system time). Time spent idle isn't charged to anyone. The
+ * cycle counter is per-cpu, but a thread only compares readings
+ * taken since it last started running, so that doesn't matter.
+ */
+void
+thread_usage_charge(bool user)
+{
+	struct thread *cur = curthread;
+	uint64_t now;
+	int spl;
+
+	/* Don't let a context switch in between see a stale stamp */
+	spl = splhigh();
+	now = cpu_cycles();
+	/* The counter can briefly lag while a timer interrupt is pending */
+	if (now > cur->t_usagestamp) {
+		if (user) {
+			cur->t_usage.tu_utime += now - cur->t_usagestamp;
+		}
+		else {
+			cur->t_usage.tu_stime += now - cur->t_usagestamp;
+		}
+	}
+	cur->t_usagestamp = now;
+	splx(spl);
+}
+
+void
+threadusage_add(struct threadusage *to, const struct threadusage *from)
+{
+	to->tu_utime += from->tu_utime;
+	to->tu_stime += from->tu_stime;
+	to->tu_nvcsw += from->tu_nvcsw;
+	to->tu_nivcsw += from->tu_nivcsw;
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Scheduler.
  *
@@ -892,12 +963,12 @@ thread_consider_migration(void)
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
+		ticketlock_acquire(&c->c_runqueue_lock);
 		total_count += c->c_runqueue.tl_count;
 		if (c == curcpu->c_self) {
 			my_count = c->c_runqueue.tl_count;
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		ticketlock_release(&c->c_runqueue_lock);
 	}
 
 	one_share = DIVROUNDUP(total_count, numcpus);
@@ -907,19 +978,19 @@ thread_consider_migration(void)
 
 	to_send = my_count - one_share;
 	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
+	ticketlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
 		t = threadlist_remtail(&curcpu->c_runqueue);
 		threadlist_addhead(&victims, t);
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
+	ticketlock_release(&curcpu->c_runqueue_lock);
 
 	for (i=0; i < numcpus && to_send > 0; i++) {
 		c = cpuarray_get(&allcpus, i);
 		if (c == curcpu->c_self) {
 			continue;
 		}
-		spinlock_acquire(&c->c_runqueue_lock);
+		ticketlock_acquire(&c->c_runqueue_lock);
 		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
@@ -964,7 +1035,7 @@ thread_consider_migration(void)
 				ipi_send(c, IPI_UNIDLE);
 			}
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		ticketlock_release(&c->c_runqueue_lock);
 	}
 
 	/*
@@ -973,11 +1044,11 @@ thread_consider_migration(void)
 	 * Don't panic; just put them back on our own run queue.
 	 */
 	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
+		ticketlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
 			threadlist_addtail(&curcpu->c_runqueue, t);
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+		ticketlock_release(&curcpu->c_runqueue_lock);
 	}
 
 	KASSERT(threadlist_isempty(&victims));
@@ -1109,6 +1180,26 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Wake up one particular thread, if it's sleeping on this channel.
+ */
+bool
+wchan_wakethread(struct wchan *wc, struct thread *t, struct spinlock *lk)
+{
+	struct thread *itervar;
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	THREADLIST_FORALL(itervar, wc->wc_threads) {
+		if (itervar == t) {
+			threadlist_remove(&wc->wc_threads, t);
+			thread_make_runnable(t, false);
+			return true;
+		}
+	}
+	return false;
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1215,12 +1306,12 @@ interprocessor_interrupt(void)
 	if (bits & (1U << IPI_OFFLINE)) {
 		/* offline request */
 		spinlock_release(&curcpu->c_ipi_lock);
-		spinlock_acquire(&curcpu->c_runqueue_lock);
+		ticketlock_acquire(&curcpu->c_runqueue_lock);
 		if (!curcpu->c_isidle) {
 			kprintf("cpu%d: offline: warning: not idle\n",
 				curcpu->c_number);
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+		ticketlock_release(&curcpu->c_runqueue_lock);
 		cpu_halt();
 	}
 	if (bits & (1U << IPI_UNIDLE)) {
@@ -0,0 +1,989 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Buffer cache.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <clock.h>
+#include <mainbus.h>
+#include <fs.h>
+#include <vfs.h>
+#include <bio.h>
+#include <buf.h>
+
+/*
+ * Sizing. The pool gets 1/BUFFER_MEMFRACTION of physical memory,
+ * within the limits given. Buffers are allocated on demand up to
+ * that many and then recycled.
+ */
+#define BUFFER_MEMFRACTION	32
+#define BUFFER_MINBUFS		16
+#define BUFFER_MAXBUFS		1024
+
+/* Number of hash buckets; a power of two. */
+#define BUFFER_HASHSIZE		256
+
+/* How often the syncer writes dirty data back, in seconds. */
+#define BUFFER_SYNCSECS		5
+
+/*
+ * Readahead queue size, and the most blocks the reader thread reads
+ * at once (fewer if the pool is small; see buffer_readbatch).
+ */
+#define BUFFER_RAQSIZE		256
+#define BUFFER_RABATCH		32
+
+struct buf {
+	struct buf *b_hashnext;		/* Next in hash chain */
+	struct buf **b_hashpprev;	/* Pointer to us in hash chain */
+	struct buf *b_lrunext;		/* LRU list links */
+	struct buf *b_lruprev;
+	struct fs *b_fs;		/* Owning fs, or NULL if unused */
+	daddr_t b_block;		/* Block number */
+	void *b_data;			/* BUFFER_SIZE bytes */
+	bool b_busy;			/* Held, or under I/O */
+	bool b_valid;			/* b_data has the block's contents */
+	bool b_dirty;			/* b_data needs writing back */
+	bool b_readahead;		/* Read ahead, not yet asked for */
+};
+
+/*
+ * A block waiting to be read ahead.
+ */
+struct buffer_rareq {
+	struct fs *rr_fs;		/* NULL if cancelled */
+	daddr_t rr_block;
+};
+
+/*
+ * All buffers are on the LRU list, least recently used first; free
+ * buffers are put at the front so they get used before anything is
+ * evicted. buffer_lru is the list head. Buffers that belong to a
+ * filesystem are also on a hash chain.
+ *
+ * buffer_lock protects all of this and the stats. It is not held
+ * while doing I/O; instead the buffer is marked busy, and anyone
+ * who wants it waits on buffer_cv.
+ */
+static struct lock *buffer_lock;
+static struct cv *buffer_cv;
+static struct buf buffer_lru;
+static struct buf *buffer_hash[BUFFER_HASHSIZE];
+static struct bufstats buffer_stats;
+
+/*
+ * The readahead queue, a ring, also protected by buffer_lock. The
+ * reader thread waits on buffer_racv for work, and sets
+ * buffer_rabusy while it's loading a batch.
+ */
+static struct buffer_rareq buffer_raq[BUFFER_RAQSIZE];
+static unsigned buffer_raqhead, buffer_raqcount;
+static bool buffer_rabusy;
+static struct cv *buffer_racv;
+
+////////////////////////////////////////////////////////////
+// Lists
+
+static
+unsigned
+buffer_hashfunc(struct fs *fs, daddr_t block)
+{
+	return (block ^ ((uintptr_t)fs >> 4)) & (BUFFER_HASHSIZE - 1);
+}
+
+static
+struct buf *
+buffer_find(struct fs *fs, daddr_t block)
+{
+	struct buf *b;
+
+	b = buffer_hash[buffer_hashfunc(fs, block)];
+	for (; b != NULL; b = b->b_hashnext) {
+		if (b->b_fs == fs && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+buffer_hash_add(struct buf *b)
+{
+	struct buf **head;
+
+	head = &buffer_hash[buffer_hashfunc(b->b_fs, b->b_block)];
+	b->b_hashnext = *head;
+	b->b_hashpprev = head;
+	if (*head != NULL) {
+		(*head)->b_hashpprev = &b->b_hashnext;
+	}
+	*head = b;
+}
+
+static
+void
+buffer_hash_remove(struct buf *b)
+{
+	*b->b_hashpprev = b->b_hashnext;
+	if (b->b_hashnext != NULL) {
+		b->b_hashnext->b_hashpprev = b->b_hashpprev;
+	}
+	b->b_hashnext = NULL;
+	b->b_hashpprev = NULL;
+}
+
+static
+void
+buffer_lru_remove(struct buf *b)
+{
+	b->b_lruprev->b_lrunext = b->b_lrunext;
+	b->b_lrunext->b_lruprev = b->b_lruprev;
+}
+
+/* Put B at the end of the list (most recently used). */
+static
+void
+buffer_lru_append(struct buf *b)
+{
+	b->b_lrunext = &buffer_lru;
+	b->b_lruprev = buffer_lru.b_lruprev;
+	b->b_lruprev->b_lrunext = b;
+	buffer_lru.b_lruprev = b;
+}
+
+/* Put B at the front of the list (next to be reused). */
+static
+void
+buffer_lru_prepend(struct buf *b)
+{
+	b->b_lruprev = &buffer_lru;
+	b->b_lrunext = buffer_lru.b_lrunext;
+	b->b_lrunext->b_lruprev = b;
+	buffer_lru.b_lrunext = b;
+}
+
+////////////////////////////////////////////////////////////
+// Internals
+
+/*
+ * Detach a buffer from its block and make it the next one to be
+ * reused. Must be busy (so nobody else is looking at it).
+ */
+static
+void
+buffer_disown(struct buf *b)
+{
+	KASSERT(lock_do_i_hold(buffer_lock));
+	KASSERT(b->b_busy);
+
+	if (b->b_fs != NULL) {
+		buffer_hash_remove(b);
+	}
+	if (b->b_readahead) {
+		if (b->b_valid) {
+			buffer_stats.bs_rawasted++;
+		}
+		b->b_readahead = false;
+	}
+	b->b_fs = NULL;
+	b->b_block = 0;
+	b->b_valid = false;
+	b->b_dirty = false;
+	buffer_lru_remove(b);
+	buffer_lru_prepend(b);
+}
+
+/*
+ * Write a dirty buffer back. The buffer must be marked busy; the
+ * buffer lock is dropped during the I/O.
+ */
+static
+int
+buffer_writeout(struct buf *b)
+{
+	int result;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+	KASSERT(b->b_busy);
+	KASSERT(b->b_valid);
+	KASSERT(b->b_dirty);
+
+	lock_release(buffer_lock);
+	result = FSOP_WRITEBLOCK(b->b_fs, b->b_block, b->b_data, BUFFER_SIZE);
+	lock_acquire(buffer_lock);
+
+	buffer_stats.bs_writes++;
+	if (result == 0) {
+		b->b_dirty = false;
+	}
+	return result;
+}
+
+/*
+ * Get a buffer to hold a new block: allocate one if we're under the
+ * limit, otherwise take the least recently used one that isn't
+ * busy, writing it back first if necessary. Returns the buffer
+ * busy and not on any hash chain. May sleep, and may drop the buffer
+ * lock.
+ */
+static
+struct buf *
+buffer_alloc(void)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+
+	if (buffer_stats.bs_numbufs < buffer_stats.bs_maxbufs) {
+		b = kmalloc(sizeof(*b));
+		if (b != NULL) {
+			b->b_data = kmalloc(BUFFER_SIZE);
+			if (b->b_data == NULL) {
+				kfree(b);
+				b = NULL;
+			}
+		}
+		if (b != NULL) {
+			b->b_hashnext = NULL;
+			b->b_hashpprev = NULL;
+			b->b_fs = NULL;
+			b->b_block = 0;
+			b->b_busy = true;
+			b->b_valid = false;
+			b->b_dirty = false;
+			b->b_readahead = false;
+			buffer_lru_prepend(b);
+			buffer_stats.bs_numbufs++;
+			return b;
+		}
+		/* Out of memory; fall back to recycling. */
+	}
+
+	while (1) {
+		for (b = buffer_lru.b_lrunext; b != &buffer_lru;
+		     b = b->b_lrunext) {
+			if (!b->b_busy) {
+				break;
+			}
+		}
+		if (b == &buffer_lru) {
+			/* Everything's in use; wait for something */
+			cv_wait(buffer_cv, buffer_lock);
+			continue;
+		}
+
+		b->b_busy = true;
+		if (b->b_dirty) {
+			result = buffer_writeout(b);
+			if (result) {
+				kprintf("buffer: block %u: write error: %s\n",
+					b->b_block, strerror(result));
+				/* Drop it; there's nothing better to do. */
+			}
+			if (b->b_fs != NULL) {
+				buffer_stats.bs_evictions++;
+			}
+			buffer_disown(b);
+			cv_broadcast(buffer_cv, buffer_lock);
+			return b;
+		}
+		if (b->b_fs != NULL) {
+			buffer_stats.bs_evictions++;
+		}
+		buffer_disown(b);
+		return b;
+	}
+}
+
+/*
+ * Common code for buffer_read and buffer_get.
+ */
+static
+int
+buffer_getinternal(struct fs *fs, daddr_t block, bool doread,
+		   struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	lock_acquire(buffer_lock);
+
+ again:
+	while ((b = buffer_find(fs, block)) != NULL && b->b_busy) {
+		cv_wait(buffer_cv, buffer_lock);
+	}
+
+	if (b != NULL) {
+		buffer_stats.bs_hits++;
+		if (b->b_readahead) {
+			buffer_stats.bs_rahits++;
+			b->b_readahead = false;
+		}
+		b->b_busy = true;
+	}
+	else {
+		b = buffer_alloc();
+		if (buffer_find(fs, block) != NULL) {
+			/*
+			 * buffer_alloc slept, and someone else loaded
+			 * the block meanwhile. Put ours back and use
+			 * theirs.
+			 */
+			b->b_busy = false;
+			cv_broadcast(buffer_cv, buffer_lock);
+			goto again;
+		}
+		buffer_stats.bs_misses++;
+		b->b_fs = fs;
+		b->b_block = block;
+		buffer_hash_add(b);
+	}
+	buffer_lru_remove(b);
+	buffer_lru_append(b);
+
+	if (doread && !b->b_valid) {
+		lock_release(buffer_lock);
+		result = FSOP_READBLOCK(fs, block, b->b_data, BUFFER_SIZE);
+		lock_acquire(buffer_lock);
+		buffer_stats.bs_reads++;
+		if (result) {
+			buffer_disown(b);
+			b->b_busy = false;
+			cv_broadcast(buffer_cv, buffer_lock);
+			lock_release(buffer_lock);
+			return result;
+		}
+		b->b_valid = true;
+	}
+
+	lock_release(buffer_lock);
+	*ret = b;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+void
+buffer_bootstrap(void)
+{
+	size_t maxbufs;
+
+	buffer_lock = lock_create("buffer cache");
+	buffer_cv = cv_create("buffer cache");
+	buffer_racv = cv_create("readahead");
+	if (buffer_lock == NULL || buffer_cv == NULL || buffer_racv == NULL) {
+		panic("buffer_bootstrap: Out of memory\n");
+	}
+
+	buffer_lru.b_lrunext = &buffer_lru;
+	buffer_lru.b_lruprev = &buffer_lru;
+
+	maxbufs = mainbus_ramsize() / BUFFER_MEMFRACTION / BUFFER_SIZE;
+	if (maxbufs < BUFFER_MINBUFS) {
+		maxbufs = BUFFER_MINBUFS;
+	}
+	if (maxbufs > BUFFER_MAXBUFS) {
+		maxbufs = BUFFER_MAXBUFS;
+	}
+	buffer_stats.bs_maxbufs = maxbufs;
+}
+
+int
+buffer_read(struct fs *fs, daddr_t block, struct buf **ret)
+{
+	return buffer_getinternal(fs, block, true, ret);
+}
+
+int
+buffer_get(struct fs *fs, daddr_t block, struct buf **ret)
+{
+	return buffer_getinternal(fs, block, false, ret);
+}
+
+void *
+buffer_map(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	return b->b_data;
+}
+
+bool
+buffer_is_valid(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	return b->b_valid;
+}
+
+void
+buffer_mark_valid(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	b->b_valid = true;
+}
+
+void
+buffer_mark_dirty(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	KASSERT(b->b_valid);
+	b->b_dirty = true;
+}
+
+void
+buffer_release(struct buf *b)
+{
+	lock_acquire(buffer_lock);
+	KASSERT(b->b_busy);
+	if (!b->b_valid) {
+		buffer_disown(b);
+	}
+	b->b_busy = false;
+	cv_broadcast(buffer_cv, buffer_lock);
+	lock_release(buffer_lock);
+}
+
+void
+buffer_release_and_invalidate(struct buf *b)
+{
+	lock_acquire(buffer_lock);
+	KASSERT(b->b_busy);
+	buffer_disown(b);
+	b->b_busy = false;
+	cv_broadcast(buffer_cv, buffer_lock);
+	lock_release(buffer_lock);
+}
+
+/*
+ * Write back one dirty buffer for buffer_sync_fs; on error, report it
+ * in *RET (if it's the first) and consider the buffer clean anyway
+ * rather than trying it over and over.
+ */
+static
+void
+buffer_syncone(struct buf *b, int *ret)
+{
+	int result;
+
+	KASSERT(!b->b_busy);
+	b->b_busy = true;
+	result = buffer_writeout(b);
+	b->b_busy = false;
+	cv_broadcast(buffer_cv, buffer_lock);
+	if (result) {
+		kprintf("buffer: block %u: write error: %s\n",
+			b->b_block, strerror(result));
+		b->b_dirty = false;
+		if (*ret == 0) {
+			*ret = result;
+		}
+	}
+}
+
+/*
+ * One buffer's I/O in flight, for buffer_sync_fs.
+ */
+struct buffer_io {
+	struct bio bi_bio;
+	struct buf *bi_buf;
+	struct semaphore *bi_sem;	/* V'd when done */
+	int bi_result;
+};
+
+static
+void
+buffer_iodone(struct bio *bio, int result)
+{
+	struct buffer_io *bi = bio->bio_arg;
+
+	bi->bi_result = result;
+	V(bi->bi_sem);
+}
+
+/*
+ * Start I/O on a bio, using the filesystem's asynchronous interface
+ * if it has one and doing it synchronously if not. Either way,
+ * bio_done gets called.
+ */
+static
+void
+buffer_submit(struct fs *fs, struct bio *bio)
+{
+	int result;
+
+	if (fs->fs_ops->fsop_submitblock != NULL) {
+		result = FSOP_SUBMITBLOCK(fs, bio);
+		if (result == 0) {
+			return;
+		}
+	}
+	else if (bio->bio_rw == UIO_READ) {
+		KASSERT(bio->bio_nblocks == 1);
+		result = FSOP_READBLOCK(fs, bio->bio_block, bio->bio_data,
+					BUFFER_SIZE);
+	}
+	else {
+		KASSERT(bio->bio_nblocks == 1);
+		result = FSOP_WRITEBLOCK(fs, bio->bio_block, bio->bio_data,
+					 BUFFER_SIZE);
+	}
+	bio->bio_done(bio, result);
+}
+
+/*
+ * Sort I/Os by block number (shell sort).
+ */
+static
+void
+buffer_sortios(struct buffer_io *ios, unsigned num)
+{
+	unsigned gap, i, j;
+	struct buffer_io tmp;
+
+	for (gap = num/2; gap > 0; gap /= 2) {
+		for (i=gap; i<num; i++) {
+			tmp = ios[i];
+			for (j=i; j>=gap && ios[j-gap].bi_buf->b_block >
+				     tmp.bi_buf->b_block; j -= gap) {
+				ios[j] = ios[j-gap];
+			}
+			ios[j] = tmp;
+		}
+	}
+}
+
+/*
+ * Write back, all at once, the dirty buffers of FS that aren't busy.
+ * They're submitted in block order and the driver queues them, so
+ * the disk never sits idle between them and the head sweeps across
+ * once instead of seeking back and forth. Does nothing if memory is
+ * short; buffer_sync_fs then does it the slow way.
+ */
+static
+void
+buffer_writebatch(struct fs *fs, int *ret)
+{
+	struct buf *b;
+	struct buffer_io *ios;
+	struct semaphore *sem;
+	unsigned num, i;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+
+	num = 0;
+	for (b = buffer_lru.b_lrunext; b != &buffer_lru; b = b->b_lrunext) {
+		if (b->b_fs == fs && b->b_dirty && !b->b_busy) {
+			num++;
+		}
+	}
+	if (num == 0) {
+		return;
+	}
+
+	ios = kmalloc(num * sizeof(ios[0]));
+	if (ios == NULL) {
+		return;
+	}
+	sem = sem_create("buffer sync", 0);
+	if (sem == NULL) {
+		kfree(ios);
+		return;
+	}
+
+	/* We've held the lock all along, so the count still holds. */
+	i = 0;
+	for (b = buffer_lru.b_lrunext; b != &buffer_lru; b = b->b_lrunext) {
+		if (b->b_fs == fs && b->b_dirty && !b->b_busy) {
+			b->b_busy = true;
+			ios[i].bi_buf = b;
+			ios[i].bi_sem = sem;
+			i++;
+		}
+	}
+	KASSERT(i == num);
+	buffer_sortios(ios, num);
+
+	lock_release(buffer_lock);
+	for (i=0; i<num; i++) {
+		b = ios[i].bi_buf;
+		ios[i].bi_bio.bio_block = b->b_block;
+		ios[i].bi_bio.bio_nblocks = 1;
+		ios[i].bi_bio.bio_rw = UIO_WRITE;
+		ios[i].bi_bio.bio_data = b->b_data;
+		ios[i].bi_bio.bio_done = buffer_iodone;
+		ios[i].bi_bio.bio_arg = &ios[i];
+		buffer_submit(fs, &ios[i].bi_bio);
+	}
+	for (i=0; i<num; i++) {
+		P(sem);
+	}
+	lock_acquire(buffer_lock);
+
+	for (i=0; i<num; i++) {
+		b = ios[i].bi_buf;
+		buffer_stats.bs_writes++;
+		if (ios[i].bi_result) {
+			/* As in buffer_syncone */
+			kprintf("buffer: block %u: write error: %s\n",
+				b->b_block, strerror(ios[i].bi_result));
+			if (*ret == 0) {
+				*ret = ios[i].bi_result;
+			}
+		}
+		b->b_dirty = false;
+		b->b_busy = false;
+	}
+	cv_broadcast(buffer_cv, buffer_lock);
+
+	sem_destroy(sem);
+	kfree(ios);
+}
+
+/*
+ * Write back everything dirty belonging to FS.
+ *
+ * First, write what's dirty now as one batch. Then, since the lock
+ * is dropped for that, go back and pick up anything that was busy
+ * or got dirtied in the meantime, starting over from the top after
+ * each write; buffers written become clean, so this terminates.
+ */
+int
+buffer_sync_fs(struct fs *fs)
+{
+	struct buf *b;
+	int ret = 0;
+
+	lock_acquire(buffer_lock);
+
+	buffer_writebatch(fs, &ret);
+
+ again:
+	for (b = buffer_lru.b_lrunext; b != &buffer_lru; b = b->b_lrunext) {
+		if (b->b_fs != fs || !b->b_dirty) {
+			continue;
+		}
+		if (b->b_busy) {
+			cv_wait(buffer_cv, buffer_lock);
+			goto again;
+		}
+		buffer_syncone(b, &ret);
+		goto again;
+	}
+	lock_release(buffer_lock);
+	return ret;
+}
+
+void
+buffer_drop_fs(struct fs *fs)
+{
+	struct buf *b, *next;
+	unsigned i;
+
+	lock_acquire(buffer_lock);
+
+	/*
+	 * Cancel any readahead for FS, and wait for the reader thread
+	 * in case it's got some in hand.
+	 */
+	for (i=0; i<buffer_raqcount; i++) {
+		struct buffer_rareq *rr;
+
+		rr = &buffer_raq[(buffer_raqhead + i) % BUFFER_RAQSIZE];
+		if (rr->rr_fs == fs) {
+			rr->rr_fs = NULL;
+		}
+	}
+	while (buffer_rabusy) {
+		cv_wait(buffer_cv, buffer_lock);
+	}
+
+	for (b = buffer_lru.b_lrunext; b != &buffer_lru; b = next) {
+		next = b->b_lrunext;
+		if (b->b_fs != fs) {
+			continue;
+		}
+		KASSERT(!b->b_busy);
+		KASSERT(!b->b_dirty);
+		b->b_busy = true;
+		buffer_disown(b);
+		b->b_busy = false;
+	}
+	lock_release(buffer_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Background threads
+
+/*
+ * The syncer thread. Dirty buffers are otherwise only written when
+ * they get evicted, so every few seconds sync all filesystems, which
+ * writes back their inodes and such into the cache and then the
+ * cache to disk. This bounds how much is lost in a crash.
+ */
+static
+void
+buffer_syncer(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		thread_sleep_ticks(BUFFER_SYNCSECS * HZ);
+		vfs_sync();
+	}
+}
+
+/*
+ * Load a batch of blocks from the readahead queue. Buffers for them
+ * are set up and marked busy (so anyone who asks for one meanwhile
+ * waits for it) and the reads are all submitted before waiting for
+ * any of them.
+ *
+ * The batch is kept to a quarter of the pool. The buffers in it stay
+ * busy while buffer_alloc is called for the next one, and on a small
+ * machine a full batch could be the whole pool; then we'd wait for
+ * ourselves, or for a filesystem thread that holds one buffer while
+ * it gets another.
+ */
+static
+void
+buffer_readbatch(struct buffer_io *ios, struct semaphore *sem)
+{
+	struct buffer_rareq rr;
+	struct buf *b;
+	unsigned num, max, i;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+
+	max = buffer_stats.bs_maxbufs / 4;
+	if (max > BUFFER_RABATCH) {
+		max = BUFFER_RABATCH;
+	}
+	if (max == 0) {
+		max = 1;
+	}
+
+	num = 0;
+	while (buffer_raqcount > 0 && num < max) {
+		rr = buffer_raq[buffer_raqhead];
+		buffer_raqhead = (buffer_raqhead + 1) % BUFFER_RAQSIZE;
+		buffer_raqcount--;
+
+		if (rr.rr_fs == NULL ||
+		    buffer_find(rr.rr_fs, rr.rr_block) != NULL) {
+			continue;
+		}
+		b = buffer_alloc();
+		if (buffer_find(rr.rr_fs, rr.rr_block) != NULL) {
+			/* Someone else loaded it while we slept */
+			b->b_busy = false;
+			cv_broadcast(buffer_cv, buffer_lock);
+			continue;
+		}
+		b->b_fs = rr.rr_fs;
+		b->b_block = rr.rr_block;
+		b->b_readahead = true;
+		buffer_hash_add(b);
+		buffer_lru_remove(b);
+		buffer_lru_append(b);
+
+		ios[num].bi_buf = b;
+		ios[num].bi_sem = sem;
+		num++;
+	}
+	if (num == 0) {
+		return;
+	}
+
+	lock_release(buffer_lock);
+	for (i=0; i<num; i++) {
+		b = ios[i].bi_buf;
+		ios[i].bi_bio.bio_block = b->b_block;
+		ios[i].bi_bio.bio_nblocks = 1;
+		ios[i].bi_bio.bio_rw = UIO_READ;
+		ios[i].bi_bio.bio_data = b->b_data;
+		ios[i].bi_bio.bio_done = buffer_iodone;
+		ios[i].bi_bio.bio_arg = &ios[i];
+		buffer_submit(b->b_fs, &ios[i].bi_bio);
+	}
+	for (i=0; i<num; i++) {
+		P(sem);
+	}
+	lock_acquire(buffer_lock);
+
+	for (i=0; i<num; i++) {
+		b = ios[i].bi_buf;
+		buffer_stats.bs_reads++;
+		buffer_stats.bs_raissued++;
+		if (ios[i].bi_result == 0) {
+			b->b_valid = true;
+		}
+		else {
+			/* Never mind; whoever wants it will try again. */
+			buffer_disown(b);
+		}
+		b->b_busy = false;
+	}
+	cv_broadcast(buffer_cv, buffer_lock);
+}
+
+/*
+ * The reader thread, which does readahead.
+ */
+static
+void
+buffer_reader(void *data1, unsigned long data2)
+{
+	struct buffer_io *ios;
+	struct semaphore *sem;
+
+	(void)data1;
+	(void)data2;
+
+	ios = kmalloc(BUFFER_RABATCH * sizeof(ios[0]));
+	sem = sem_create("readahead", 0);
+	if (ios == NULL || sem == NULL) {
+		panic("buffer_reader: Out of memory\n");
+	}
+
+	lock_acquire(buffer_lock);
+	while (1) {
+		while (buffer_raqcount == 0) {
+			cv_wait(buffer_racv, buffer_lock);
+		}
+		buffer_rabusy = true;
+		buffer_readbatch(ios, sem);
+		buffer_rabusy = false;
+		cv_broadcast(buffer_cv, buffer_lock);
+	}
+}
+
+/*
+ * Queue blocks to be read ahead. Blocks already cached are skipped,
+ * and if the queue is full the rest are dropped; readahead is only
+ * a hint.
+ */
+void
+buffer_readahead(struct fs *fs, const daddr_t *blocks, unsigned num)
+{
+	struct buffer_rareq *rr;
+	unsigned i;
+	bool queued = false;
+
+	lock_acquire(buffer_lock);
+	for (i=0; i<num && buffer_raqcount < BUFFER_RAQSIZE; i++) {
+		if (buffer_find(fs, blocks[i]) != NULL) {
+			continue;
+		}
+		rr = &buffer_raq[(buffer_raqhead + buffer_raqcount) %
+				 BUFFER_RAQSIZE];
+		rr->rr_fs = fs;
+		rr->rr_block = blocks[i];
+		buffer_raqcount++;
+		queued = true;
+	}
+	if (queued) {
+		cv_signal(buffer_racv, buffer_lock);
+	}
+	lock_release(buffer_lock);
+}
+
+void
+buffer_start_threads(void)
+{
+	int result;
+
+	result = thread_fork("syncer", NULL, buffer_syncer, NULL, 0);
+	if (result) {
+		panic("buffer_start_threads: thread_fork: %s\n",
+		      strerror(result));
+	}
+	result = thread_fork("reader", NULL, buffer_reader, NULL, 0);
+	if (result) {
+		panic("buffer_start_threads: thread_fork: %s\n",
+		      strerror(result));
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Stats
+
+void
+buffer_getstats(struct bufstats *bs)
+{
+	lock_acquire(buffer_lock);
+	*bs = buffer_stats;
+	lock_release(buffer_lock);
+}
+
+void
+buffer_resetstats(void)
+{
+	lock_acquire(buffer_lock);
+	buffer_stats.bs_hits = 0;
+	buffer_stats.bs_misses = 0;
+	buffer_stats.bs_reads = 0;
+	buffer_stats.bs_writes = 0;
+	buffer_stats.bs_evictions = 0;
+	buffer_stats.bs_raissued = 0;
+	buffer_stats.bs_rahits = 0;
+	buffer_stats.bs_rawasted = 0;
+	lock_release(buffer_lock);
+}
+
+void
+buffer_printstats(void)
+{
+	struct bufstats bs;
+	unsigned lookups;
+
+	buffer_getstats(&bs);
+	lookups = bs.bs_hits + bs.bs_misses;
+
+	kprintf("Buffer cache: %u of %u buffers (%u bytes each) in use\n",
+		bs.bs_numbufs, bs.bs_maxbufs, BUFFER_SIZE);
+	kprintf("    %u lookups, %u hits, %u misses (%u%% hit rate)\n",
+		lookups, bs.bs_hits, bs.bs_misses,
+		lookups == 0 ? 0 : bs.bs_hits * 100 / lookups);
+	kprintf("    %u reads, %u writes, %u evictions\n",
+		bs.bs_reads, bs.bs_writes, bs.bs_evictions);
+	kprintf("    %u blocks read ahead, %u used, %u wasted "
+		"(%u%% hit rate)\n",
+		bs.bs_raissued, bs.bs_rahits, bs.bs_rawasted,
+		bs.bs_raissued == 0 ? 0 :
+		bs.bs_rahits * 100 / bs.bs_raissued);
+}
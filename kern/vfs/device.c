@@ -248,6 +248,22 @@ dev_mmap(struct vnode *v  /* add stuff as needed */)
 	return ENOSYS;
 }
 
+/*
+ * For poll(). Devices without a poll function never make anyone wait
+ * except for their own I/O to complete, so count them as ready.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, struct pollwait *pw)
+{
+	struct device *d = v->vn_data;
+
+	if (!DEVOP_CANPOLL(d)) {
+		return vopready_poll(v, events, pw);
+	}
+	return DEVOP_POLL(d, events, pw);
+}
+
 /*
  * For ftruncate().
  */
@@ -330,6 +346,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_read = dev_read,
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_dirents_notdir,
 	.vop_write = dev_write,
 	.vop_ioctl = dev_ioctl,
 	.vop_stat = dev_stat,
@@ -337,6 +354,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_isseekable = dev_isseekable,
 	.vop_fsync = null_fsync,
 	.vop_mmap = dev_mmap,
+	.vop_poll = dev_poll,
 	.vop_truncate = dev_truncate,
 	.vop_namefile = dev_namefile,
 	.vop_creat = vopfail_creat_notdir,
@@ -0,0 +1,506 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Anonymous pipes.
+ *
+ * A pipe is a ring buffer with a vnode in front of each end. The
+ * buffer size is a power of two, so the read and write positions are
+ * free-running byte counts: the number of bytes buffered is just
+ * their difference, and the low bits index the buffer. They are
+ * allowed to wrap.
+ *
+ * Readers sleep on p_readcv while the pipe is empty and writers on
+ * p_writecv while it is full. When the last reference to one end
+ * goes away the other side is woken up: readers then see EOF once
+ * the buffer drains, and writers get EPIPE.
+ *
+ * poll() waiters are on p_readpq and p_writepq, which are woken
+ * alongside the condition variables.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vnode.h>
+#include <poll.h>
+#include <pipe.h>
+
+/* Buffer size; must be a power of two */
+#define PIPE_SIZE	4096
+#define PIPE_MASK	(PIPE_SIZE - 1)
+
+struct pipe {
+	struct vnode p_readvn;		/* read end */
+	struct vnode p_writevn;		/* write end */
+
+	struct lock *p_lock;		/* protects everything below */
+	struct cv *p_readcv;		/* readers wait here for data */
+	struct cv *p_writecv;		/* writers wait here for space */
+	struct pollqueue p_readpq;	/* pollers of the read end */
+	struct pollqueue p_writepq;	/* pollers of the write end */
+	char *p_buf;			/* PIPE_SIZE bytes */
+	unsigned p_readpos;		/* total bytes ever read */
+	unsigned p_writepos;		/* total bytes ever written */
+	bool p_readclosed;		/* read end is gone */
+	bool p_writeclosed;		/* write end is gone */
+	bool p_nonblock;		/* fail with EAGAIN, don't sleep */
+};
+
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	pollqueue_cleanup(&p->p_writepq);
+	pollqueue_cleanup(&p->p_readpq);
+	cv_destroy(p->p_writecv);
+	cv_destroy(p->p_readcv);
+	lock_destroy(p->p_lock);
+	kfree(p->p_buf);
+	kfree(p);
+}
+
+/*
+ * Called when the last reference to one end is dropped. Mark that
+ * end closed and wake up the other side; whichever end goes second
+ * frees the pipe.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	bool last;
+
+	lock_acquire(p->p_lock);
+	if (v == &p->p_readvn) {
+		p->p_readclosed = true;
+		cv_broadcast(p->p_writecv, p->p_lock);
+		pollqueue_wakeup(&p->p_writepq);
+	}
+	else {
+		KASSERT(v == &p->p_writevn);
+		p->p_writeclosed = true;
+		cv_broadcast(p->p_readcv, p->p_lock);
+		pollqueue_wakeup(&p->p_readpq);
+	}
+	vnode_cleanup(v);
+	last = p->p_readclosed && p->p_writeclosed;
+	lock_release(p->p_lock);
+
+	if (last) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+/*
+ * Read: wait until there is something to read (or the write end is
+ * gone), then take as much as is there, up to the size requested.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	unsigned avail, pos;
+	size_t len;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	lock_acquire(p->p_lock);
+	while (p->p_writepos == p->p_readpos) {
+		if (p->p_writeclosed || uio->uio_resid == 0) {
+			/* EOF */
+			lock_release(p->p_lock);
+			return 0;
+		}
+		if (p->p_nonblock) {
+			lock_release(p->p_lock);
+			return EAGAIN;
+		}
+		cv_wait(p->p_readcv, p->p_lock);
+	}
+
+	/* At most two pieces: up to the end of the buffer, then the rest */
+	while (uio->uio_resid > 0 && p->p_writepos != p->p_readpos) {
+		avail = p->p_writepos - p->p_readpos;
+		pos = p->p_readpos & PIPE_MASK;
+		len = PIPE_SIZE - pos;
+		if (len > avail) {
+			len = avail;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + pos, len, uio);
+		if (result) {
+			break;
+		}
+		p->p_readpos += len;
+	}
+
+	cv_broadcast(p->p_writecv, p->p_lock);
+	pollqueue_wakeup(&p->p_writepq);
+	lock_release(p->p_lock);
+	return result;
+}
+
+/*
+ * Write: copy in as space becomes available until it's all written.
+ * Readers are woken after each piece, so a write larger than the
+ * buffer streams through it. If the read end goes away (or, when
+ * nonblocking, the pipe fills) after some bytes were written, report
+ * the short write rather than the error.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	size_t startresid = uio->uio_resid;
+	unsigned space, pos;
+	size_t len;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	lock_acquire(p->p_lock);
+	while (uio->uio_resid > 0) {
+		if (p->p_readclosed) {
+			result = EPIPE;
+			break;
+		}
+		space = PIPE_SIZE - (p->p_writepos - p->p_readpos);
+		if (space == 0) {
+			if (p->p_nonblock) {
+				result = EAGAIN;
+				break;
+			}
+			cv_wait(p->p_writecv, p->p_lock);
+			continue;
+		}
+
+		pos = p->p_writepos & PIPE_MASK;
+		len = PIPE_SIZE - pos;
+		if (len > space) {
+			len = space;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + pos, len, uio);
+		if (result) {
+			break;
+		}
+		p->p_writepos += len;
+		cv_broadcast(p->p_readcv, p->p_lock);
+		pollqueue_wakeup(&p->p_readpq);
+	}
+	lock_release(p->p_lock);
+
+	if ((result == EPIPE || result == EAGAIN) &&
+	    uio->uio_resid < startresid) {
+		result = 0;
+	}
+	return result;
+}
+
+/*
+ * The read end can't be written and vice versa. The file table
+ * checks the open mode first, so these are only a backstop.
+ */
+static
+int
+pipe_badio(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EBADF;
+}
+
+/*
+ * Readiness for poll(). The read end is readable when there's data
+ * or EOF, and reports POLLHUP once the write end is gone; the write
+ * end is writable when there's space, and reports POLLERR once the
+ * read end is gone (a write would fail with EPIPE).
+ */
+static
+int
+pipe_poll(struct vnode *v, int events, struct pollwait *pw)
+{
+	struct pipe *p = v->vn_data;
+	unsigned used;
+	int revents = 0;
+
+	lock_acquire(p->p_lock);
+	used = p->p_writepos - p->p_readpos;
+	if (v == &p->p_readvn) {
+		pollqueue_register(&p->p_readpq, pw);
+		if (used > 0 || p->p_writeclosed) {
+			revents |= events & POLLIN;
+		}
+		if (p->p_writeclosed) {
+			revents |= POLLHUP;
+		}
+	}
+	else {
+		pollqueue_register(&p->p_writepq, pw);
+		if (p->p_readclosed) {
+			revents |= POLLERR;
+		}
+		else if (used < PIPE_SIZE) {
+			revents |= events & POLLOUT;
+		}
+	}
+	lock_release(p->p_lock);
+
+	return revents;
+}
+
+/*
+ * Pipes are never opened by name, so there's nothing to check.
+ */
+static
+int
+pipe_eachopen(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return 0;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+/*
+ * Report a FIFO, with the number of bytes currently buffered as
+ * its size.
+ */
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+
+	lock_acquire(p->p_lock);
+	statbuf->st_size = p->p_writepos - p->p_readpos;
+	lock_release(p->p_lock);
+
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PIPE_SIZE;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+pipe_lookup(struct vnode *dir, char *pathname, struct vnode **result)
+{
+	(void)dir;
+	(void)pathname;
+	(void)result;
+	return ENOTDIR;
+}
+
+/*
+ * Function tables for the two ends.
+ */
+static const struct vnode_ops pipe_read_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+	.vop_read = pipe_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_dirents_notdir,
+	.vop_write = pipe_badio,
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_fsync = pipe_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_poll = pipe_poll,
+	.vop_truncate = pipe_truncate,
+	.vop_namefile = vopfail_uio_nosys,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = pipe_lookup,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+static const struct vnode_ops pipe_write_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+	.vop_read = pipe_badio,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_dirents_notdir,
+	.vop_write = pipe_write,
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_fsync = pipe_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_poll = pipe_poll,
+	.vop_truncate = pipe_truncate,
+	.vop_namefile = vopfail_uio_nosys,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = pipe_lookup,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+/*
+ * Make a new pipe.
+ */
+int
+pipe_create(bool nonblock, struct vnode **readret, struct vnode **writeret)
+{
+	struct pipe *p;
+	int result;
+
+	p = kmalloc(sizeof(struct pipe));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_buf = kmalloc(PIPE_SIZE);
+	if (p->p_buf == NULL) {
+		kfree(p);
+		return ENOMEM;
+	}
+	p->p_lock = lock_create("pipe");
+	if (p->p_lock == NULL) {
+		goto fail_buf;
+	}
+	p->p_readcv = cv_create("pipe read");
+	if (p->p_readcv == NULL) {
+		goto fail_lock;
+	}
+	p->p_writecv = cv_create("pipe write");
+	if (p->p_writecv == NULL) {
+		goto fail_readcv;
+	}
+	p->p_readpos = 0;
+	p->p_writepos = 0;
+	p->p_readclosed = false;
+	p->p_writeclosed = false;
+	p->p_nonblock = nonblock;
+	pollqueue_init(&p->p_readpq);
+	pollqueue_init(&p->p_writepq);
+
+	result = vnode_init(&p->p_readvn, &pipe_read_vnode_ops, NULL, p);
+	if (result) {
+		goto fail_pq;
+	}
+	result = vnode_init(&p->p_writevn, &pipe_write_vnode_ops, NULL, p);
+	if (result) {
+		vnode_cleanup(&p->p_readvn);
+		goto fail_pq;
+	}
+
+	*readret = &p->p_readvn;
+	*writeret = &p->p_writevn;
+	return 0;
+
+ fail_pq:
+	pollqueue_cleanup(&p->p_writepq);
+	pollqueue_cleanup(&p->p_readpq);
+	cv_destroy(p->p_writecv);
+ fail_readcv:
+	cv_destroy(p->p_readcv);
+ fail_lock:
+	lock_destroy(p->p_lock);
+ fail_buf:
+	kfree(p->p_buf);
+	kfree(p);
+	return ENOMEM;
+}
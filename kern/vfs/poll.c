@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Wait queues for poll(). See poll.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <wchan.h>
+#include <vnode.h>
+#include <poll.h>
+
+/*
+ * Queue setup and teardown.
+ */
+void
+pollqueue_init(struct pollqueue *pq)
+{
+	spinlock_init(&pq->pq_lock);
+	pq->pq_entries = NULL;
+}
+
+void
+pollqueue_cleanup(struct pollqueue *pq)
+{
+	KASSERT(pq->pq_entries == NULL);
+	spinlock_cleanup(&pq->pq_lock);
+}
+
+/*
+ * Hook PW onto PQ, using the next of its preallocated entries.
+ */
+void
+pollqueue_register(struct pollqueue *pq, struct pollwait *pw)
+{
+	struct pollentry *pe;
+
+	if (pw == NULL) {
+		return;
+	}
+
+	KASSERT(pw->pw_numentries < pw->pw_maxentries);
+	pe = &pw->pw_entries[pw->pw_numentries++];
+	pe->pe_queue = pq;
+	pe->pe_wait = pw;
+
+	spinlock_acquire(&pq->pq_lock);
+	pe->pe_next = pq->pq_entries;
+	pq->pq_entries = pe;
+	spinlock_release(&pq->pq_lock);
+}
+
+/*
+ * Wake everyone on PQ. Lock order is queue, then pollwait.
+ */
+void
+pollqueue_wakeup(struct pollqueue *pq)
+{
+	struct pollentry *pe;
+	struct pollwait *pw;
+
+	spinlock_acquire(&pq->pq_lock);
+	for (pe = pq->pq_entries; pe != NULL; pe = pe->pe_next) {
+		pw = pe->pe_wait;
+		spinlock_acquire(&pw->pw_lock);
+		pw->pw_woken = true;
+		wchan_wakeall(pw->pw_wchan, &pw->pw_lock);
+		spinlock_release(&pw->pw_lock);
+	}
+	spinlock_release(&pq->pq_lock);
+}
+
+/*
+ * Poller setup.
+ */
+int
+pollwait_init(struct pollwait *pw, unsigned maxentries)
+{
+	pw->pw_entries = NULL;
+	if (maxentries > 0) {
+		pw->pw_entries = kmalloc(maxentries * sizeof(struct pollentry));
+		if (pw->pw_entries == NULL) {
+			return ENOMEM;
+		}
+	}
+	pw->pw_wchan = wchan_create("poll");
+	if (pw->pw_wchan == NULL) {
+		kfree(pw->pw_entries);
+		return ENOMEM;
+	}
+	spinlock_init(&pw->pw_lock);
+	pw->pw_woken = false;
+	pw->pw_timedout = false;
+	pw->pw_numentries = 0;
+	pw->pw_maxentries = maxentries;
+	return 0;
+}
+
+/*
+ * Take PW off every queue it was registered on, and tear it down.
+ * Once off the queues nobody else can find it, so there's no need
+ * to lock it for the rest.
+ */
+void
+pollwait_cleanup(struct pollwait *pw)
+{
+	struct pollentry *pe, **pep;
+	struct pollqueue *pq;
+	unsigned i;
+
+	for (i=0; i<pw->pw_numentries; i++) {
+		pe = &pw->pw_entries[i];
+		pq = pe->pe_queue;
+
+		spinlock_acquire(&pq->pq_lock);
+		for (pep = &pq->pq_entries; *pep != pe; pep = &(*pep)->pe_next) {
+			KASSERT(*pep != NULL);
+		}
+		*pep = pe->pe_next;
+		spinlock_release(&pq->pq_lock);
+	}
+
+	wchan_destroy(pw->pw_wchan);
+	spinlock_cleanup(&pw->pw_lock);
+	kfree(pw->pw_entries);
+}
+
+void
+pollwait_reset(struct pollwait *pw)
+{
+	spinlock_acquire(&pw->pw_lock);
+	pw->pw_woken = false;
+	spinlock_release(&pw->pw_lock);
+}
+
+void
+pollwait_sleep(struct pollwait *pw)
+{
+	spinlock_acquire(&pw->pw_lock);
+	while (!pw->pw_woken) {
+		wchan_sleep(pw->pw_wchan, &pw->pw_lock);
+	}
+	spinlock_release(&pw->pw_lock);
+}
+
+void
+pollwait_timeout(void *data)
+{
+	struct pollwait *pw = data;
+
+	spinlock_acquire(&pw->pw_lock);
+	pw->pw_timedout = true;
+	pw->pw_woken = true;
+	wchan_wakeall(pw->pw_wchan, &pw->pw_lock);
+	spinlock_release(&pw->pw_lock);
+}
+
+/*
+ * VOP_POLL for files that never block: regular files, directories.
+ */
+int
+vopready_poll(struct vnode *vn, int events, struct pollwait *pw)
+{
+	(void)vn;
+	(void)pw;
+	return events & (POLLIN | POLLOUT);
+}
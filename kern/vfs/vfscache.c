@@ -0,0 +1,493 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Name lookup cache.
+ *
+ * This remembers the results of looking up single path components:
+ * a (directory vnode, name) pair maps either to the vnode found or,
+ * for a negative entry, to "no such file". The path walk in
+ * vfslookup.c checks here before calling VOP_LOOKUP, so commonly
+ * used paths like /bin/sh don't go to the filesystem at all.
+ *
+ * Each entry holds a reference to its directory and (if positive) to
+ * the vnode it names, so the pointers stay good. That means entries
+ * have to be dropped before a filesystem can be unmounted; see
+ * vfs_dcache_purge.
+ *
+ * The vfs operations that change directories (vfspath.c) bracket
+ * the filesystem call with vfs_dcache_begin and vfs_dcache_end on
+ * each name they touch. Begin drops the entry before the filesystem
+ * starts changing things, so nobody keeps getting the old answer
+ * from the cache meanwhile, and marks the name's hash bucket busy;
+ * nothing is entered in a busy bucket, so a lookup racing with the
+ * change can't put back an answer that is about to go stale. Both
+ * ends also bump a generation number, and a lookup result is only
+ * entered if the generation hasn't moved since the lookup started;
+ * that covers a slow lookup that began before the change and
+ * finishes after it. Changes made to an emufs volume from outside
+ * the system are of course not seen.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vfs.h>
+#include <vnode.h>
+
+/* Longest name cached, plus one. Longer names always miss. */
+#define DC_NAMELEN		32
+
+/* Number of entries. */
+#define DC_NENTRIES		256
+
+/* Number of hash buckets; a power of two. */
+#define DC_NBUCKETS		128
+
+struct dcentry {
+	struct dcentry *dc_hashnext;	/* hash chain */
+	struct dcentry *dc_newer;	/* LRU list, toward most recent */
+	struct dcentry *dc_older;	/* LRU list, toward least recent */
+	struct vnode *dc_dir;		/* directory; NULL if entry unused */
+	struct vnode *dc_vn;		/* result; NULL if negative */
+	unsigned dc_hash;		/* hash of dc_dir and dc_name */
+	char dc_name[DC_NAMELEN];	/* component name */
+};
+
+/*
+ * The cache. This is all protected by dcache_lock, which is a leaf
+ * lock: vnodes dropped from the cache are decref'd only after it is
+ * released, since that can call into the filesystem.
+ */
+static struct spinlock dcache_lock = SPINLOCK_INITIALIZER;
+static struct dcentry dcache_entries[DC_NENTRIES];
+static struct dcentry *dcache_buckets[DC_NBUCKETS];
+static struct dcentry *dcache_oldest, *dcache_newest;
+static unsigned dcache_gen;
+static unsigned dcache_busy[DC_NBUCKETS];	/* changes in progress */
+
+static struct {
+	unsigned lookups;		/* calls to vfs_dcache_lookup */
+	unsigned hits;			/* found a vnode */
+	unsigned neghits;		/* found a negative entry */
+	unsigned enters;		/* entries made */
+	unsigned invalidations;		/* entries dropped for changes */
+	unsigned evictions;		/* entries reused */
+} dcache_stats;
+
+////////////////////////////////////////////////////////////
+// Internals
+
+/*
+ * Hash a directory and name (FNV-1a over the name, mixed with the
+ * directory pointer).
+ */
+static
+unsigned
+dcache_hash(struct vnode *dir, const char *name)
+{
+	unsigned hash = 2166136261U;
+
+	while (*name != 0) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	hash ^= (unsigned)(uintptr_t)dir >> 4;
+	return hash;
+}
+
+/*
+ * Take E off the LRU list.
+ */
+static
+void
+dcache_lru_unlink(struct dcentry *e)
+{
+	if (e->dc_older != NULL) {
+		e->dc_older->dc_newer = e->dc_newer;
+	}
+	else {
+		dcache_oldest = e->dc_newer;
+	}
+	if (e->dc_newer != NULL) {
+		e->dc_newer->dc_older = e->dc_older;
+	}
+	else {
+		dcache_newest = e->dc_older;
+	}
+	e->dc_newer = e->dc_older = NULL;
+}
+
+/*
+ * Put E on the most recently used end of the LRU list.
+ */
+static
+void
+dcache_lru_addnewest(struct dcentry *e)
+{
+	e->dc_older = dcache_newest;
+	e->dc_newer = NULL;
+	if (dcache_newest != NULL) {
+		dcache_newest->dc_newer = e;
+	}
+	else {
+		dcache_oldest = e;
+	}
+	dcache_newest = e;
+}
+
+/*
+ * Put E on the least recently used end of the LRU list, so it's
+ * reused first.
+ */
+static
+void
+dcache_lru_addoldest(struct dcentry *e)
+{
+	e->dc_newer = dcache_oldest;
+	e->dc_older = NULL;
+	if (dcache_oldest != NULL) {
+		dcache_oldest->dc_older = e;
+	}
+	else {
+		dcache_newest = e;
+	}
+	dcache_oldest = e;
+}
+
+/*
+ * Find the entry for DIR and NAME, if any.
+ */
+static
+struct dcentry *
+dcache_find(struct vnode *dir, const char *name, unsigned hash)
+{
+	struct dcentry *e;
+
+	KASSERT(spinlock_do_i_hold(&dcache_lock));
+
+	for (e = dcache_buckets[hash % DC_NBUCKETS];
+	     e != NULL;
+	     e = e->dc_hashnext) {
+		if (e->dc_hash == hash && e->dc_dir == dir &&
+		    !strcmp(e->dc_name, name)) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Empty out entry E. The references it held are handed back in
+ * *DIR and *VN for the caller to drop once the lock is released.
+ */
+static
+void
+dcache_clear(struct dcentry *e, struct vnode **dir, struct vnode **vn)
+{
+	struct dcentry **ep;
+
+	KASSERT(spinlock_do_i_hold(&dcache_lock));
+	KASSERT(e->dc_dir != NULL);
+
+	ep = &dcache_buckets[e->dc_hash % DC_NBUCKETS];
+	while (*ep != e) {
+		KASSERT(*ep != NULL);
+		ep = &(*ep)->dc_hashnext;
+	}
+	*ep = e->dc_hashnext;
+	e->dc_hashnext = NULL;
+
+	*dir = e->dc_dir;
+	*vn = e->dc_vn;
+	e->dc_dir = NULL;
+	e->dc_vn = NULL;
+	e->dc_name[0] = 0;
+
+	dcache_lru_unlink(e);
+	dcache_lru_addoldest(e);
+}
+
+/*
+ * Drop the references from an entry that's been cleared.
+ */
+static
+void
+dcache_release(struct vnode *dir, struct vnode *vn)
+{
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+	if (dir != NULL) {
+		VOP_DECREF(dir);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+/*
+ * Setup function.
+ */
+void
+vfs_dcache_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<DC_NENTRIES; i++) {
+		dcache_entries[i].dc_dir = NULL;
+		dcache_entries[i].dc_vn = NULL;
+		dcache_entries[i].dc_hashnext = NULL;
+		dcache_lru_addoldest(&dcache_entries[i]);
+	}
+	for (i=0; i<DC_NBUCKETS; i++) {
+		dcache_buckets[i] = NULL;
+		dcache_busy[i] = 0;
+	}
+	dcache_gen = 0;
+}
+
+/*
+ * Look up NAME in DIR. Returns true if the cache knows the answer:
+ * then *RET is the vnode, with a reference, or NULL if the name is
+ * known not to exist. Otherwise, hands back the generation number to
+ * pass to vfs_dcache_enter once the filesystem has been asked.
+ */
+bool
+vfs_dcache_lookup(struct vnode *dir, const char *name,
+		  struct vnode **ret, unsigned *gen)
+{
+	struct dcentry *e;
+
+	spinlock_acquire(&dcache_lock);
+	dcache_stats.lookups++;
+	*gen = dcache_gen;
+	if (strlen(name) >= DC_NAMELEN) {
+		spinlock_release(&dcache_lock);
+		return false;
+	}
+
+	e = dcache_find(dir, name, dcache_hash(dir, name));
+	if (e == NULL) {
+		spinlock_release(&dcache_lock);
+		return false;
+	}
+
+	if (e->dc_vn != NULL) {
+		VOP_INCREF(e->dc_vn);
+		dcache_stats.hits++;
+	}
+	else {
+		dcache_stats.neghits++;
+	}
+	*ret = e->dc_vn;
+
+	dcache_lru_unlink(e);
+	dcache_lru_addnewest(e);
+
+	spinlock_release(&dcache_lock);
+	return true;
+}
+
+/*
+ * Remember that NAME in DIR is VN (or, if VN is NULL, doesn't
+ * exist). GEN is what vfs_dcache_lookup handed back before the
+ * lookup was done; if anything has been invalidated since, or a
+ * change to a name in the same bucket is still in progress, the
+ * result might be stale and is not entered.
+ */
+void
+vfs_dcache_enter(struct vnode *dir, const char *name, struct vnode *vn,
+		 unsigned gen)
+{
+	struct vnode *olddir = NULL, *oldvn = NULL;
+	struct dcentry *e;
+	unsigned hash;
+
+	if (strlen(name) >= DC_NAMELEN) {
+		return;
+	}
+	hash = dcache_hash(dir, name);
+
+	spinlock_acquire(&dcache_lock);
+	if (gen != dcache_gen || dcache_busy[hash % DC_NBUCKETS] > 0 ||
+	    dcache_find(dir, name, hash) != NULL) {
+		spinlock_release(&dcache_lock);
+		return;
+	}
+
+	/* Reuse the least recently used entry. */
+	e = dcache_oldest;
+	KASSERT(e != NULL);
+	if (e->dc_dir != NULL) {
+		dcache_clear(e, &olddir, &oldvn);
+		dcache_stats.evictions++;
+	}
+
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	e->dc_dir = dir;
+	e->dc_vn = vn;
+	e->dc_hash = hash;
+	strcpy(e->dc_name, name);
+
+	e->dc_hashnext = dcache_buckets[hash % DC_NBUCKETS];
+	dcache_buckets[hash % DC_NBUCKETS] = e;
+	dcache_lru_unlink(e);
+	dcache_lru_addnewest(e);
+	dcache_stats.enters++;
+
+	spinlock_release(&dcache_lock);
+
+	dcache_release(olddir, oldvn);
+}
+
+/*
+ * Forget whatever is known about NAME in DIR, bump the generation,
+ * and adjust the busy count of NAME's bucket by DELTA.
+ */
+static
+void
+dcache_invalidate(struct vnode *dir, const char *name, int delta)
+{
+	struct vnode *olddir = NULL, *oldvn = NULL;
+	struct dcentry *e = NULL;
+	unsigned hash;
+
+	hash = dcache_hash(dir, name);
+
+	spinlock_acquire(&dcache_lock);
+	dcache_gen++;
+	KASSERT(delta > 0 || dcache_busy[hash % DC_NBUCKETS] > 0);
+	dcache_busy[hash % DC_NBUCKETS] += delta;
+	if (strlen(name) < DC_NAMELEN) {
+		e = dcache_find(dir, name, hash);
+	}
+	if (e != NULL) {
+		dcache_clear(e, &olddir, &oldvn);
+		dcache_stats.invalidations++;
+	}
+	spinlock_release(&dcache_lock);
+
+	dcache_release(olddir, oldvn);
+}
+
+/*
+ * Call before an operation that may create, remove, or rename NAME
+ * in DIR. Until the matching vfs_dcache_end, NAME is not cached.
+ */
+void
+vfs_dcache_begin(struct vnode *dir, const char *name)
+{
+	dcache_invalidate(dir, name, 1);
+}
+
+/*
+ * Call when the operation is done, whether or not it succeeded.
+ */
+void
+vfs_dcache_end(struct vnode *dir, const char *name)
+{
+	dcache_invalidate(dir, name, -1);
+}
+
+/*
+ * Drop all entries for the filesystem FS, or everything if FS is
+ * NULL. Used before unmounting, so the references the cache holds
+ * don't keep the volume busy.
+ */
+void
+vfs_dcache_purge(struct fs *fs)
+{
+	struct vnode *olddir, *oldvn;
+	struct dcentry *e;
+	unsigned i;
+
+	for (i=0; i<DC_NENTRIES; i++) {
+		e = &dcache_entries[i];
+		olddir = oldvn = NULL;
+
+		spinlock_acquire(&dcache_lock);
+		dcache_gen++;
+		if (e->dc_dir != NULL &&
+		    (fs == NULL || e->dc_dir->vn_fs == fs)) {
+			dcache_clear(e, &olddir, &oldvn);
+		}
+		spinlock_release(&dcache_lock);
+
+		dcache_release(olddir, oldvn);
+	}
+}
+
+/*
+ * Statistics.
+ */
+void
+vfs_dcache_resetstats(void)
+{
+	spinlock_acquire(&dcache_lock);
+	bzero(&dcache_stats, sizeof(dcache_stats));
+	spinlock_release(&dcache_lock);
+}
+
+void
+vfs_dcache_printstats(void)
+{
+	unsigned lookups, hits, neghits, enters, invalidations, evictions;
+	unsigned used, negative, i;
+
+	spinlock_acquire(&dcache_lock);
+	lookups = dcache_stats.lookups;
+	hits = dcache_stats.hits;
+	neghits = dcache_stats.neghits;
+	enters = dcache_stats.enters;
+	invalidations = dcache_stats.invalidations;
+	evictions = dcache_stats.evictions;
+	used = negative = 0;
+	for (i=0; i<DC_NENTRIES; i++) {
+		if (dcache_entries[i].dc_dir != NULL) {
+			used++;
+			if (dcache_entries[i].dc_vn == NULL) {
+				negative++;
+			}
+		}
+	}
+	spinlock_release(&dcache_lock);
+
+	kprintf("Name cache: %u of %u entries in use (%u negative)\n",
+		used, DC_NENTRIES, negative);
+	kprintf("    %u lookups, %u hits, %u negative hits "
+		"(%u%% hit rate)\n", lookups, hits, neghits,
+		lookups == 0 ? 0 : (hits + neghits) * 100 / lookups);
+	kprintf("    %u entered, %u invalidated, %u evicted\n",
+		enters, invalidations, evictions);
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Support for getdirentries: building dirent records, and a generic
+ * VOP_GETDIRENTRIES for filesystems that can only produce one name
+ * at a time.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/dirent.h>
+#include <limits.h>
+#include <lib.h>
+#include <stat.h>
+#include <uio.h>
+#include <vnode.h>
+
+/*
+ * Append a record for NAME to UIO, or return ENOSPC without moving
+ * anything if the whole record doesn't fit. The uio's offset is the
+ * directory position, not a byte count, so it is left alone.
+ */
+int
+vfs_putdirent(struct uio *uio, const char *name, ino_t ino,
+	      const struct stat *st)
+{
+	struct dirent d;
+	size_t namelen, reclen;
+	off_t pos;
+	int result;
+
+	namelen = strlen(name);
+	reclen = _DIRENT_RECLEN(namelen);
+	if (reclen > uio->uio_resid) {
+		return ENOSPC;
+	}
+
+	bzero(&d, sizeof(d));
+	d.d_ino = ino;
+	if (st != NULL) {
+		d.d_mode = st->st_mode;
+		d.d_size = st->st_size;
+		d.d_blocks = st->st_blocks;
+		d.d_nlink = st->st_nlink;
+	}
+	d.d_reclen = reclen;
+
+	pos = uio->uio_offset;
+	result = uiomove(&d, sizeof(d), uio);
+	if (result == 0) {
+		result = uiomove((char *)name, namelen + 1, uio);
+	}
+	if (result == 0) {
+		result = uiomovezeros(reclen - sizeof(d) - namelen - 1, uio);
+	}
+	uio->uio_offset = pos;
+	return result;
+}
+
+/*
+ * VOP_GETDIRENTRIES in terms of VOP_GETDIRENTRY. This still costs a
+ * filesystem operation per name (and a lookup and stat per name for
+ * DIRENT_STAT), but not a system call per name.
+ */
+int
+vopgeneric_getdirentries(struct vnode *dir, struct uio *uio, int flags)
+{
+	char name[NAME_MAX+1];
+	struct iovec iov;
+	struct uio nameuio;
+	struct stat st;
+	struct vnode *vn;
+	size_t startresid, len;
+	off_t next;
+	int result;
+
+	startresid = uio->uio_resid;
+
+	while (1) {
+		uio_kinit(&iov, &nameuio, name, sizeof(name) - 1,
+			  uio->uio_offset, UIO_READ);
+		result = VOP_GETDIRENTRY(dir, &nameuio);
+		if (result) {
+			return result;
+		}
+		len = sizeof(name) - 1 - nameuio.uio_resid;
+		if (len == 0) {
+			/* end of directory */
+			return 0;
+		}
+		name[len] = 0;
+		next = nameuio.uio_offset;
+
+		if (flags & DIRENT_STAT) {
+			result = VOP_LOOKUP(dir, name, &vn);
+			if (result) {
+				return result;
+			}
+			result = VOP_STAT(vn, &st);
+			VOP_DECREF(vn);
+			if (result) {
+				return result;
+			}
+		}
+
+		result = vfs_putdirent(uio, name,
+				       (flags & DIRENT_STAT) ? st.st_ino : 0,
+				       (flags & DIRENT_STAT) ? &st : NULL);
+		if (result == ENOSPC) {
+			/* Stop here; this name comes first next time. */
+			return uio->uio_resid == startresid ? EINVAL : 0;
+		}
+		if (result) {
+			return result;
+		}
+		uio->uio_offset = next;
+	}
+}
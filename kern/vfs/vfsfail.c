@@ -79,6 +79,18 @@ vopfail_uio_nosys(struct vnode *vn, struct uio *uio)
 	return ENOSYS;
 }
 
+////////////////////////////////////////////////////////////
+// getdirentries
+
+int
+vopfail_dirents_notdir(struct vnode *vn, struct uio *uio, int flags)
+{
+	(void)vn;
+	(void)uio;
+	(void)flags;
+	return ENOTDIR;
+}
+
 ////////////////////////////////////////////////////////////
 // mmap
 
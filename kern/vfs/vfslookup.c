@@ -234,41 +234,163 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	return 0;
 }
 
+/*
+ * Look up a single path component NAME in DIR, checking the name
+ * cache first and filling it in afterwards.
+ */
+static
+int
+lookup_component(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	char buf[NAME_MAX+1];
+	struct vnode *vn;
+	unsigned gen;
+	bool cacheable;
+	int result;
+
+	if (strlen(name) > NAME_MAX) {
+		return ENAMETOOLONG;
+	}
+
+	/*
+	 * Don't cache . and ..; what .. names changes when a
+	 * directory is renamed, and the rename only invalidates the
+	 * directory's own name.
+	 */
+	cacheable = strcmp(name, ".") && strcmp(name, "..");
+
+	if (cacheable && vfs_dcache_lookup(dir, name, &vn, &gen)) {
+		if (vn == NULL) {
+			return ENOENT;
+		}
+		*ret = vn;
+		return 0;
+	}
+
+	/* VOP_LOOKUP is allowed to destroy the name, so pass a copy. */
+	strcpy(buf, name);
+	result = VOP_LOOKUP(dir, buf, &vn);
+
+	if (cacheable && result == 0) {
+		vfs_dcache_enter(dir, name, vn, gen);
+	}
+	else if (cacheable && result == ENOENT) {
+		vfs_dcache_enter(dir, name, NULL, gen);
+	}
+	if (result) {
+		return result;
+	}
+	*ret = vn;
+	return 0;
+}
+
+/*
+ * Walk PATH from STARTVN a component at a time. The reference to
+ * STARTVN is consumed; the vnode found is handed back with a
+ * reference. PATH is destroyed.
+ */
+static
+int
+walkpath(struct vnode *startvn, char *path, struct vnode **ret)
+{
+	struct vnode *dir, *next;
+	char *s, *name;
+	int result;
+
+	dir = startvn;
+	s = path;
+	while (*s != 0) {
+		/* Skip slashes; a / at the end names the directory itself */
+		if (*s == '/') {
+			s++;
+			continue;
+		}
+
+		name = s;
+		s = strchr(s, '/');
+		if (s != NULL) {
+			*s++ = 0;
+		}
+		else {
+			s = name + strlen(name);
+		}
+
+		result = lookup_component(dir, name, &next);
+		VOP_DECREF(dir);
+		if (result) {
+			return result;
+		}
+		dir = next;
+	}
+
+	*ret = dir;
+	return 0;
+}
+
 /*
  * Name-to-vnode translation.
  * (In BSD, both of these are subsumed by namei().)
+ *
+ * The path is walked here one component at a time, rather than being
+ * handed whole to VOP_LOOKUP, so each step can use the name cache.
  */
 
 int
 vfs_lookparent(char *path, struct vnode **retval,
 	       char *buf, size_t buflen)
 {
-	struct vnode *startvn;
+	struct vnode *startvn, *dir;
+	char *s, *name;
+	size_t len;
 	int result;
 
+	/*
+	 * The big lock only covers finding the starting point; the
+	 * filesystem does its own locking for the rest.
+	 */
 	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	if (strlen(path)==0) {
+	/* Trailing slashes don't change which directory the name is in */
+	len = strlen(path);
+	while (len > 0 && path[len-1] == '/') {
+		path[--len] = 0;
+	}
+
+	if (len==0) {
 		/*
 		 * It does not make sense to use just a device name in
 		 * a context where "lookparent" is the desired
 		 * operation.
 		 */
-		result = EINVAL;
+		VOP_DECREF(startvn);
+		return EINVAL;
+	}
+
+	/* Get the directory part (if any) from the cache or the fs */
+	s = strrchr(path, '/');
+	if (s != NULL) {
+		*s = 0;
+		name = s+1;
+		result = walkpath(startvn, path, &dir);
+		if (result) {
+			return result;
+		}
 	}
 	else {
-		result = VOP_LOOKPARENT(startvn, path, retval, buf, buflen);
+		name = path;
+		dir = startvn;
 	}
 
-	VOP_DECREF(startvn);
+	/* and let the fs check the directory and the last component */
+	result = VOP_LOOKPARENT(dir, name, retval, buf, buflen);
+
+	VOP_DECREF(dir);
 
-	vfs_biglock_release();
 	return result;
 }
 
@@ -279,22 +401,11 @@ vfs_lookup(char *path, struct vnode **retval)
 	int result;
 
 	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	if (strlen(path)==0) {
-		*retval = startvn;
-		vfs_biglock_release();
-		return 0;
-	}
-
-	result = VOP_LOOKUP(startvn, path, retval);
-
-	VOP_DECREF(startvn);
-	vfs_biglock_release();
-	return result;
+	return walkpath(startvn, path, retval);
 }
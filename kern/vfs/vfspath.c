@@ -73,7 +73,9 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 			return result;
 		}
 
+		vfs_dcache_begin(dir, name);
 		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		vfs_dcache_end(dir, name);
 
 		VOP_DECREF(dir);
 	}
@@ -145,7 +147,9 @@ vfs_remove(char *path)
 		return result;
 	}
 
+	vfs_dcache_begin(dir, name);
 	result = VOP_REMOVE(dir, name);
+	vfs_dcache_end(dir, name);
 	VOP_DECREF(dir);
 
 	return result;
@@ -178,7 +182,11 @@ vfs_rename(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	vfs_dcache_begin(olddir, oldname);
+	vfs_dcache_begin(newdir, newname);
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	vfs_dcache_end(newdir, newname);
+	vfs_dcache_end(olddir, oldname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -212,7 +220,9 @@ vfs_link(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	vfs_dcache_begin(newdir, newname);
 	result = VOP_LINK(newdir, newname, oldfile);
+	vfs_dcache_end(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -239,7 +249,9 @@ vfs_symlink(const char *contents, char *path)
 		return result;
 	}
 
+	vfs_dcache_begin(newdir, newname);
 	result = VOP_SYMLINK(newdir, newname, contents);
+	vfs_dcache_end(newdir, newname);
 	VOP_DECREF(newdir);
 
 	return result;
@@ -285,7 +297,9 @@ vfs_mkdir(char *path, mode_t mode)
 		return result;
 	}
 
+	vfs_dcache_begin(parent, name);
 	result = VOP_MKDIR(parent, name, mode);
+	vfs_dcache_end(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -307,7 +321,9 @@ vfs_rmdir(char *path)
 		return result;
 	}
 
+	vfs_dcache_begin(parent, name);
 	result = VOP_RMDIR(parent, name);
+	vfs_dcache_end(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -153,6 +153,9 @@ as_create(void)
 	as->stack_region->writeable = 1; /* Stack is writeable */
 	as->stack_region->executable = 0; /* Stack is not executable */
 	as->stack_region->temp_write = 0; /* Temporary write permission not set */
+	as->stack_region->shared = 0;
+	as->stack_region->vn = NULL; /* Not a mapped file */
+	as->stack_region->offset = 0;
 	as->stack_region->next = NULL; /* No next region */
 	// Initialize the heap region
 	as->heap_region = kmalloc(sizeof(struct vm_region));
@@ -169,10 +172,16 @@ as_create(void)
 	as->heap_region->writeable = 1; /* Heap is writeable */
 	as->heap_region->executable = 0; /* Heap is not executable */
 	as->heap_region->temp_write = 0; /* Temporary write permission not set */
+	as->heap_region->shared = 0;
+	as->heap_region->vn = NULL; /* Not a mapped file */
+	as->heap_region->offset = 0;
 	as->heap_region->next = NULL; /* No next region */
 	// Initialize the regions linked list
 
 
+	/* mmap regions are placed downward from just below the stack */
+	as->mmap_base = MAX_USERSTACK;
+
 	as->asid = 0; /* get a new address space identifier */	
 
 	return as;
@@ -206,6 +215,7 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	newas->stack_bottom = old->stack_bottom; /* Copy stack bottom */
 	newas->heap_base = old->heap_base; /* Copy heap base */
 	newas->heap_end = old->heap_end; /* Copy heap end */
+	newas->mmap_base = old->mmap_base; /* Copy mmap placement */
 	newas->asid = 0; /* This would be assinged when process gets activated */
 
 	// TODO: probably redundant 
@@ -234,6 +244,13 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		new_region->writeable = old_region->writeable;
 		new_region->executable = old_region->executable;
 		new_region->temp_write = old_region->temp_write;
+		new_region->shared = old_region->shared;
+		new_region->vn = old_region->vn;
+		new_region->offset = old_region->offset;
+		if (new_region->vn != NULL) {
+			/* The child's mapping holds its own file reference */
+			VOP_INCREF(new_region->vn);
+		}
 		new_region->next = NULL; /* Insert at the beginning of the list */
 		if (newas->regions == NULL)
 			newas->regions = new_region; /* Set the new region as the first region */	
@@ -268,6 +285,9 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
+	/* Mapped files get written back; that sleeps, so do it first */
+	mmap_destroy(as);
+
 	spinlock_acquire(&addrspace_lock);
 	/*
 	 * Clean up as needed.
@@ -396,6 +416,9 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	region->writeable = writeable ? 1 : 0;
 	region->executable = executable ? 1 : 0;
 	region->temp_write = 0; /* Temporary write permission not set */
+	region->shared = 0;
+	region->vn = NULL; /* Not a mapped file */
+	region->offset = 0;
 	region->next = NULL; /* Insert at the beginning of the list */
 
 	if (last_region != NULL){
@@ -0,0 +1,759 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * File-backed mmap.
+ *
+ * Mapped file pages live in a page cache keyed by (vnode, page number
+ * within the file). A cache page holds one coremap reference of its
+ * own, and each page table entry that maps it holds another, so every
+ * process mapping the same part of the same file uses the same
+ * physical page.
+ *
+ * MAP_SHARED pages are mapped read-only at first. The first write
+ * fault marks the cache page dirty and makes the mapping writable.
+ * Dirty pages are written back with VOP_WRITE by msync(), by munmap(),
+ * and when the address space goes away. MAP_PRIVATE pages are mapped
+ * copy-on-write, so the COW code in vm_fault gives a writer its own
+ * copy and the cache page never changes.
+ *
+ * A cache page goes away when its region is torn down and nothing
+ * else maps it. Nothing else is evicted; the cache only holds pages
+ * that are mapped somewhere. It is also not kept coherent with read()
+ * and write(): stores through a shared mapping reach the file at
+ * msync or munmap time, and a write() to a mapped page isn't seen
+ * through the mapping until the file is mapped again.
+ *
+ * Locking: the page cache lock comes after page table locks. It is
+ * never held across VOP_READ or VOP_WRITE, and neither is a page table
+ * lock: the filesystem takes its own vnode locks and then copies to
+ * and from user memory, which can fault back in here. A page being
+ * read in or written back is marked busy and stays in the hash table
+ * while the lock is dropped; anyone else who wants it waits on pc_cv
+ * and looks again once the I/O is done.
+ *
+ * The filesystem itself can't read a page in while it holds a vnode
+ * lock: if the page belonged to the same file it would wait for the
+ * lock it holds, and otherwise two processes could each hold one
+ * file's lock and wait on a busy page of the other. So the read and
+ * write system calls fault in the mapped pages of their user buffers
+ * first (mmap_prefault), and the copy the filesystem does under its
+ * lock finds them already there. Nothing evicts a page that is
+ * mapped, so they stay there.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <syscall.h>
+
+/* Number of hash buckets; a power of two. */
+#define PC_NBUCKETS		64
+
+struct pcpage {
+	struct pcpage *pp_next;		/* hash chain */
+	struct vnode *pp_vn;		/* file; referenced by the regions */
+	off_t pp_pageno;		/* page number within the file */
+	unsigned pp_frame;		/* coremap frame holding the data */
+	bool pp_dirty;			/* written through a shared mapping */
+	bool pp_busy;			/* being read in or written back */
+};
+
+static struct pcpage *pc_buckets[PC_NBUCKETS];
+static struct lock *pc_lock;
+static struct cv *pc_cv;		/* signalled when I/O finishes */
+
+/*
+ * Set up the page cache.
+ */
+void
+mmap_bootstrap(void)
+{
+	pc_lock = lock_create("pagecache");
+	pc_cv = cv_create("pagecache");
+	if (pc_lock == NULL || pc_cv == NULL) {
+		panic("mmap_bootstrap: Out of memory\n");
+	}
+}
+
+static
+unsigned
+pc_hash(struct vnode *vn, off_t pageno)
+{
+	return (((uintptr_t)vn >> 4) + (unsigned)pageno) & (PC_NBUCKETS - 1);
+}
+
+static
+vaddr_t
+pc_kvaddr(struct pcpage *pp)
+{
+	return PADDR_TO_KVADDR(PAGE_TO_PADDR(pp->pp_frame));
+}
+
+/*
+ * Find a cached page. Returns NULL if it isn't cached; if PREVP is
+ * given, also hands back the link pointing to the page, for unlinking.
+ */
+static
+struct pcpage *
+pc_find(struct vnode *vn, off_t pageno, struct pcpage ***prevp)
+{
+	struct pcpage **pp;
+
+	KASSERT(lock_do_i_hold(pc_lock));
+
+	for (pp = &pc_buckets[pc_hash(vn, pageno)]; *pp != NULL;
+	     pp = &(*pp)->pp_next) {
+		if ((*pp)->pp_vn == vn && (*pp)->pp_pageno == pageno) {
+			if (prevp != NULL) {
+				*prevp = pp;
+			}
+			return *pp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Find a cached page that isn't busy, waiting out any I/O on it. The
+ * lock may be dropped while waiting, so the page may have gone away;
+ * returns NULL in that case as well as if it was never cached.
+ */
+static
+struct pcpage *
+pc_findidle(struct vnode *vn, off_t pageno, struct pcpage ***prevp)
+{
+	struct pcpage *pp;
+
+	KASSERT(lock_do_i_hold(pc_lock));
+
+	while ((pp = pc_find(vn, pageno, prevp)) != NULL && pp->pp_busy) {
+		cv_wait(pc_cv, pc_lock);
+	}
+	return pp;
+}
+
+/*
+ * Get a page of a file, reading it in if it isn't cached. The part of
+ * the page past EOF reads as zeros.
+ *
+ * The page goes into the hash table busy before the read, and the
+ * page cache lock is dropped for the read itself. Returns with the
+ * lock held again.
+ */
+static
+int
+pc_getpage(struct vnode *vn, off_t pageno, struct pcpage **ret)
+{
+	struct pcpage *pp, **prev;
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(lock_do_i_hold(pc_lock));
+
+	pp = pc_findidle(vn, pageno, NULL);
+	if (pp != NULL) {
+		*ret = pp;
+		return 0;
+	}
+
+	pp = kmalloc(sizeof(*pp));
+	if (pp == NULL) {
+		return ENOMEM;
+	}
+	pp->pp_vn = vn;
+	pp->pp_pageno = pageno;
+	pp->pp_frame = coremap_alloc_userpage();
+	pp->pp_dirty = false;
+	pp->pp_busy = true;
+	if (pp->pp_frame == 0) {
+		kfree(pp);
+		return ENOMEM;
+	}
+	pp->pp_next = pc_buckets[pc_hash(vn, pageno)];
+	pc_buckets[pc_hash(vn, pageno)] = pp;
+	lock_release(pc_lock);
+
+	uio_kinit(&iov, &ku, (void *)pc_kvaddr(pp), PAGE_SIZE,
+		  pageno * PAGE_SIZE, UIO_READ);
+	result = VOP_READ(vn, &ku);
+	if (result == 0) {
+		bzero((char *)pc_kvaddr(pp) + PAGE_SIZE - ku.uio_resid,
+		      ku.uio_resid);
+	}
+
+	lock_acquire(pc_lock);
+	pp->pp_busy = false;
+	cv_broadcast(pc_cv, pc_lock);
+	if (result) {
+		/* Nobody else touches a busy page, so it's still there */
+		pc_find(vn, pageno, &prev);
+		*prev = pp->pp_next;
+		kfree((void *)pc_kvaddr(pp));
+		kfree(pp);
+		return result;
+	}
+	*ret = pp;
+	return 0;
+}
+
+/*
+ * Write a dirty page back to its file. Only the part before EOF is
+ * written; stores past the end of the file in the last page are lost,
+ * as they would be elsewhere. The page must be marked busy, and the
+ * page cache lock must not be held.
+ */
+static
+int
+pc_writeback(struct pcpage *pp)
+{
+	struct stat st;
+	struct iovec iov;
+	struct uio ku;
+	off_t pos;
+	size_t len;
+	int result;
+
+	KASSERT(pp->pp_busy);
+	KASSERT(!lock_do_i_hold(pc_lock));
+
+	result = VOP_STAT(pp->pp_vn, &st);
+	if (result) {
+		return result;
+	}
+	pos = pp->pp_pageno * PAGE_SIZE;
+	if (pos >= st.st_size) {
+		return 0;
+	}
+	len = st.st_size - pos < PAGE_SIZE ? st.st_size - pos : PAGE_SIZE;
+
+	uio_kinit(&iov, &ku, (void *)pc_kvaddr(pp), len, pos, UIO_WRITE);
+	return VOP_WRITE(pp->pp_vn, &ku);
+}
+
+/*
+ * Write back the dirty cached pages among NPAGES pages of VN starting
+ * at FIRST. If RELEASE is set, the region mapping them is going away;
+ * drop the pages nobody else maps.
+ */
+static
+int
+pc_sync(struct vnode *vn, off_t first, unsigned npages, bool release)
+{
+	struct pcpage *pp, **prev;
+	unsigned i;
+	int result, err;
+
+	err = 0;
+	lock_acquire(pc_lock);
+	for (i = 0; i < npages; i++) {
+		pp = pc_findidle(vn, first + i, &prev);
+		if (pp == NULL) {
+			continue;
+		}
+		if (pp->pp_dirty) {
+			pp->pp_busy = true;
+			lock_release(pc_lock);
+			result = pc_writeback(pp);
+			lock_acquire(pc_lock);
+			pp->pp_busy = false;
+			cv_broadcast(pc_cv, pc_lock);
+			if (result && err == 0) {
+				err = result;
+			}
+			/* The chain may have changed while unlocked */
+			pc_find(vn, first + i, &prev);
+		}
+		if (coremap_getref(pp->pp_frame) == 1) {
+			/* Only the cache's own reference is left */
+			pp->pp_dirty = false;
+			if (release) {
+				*prev = pp->pp_next;
+				kfree((void *)pc_kvaddr(pp));
+				kfree(pp);
+			}
+		}
+	}
+	lock_release(pc_lock);
+	return err;
+}
+
+/*
+ * Page number within the file of the page at VADDR in REGION.
+ */
+static
+off_t
+region_pageno(struct vm_region *region, vaddr_t vaddr)
+{
+	return (region->offset + (vaddr & PAGE_FRAME) - region->start)
+		/ PAGE_SIZE;
+}
+
+/*
+ * Fault in a file-backed region. Fill in PTE from the page cache if it
+ * isn't valid yet, and make shared pages writable (and dirty) on the
+ * first write. Private pages are mapped copy-on-write and the caller's
+ * COW code takes it from there.
+ *
+ * Called from vm_fault with the page table locked; PTLOCK is that
+ * lock. If the page has to be read in, the page table lock is dropped
+ * for the read, and the entry is looked at again afterwards in case
+ * it was filled in meanwhile. Returns with the lock held.
+ */
+int
+mmap_fault(struct vm_region *region, struct lock *ptlock,
+	   struct page_table_entry *pte, int faulttype, vaddr_t faultaddress)
+{
+	struct pcpage *pp;
+	struct vnode *vn;
+	unsigned frame;
+	off_t pageno;
+	bool write;
+	int result;
+
+	KASSERT(region->vn != NULL);
+	KASSERT(lock_do_i_hold(ptlock));
+
+	write = (faulttype != VM_FAULT_READ);
+	if (write && !region->writeable) {
+		return EFAULT;
+	}
+	vn = region->vn;
+	pageno = region_pageno(region, faultaddress);
+
+	if (!pte->valid) {
+		lock_release(ptlock);
+		lock_acquire(pc_lock);
+		result = pc_getpage(vn, pageno, &pp);
+		if (result == 0) {
+			frame = pp->pp_frame;
+			coremap_incref(frame);
+		}
+		lock_release(pc_lock);
+		lock_acquire(ptlock);
+		if (result) {
+			return result;
+		}
+
+		if (pte->valid) {
+			/* Someone else mapped it while we were reading */
+			kfree((void *)PADDR_TO_KVADDR(PAGE_TO_PADDR(frame)));
+		}
+		else {
+			pte->frame = frame;
+			pte->valid = 1;
+			pte->readable = region->readable;
+			pte->executable = region->executable;
+			pte->shared = region->shared;
+			pte->writable = 0;
+			pte->cow = region->shared ? 0 : region->writeable;
+			pte->dirty = 0;
+		}
+	}
+
+	/* The first write to a shared page dirties it */
+	if (pte->shared && write && !pte->writable) {
+		lock_acquire(pc_lock);
+		pp = pc_find(vn, pageno, NULL);
+		KASSERT(pp != NULL && pp->pp_frame == pte->frame);
+		pp->pp_dirty = true;
+		lock_release(pc_lock);
+		pte->writable = 1;
+		pte->dirty = 1;
+	}
+	return 0;
+}
+
+/*
+ * Tear down a file-backed region that has already been unlinked from
+ * its address space: unmap its pages, write back what's dirty, drop
+ * the cache pages nothing else maps, and let go of the file.
+ */
+static
+int
+mmap_teardown(struct addrspace *as, struct vm_region *region)
+{
+	struct page_table *pt;
+	struct page_table_entry *pte;
+	unsigned frame;
+	vaddr_t va;
+	int result;
+
+	for (va = region->start; va < region->start + region->size;
+	     va += PAGE_SIZE) {
+		pt = find_last_level_pt(va, as);
+		if (pt == NULL) {
+			continue;
+		}
+		lock_acquire(pt->pt_lock);
+		pte = &pt->entries[THIRD_LEVEL_MASK(va)];
+		if (pte->valid) {
+			frame = pte->frame;
+			bzero(pte, sizeof(*pte));
+			if (as->asid != 0) {
+				tlb_shootdown_individual(va, as->asid);
+			}
+			/* Drops this mapping's reference (or a COW copy) */
+			kfree((void *)PADDR_TO_KVADDR(PAGE_TO_PADDR(frame)));
+		}
+		lock_release(pt->pt_lock);
+	}
+
+	result = pc_sync(region->vn, region_pageno(region, region->start),
+			 region->size / PAGE_SIZE, true);
+	VOP_DECREF(region->vn);
+	kfree(region);
+	return result;
+}
+
+/*
+ * Recompute where the next mapping goes: below the lowest one left.
+ */
+static
+void
+mmap_resetbase(struct addrspace *as)
+{
+	struct vm_region *region;
+
+	KASSERT(lock_do_i_hold(as->addrlock));
+
+	as->mmap_base = MAX_USERSTACK;
+	for (region = as->regions; region != NULL; region = region->next) {
+		if (region->vn != NULL && region->start < as->mmap_base) {
+			as->mmap_base = region->start;
+		}
+	}
+}
+
+/*
+ * Remove all file-backed regions of an address space that is being
+ * destroyed. Write errors have nowhere to go and are dropped.
+ */
+void
+mmap_destroy(struct addrspace *as)
+{
+	struct vm_region *region, **prev;
+
+	lock_acquire(as->addrlock);
+	prev = &as->regions;
+	while (*prev != NULL) {
+		region = *prev;
+		if (region->vn == NULL) {
+			prev = &region->next;
+			continue;
+		}
+		*prev = region->next;
+		(void)mmap_teardown(as, region);
+	}
+	as->mmap_base = MAX_USERSTACK;
+	lock_release(as->addrlock);
+}
+
+/*
+ * Pin a page of VN in the page cache, reading it in if need be, and
+ * hand back its kernel address. The pin is a coremap reference like a
+ * mapping's, so the page stays in the cache, and anyone who maps that
+ * part of VN gets the same physical page. This is how a kernel object
+ * shares memory with its user mappings.
+ */
+int
+mmap_pinpage(struct vnode *vn, off_t pageno, vaddr_t *ret)
+{
+	struct pcpage *pp;
+	int result;
+
+	lock_acquire(pc_lock);
+	result = pc_getpage(vn, pageno, &pp);
+	if (result == 0) {
+		coremap_incref(pp->pp_frame);
+		*ret = pc_kvaddr(pp);
+	}
+	lock_release(pc_lock);
+	return result;
+}
+
+/*
+ * Drop a pin. Mappings hold a reference to the vnode, so by the time
+ * its owner is being reclaimed nothing maps the page and it leaves
+ * the cache as well.
+ */
+void
+mmap_unpinpage(struct vnode *vn, off_t pageno)
+{
+	struct pcpage *pp, **prev;
+
+	lock_acquire(pc_lock);
+	pp = pc_findidle(vn, pageno, &prev);
+	KASSERT(pp != NULL);
+	/* Drops the pin's reference */
+	kfree((void *)pc_kvaddr(pp));
+	if (coremap_getref(pp->pp_frame) == 1) {
+		*prev = pp->pp_next;
+		kfree((void *)pc_kvaddr(pp));
+		kfree(pp);
+	}
+	lock_release(pc_lock);
+}
+
+/*
+ * Fault in the pages of UIO's user buffers that lie in file-backed
+ * regions, before the caller hands UIO to VOP_READ or VOP_WRITE. The
+ * pages are read-faulted if the region allows it (a store into one
+ * later only has to mark it dirty), so nothing is dirtied that won't
+ * be written. Errors are ignored; the copy will find them again, and
+ * fail without reading anything in.
+ */
+void
+mmap_prefault(struct uio *uio)
+{
+	struct addrspace *as;
+	struct vm_region *region;
+	vaddr_t start, end, va;
+	unsigned i;
+
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		return;
+	}
+	as = uio->uio_space;
+	KASSERT(as == proc_getas());
+
+	/* Hold the region list still; ring workers share it */
+	lock_acquire(as->addrlock);
+	for (i = 0; i < uio->uio_iovcnt; i++) {
+		start = (vaddr_t)uio->uio_iov[i].iov_ubase;
+		end = start + uio->uio_iov[i].iov_len;
+		if (end <= start) {
+			continue;
+		}
+		for (region = as->regions; region != NULL;
+		     region = region->next) {
+			if (region->vn == NULL ||
+			    end <= region->start ||
+			    start >= region->start + region->size) {
+				continue;
+			}
+			va = start > region->start ? start : region->start;
+			for (va &= PAGE_FRAME;
+			     va < end && va < region->start + region->size;
+			     va += PAGE_SIZE) {
+				(void)vm_fault(region->readable ?
+					       VM_FAULT_READ : VM_FAULT_WRITE,
+					       va);
+			}
+		}
+	}
+	lock_release(as->addrlock);
+}
+
+/*
+ * mmap(): map LEN bytes of the file open on FD, starting at OFFSET.
+ * The address is always chosen here; ADDR is only a hint and is
+ * ignored. Mappings are placed downward from just below the stack.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	 off_t offset, int *retval)
+{
+	struct addrspace *as;
+	struct vm_region *region, *r;
+	struct vnode *vn;
+	int openflags;
+	vaddr_t start;
+	int result;
+
+	(void)addr;
+
+	if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if (flags != MAP_SHARED && flags != MAP_PRIVATE) {
+		return EINVAL;
+	}
+	if ((prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0) {
+		return EINVAL;
+	}
+	if (len > MAX_USERSTACK) {
+		return ENOMEM;
+	}
+	len = ROUNDUP(len, PAGE_SIZE);
+
+	as = proc_getas();
+	KASSERT(as != NULL);
+
+	result = file_getvnode(fd, &vn, &openflags);
+	if (result) {
+		return result;
+	}
+	if ((openflags & O_ACCMODE) == O_WRONLY ||
+	    (flags == MAP_SHARED && (prot & PROT_WRITE) &&
+	     (openflags & O_ACCMODE) != O_RDWR)) {
+		VOP_DECREF(vn);
+		return EACCES;
+	}
+	result = VOP_MMAP(vn);
+	if (result) {
+		VOP_DECREF(vn);
+		return result == ENOSYS ? ENODEV : result;
+	}
+
+	region = kmalloc(sizeof(*region));
+	if (region == NULL) {
+		VOP_DECREF(vn);
+		return ENOMEM;
+	}
+
+	lock_acquire(as->addrlock);
+	if (as->mmap_base < len || as->mmap_base - len < as->heap_end) {
+		goto nomem;
+	}
+	start = as->mmap_base - len;
+	for (r = as->regions; r != NULL; r = r->next) {
+		if (start < r->start + r->size && start + len > r->start) {
+			goto nomem;
+		}
+	}
+
+	region->start = start;
+	region->size = len;
+	region->readable = (prot & (PROT_READ | PROT_EXEC)) ? 1 : 0;
+	region->writeable = (prot & PROT_WRITE) ? 1 : 0;
+	region->executable = (prot & PROT_EXEC) ? 1 : 0;
+	region->temp_write = 0;
+	region->shared = (flags == MAP_SHARED);
+	region->vn = vn;
+	region->offset = offset;
+	region->next = as->regions;
+	as->regions = region;
+	as->mmap_base = start;
+	lock_release(as->addrlock);
+
+	*retval = (int)start;
+	return 0;
+
+ nomem:
+	lock_release(as->addrlock);
+	kfree(region);
+	VOP_DECREF(vn);
+	return ENOMEM;
+}
+
+/*
+ * munmap(): remove a mapping, writing back its dirty pages. Only whole
+ * mappings, as returned by mmap, can be removed.
+ */
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+	struct addrspace *as;
+	struct vm_region *region, **prev;
+
+	if ((vaddr_t)addr % PAGE_SIZE != 0 || len == 0) {
+		return EINVAL;
+	}
+
+	as = proc_getas();
+	KASSERT(as != NULL);
+
+	lock_acquire(as->addrlock);
+	for (prev = &as->regions; *prev != NULL; prev = &(*prev)->next) {
+		region = *prev;
+		if (region->vn != NULL && region->start == (vaddr_t)addr) {
+			break;
+		}
+	}
+	if (*prev == NULL || ROUNDUP(len, PAGE_SIZE) != region->size) {
+		lock_release(as->addrlock);
+		return EINVAL;
+	}
+	*prev = region->next;
+	mmap_resetbase(as);
+	lock_release(as->addrlock);
+
+	return mmap_teardown(as, region);
+}
+
+/*
+ * msync(): write back the dirty pages of shared mappings in the given
+ * range. Writeback is always synchronous, so MS_ASYNC does the same
+ * thing as MS_SYNC.
+ */
+int
+sys_msync(userptr_t addr, size_t len, int flags)
+{
+	struct addrspace *as;
+	struct vm_region *region;
+	vaddr_t start, end, lo, hi;
+	int result, err;
+
+	if ((vaddr_t)addr % PAGE_SIZE != 0 ||
+	    (flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) != 0 ||
+	    (flags & (MS_ASYNC | MS_SYNC)) == (MS_ASYNC | MS_SYNC)) {
+		return EINVAL;
+	}
+	start = (vaddr_t)addr;
+	end = start + ROUNDUP(len, PAGE_SIZE);
+	if (end < start) {
+		return ENOMEM;
+	}
+
+	as = proc_getas();
+	KASSERT(as != NULL);
+
+	err = 0;
+	lock_acquire(as->addrlock);
+	for (region = as->regions; region != NULL; region = region->next) {
+		if (region->vn == NULL || !region->shared) {
+			continue;
+		}
+		lo = start > region->start ? start : region->start;
+		hi = end < region->start + region->size ?
+			end : region->start + region->size;
+		if (lo >= hi) {
+			continue;
+		}
+		result = pc_sync(region->vn, region_pageno(region, lo),
+				 (hi - lo) / PAGE_SIZE, false);
+		if (result && err == 0) {
+			err = result;
+		}
+	}
+	lock_release(as->addrlock);
+	return err;
+}
@@ -15,11 +15,10 @@
 void save_tlb_state_to_page_tables(void);
 void init_coremap(paddr_t , size_t );
 paddr_t get_last_level_pt(vaddr_t vaddr, struct addrspace *as);
-unsigned int coremap_alloc_userpage(void);
 /* Coremap Spinlock */
-static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+static struct ticketlock coremap_lock = TICKETLOCK_INITIALIZER;
 static struct spinlock cow_lock = SPINLOCK_INITIALIZER;
-static struct spinlock tlb_lock = SPINLOCK_INITIALIZER;
+static struct ticketlock tlb_lock = TICKETLOCK_INITIALIZER;
 
 
 void init_coremap(paddr_t start_paddr, size_t num_pages){
@@ -106,7 +105,7 @@ void vm_bootstrap(){
  * We allocate contigous pages for kernel. 
  */
 vaddr_t alloc_kpages(unsigned npages){
-    spinlock_acquire(&coremap_lock);
+    ticketlock_acquire(&coremap_lock);
     size_t page,i;
     size_t starting_page,ending_page;
     size_t max_found, aquired_pages, max_consecutive;
@@ -165,7 +164,7 @@ vaddr_t alloc_kpages(unsigned npages){
     {
         /* TODO: fix this when fixing swap*/
         // panic("not enough consecutive memory !!! -- max found : %d -- used pages : %d ", max_consecutive, used_pages);
-        spinlock_release(&coremap_lock);
+        ticketlock_release(&coremap_lock);
         return 0;
     }
 
@@ -196,13 +195,13 @@ vaddr_t alloc_kpages(unsigned npages){
     paddr_t page_paddr;
     page_paddr = PAGE_TO_PADDR(starting_page);
     
-    spinlock_release(&coremap_lock);
+    ticketlock_release(&coremap_lock);
     return PADDR_TO_KVADDR(page_paddr);
 }
 
 
 void free_kpages(vaddr_t addr){
-    spinlock_acquire(&coremap_lock);
+    ticketlock_acquire(&coremap_lock);
     size_t page_paddr,page,i,next_page;
     int p_num;
     /* Hope this doesnt wrongly align */
@@ -254,7 +253,7 @@ void free_kpages(vaddr_t addr){
         }
         page = next_page;
     }
-    spinlock_release(&coremap_lock);
+    ticketlock_release(&coremap_lock);
     return;
 }
 
@@ -317,6 +316,43 @@ vaddr_t get_last_level_pt(vaddr_t vaddr, struct addrspace *as){
     return (int)pt;
 }
 
+/*
+ * Like get_last_level_pt, but don't create missing tables; returns
+ * NULL if nothing is mapped anywhere near vaddr.
+ */
+struct page_table *find_last_level_pt(vaddr_t vaddr, struct addrspace *as){
+    KASSERT(as != NULL);
+    struct page_table *pt;
+    pt = as->pt;
+    KASSERT(pt != NULL);
+    if (pt->entries[FIRST_LEVEL_MASK(vaddr)].valid == 0)
+        return NULL;
+    pt = (struct page_table *)PADDR_TO_KVADDR(PAGE_TO_PADDR(pt->entries[FIRST_LEVEL_MASK(vaddr)].frame));
+    if (pt->entries[SECOND_LEVEL_MASK(vaddr)].valid == 0)
+        return NULL;
+    return (struct page_table *)PADDR_TO_KVADDR(PAGE_TO_PADDR(pt->entries[SECOND_LEVEL_MASK(vaddr)].frame));
+}
+
+/*
+ * Take another reference to a user page, for a second mapping of it.
+ * Drop it again with kfree as usual.
+ */
+void coremap_incref(unsigned int frame){
+    ticketlock_acquire(&coremap_lock);
+    KASSERT(coremap[frame].allocated);
+    coremap[frame].reference_count++;
+    ticketlock_release(&coremap_lock);
+}
+
+/* Current number of references to a user page */
+unsigned int coremap_getref(unsigned int frame){
+    unsigned int count;
+    ticketlock_acquire(&coremap_lock);
+    count = coremap[frame].reference_count;
+    ticketlock_release(&coremap_lock);
+    return count;
+}
+
 /*
  * Allocate a single user page in the coremap.
  */
@@ -331,9 +367,9 @@ unsigned int coremap_alloc_userpage(){
         return 0; // Allocation failed
     }
     page = PADDR_TO_PAGE(KVADDR_TO_PADDR(addr));
-    spinlock_acquire(&coremap_lock);
+    ticketlock_acquire(&coremap_lock);
     coremap[page].kernel = 0;
-    spinlock_release(&coremap_lock);
+    ticketlock_release(&coremap_lock);
     KASSERT(coremap[page].allocated == 1);
     KASSERT(coremap[page].start == 1);
     KASSERT(page < total_pages); // Ensure the page frame is within bounds
@@ -419,11 +455,13 @@ void *copy_page_table(void *page_table, size_t level) {
                 // Level 3 (leaf level) - implement COW
                 // Copy the page table entry
 
-                spinlock_acquire(&coremap_lock);
+                ticketlock_acquire(&coremap_lock);
                 memcpy( &new_pt->entries[i], &src_pt->entries[i], sizeof(struct page_table_entry));
                 
-                // If the page was writable, make it COW
-                if (src_pt->entries[i].writable || src_pt->entries[i].cow) {
+                // If the page was writable, make it COW; MAP_SHARED file
+                // pages stay shared between parent and child instead
+                if ((src_pt->entries[i].writable || src_pt->entries[i].cow) &&
+                        !src_pt->entries[i].shared) {
                     // Mark both parent and child as COW and read-only
                     src_pt->entries[i].cow = 1;
                     src_pt->entries[i].writable = 0;
@@ -436,7 +474,7 @@ void *copy_page_table(void *page_table, size_t level) {
                 // Increment reference count for the physical frame
                 unsigned int frame_num = src_pt->entries[i].frame;
                 coremap[frame_num].reference_count++;
-                spinlock_release(&coremap_lock);
+                ticketlock_release(&coremap_lock);
             }
         }
     }
@@ -520,6 +558,14 @@ int vm_fault(int faulttype, vaddr_t faultaddress){
     third_level_pt = get_last_level_pt(faultaddress, curproc->p_addrspace);
     struct page_table *pt = (struct page_table *)third_level_pt;
     lock_acquire(pt->pt_lock); // Acquire the page table lock
+    if (region->vn != NULL) {
+        // mmap'd file: map the page cache page, leaving COW to the code below
+        int result = mmap_fault(region, pt->pt_lock, &pt->entries[third_level_index], faulttype, faultaddress);
+        if (result) {
+            lock_release(pt->pt_lock);
+            return result;
+        }
+    }
     if (pt->entries[third_level_index].valid && 
             (faulttype == VM_FAULT_WRITE || faulttype == VM_FAULT_READONLY) &&
                  pt->entries[third_level_index].cow)
@@ -646,7 +692,7 @@ void vm_tlbshootdown(const struct tlbshootdown *ts) {
 void tlb_invalidate_vaddr(const struct tlbshootdown *ts) {
     KASSERT(ts != NULL);
     
-    spinlock_acquire(&tlb_lock); 
+    ticketlock_acquire(&tlb_lock); 
     uint32_t tlbhi = ts->vaddr & TLBHI_VPAGE;
 
     tlbhi |= (ts->asid << TLBHI_ASID_SHIFT) & TLBHI_PID;
@@ -658,7 +704,7 @@ void tlb_invalidate_vaddr(const struct tlbshootdown *ts) {
         tlb_write(TLBHI_INVALID(index), TLBLO_INVALID(), index);
         splx(spl);
     } 
-    spinlock_release(&tlb_lock);
+    ticketlock_release(&tlb_lock);
     
 }
 
@@ -29,6 +29,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -45,6 +46,9 @@
  *    -s   (with -l) Show block counts.
  */
 
+/* Size of the buffer for reading directories. */
+#define DIRBUFSIZE 2048
+
 /* Flags for which options we're using. */
 static int aopt=0;
 static int dopt=0;
@@ -132,45 +136,28 @@ printheader(const char *file)
  */
 static
 void
-print(const char *path)
+printstat(const char *file, const struct stat *statbuf)
 {
-	struct stat statbuf;
-	const char *file;
 	int typech;
 
-	if (lopt || sopt) {
-		int fd;
-
-		fd = open(path, O_RDONLY);
-		if (fd<0) {
-			err(1, "%s", path);
-		}
-		if (fstat(fd, &statbuf)<0) {
-			err(1, "%s: fstat", path);
-		}
-		close(fd);
-	}
-
-	file = basename(path);
-
 	if (sopt) {
-		printf("%3d ", statbuf.st_blocks);
+		printf("%3d ", statbuf->st_blocks);
 	}
 
 	if (lopt) {
-		if (S_ISREG(statbuf.st_mode)) {
+		if (S_ISREG(statbuf->st_mode)) {
 			typech = '-';
 		}
-		else if (S_ISDIR(statbuf.st_mode)) {
+		else if (S_ISDIR(statbuf->st_mode)) {
 			typech = 'd';
 		}
-		else if (S_ISLNK(statbuf.st_mode)) {
+		else if (S_ISLNK(statbuf->st_mode)) {
 			typech = 'l';
 		}
-		else if (S_ISCHR(statbuf.st_mode)) {
+		else if (S_ISCHR(statbuf->st_mode)) {
 			typech = 'c';
 		}
-		else if (S_ISBLK(statbuf.st_mode)) {
+		else if (S_ISBLK(statbuf->st_mode)) {
 			typech = 'b';
 		}
 		else {
@@ -179,12 +166,56 @@ print(const char *path)
 
 		printf("%crwx------ %2d root  %-7llu ",
 		       typech,
-		       statbuf.st_nlink,
-		       statbuf.st_size);
+		       statbuf->st_nlink,
+		       statbuf->st_size);
 	}
 	printf("%s\n", file);
 }
 
+/*
+ * Show a file named on the command line.
+ */
+static
+void
+print(const char *path)
+{
+	struct stat statbuf;
+
+	if (lopt || sopt) {
+		int fd;
+
+		fd = open(path, O_RDONLY);
+		if (fd<0) {
+			err(1, "%s", path);
+		}
+		if (fstat(fd, &statbuf)<0) {
+			err(1, "%s: fstat", path);
+		}
+		close(fd);
+	}
+
+	printstat(basename(path), &statbuf);
+}
+
+/*
+ * Show a file found in a directory. With DIRENT_STAT, getdirentries
+ * already told us everything, so there's no need to open it.
+ */
+static
+void
+printdirent(const struct dirent *d)
+{
+	struct stat statbuf;
+
+	memset(&statbuf, 0, sizeof(statbuf));
+	statbuf.st_mode = d->d_mode;
+	statbuf.st_nlink = d->d_nlink;
+	statbuf.st_size = d->d_size;
+	statbuf.st_blocks = d->d_blocks;
+
+	printstat(d->d_name, &statbuf);
+}
+
 /*
  * List a directory.
  */
@@ -193,9 +224,10 @@ void
 listdir(const char *path, int showheader)
 {
 	int fd;
-	char buf[1024];
-	char newpath[1024];
-	ssize_t len;
+	/* off_t so the records in it are suitably aligned */
+	off_t buf[DIRBUFSIZE / sizeof(off_t)];
+	struct dirent *d;
+	int len, pos;
 
 	if (showheader) {
 		printheader(path);
@@ -210,21 +242,22 @@ listdir(const char *path, int showheader)
 	}
 
 	/*
-	 * List the directory.
+	 * List the directory, as many names per call as fit in the
+	 * buffer. Only ask for the file info if we're going to print it.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
-
-		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
-
-		if (aopt || buf[0]!='.') {
-			/* Print it */
-			print(newpath);
+	while ((len = getdirentries(fd, buf, sizeof(buf),
+				    (lopt || sopt) ? DIRENT_STAT : 0)) > 0) {
+		for (pos = 0; pos < len; pos += d->d_reclen) {
+			d = (struct dirent *)((char *)buf + pos);
+
+			if (aopt || d->d_name[0]!='.') {
+				/* Print it */
+				printdirent(d);
+			}
 		}
 	}
 	if (len<0) {
-		err(1, "%s: getdirentry", path);
+		err(1, "%s: getdirentries", path);
 	}
 
 	/* Done */
@@ -236,9 +269,10 @@ void
 recursedir(const char *path)
 {
 	int fd;
-	char buf[1024];
+	off_t buf[DIRBUFSIZE / sizeof(off_t)];
 	char newpath[1024];
-	int len;
+	struct dirent *d;
+	int len, pos;
 
 	/*
 	 * Open it.
@@ -251,29 +285,33 @@ recursedir(const char *path)
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
+	while ((len = getdirentries(fd, buf, sizeof(buf), DIRENT_STAT)) > 0) {
+		for (pos = 0; pos < len; pos += d->d_reclen) {
+			d = (struct dirent *)((char *)buf + pos);
 
-		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+			if (!aopt && d->d_name[0]=='.') {
+				/* skip this one */
+				continue;
+			}
 
-		if (!aopt && buf[0]=='.') {
-			/* skip this one */
-			continue;
-		}
+			if (!strcmp(d->d_name, ".") ||
+			    !strcmp(d->d_name, "..")) {
+				/* always skip these */
+				continue;
+			}
 
-		if (!strcmp(buf, ".") || !strcmp(buf, "..")) {
-			/* always skip these */
-			continue;
-		}
+			if (!S_ISDIR(d->d_mode)) {
+				continue;
+			}
 
-		if (!isdir(newpath)) {
-			continue;
-		}
+			/* Assemble the full name of the new item */
+			snprintf(newpath, sizeof(newpath), "%s/%s",
+				 path, d->d_name);
 
-		listdir(newpath, 1 /*showheader*/);
-		if (Ropt) {
-			recursedir(newpath);
+			listdir(newpath, 1 /*showheader*/);
+			if (Ropt) {
+				recursedir(newpath);
+			}
 		}
 	}
 	if (len<0) {
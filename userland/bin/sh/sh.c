@@ -58,6 +58,9 @@
 /* avoid making this unreasonably large; causes problems under dumbvm */
 #define CMDLINE_MAX 4096
 
+/* most commands allowed in one pipeline */
+#define MAXPIPE 16
+
 /* struct to (portably) hold exit info */
 struct exitinfo {
 	unsigned val:8,
@@ -355,19 +358,92 @@ static struct {
 	{ NULL, NULL }
 };
 
+/*
+ * runpipeline
+ * runs the commands of a pipeline, each one's output connected to the
+ * next one's input, and waits for all of them. the exit status is that
+ * of the last command.
+ */
+static
+void
+runpipeline(char **cmds[], int ncmds, struct exitinfo *ei)
+{
+	pid_t pids[MAXPIPE];
+	int fds[2];
+	int infd = -1;
+	int i, j, status;
+
+	for (i=0; i<ncmds; i++) {
+		if (i < ncmds-1 && pipe(fds) < 0) {
+			warn("pipe");
+			break;
+		}
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			warn("fork");
+			if (i < ncmds-1) {
+				close(fds[0]);
+				close(fds[1]);
+			}
+			break;
+		}
+		if (pids[i] == 0) {
+			/* child */
+			if (infd >= 0) {
+				dup2(infd, STDIN_FILENO);
+				close(infd);
+			}
+			if (i < ncmds-1) {
+				dup2(fds[1], STDOUT_FILENO);
+				close(fds[0]);
+				close(fds[1]);
+			}
+			execvp(cmds[i][0], cmds[i]);
+			warn("%s", cmds[i][0]);
+			/* see docommand for why _exit */
+			_exit(1);
+		}
+
+		/* parent; the children have their own copies now */
+		if (infd >= 0) {
+			close(infd);
+			infd = -1;
+		}
+		if (i < ncmds-1) {
+			close(fds[1]);
+			infd = fds[0];
+		}
+	}
+	if (infd >= 0) {
+		close(infd);
+	}
+
+	exitinfo_exit(ei, 255);
+	for (j=0; j<i; j++) {
+		if (waitpid(pids[j], &status, 0) < 0) {
+			warn("waitpid");
+		}
+		else if (j == ncmds-1) {
+			readstatus(status, ei);
+		}
+	}
+}
+
 /*
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
  * simply returns.  checks to see if it's a builtin, running it if it is.
  * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * the job if possible, otherwise just run it and wait on it.  a '|' splits
+ * the line into a pipeline, which always runs in the foreground.
  */
 static
 void
 docommand(char *buf, struct exitinfo *ei)
 {
 	char *args[NARG_MAX + 1];
-	int nargs, i;
+	char **cmds[MAXPIPE];
+	int nargs, ncmds, i;
 	char *s;
 	pid_t pid;
 	int status;
@@ -417,48 +493,82 @@ docommand(char *buf, struct exitinfo *ei)
 		bg = 1;
 	}
 
-	if (timing) {
-		__time(&startsecs, &startnsecs);
+	/* split pipelines at each '|', in place */
+	cmds[0] = args;
+	ncmds = 1;
+	for (i=0; i<nargs; i++) {
+		if (strcmp(args[i], "|")) {
+			continue;
+		}
+		if (ncmds >= MAXPIPE) {
+			printf("%s: Too many commands in pipeline\n", args[0]);
+			exitinfo_exit(ei, 1);
+			return;
+		}
+		args[i] = NULL;
+		cmds[ncmds++] = &args[i+1];
 	}
-
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			exitinfo_exit(ei, 255);
+	for (i=0; i<ncmds; i++) {
+		if (cmds[i][0] == NULL) {
+			printf("Invalid null command in pipeline\n");
+			exitinfo_exit(ei, 1);
 			return;
-		case 0:
-			/* child */
-			execvp(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
+		}
 	}
-
-	/* parent */
-	if (bg) {
-		/* background this command */
-		remember_bg(pid);
-		printf("[%d] %s ... &\n", pid, args[0]);
-		exitinfo_exit(ei, 0);
+	if (ncmds > 1 && bg) {
+		printf("%s: Pipelines can't be run in the background\n",
+		       args[0]);
+		exitinfo_exit(ei, 1);
 		return;
 	}
 
-	if (waitpid(pid, &status, 0) < 0) {
-		warn("waitpid");
-		exitinfo_exit(ei, 255);
+	if (timing) {
+		__time(&startsecs, &startnsecs);
+	}
+
+	if (ncmds > 1) {
+		runpipeline(cmds, ncmds, ei);
 	}
 	else {
-		readstatus(status, ei);
+		pid = fork();
+		switch (pid) {
+			case -1:
+				/* error */
+				warn("fork");
+				exitinfo_exit(ei, 255);
+				return;
+			case 0:
+				/* child */
+				execvp(args[0], args);
+				warn("%s", args[0]);
+				/*
+				 * Use _exit() instead of exit() in the child
+				 * process to avoid calling atexit() functions,
+				 * which would cause hostcompat (if present) to
+				 * reset the tty state and mess up our input
+				 * handling.
+				 */
+				_exit(1);
+			default:
+				break;
+		}
+
+		/* parent */
+		if (bg) {
+			/* background this command */
+			remember_bg(pid);
+			printf("[%d] %s ... &\n", pid, args[0]);
+			exitinfo_exit(ei, 0);
+			return;
+		}
+
+		if (waitpid(pid, &status, 0) < 0) {
+			warn("waitpid");
+			exitinfo_exit(ei, 255);
+		}
+		else {
+			readstatus(status, ei);
+		}
 	}
 
 	if (timing) {
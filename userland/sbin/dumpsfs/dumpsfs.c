@@ -142,6 +142,10 @@ readsb(void)
 	if (SWAP32(sb.sb_magic) != SFS_MAGIC) {
 		errx(1, "Not an sfs filesystem");
 	}
+	if (SWAP32(sb.sb_version) != SFS_VERSION) {
+		errx(1, "Unsupported sfs format version %u (should be %u)",
+		     SWAP32(sb.sb_version), SFS_VERSION);
+	}
 	return SWAP32(sb.sb_nblocks);
 }
 
@@ -158,6 +162,7 @@ dumpsb(void)
 	printf("Superblock\n");
 	printf("----------\n");
 	dumpvalf("Magic", "0x%8x", SWAP32(sb.sb_magic));
+	dumpvalf("Version", "%u", SWAP32(sb.sb_version));
 	dumpvalf("Size", "%u blocks", SWAP32(sb.sb_nblocks));
 	dumpvalf("Freemap size", "%u blocks",
 		 SFS_FREEMAPBLOCKS(SWAP32(sb.sb_nblocks)));
@@ -230,7 +235,7 @@ dumpfreemap(uint32_t fsblocks)
 
 static
 void
-dumpindirect(uint32_t block)
+dumpindirect(uint32_t block, unsigned levels)
 {
 	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
 	char tmp[128];
@@ -239,7 +244,7 @@ dumpindirect(uint32_t block)
 	if (block == 0) {
 		return;
 	}
-	printf("Indirect block %u\n", block);
+	printf("Indirect block %u (level %u)\n", block, levels);
 
 	diskread(ib, block);
 	for (i=0; i<ARRAYCOUNT(ib); i++) {
@@ -253,26 +258,69 @@ dumpindirect(uint32_t block)
 			printf("\n");
 		}
 	}
+
+	if (levels > 1) {
+		for (i=0; i<ARRAYCOUNT(ib); i++) {
+			dumpindirect(SWAP32(ib[i]), levels - 1);
+		}
+	}
 }
 
+/*
+ * Look up INDEX in the indirect block tree rooted at BLOCK, which has
+ * LEVELS levels.
+ */
 static
 uint32_t
-traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
-	    void (*doblock)(uint32_t, uint32_t))
+ibmap(uint32_t block, unsigned levels, uint32_t index)
 {
 	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
+	uint32_t span;
 	unsigned i;
 
-	if (block == 0) {
-		memset(ib, 0, sizeof(ib));
+	span = 1;
+	for (i=1; i<levels; i++) {
+		span *= SFS_DBPERIDB;
 	}
-	else {
+	for (i=levels; i>0 && block != 0; i--) {
 		diskread(ib, block);
+		block = SWAP32(ib[(index / span) % SFS_DBPERIDB]);
+		span /= SFS_DBPERIDB;
 	}
-	for (i=0; i<ARRAYCOUNT(ib) && fileblock < numblocks; i++) {
-		doblock(fileblock++, SWAP32(ib[i]));
+	return block;
+}
+
+/*
+ * Get the disk block for FILEBLOCK: extents first, then the indirect
+ * blocks.
+ */
+static
+uint32_t
+bmap(const struct sfs_dinode *sfi, uint32_t fileblock)
+{
+	const uint32_t range1 = SFS_DBPERIDB;
+	const uint32_t range2 = SFS_DBPERIDB * SFS_DBPERIDB;
+	uint32_t start, len;
+	unsigned i;
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		start = SWAP32(sfi->sfi_extents[i].sfe_fileblock);
+		len = SWAP32(sfi->sfi_extents[i].sfe_nblocks);
+		if (fileblock >= start && fileblock - start < len) {
+			return SWAP32(sfi->sfi_extents[i].sfe_diskblock) +
+				(fileblock - start);
+		}
+	}
+
+	if (fileblock < range1) {
+		return ibmap(SWAP32(sfi->sfi_indirect), 1, fileblock);
+	}
+	fileblock -= range1;
+	if (fileblock < range2) {
+		return ibmap(SWAP32(sfi->sfi_dindirect), 2, fileblock);
 	}
-	return fileblock;
+	fileblock -= range2;
+	return ibmap(SWAP32(sfi->sfi_tindirect), 3, fileblock);
 }
 
 static
@@ -281,19 +329,12 @@ traverse(const struct sfs_dinode *sfi, void (*doblock)(uint32_t, uint32_t))
 {
 	uint32_t fileblock;
 	uint32_t numblocks;
-	unsigned i;
 
 	numblocks = DIVROUNDUP(SWAP32(sfi->sfi_size), SFS_BLOCKSIZE);
 
-	fileblock = 0;
-	for (i=0; i<SFS_NDIRECT && fileblock < numblocks; i++) {
-		doblock(fileblock++, SWAP32(sfi->sfi_direct[i]));
-	}
-	if (fileblock < numblocks) {
-		fileblock = traverse_ib(fileblock, numblocks,
-					SWAP32(sfi->sfi_indirect), doblock);
+	for (fileblock = 0; fileblock < numblocks; fileblock++) {
+		doblock(fileblock, bmap(sfi, fileblock));
 	}
-	assert(fileblock == numblocks);
 }
 
 static
@@ -451,31 +492,32 @@ dumpinode(uint32_t ino, const char *name)
 	dumpvalf("Link count", "%u", SWAP16(sfi.sfi_linkcount));
 	printf("\n");
 
-        printf("    Direct blocks:\n");
-        for (i=0; i<SFS_NDIRECT; i++) {
-		if (i % 4 == 0) {
-			printf("@%-2u    ", i);
+	printf("    Extents:\n");
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		const struct sfs_extent *ext = &sfi.sfi_extents[i];
+
+		if (ext->sfe_nblocks == 0 && ext->sfe_fileblock == 0 &&
+		    ext->sfe_diskblock == 0) {
+			continue;
 		}
 		/*
 		 * Assume the disk size might be > 64K sectors (which
 		 * would be 32M) but is < 1024K sectors (512M) so we
-		 * need up to 5 hex digits for a block number. And
-		 * assume it's actually < 1 million sectors so we need
-		 * only up to 6 decimal digits. The complete block
-		 * number print then needs up to 16 digits.
+		 * need up to 5 hex digits for a block number.
 		 */
 		snprintf(tmp, sizeof(tmp), "%u (0x%x)",
-			 SWAP32(sfi.sfi_direct[i]), SWAP32(sfi.sfi_direct[i]));
-		printf("  %-16s", tmp);
-		if (i % 4 == 3) {
-			printf("\n");
-		}
-	}
-	if (i % 4 != 0) {
-		printf("\n");
+			 SWAP32(ext->sfe_diskblock),
+			 SWAP32(ext->sfe_diskblock));
+		printf("@%-2u      file block %-6u  %u blocks at %s\n", i,
+		       SWAP32(ext->sfe_fileblock),
+		       SWAP32(ext->sfe_nblocks), tmp);
 	}
 	printf("    Indirect block: %u (0x%x)\n",
 	       SWAP32(sfi.sfi_indirect), SWAP32(sfi.sfi_indirect));
+	printf("    Double indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_dindirect), SWAP32(sfi.sfi_dindirect));
+	printf("    Triple indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_tindirect), SWAP32(sfi.sfi_tindirect));
 	for (i=0; i<ARRAYCOUNT(sfi.sfi_waste); i++) {
 		if (sfi.sfi_waste[i] != 0) {
 			printf("    Word %u in waste area: 0x%x\n",
@@ -484,7 +526,9 @@ dumpinode(uint32_t ino, const char *name)
 	}
 
 	if (doindirect) {
-		dumpindirect(SWAP32(sfi.sfi_indirect));
+		dumpindirect(SWAP32(sfi.sfi_indirect), 1);
+		dumpindirect(SWAP32(sfi.sfi_dindirect), 2);
+		dumpindirect(SWAP32(sfi.sfi_tindirect), 3);
 	}
 
 	if (SWAP16(sfi.sfi_type) == SFS_TYPE_DIR && dodirs) {
@@ -140,6 +140,7 @@ writesuper(const char *volname, uint32_t nblocks)
 	sb.sb_magic = SWAP32(SFS_MAGIC);
 	sb.sb_nblocks = SWAP32(nblocks);
 	strcpy(sb.sb_volname, volname);
+	sb.sb_version = SWAP32(SFS_VERSION);
 
 	/* and write it out. */
 	diskwrite(&sb, SFS_SUPER_BLOCK);
@@ -93,9 +93,11 @@ main(int argc, char **argv)
 
 	closedisk();
 
-	warnx("%lu blocks used (of %lu); %lu directories; %lu files",
+	warnx("%lu blocks used (of %lu); %lu directories; %lu files "
+	      "(%lu non-contiguous)",
 	      freemap_blocksused(), (unsigned long)sb_totalblocks(),
-	      pass1_founddirs(), pass1_foundfiles());
+	      pass1_founddirs(), pass1_foundfiles(),
+	      pass1_foundfragmented());
 
 	switch (badness) {
 	    case EXIT_USAGE:
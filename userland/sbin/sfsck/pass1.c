@@ -47,7 +47,7 @@
 #include "passes.h"
 #include "main.h"
 
-static unsigned long count_dirs=0, count_files=0;
+static unsigned long count_dirs=0, count_files=0, count_fragmented=0;
 
 /*
  * State for checking indirect blocks.
@@ -172,6 +172,91 @@ check_indirect_block(struct ibstate *ibs, uint32_t *ientry, int *iechangedp,
 	}
 }
 
+/*
+ * Check the extents of an inode: record the blocks that are in use,
+ * drop any that are past EOF, and clear extents that point outside
+ * the volume. The state in IBS is the same as for the indirect
+ * blocks, except that curfileblock isn't used.
+ *
+ * Returns nonzero if SFI has been modified.
+ */
+static
+int
+check_inode_extents(struct ibstate *ibs, struct sfs_dinode *sfi)
+{
+	struct sfs_extent *ext;
+	uint32_t j, keep;
+	int changed = 0;
+	unsigned i;
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sfi->sfi_extents[i];
+
+		if (ext->sfe_nblocks == 0) {
+			if (ext->sfe_fileblock != 0 ||
+			    ext->sfe_diskblock != 0) {
+				setbadness(EXIT_RECOV);
+				warnx("Inode %lu: unused extent %u not "
+				      "zeroed (fixed)",
+				      (unsigned long)ibs->ino, i);
+				ext->sfe_fileblock = 0;
+				ext->sfe_diskblock = 0;
+				changed = 1;
+			}
+			continue;
+		}
+
+		if (ext->sfe_diskblock == 0 ||
+		    ext->sfe_diskblock >= ibs->volblocks ||
+		    ext->sfe_nblocks > ibs->volblocks - ext->sfe_diskblock) {
+			setbadness(EXIT_RECOV);
+			warnx("Inode %lu: extent %u (%lu blocks at %lu) "
+			      "outside of volume (cleared)",
+			      (unsigned long)ibs->ino, i,
+			      (unsigned long)ext->sfe_nblocks,
+			      (unsigned long)ext->sfe_diskblock);
+			ext->sfe_fileblock = 0;
+			ext->sfe_diskblock = 0;
+			ext->sfe_nblocks = 0;
+			changed = 1;
+			continue;
+		}
+
+		/* How much of it is before EOF */
+		if (ext->sfe_fileblock >= ibs->fileblocks) {
+			keep = 0;
+		}
+		else if (ibs->fileblocks - ext->sfe_fileblock <
+			 ext->sfe_nblocks) {
+			keep = ibs->fileblocks - ext->sfe_fileblock;
+		}
+		else {
+			keep = ext->sfe_nblocks;
+		}
+
+		for (j=0; j<ext->sfe_nblocks; j++) {
+			if (j < keep) {
+				freemap_blockinuse(ext->sfe_diskblock + j,
+						   ibs->usagetype, ibs->ino);
+			}
+			else {
+				freemap_blockfree(ext->sfe_diskblock + j);
+				ibs->pasteofcount++;
+			}
+		}
+		if (keep < ext->sfe_nblocks) {
+			setbadness(EXIT_RECOV);
+			ext->sfe_nblocks = keep;
+			if (keep == 0) {
+				ext->sfe_fileblock = 0;
+				ext->sfe_diskblock = 0;
+			}
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
 /*
  * Check the blocks belonging to inode INO, whose inode has already
  * been loaded into SFI. ISDIR is a shortcut telling us if the inode
@@ -185,21 +270,25 @@ int
 check_inode_blocks(uint32_t ino, struct sfs_dinode *sfi, int isdir)
 {
 	struct ibstate ibs;
-	uint32_t size, datablock;
+	uint32_t size;
+#if NUM_D > 0
+	uint32_t datablock;
+#endif
 	int changed;
 	int i;
 
 	size = SFS_ROUNDUP(sfi->sfi_size, SFS_BLOCKSIZE);
 
 	ibs.ino = ino;
-	/*ibs.curfileblock = 0;*/
+	ibs.curfileblock = 0;
 	ibs.fileblocks = size/SFS_BLOCKSIZE;
 	ibs.volblocks = sb_totalblocks();
 	ibs.pasteofcount = 0;
 	ibs.usagetype = isdir ? B_DIRDATA : B_DATA;
 
-	changed = 0;
+	changed = check_inode_extents(&ibs, sfi);
 
+#if NUM_D > 0
 	for (ibs.curfileblock=0; ibs.curfileblock<NUM_D; ibs.curfileblock++) {
 		datablock = GET_D(sfi, ibs.curfileblock);
 		if (datablock >= ibs.volblocks) {
@@ -227,6 +316,7 @@ check_inode_blocks(uint32_t ino, struct sfs_dinode *sfi, int isdir)
 			}
 		}
 	}
+#endif
 
 	for (i=0; i<NUM_I; i++) {
 		check_indirect_block(&ibs, &SET_I(sfi, i), &changed, 1);
@@ -281,6 +371,10 @@ pass1_inode(uint32_t ino, struct sfs_dinode *sfi, int alreadychanged)
 		changed = 1;
 	}
 
+	if (!isdir && !sfs_iscontiguous(sfi)) {
+		count_fragmented++;
+	}
+
 	if (changed) {
 		sfs_writeinode(ino, sfi);
 	}
@@ -494,3 +588,9 @@ pass1_foundfiles(void)
 {
 	return count_files;
 }
+
+unsigned long
+pass1_foundfragmented(void)
+{
+	return count_fragmented;
+}
@@ -48,4 +48,7 @@ void pass2(void);
 unsigned long pass1_founddirs(void);
 unsigned long pass1_foundfiles(void);
 
+/* Of those files, how many are not laid out in one piece on disk. */
+unsigned long pass1_foundfragmented(void);
+
 #endif /* PASSES_H */
@@ -54,6 +54,11 @@ sb_load(void)
 	if (sb.sb_magic != SFS_MAGIC) {
 		errx(EXIT_FATAL, "Not an sfs filesystem");
 	}
+	if (sb.sb_version != SFS_VERSION) {
+		errx(EXIT_FATAL, "Unsupported sfs format version %lu "
+		     "(should be %lu)", (unsigned long)sb.sb_version,
+		     (unsigned long)SFS_VERSION);
+	}
 
 	assert(sb.sb_nblocks > 0);
 	assert(SFS_FREEMAPBLOCKS(sb.sb_nblocks) > 0);
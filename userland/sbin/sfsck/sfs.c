@@ -62,6 +62,7 @@ swapsb(struct sfs_superblock *sb)
 {
 	sb->sb_magic = SWAP32(sb->sb_magic);
 	sb->sb_nblocks = SWAP32(sb->sb_nblocks);
+	sb->sb_version = SWAP32(sb->sb_version);
 }
 
 static
@@ -82,6 +83,14 @@ swapinode(struct sfs_dinode *sfi)
 	sfi->sfi_type = SWAP16(sfi->sfi_type);
 	sfi->sfi_linkcount = SWAP16(sfi->sfi_linkcount);
 
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		struct sfs_extent *ext = &sfi->sfi_extents[i];
+
+		ext->sfe_fileblock = SWAP32(ext->sfe_fileblock);
+		ext->sfe_diskblock = SWAP32(ext->sfe_diskblock);
+		ext->sfe_nblocks = SWAP32(ext->sfe_nblocks);
+	}
+
 	for (i=0; i<NUM_D; i++) {
 		SET_D(sfi, i) = SWAP32(GET_D(sfi, i));
 	}
@@ -155,18 +164,32 @@ ibmap(uint32_t iblock, uint32_t offset, uint32_t entrysize)
 /*
  * bmap() for SFS.
  *
- * Given an inode and a file block, returns a disk block.
+ * Given an inode and a file block, returns a disk block. Extents
+ * first, then the indirect blocks.
  */
 static
 uint32_t
 bmap(const struct sfs_dinode *sfi, uint32_t fileblock)
 {
+	const struct sfs_extent *ext;
 	uint32_t iblock, offset;
+	unsigned i;
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sfi->sfi_extents[i];
+		if (fileblock >= ext->sfe_fileblock &&
+		    fileblock - ext->sfe_fileblock < ext->sfe_nblocks) {
+			return ext->sfe_diskblock +
+				(fileblock - ext->sfe_fileblock);
+		}
+	}
 
+#if NUM_D > 0
 	if (fileblock < INOMAX_D) {
 		return GET_D(sfi, fileblock);
 	}
-	else if (fileblock < INOMAX_I) {
+#endif
+	if (fileblock < INOMAX_I) {
 		iblock = (fileblock - INOMAX_D) / RANGE_I;
 		offset = (fileblock - INOMAX_D) % RANGE_I;
 		return ibmap(GET_I(sfi, iblock), offset, RANGE_D);
@@ -391,6 +414,30 @@ sfs_writedir(const struct sfs_dinode *sfi, struct sfs_direntry *d, unsigned nd)
 	assert(left == 0);
 }
 
+/*
+ * Check whether the blocks of the file whose inode is SFI lie on the
+ * disk one after another in file order. Holes are skipped over.
+ */
+int
+sfs_iscontiguous(const struct sfs_dinode *sfi)
+{
+	uint32_t nblocks, i, diskblock, prev;
+
+	nblocks = SFS_ROUNDUP(sfi->sfi_size, SFS_BLOCKSIZE) / SFS_BLOCKSIZE;
+	prev = 0;
+	for (i=0; i<nblocks; i++) {
+		diskblock = bmap(sfi, i);
+		if (diskblock == 0) {
+			continue;
+		}
+		if (prev != 0 && diskblock != prev + 1) {
+			return 0;
+		}
+		prev = diskblock;
+	}
+	return 1;
+}
+
 ////////////////////////////////////////////////////////////
 // directory utilities
 
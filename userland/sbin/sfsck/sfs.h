@@ -70,6 +70,9 @@ void sfs_readdir(struct sfs_dinode *sfi, struct sfs_direntry *d, unsigned nd);
 void sfs_writedir(const struct sfs_dinode *sfi,
 		  struct sfs_direntry *d, unsigned nd);
 
+/* Check if a file's blocks are laid out in order on disk. */
+int sfs_iscontiguous(const struct sfs_dinode *sfi);
+
 /* Try to add an entry to a directory. */
 int sfsdir_tryadd(struct sfs_direntry *d, int nd,
 		  const char *name, uint32_t ino);
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Several processes each append to their own file at the same time,
+ * a block at a time.
+ *
+ * This is meant for looking at how the file system lays out files
+ * that grow side by side: run it, then check the disk with sfsck and
+ * see how many files it reports as non-contiguous (or look at the
+ * extents with dumpsfs).
+ *
+ * Afterwards they all read their files back at once and check the
+ * contents. Both phases are timed; run it with more than one CPU to
+ * see whether the file system lets the processes overlap.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define NPROCS		4
+#define CHUNKSIZE	512
+
+static char buffer[CHUNKSIZE];
+static char readbuf[CHUNKSIZE];
+
+static
+void
+writer(unsigned num, unsigned nchunks)
+{
+	char name[32];
+	unsigned i;
+	ssize_t len;
+	int fd;
+
+	snprintf(name, sizeof(name), "concwrite.%u", num);
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: create", name);
+	}
+
+	memset(buffer, 'a' + num, sizeof(buffer));
+	for (i=0; i<nchunks; i++) {
+		len = write(fd, buffer, sizeof(buffer));
+		if (len < 0) {
+			err(1, "%s: write", name);
+		}
+		if ((size_t)len != sizeof(buffer)) {
+			errx(1, "%s: short write (%ld bytes)", name, (long)len);
+		}
+	}
+
+	if (close(fd)) {
+		err(1, "%s: close", name);
+	}
+}
+
+static
+void
+reader(unsigned num, unsigned nchunks)
+{
+	char name[32];
+	unsigned i, j;
+	ssize_t len;
+	int fd;
+
+	snprintf(name, sizeof(name), "concwrite.%u", num);
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", name);
+	}
+
+	for (i=0; i<nchunks; i++) {
+		len = read(fd, readbuf, sizeof(readbuf));
+		if (len < 0) {
+			err(1, "%s: read", name);
+		}
+		if ((size_t)len != sizeof(readbuf)) {
+			errx(1, "%s: short read (%ld bytes)", name, (long)len);
+		}
+		for (j=0; j<sizeof(readbuf); j++) {
+			if (readbuf[j] != 'a' + (int)num) {
+				errx(1, "%s: wrong data at offset %u",
+				     name, i * CHUNKSIZE + j);
+			}
+		}
+	}
+	len = read(fd, readbuf, sizeof(readbuf));
+	if (len != 0) {
+		errx(1, "%s: file too long", name);
+	}
+
+	if (close(fd)) {
+		err(1, "%s: close", name);
+	}
+}
+
+/*
+ * Run FUNC in NPROCS processes at once and wait for them all.
+ * Returns nonzero if any of them failed.
+ */
+static
+int
+runall(const char *what, void (*func)(unsigned, unsigned), unsigned nchunks)
+{
+	pid_t pids[NPROCS];
+	unsigned long long start;
+	unsigned i;
+	int status, bad = 0;
+
+	start = bench_now();
+	for (i=0; i<NPROCS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			func(i, nchunks);
+			_exit(0);
+		}
+	}
+
+	for (i=0; i<NPROCS; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			warnx("%s %u failed", what, i);
+			bad = 1;
+		}
+	}
+	tprintf("%s: %llu ms\n", what, bench_now() - start);
+	return bad;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned nchunks;
+	int bad;
+
+	if (argc > 2) {
+		errx(1, "Usage: concwrite [blocks-per-file]");
+	}
+	nchunks = argc == 2 ? (unsigned)atoi(argv[1]) : 256;
+
+	tprintf("Writing %u files of %u blocks each at once\n",
+		NPROCS, nchunks);
+	bad = runall("writer", writer, nchunks);
+	if (!bad) {
+		bad = runall("reader", reader, nchunks);
+	}
+
+	if (bad) {
+		errx(1, "FAILED");
+	}
+	tprintf("Passed.\n");
+	return 0;
+}
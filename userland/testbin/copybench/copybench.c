@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * File copy benchmark.
+ *
+ * Writes a file of a few megabytes, then copies it three ways: with
+ * read() and write() through a small buffer, as cp used to; through
+ * a large buffer; and with sendfile(), which keeps the data in the
+ * kernel. Each copy is checked and timed. Last, sendfile() with an
+ * explicit offset is checked not to move the input's seek position.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define FROMFILE	"copybench.src"
+#define TOFILE		"copybench.dst"
+#define DEFAULT_KB	2048
+#define SMALLBUF	1024
+#define BIGBUF		65536
+
+static char buf[BIGBUF];
+static char buf2[BIGBUF];
+
+static
+int
+openfile(const char *name, int flags)
+{
+	int fd;
+
+	fd = open(name, flags, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	return fd;
+}
+
+static
+void
+fillbuf(char *p, size_t len, unsigned seed)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		p[i] = (char)((seed + i) * 31 + (i >> 8));
+	}
+}
+
+/*
+ * Copy FROMFILE to TOFILE with read() and write() through BUFSIZE
+ * bytes of buffer.
+ */
+static
+void
+rwcopy(size_t bufsize)
+{
+	int fromfd, tofd;
+	ssize_t len, wr;
+
+	fromfd = openfile(FROMFILE, O_RDONLY);
+	tofd = openfile(TOFILE, O_WRONLY|O_CREAT|O_TRUNC);
+	while ((len = read(fromfd, buf, bufsize)) > 0) {
+		wr = write(tofd, buf, len);
+		if (wr != len) {
+			err(1, "%s: write", TOFILE);
+		}
+	}
+	if (len < 0) {
+		err(1, "%s: read", FROMFILE);
+	}
+	close(fromfd);
+	close(tofd);
+}
+
+static
+void
+sfcopy(void)
+{
+	int fromfd, tofd;
+	ssize_t len;
+
+	fromfd = openfile(FROMFILE, O_RDONLY);
+	tofd = openfile(TOFILE, O_WRONLY|O_CREAT|O_TRUNC);
+	while ((len = sendfile(tofd, fromfd, NULL, BIGBUF)) > 0) {
+		/* nothing */
+	}
+	if (len < 0) {
+		err(1, "sendfile");
+	}
+	close(fromfd);
+	close(tofd);
+}
+
+/*
+ * Check that TOFILE is the same as FROMFILE, which is KB kilobytes.
+ */
+static
+void
+check(const char *what, unsigned kb)
+{
+	int fromfd, tofd;
+	ssize_t len, len2;
+	size_t total;
+
+	fromfd = openfile(FROMFILE, O_RDONLY);
+	tofd = openfile(TOFILE, O_RDONLY);
+	total = 0;
+	while ((len = read(fromfd, buf, BIGBUF)) > 0) {
+		len2 = read(tofd, buf2, len);
+		if (len2 != len || memcmp(buf, buf2, len)) {
+			errx(1, "%s: copy differs near byte %lu", what,
+			     (unsigned long)total);
+		}
+		total += len;
+	}
+	if (len < 0) {
+		err(1, "%s: read", FROMFILE);
+	}
+	if (read(tofd, buf2, 1) != 0 || total != kb * 1024) {
+		errx(1, "%s: copy is the wrong size", what);
+	}
+	close(fromfd);
+	close(tofd);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long long start;
+	unsigned i, kb;
+	off_t offset;
+	ssize_t len;
+	int fromfd, tofd;
+
+	if (argc > 2) {
+		errx(1, "Usage: copybench [kilobytes]");
+	}
+	kb = argc == 2 ? (unsigned)atoi(argv[1]) : DEFAULT_KB;
+	kb = (kb + 63) / 64 * 64;
+
+	fromfd = openfile(FROMFILE, O_WRONLY|O_CREAT|O_TRUNC);
+	for (i=0; i<kb/64; i++) {
+		fillbuf(buf, BIGBUF, i);
+		if (write(fromfd, buf, BIGBUF) != BIGBUF) {
+			err(1, "%s: write", FROMFILE);
+		}
+	}
+	close(fromfd);
+
+	start = bench_now();
+	rwcopy(SMALLBUF);
+	bench_report("read/write 1K", start, kb);
+	check("read/write 1K", kb);
+
+	start = bench_now();
+	rwcopy(BIGBUF);
+	bench_report("read/write 64K", start, kb);
+	check("read/write 64K", kb);
+
+	start = bench_now();
+	sfcopy();
+	bench_report("sendfile", start, kb);
+	check("sendfile", kb);
+
+	/* With an offset, the input's seek position doesn't move */
+	fromfd = openfile(FROMFILE, O_RDONLY);
+	tofd = openfile(TOFILE, O_WRONLY|O_CREAT|O_TRUNC);
+	offset = BIGBUF;
+	len = sendfile(tofd, fromfd, &offset, BIGBUF);
+	if (len != BIGBUF) {
+		err(1, "sendfile with offset");
+	}
+	if (offset != 2 * BIGBUF || lseek(fromfd, 0, SEEK_CUR) != 0) {
+		errx(1, "sendfile with offset: wrong position afterwards");
+	}
+	close(fromfd);
+	close(tofd);
+	tofd = openfile(TOFILE, O_RDONLY);
+	fillbuf(buf, BIGBUF, 1);
+	if (read(tofd, buf2, BIGBUF) != BIGBUF || memcmp(buf, buf2, BIGBUF)) {
+		errx(1, "sendfile with offset: wrong data");
+	}
+	close(tofd);
+
+	remove(FROMFILE);
+	remove(TOFILE);
+	tprintf("Passed.\n");
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Directory lookup benchmark.
+ *
+ * Creates a lot of files in one directory, opens each of them by
+ * name, looks up names that aren't there, lists the directory, and
+ * removes them all again, timing each phase. How long these take as
+ * the number of files grows shows how directory search scales: with
+ * a linear scan each phase is quadratic in the number of files.
+ *
+ * The directory is listed three ways: with getdirentries alone, with
+ * getdirentries returning the file info too (as ls -l does), and the
+ * old way, with an open and fstat per name.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define DEFAULT_NFILES	1000
+#define PREFIX		"dirbench."
+#define DIRBUFSIZE	4096
+
+static
+void
+mkname(char *buf, size_t len, const char *prefix, unsigned num)
+{
+	snprintf(buf, len, "%s%u", prefix, num);
+}
+
+static
+void
+report(const char *what, unsigned n, unsigned long long start)
+{
+	unsigned long long ms;
+
+	ms = bench_now() - start;
+	tprintf("%-20s %6u in %6llu ms\n", what, n, ms);
+}
+
+/*
+ * List the current directory with getdirentries, checking that each
+ * of our NFILES files turns up once (by counting them), and, with
+ * DIRENT_STAT, that each is a regular file. If OPENSTAT is set, also
+ * open and fstat each of them by name, for comparison.
+ */
+static
+void
+listdir(unsigned nfiles, int flags, int openstat)
+{
+	/* off_t so the records in it are suitably aligned */
+	off_t buf[DIRBUFSIZE / sizeof(off_t)];
+	struct dirent *d;
+	struct stat st;
+	unsigned found;
+	int dirfd, fd, len, pos;
+
+	dirfd = open(".", O_RDONLY);
+	if (dirfd < 0) {
+		err(1, ".");
+	}
+
+	found = 0;
+	while ((len = getdirentries(dirfd, buf, sizeof(buf), flags)) > 0) {
+		for (pos = 0; pos < len; pos += d->d_reclen) {
+			d = (struct dirent *)((char *)buf + pos);
+			if (strncmp(d->d_name, PREFIX, strlen(PREFIX))) {
+				continue;
+			}
+			found++;
+			if (openstat) {
+				fd = open(d->d_name, O_RDONLY);
+				if (fd < 0) {
+					err(1, "%s: open", d->d_name);
+				}
+				if (fstat(fd, &st) < 0) {
+					err(1, "%s: fstat", d->d_name);
+				}
+				close(fd);
+				d->d_mode = st.st_mode;
+			}
+			if (((flags & DIRENT_STAT) || openstat) &&
+			    !S_ISREG(d->d_mode)) {
+				errx(1, "%s: not a regular file", d->d_name);
+			}
+		}
+	}
+	if (len < 0) {
+		err(1, "getdirentries");
+	}
+	close(dirfd);
+
+	if (found != nfiles) {
+		errx(1, "Found %u files, expected %u", found, nfiles);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	char name[32];
+	unsigned i, nfiles;
+	unsigned long long start;
+	int fd;
+
+	if (argc > 2) {
+		errx(1, "Usage: dirbench [nfiles]");
+	}
+	nfiles = argc == 2 ? (unsigned)atoi(argv[1]) : DEFAULT_NFILES;
+
+	start = bench_now();
+	for (i=0; i<nfiles; i++) {
+		mkname(name, sizeof(name), PREFIX, i);
+		fd = open(name, O_WRONLY|O_CREAT|O_EXCL, 0664);
+		if (fd < 0) {
+			err(1, "%s: create", name);
+		}
+		close(fd);
+	}
+	report("create", nfiles, start);
+
+	start = bench_now();
+	for (i=0; i<nfiles; i++) {
+		mkname(name, sizeof(name), PREFIX, i);
+		fd = open(name, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s: open", name);
+		}
+		close(fd);
+	}
+	report("lookup", nfiles, start);
+
+	start = bench_now();
+	for (i=0; i<nfiles; i++) {
+		mkname(name, sizeof(name), "dirbench-missing.", i);
+		fd = open(name, O_RDONLY);
+		if (fd >= 0) {
+			errx(1, "%s: open succeeded on missing file", name);
+		}
+		if (errno != ENOENT) {
+			err(1, "%s: open", name);
+		}
+	}
+	report("lookup (missing)", nfiles, start);
+
+	start = bench_now();
+	listdir(nfiles, 0, 0);
+	report("list", nfiles, start);
+
+	start = bench_now();
+	listdir(nfiles, DIRENT_STAT, 0);
+	report("list (with stat)", nfiles, start);
+
+	start = bench_now();
+	listdir(nfiles, 0, 1);
+	report("list (open+fstat)", nfiles, start);
+
+	start = bench_now();
+	for (i=0; i<nfiles; i++) {
+		mkname(name, sizeof(name), PREFIX, i);
+		if (remove(name)) {
+			err(1, "%s: remove", name);
+		}
+	}
+	report("remove", nfiles, start);
+
+	tprintf("Passed.\n");
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * File descriptor syscall-rate benchmark.
+ *
+ * Times tight loops of cheap calls that do little besides look up a
+ * file descriptor: lseek() to the current position, a one-byte read()
+ * and pread(), and fstat(). Each loop is run first by one process and
+ * then by several forked processes at once, and the rate reported in
+ * calls per second.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define FILENAME	"fdbench.dat"
+#define DEFAULT_NCALLS	20000
+#define NPROCS		4
+
+static unsigned ncalls;
+
+static
+void
+run(int fd, int which)
+{
+	struct stat st;
+	unsigned i;
+	char ch;
+
+	for (i=0; i<ncalls; i++) {
+		switch (which) {
+		    case 0:
+			if (lseek(fd, 0, SEEK_CUR) < 0) {
+				err(1, "lseek");
+			}
+			break;
+		    case 1:
+			if (lseek(fd, 0, SEEK_SET) < 0 ||
+			    read(fd, &ch, 1) != 1) {
+				err(1, "lseek/read");
+			}
+			break;
+		    case 2:
+			if (pread(fd, &ch, 1, 0) != 1) {
+				err(1, "pread");
+			}
+			break;
+		    case 3:
+			if (fstat(fd, &st) < 0) {
+				err(1, "fstat");
+			}
+			break;
+		}
+	}
+}
+
+static const char *const names[] = {
+	"lseek", "lseek+read", "pread", "fstat",
+};
+
+/*
+ * Run loop WHICH in NPROCS processes at once (each with the file open
+ * on the same, inherited fd) and report the total rate.
+ */
+static
+void
+runprocs(int fd, int which, int nprocs)
+{
+	unsigned long long start, ms, total;
+	pid_t pids[NPROCS];
+	int i, status;
+
+	start = bench_now();
+	for (i=0; i<nprocs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			run(fd, which);
+			_exit(0);
+		}
+	}
+	for (i=0; i<nprocs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "%s: child failed", names[which]);
+		}
+	}
+	ms = bench_now() - start;
+	total = (unsigned long long)ncalls * nprocs;
+	tprintf("%-12s %d proc%s %8llu calls %6llu ms %8llu calls/s\n",
+		names[which], nprocs, nprocs == 1 ? " " : "s", total, ms,
+		ms == 0 ? 0 : total * 1000 / ms);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int fd, which;
+
+	if (argc > 2) {
+		errx(1, "Usage: fdbench [ncalls]");
+	}
+	ncalls = argc == 2 ? (unsigned)atoi(argv[1]) : DEFAULT_NCALLS;
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	if (write(fd, "x", 1) != 1) {
+		err(1, "%s: write", FILENAME);
+	}
+
+	for (which=0; which<4; which++) {
+		runprocs(fd, which, 1);
+		runprocs(fd, which, NPROCS);
+	}
+
+	close(fd);
+	remove(FILENAME);
+	return 0;
+}
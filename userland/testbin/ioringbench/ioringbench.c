@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Asynchronous I/O ring benchmark.
+ *
+ * Writes a file, then reads it back in blocks two ways: with pread(),
+ * one block at a time, and through an I/O ring with up to DEPTH reads
+ * in flight at once. Both are checked and timed. Then it rewrites the
+ * file through the ring, with an fsync, and checks the result, and
+ * checks that a request on a bad descriptor completes with -EBADF.
+ * Last, it reads a pipe through the ring, and has a child exit with a
+ * ring read still blocked on a pipe, which must not hang the exit.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <ioring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define TESTFILE	"ioringbench.dat"
+#define DEFAULT_KB	1024
+#define BLOCK		4096
+#define DEPTH		16
+
+static char bufs[DEPTH][BLOCK];
+
+/* The ring */
+static int ringfd;
+static struct ioring_params params;
+static struct ioring_ctl *ctl;
+static struct io_sqe *sq;
+static struct io_cqe *cq;
+
+/*
+ * Contents of block BLK; PASS distinguishes the two versions of the
+ * file written.
+ */
+static
+void
+fillblock(char *p, unsigned blk, unsigned pass)
+{
+	unsigned i;
+
+	for (i=0; i<BLOCK; i++) {
+		p[i] = (char)((blk * 131 + i * 7 + pass) ^ (i >> 8));
+	}
+}
+
+static
+void
+checkblock(const char *what, const char *p, unsigned blk, unsigned pass)
+{
+	static char expected[BLOCK];
+
+	fillblock(expected, blk, pass);
+	if (memcmp(p, expected, BLOCK)) {
+		errx(1, "%s: block %u is wrong", what, blk);
+	}
+}
+
+static
+void
+setupring(void)
+{
+	char *base;
+
+	ringfd = ioring_setup(DEPTH, &params);
+	if (ringfd < 0) {
+		err(1, "ioring_setup");
+	}
+	base = mmap(NULL, params.ring_size, PROT_READ|PROT_WRITE, MAP_SHARED,
+		    ringfd, 0);
+	if (base == MAP_FAILED) {
+		err(1, "mmap of ring");
+	}
+	ctl = (struct ioring_ctl *)base;
+	sq = (struct io_sqe *)(base + params.sq_off);
+	cq = (struct io_cqe *)(base + params.cq_off);
+	tprintf("ring: %u submission, %u completion entries, %u bytes\n",
+		params.sq_entries, params.cq_entries, params.ring_size);
+}
+
+/*
+ * Queue a request; it's handed to the kernel by the next ioring_enter.
+ */
+static
+void
+queue(int op, int fd, unsigned blk, void *buf, unsigned userdata)
+{
+	struct io_sqe *sqe;
+
+	if (ctl->sq_tail - ctl->sq_head >= params.sq_entries) {
+		errx(1, "submission queue full");
+	}
+	sqe = &sq[ctl->sq_tail & (params.sq_entries - 1)];
+	sqe->sqe_op = op;
+	sqe->sqe_fd = fd;
+	sqe->sqe_offset = (off_t)blk * BLOCK;
+	sqe->sqe_buf = buf;
+	sqe->sqe_len = BLOCK;
+	sqe->sqe_userdata = userdata;
+	ctl->sq_tail++;
+}
+
+/*
+ * Submit everything queued and wait for at least MIN completions.
+ */
+static
+void
+enter(unsigned min)
+{
+	unsigned pending;
+	int r;
+
+	pending = ctl->sq_tail - ctl->sq_head;
+	r = ioring_enter(ringfd, pending, min);
+	if (r < 0) {
+		err(1, "ioring_enter");
+	}
+	if ((unsigned)r != pending) {
+		errx(1, "ioring_enter took %d of %u", r, pending);
+	}
+}
+
+/*
+ * Take the next completion, or return 0 if there isn't one.
+ */
+static
+int
+reap(unsigned *userdata, int *res)
+{
+	struct io_cqe *cqe;
+
+	if (ctl->cq_head == ctl->cq_tail) {
+		return 0;
+	}
+	cqe = &cq[ctl->cq_head & (params.cq_entries - 1)];
+	*userdata = cqe->cqe_userdata;
+	*res = cqe->cqe_res;
+	ctl->cq_head++;
+	return 1;
+}
+
+/*
+ * Run NBLOCKS block reads (or writes of version PASS) of FD through
+ * the ring, keeping up to DEPTH in flight. Each request uses its own
+ * buffer; userdata records which buffer and which block.
+ */
+static
+void
+ringio(int fd, int op, unsigned nblocks, unsigned pass)
+{
+	unsigned freeslots[DEPTH], nfree;
+	unsigned next, done, userdata, slot, blk;
+	int res;
+
+	for (nfree = 0; nfree < DEPTH; nfree++) {
+		freeslots[nfree] = nfree;
+	}
+	next = done = 0;
+	while (done < nblocks) {
+		while (next < nblocks && nfree > 0) {
+			slot = freeslots[--nfree];
+			if (op == IORING_OP_WRITE) {
+				fillblock(bufs[slot], next, pass);
+			}
+			queue(op, fd, next, bufs[slot], next * DEPTH + slot);
+			next++;
+		}
+		enter(1);
+		while (reap(&userdata, &res)) {
+			slot = userdata % DEPTH;
+			blk = userdata / DEPTH;
+			if (res != BLOCK) {
+				errx(1, "ring: block %u: result %d", blk, res);
+			}
+			if (op == IORING_OP_READ) {
+				checkblock("ring read", bufs[slot], blk, pass);
+			}
+			freeslots[nfree++] = slot;
+			done++;
+		}
+	}
+}
+
+/*
+ * One request that should complete on its own with result WANT.
+ */
+static
+void
+single(int op, int fd, int want)
+{
+	unsigned userdata;
+	int res;
+
+	queue(op, fd, 0, bufs[0], 12345);
+	enter(1);
+	if (!reap(&userdata, &res) || userdata != 12345) {
+		errx(1, "op %d: no completion", op);
+	}
+	if (res != want) {
+		errx(1, "op %d: result %d, expected %d", op, res, want);
+	}
+}
+
+/*
+ * A read on a pipe ignores the offset and gets what's there. Then a
+ * child with its own ring leaves a read waiting on a pipe whose write
+ * end we still hold, and exits; the exit has to give up on the read
+ * rather than wait for it.
+ */
+static
+void
+pipetests(void)
+{
+	unsigned userdata;
+	int fds[2], res, status;
+	pid_t pid;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	if (write(fds[1], "hello", 5) != 5) {
+		err(1, "pipe write");
+	}
+	queue(IORING_OP_READ, fds[0], 7, bufs[0], 1);
+	enter(1);
+	if (!reap(&userdata, &res) || userdata != 1) {
+		errx(1, "pipe read: no completion");
+	}
+	if (res != 5 || memcmp(bufs[0], "hello", 5)) {
+		errx(1, "pipe read: result %d", res);
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		setupring();
+		queue(IORING_OP_READ, fds[0], 0, bufs[0], 2);
+		enter(0);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child with a blocked pipe read failed");
+	}
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long long start;
+	unsigned kb, nblocks, i;
+	int fd;
+
+	if (argc > 2) {
+		errx(1, "Usage: ioringbench [kilobytes]");
+	}
+	kb = argc == 2 ? (unsigned)atoi(argv[1]) : DEFAULT_KB;
+	nblocks = (kb * 1024 + BLOCK - 1) / BLOCK;
+	kb = nblocks * BLOCK / 1024;
+
+	fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", TESTFILE);
+	}
+	for (i=0; i<nblocks; i++) {
+		fillblock(bufs[0], i, 0);
+		if (pwrite(fd, bufs[0], BLOCK, (off_t)i * BLOCK) != BLOCK) {
+			err(1, "%s: pwrite", TESTFILE);
+		}
+	}
+
+	start = bench_now();
+	for (i=0; i<nblocks; i++) {
+		if (pread(fd, bufs[0], BLOCK, (off_t)i * BLOCK) != BLOCK) {
+			err(1, "%s: pread", TESTFILE);
+		}
+		checkblock("pread", bufs[0], i, 0);
+	}
+	bench_report("pread, one at a time", start, kb);
+
+	setupring();
+
+	start = bench_now();
+	ringio(fd, IORING_OP_READ, nblocks, 0);
+	bench_report("ring, 16 in flight", start, kb);
+
+	start = bench_now();
+	ringio(fd, IORING_OP_WRITE, nblocks, 1);
+	single(IORING_OP_FSYNC, fd, 0);
+	bench_report("ring writes + fsync", start, kb);
+	for (i=0; i<nblocks; i++) {
+		if (pread(fd, bufs[0], BLOCK, (off_t)i * BLOCK) != BLOCK) {
+			err(1, "%s: pread", TESTFILE);
+		}
+		checkblock("ring write", bufs[0], i, 1);
+	}
+
+	single(IORING_OP_NOP, -1, 0);
+	single(IORING_OP_READ, 1000, -EBADF);
+	pipetests();
+	if (ctl->cq_overflow != 0) {
+		errx(1, "%u completions overflowed", ctl->cq_overflow);
+	}
+
+	close(fd);
+	remove(TESTFILE);
+	tprintf("ioringbench: passed\n");
+	return 0;
+}
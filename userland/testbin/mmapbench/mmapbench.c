@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * mmap benchmark and test.
+ *
+ * Writes a file of words, then sums it with read() and with a mapping,
+ * and once more with a second mapping while the first still holds the
+ * pages in the page cache. Then checks that stores through a shared
+ * mapping reach the file (and a forked child's mapping of it), that
+ * stores through a private mapping don't, and that read() into and
+ * write() from a mapping of the very file being read or written work
+ * (the kernel has to bring the page in without the file's lock). Each
+ * scan is timed.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define FILENAME	"mmapbench.dat"
+#define PAGESIZE	4096
+#define WORDSPERPAGE	((unsigned)(PAGESIZE / sizeof(unsigned)))
+#define DEFAULT_NPAGES	64
+
+static unsigned buf[WORDSPERPAGE];
+
+static
+unsigned
+wordval(unsigned i)
+{
+	return i * 2654435761U;
+}
+
+static
+int
+openfile(int flags)
+{
+	int fd;
+
+	fd = open(FILENAME, flags, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	return fd;
+}
+
+static
+unsigned *
+mapfile(int fd, size_t len, int prot, int flags)
+{
+	void *p;
+
+	p = mmap(NULL, len, prot, flags, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	return p;
+}
+
+static
+unsigned
+summap(const unsigned *p, unsigned nwords)
+{
+	unsigned i, sum;
+
+	sum = 0;
+	for (i=0; i<nwords; i++) {
+		sum += p[i];
+	}
+	return sum;
+}
+
+/*
+ * Read the whole file with read() and check word I is WANT(I) + DELTA.
+ */
+static
+void
+checkfile(unsigned npages, unsigned delta)
+{
+	unsigned i, j;
+	ssize_t len;
+	int fd;
+
+	fd = openfile(O_RDONLY);
+	for (i=0; i<npages; i++) {
+		len = read(fd, buf, sizeof(buf));
+		if (len != sizeof(buf)) {
+			errx(1, "read: short read");
+		}
+		for (j=0; j<WORDSPERPAGE; j++) {
+			if (buf[j] != wordval(i*WORDSPERPAGE + j) + delta) {
+				errx(1, "word %u: wrong data",
+				     i*WORDSPERPAGE + j);
+			}
+		}
+	}
+	close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long long start;
+	unsigned i, j, npages, nwords, sum, msum;
+	unsigned *p, *q;
+	size_t len;
+	pid_t pid;
+	int fd, status;
+
+	if (argc > 2) {
+		errx(1, "Usage: mmapbench [npages]");
+	}
+	npages = argc == 2 ? (unsigned)atoi(argv[1]) : DEFAULT_NPAGES;
+	nwords = npages * WORDSPERPAGE;
+	len = npages * PAGESIZE;
+
+	fd = openfile(O_WRONLY|O_CREAT|O_TRUNC);
+	sum = 0;
+	for (i=0; i<npages; i++) {
+		for (j=0; j<WORDSPERPAGE; j++) {
+			buf[j] = wordval(i*WORDSPERPAGE + j);
+			sum += buf[j];
+		}
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			err(1, "write");
+		}
+	}
+	close(fd);
+
+	/* read() a page at a time */
+	fd = openfile(O_RDONLY);
+	start = bench_now();
+	msum = 0;
+	for (i=0; i<npages; i++) {
+		if (read(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			err(1, "read");
+		}
+		msum += summap(buf, WORDSPERPAGE);
+	}
+	bench_report("read", start, 0);
+	if (msum != sum) {
+		errx(1, "read: wrong sum");
+	}
+
+	/* Map it; every page comes in from the file */
+	start = bench_now();
+	p = mapfile(fd, len, PROT_READ, MAP_SHARED);
+	msum = summap(p, nwords);
+	bench_report("mmap", start, 0);
+	if (msum != sum) {
+		errx(1, "mmap: wrong sum");
+	}
+
+	/* Map it again; now the pages are all in the page cache */
+	start = bench_now();
+	q = mapfile(fd, len, PROT_READ, MAP_PRIVATE);
+	msum = summap(q, nwords);
+	bench_report("mmap (cached)", start, 0);
+	if (msum != sum) {
+		errx(1, "mmap (cached): wrong sum");
+	}
+	if (munmap(q, len) || munmap(p, len)) {
+		err(1, "munmap");
+	}
+	close(fd);
+
+	/* Stores through a shared mapping go to the file */
+	fd = openfile(O_RDWR);
+	p = mapfile(fd, len, PROT_READ|PROT_WRITE, MAP_SHARED);
+	start = bench_now();
+	for (i=0; i<nwords; i++) {
+		p[i]++;
+	}
+	if (msync(p, len, MS_SYNC)) {
+		err(1, "msync");
+	}
+	bench_report("mmap store+msync", start, 0);
+	checkfile(npages, 1);
+
+	/* ...and are seen by a forked child's mapping, and vice versa */
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		for (i=0; i<nwords; i++) {
+			if (p[i] != wordval(i) + 1) {
+				errx(1, "child: word %u: wrong data", i);
+			}
+			p[i]++;
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+	for (i=0; i<nwords; i++) {
+		if (p[i] != wordval(i) + 2) {
+			errx(1, "word %u: child's store not seen", i);
+		}
+	}
+	if (munmap(p, len)) {
+		err(1, "munmap");
+	}
+	checkfile(npages, 2);
+
+	/* Stores through a private mapping don't */
+	p = mapfile(fd, len, PROT_READ|PROT_WRITE, MAP_PRIVATE);
+	for (i=0; i<nwords; i++) {
+		p[i] = 0;
+	}
+	if (munmap(p, len)) {
+		err(1, "munmap");
+	}
+	close(fd);
+	checkfile(npages, 2);
+
+	/* read() into, and write() from, unfaulted mappings of the file */
+	fd = openfile(O_RDWR);
+	p = mapfile(fd, len, PROT_READ|PROT_WRITE, MAP_SHARED);
+	if (read(fd, p, PAGESIZE) != PAGESIZE) {
+		err(1, "read into a mapping of the same file");
+	}
+	for (j=0; j<WORDSPERPAGE; j++) {
+		if (p[j] != wordval(j) + 2) {
+			errx(1, "read into mapping: word %u: wrong data", j);
+		}
+	}
+	q = mapfile(fd, len, PROT_READ, MAP_SHARED);
+	if (lseek(fd, len - PAGESIZE, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	if (write(fd, q + nwords - WORDSPERPAGE, PAGESIZE) != PAGESIZE) {
+		err(1, "write from a mapping of the same file");
+	}
+	if (munmap(q, len) || munmap(p, len)) {
+		err(1, "munmap");
+	}
+	close(fd);
+	checkfile(npages, 2);
+
+	remove(FILENAME);
+	tprintf("Passed.\n");
+	return 0;
+}
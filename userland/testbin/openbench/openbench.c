@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Path lookup benchmark.
+ *
+ * Opens and closes the same paths over and over, and reports how
+ * long each open takes. Paths that don't exist are timed too, since
+ * failing lookups are common (think of the shell searching $PATH).
+ * Use the kernel's dcstats menu command afterwards to see how the
+ * name cache did.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define DEFAULT_COUNT	1000
+
+static const char *const defaultpaths[] = {
+	"/bin/sh",
+	"/testbin/openbench",
+	"/testbin/../bin/cat",
+	"/testbin/no-such-file",
+	NULL
+};
+
+static
+void
+bench(const char *path, unsigned count)
+{
+	unsigned long long start, us;
+	unsigned i;
+	int fd, error = 0;
+
+	start = bench_now_us();
+	for (i=0; i<count; i++) {
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			error = errno;
+			continue;
+		}
+		close(fd);
+	}
+	us = bench_now_us() - start;
+
+	tprintf("%-24s %s: %llu.%02llu us per open\n", path,
+		error ? strerror(error) : "ok",
+		us / count, (us * 100 / count) % 100);
+}
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: openbench [-n count] [path...]");
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned count = DEFAULT_COUNT;
+	int i;
+
+	for (i=1; i<argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-n") && i+1 < argc) {
+			count = atoi(argv[++i]);
+		}
+		else {
+			usage();
+		}
+	}
+	if (count == 0) {
+		usage();
+	}
+
+	if (i == argc) {
+		for (i=0; defaultpaths[i] != NULL; i++) {
+			bench(defaultpaths[i], count);
+		}
+	}
+	else {
+		for (; i<argc; i++) {
+			bench(argv[i], count);
+		}
+	}
+	return 0;
+}
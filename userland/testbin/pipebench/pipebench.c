@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pipe benchmark.
+ *
+ * Hands a few megabytes from a child process to its parent twice:
+ * through a pipe, with the two running concurrently, and through a
+ * temporary file that the child writes and the parent reads back
+ * after it exits. Both transfers are checked and timed. Then the
+ * edge cases are checked: EOF once the writer is gone, EPIPE once
+ * the reader is gone, and EAGAIN from a nonblocking pipe.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define TMPFILE		"pipebench.tmp"
+#define DEFAULT_KB	2048
+#define CHUNK		8192
+
+static char buf[CHUNK];
+
+/*
+ * The data stream: each byte depends on its position, so it can be
+ * checked however the reads happen to be split up.
+ */
+static
+char
+pattern(size_t pos)
+{
+	return (char)(pos * 31 + (pos >> 8));
+}
+
+/*
+ * Child side: write KB kilobytes of the pattern to FD and exit.
+ */
+static
+void
+produce(int fd, unsigned kb)
+{
+	size_t pos, total, i;
+	ssize_t len;
+
+	total = (size_t)kb * 1024;
+	for (pos = 0; pos < total; pos += CHUNK) {
+		for (i=0; i<CHUNK; i++) {
+			buf[i] = pattern(pos + i);
+		}
+		len = write(fd, buf, CHUNK);
+		if (len != CHUNK) {
+			err(1, "producer: write");
+		}
+	}
+	close(fd);
+	_exit(0);
+}
+
+/*
+ * Parent side: read FD to EOF and check it's KB kilobytes of the
+ * pattern.
+ */
+static
+void
+consume(const char *what, int fd, unsigned kb)
+{
+	size_t pos;
+	ssize_t len, i;
+
+	pos = 0;
+	while ((len = read(fd, buf, CHUNK)) > 0) {
+		for (i=0; i<len; i++) {
+			if (buf[i] != pattern(pos + i)) {
+				errx(1, "%s: data differs at byte %lu", what,
+				     (unsigned long)(pos + i));
+			}
+		}
+		pos += len;
+	}
+	if (len < 0) {
+		err(1, "%s: read", what);
+	}
+	if (pos != (size_t)kb * 1024) {
+		errx(1, "%s: got %lu bytes, expected %lu", what,
+		     (unsigned long)pos, (unsigned long)kb * 1024);
+	}
+}
+
+static
+void
+waitchild(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "producer failed");
+	}
+}
+
+static
+void
+viapipe(unsigned kb)
+{
+	int fds[2];
+	pid_t pid;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		produce(fds[1], kb);
+	}
+	close(fds[1]);
+	consume("pipe", fds[0], kb);
+	close(fds[0]);
+	waitchild(pid);
+}
+
+static
+void
+viafile(unsigned kb)
+{
+	int fd;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		fd = open(TMPFILE, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+		if (fd < 0) {
+			err(1, "%s", TMPFILE);
+		}
+		produce(fd, kb);
+	}
+	waitchild(pid);
+
+	fd = open(TMPFILE, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", TMPFILE);
+	}
+	consume("file", fd, kb);
+	close(fd);
+	remove(TMPFILE);
+}
+
+/*
+ * EOF, EPIPE, and nonblocking behavior.
+ */
+static
+void
+edgecases(void)
+{
+	int fds[2];
+	size_t total;
+	ssize_t len;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	if (write(fds[1], "x", 1) != 1) {
+		err(1, "pipe: write");
+	}
+	close(fds[1]);
+	if (read(fds[0], buf, CHUNK) != 1) {
+		errx(1, "pipe: buffered data lost after writer closed");
+	}
+	if (read(fds[0], buf, CHUNK) != 0) {
+		errx(1, "pipe: no EOF after writer closed");
+	}
+	close(fds[0]);
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	close(fds[0]);
+	len = write(fds[1], "x", 1);
+	if (len >= 0 || errno != EPIPE) {
+		errx(1, "pipe: write with no reader did not fail with EPIPE");
+	}
+	close(fds[1]);
+
+	if (pipe2(fds, O_NONBLOCK) < 0) {
+		err(1, "pipe2");
+	}
+	len = read(fds[0], buf, CHUNK);
+	if (len >= 0 || errno != EAGAIN) {
+		errx(1, "pipe2: read of empty pipe did not fail with EAGAIN");
+	}
+	memset(buf, 'x', CHUNK);
+	total = 0;
+	while ((len = write(fds[1], buf, CHUNK)) > 0) {
+		total += len;
+	}
+	if (errno != EAGAIN || total == 0) {
+		errx(1, "pipe2: write to full pipe did not fail with EAGAIN");
+	}
+	tprintf("pipe buffer holds %lu bytes\n", (unsigned long)total);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long long start;
+	unsigned kb;
+
+	if (argc > 2) {
+		errx(1, "Usage: pipebench [kilobytes]");
+	}
+	kb = argc == 2 ? (unsigned)atoi(argv[1]) : DEFAULT_KB;
+	kb = (kb + CHUNK/1024 - 1) / (CHUNK/1024) * (CHUNK/1024);
+
+	start = bench_now();
+	viapipe(kb);
+	bench_report("pipe", start, kb);
+
+	start = bench_now();
+	viafile(kb);
+	bench_report("temporary file", start, kb);
+
+	edgecases();
+
+	tprintf("pipebench: passed\n");
+	return 0;
+}
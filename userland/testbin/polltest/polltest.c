@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * poll() test.
+ *
+ * Checks that poll() reports readiness correctly for pipes, semfs
+ * semaphores and regular files, that it sleeps until a pipe it is
+ * watching is written to (rather than returning early or spinning),
+ * and that the timeout works.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define SEMNAME		"sem:polltest"
+#define DELAY_MS	200
+
+static
+void
+sleepms(unsigned ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+}
+
+/*
+ * Poll one file without waiting and return its revents.
+ */
+static
+int
+pollone(int fd, int events)
+{
+	struct pollfd pfd;
+	int r;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = 0;
+	r = poll(&pfd, 1, 0);
+	if (r < 0) {
+		err(1, "poll");
+	}
+	if (r != (pfd.revents != 0)) {
+		errx(1, "poll returned %d with revents 0x%x", r, pfd.revents);
+	}
+	return pfd.revents;
+}
+
+static
+void
+expect(const char *what, int got, int want)
+{
+	if (got != want) {
+		errx(1, "%s: revents 0x%x, expected 0x%x", what, got, want);
+	}
+}
+
+static
+void
+testtimeout(void)
+{
+	unsigned long long start, ms;
+	int r;
+
+	start = bench_now();
+	r = poll(NULL, 0, DELAY_MS);
+	ms = bench_now() - start;
+	if (r != 0) {
+		errx(1, "timeout: poll returned %d", r);
+	}
+	if (ms < DELAY_MS / 2) {
+		errx(1, "timeout: poll returned after %llu ms", ms);
+	}
+	tprintf("timeout: %d ms requested, %llu ms elapsed\n", DELAY_MS, ms);
+}
+
+/*
+ * Two pipes; a child writes to the second after a delay and then
+ * exits. Poll should sleep until the write, report only the second
+ * pipe, and then report POLLHUP once the child is gone.
+ */
+static
+void
+testpipes(void)
+{
+	int p1[2], p2[2];
+	struct pollfd pfds[2];
+	unsigned long long start, ms;
+	pid_t pid;
+	char ch;
+	int r, status;
+
+	if (pipe(p1) < 0 || pipe(p2) < 0) {
+		err(1, "pipe");
+	}
+	expect("empty pipe", pollone(p1[0], POLLIN), 0);
+	expect("pipe write end", pollone(p1[1], POLLOUT), POLLOUT);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(p1[0]);
+		close(p2[0]);
+		sleepms(DELAY_MS);
+		if (write(p2[1], "x", 1) != 1) {
+			err(1, "child: write");
+		}
+		_exit(0);
+	}
+	close(p2[1]);
+
+	pfds[0].fd = p1[0];
+	pfds[0].events = POLLIN;
+	pfds[1].fd = p2[0];
+	pfds[1].events = POLLIN;
+	start = bench_now();
+	r = poll(pfds, 2, -1);
+	ms = bench_now() - start;
+	if (r != 1) {
+		errx(1, "pipes: poll returned %d", r);
+	}
+	expect("idle pipe", pfds[0].revents, 0);
+	if (!(pfds[1].revents & POLLIN)) {
+		errx(1, "pipes: written pipe not readable");
+	}
+	if (ms < DELAY_MS / 2) {
+		errx(1, "pipes: poll returned after %llu ms", ms);
+	}
+	tprintf("pipes: woke after %llu ms\n", ms);
+	if (read(p2[0], &ch, 1) != 1 || ch != 'x') {
+		errx(1, "pipes: read the wrong thing");
+	}
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	expect("pipe with no writer", pollone(p2[0], POLLIN),
+	       POLLIN | POLLHUP);
+	close(p2[0]);
+
+	close(p1[0]);
+	expect("pipe with no reader", pollone(p1[1], POLLOUT), POLLERR);
+	close(p1[1]);
+}
+
+/*
+ * A semaphore is readable (P won't block) when its count is nonzero.
+ */
+static
+void
+testsem(void)
+{
+	char ch = 0;
+	int fd;
+
+	fd = open(SEMNAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", SEMNAME);
+	}
+	expect("semaphore at 0", pollone(fd, POLLIN|POLLOUT), POLLOUT);
+	if (write(fd, &ch, 1) != 1) {
+		err(1, "%s: write", SEMNAME);
+	}
+	expect("semaphore at 1", pollone(fd, POLLIN|POLLOUT),
+	       POLLIN|POLLOUT);
+	if (read(fd, &ch, 1) != 1) {
+		err(1, "%s: read", SEMNAME);
+	}
+	expect("semaphore back at 0", pollone(fd, POLLIN), 0);
+	close(fd);
+	remove(SEMNAME);
+}
+
+/*
+ * Regular files are always ready, and closed descriptors are
+ * reported as such.
+ */
+static
+void
+testmisc(void)
+{
+	struct pollfd pfd;
+	int fd;
+
+	fd = open("polltest.tmp", O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "polltest.tmp");
+	}
+	expect("regular file", pollone(fd, POLLIN|POLLOUT), POLLIN|POLLOUT);
+	close(fd);
+	remove("polltest.tmp");
+
+	expect("closed fd", pollone(fd, POLLIN), POLLNVAL);
+
+	pfd.fd = -1;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) != 0 || pfd.revents != 0) {
+		errx(1, "negative fd was not ignored");
+	}
+}
+
+int
+main(void)
+{
+	testtimeout();
+	testpipes();
+	testsem();
+	testmisc();
+	tprintf("polltest: passed\n");
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * rusage.c
+ *
+ * 	Tests getrusage(), and that waitpid() hands a child's usage
+ * 	to its parent.
+ *
+ * Burns some CPU in user mode, then forks a child that does the
+ * same and checks that the time shows up under RUSAGE_SELF and,
+ * once the child is waited for, under RUSAGE_CHILDREN.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define SPINS 2000000
+
+static volatile unsigned sink;
+
+static
+void
+spin(void)
+{
+	unsigned i;
+
+	for (i=0; i<SPINS; i++) {
+		sink += i;
+	}
+}
+
+static
+void
+show(const char *what, const struct rusage *ru)
+{
+	printf("%s: user %lld.%06ds, sys %lld.%06ds, "
+	       "%llu voluntary, %llu involuntary switches\n",
+	       what,
+	       (long long)ru->ru_utime.tv_sec, (int)ru->ru_utime.tv_usec,
+	       (long long)ru->ru_stime.tv_sec, (int)ru->ru_stime.tv_usec,
+	       (unsigned long long)ru->ru_nvcsw,
+	       (unsigned long long)ru->ru_nivcsw);
+}
+
+static
+int
+hastime(const struct timeval *tv)
+{
+	return tv->tv_sec > 0 || tv->tv_usec > 0;
+}
+
+int
+main(void)
+{
+	struct rusage self, children;
+	pid_t pid;
+	int status;
+
+	spin();
+
+	if (getrusage(RUSAGE_SELF, &self) < 0) {
+		err(1, "getrusage(RUSAGE_SELF)");
+	}
+	show("self", &self);
+	if (!hastime(&self.ru_utime)) {
+		errx(1, "No user time recorded for self");
+	}
+
+	if (getrusage(RUSAGE_CHILDREN, &children) < 0) {
+		err(1, "getrusage(RUSAGE_CHILDREN)");
+	}
+	if (hastime(&children.ru_utime)) {
+		errx(1, "Child time recorded before any children");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		spin();
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+
+	if (getrusage(RUSAGE_CHILDREN, &children) < 0) {
+		err(1, "getrusage(RUSAGE_CHILDREN)");
+	}
+	show("children", &children);
+	if (!hastime(&children.ru_utime)) {
+		errx(1, "No user time recorded for child");
+	}
+
+	if (getrusage(-2, &self) == 0) {
+		errx(1, "getrusage with bad who succeeded");
+	}
+
+	printf("rusage: passed\n");
+	return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Scatter/gather and positional I/O benchmark.
+ *
+ * Writes and reads a file of fixed-size records, each a small header
+ * followed by a body, first with a read() or write() per piece and
+ * then with readv() and writev() doing many records per call. Then
+ * reads the records in reverse order with lseek() and read(), and
+ * again with pread(). Everything read is checked, and each phase is
+ * timed.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define FILENAME	"vecbench.dat"
+#define DEFAULT_NRECS	512
+#define HDRSIZE		16
+#define BODYSIZE	112
+#define RECSIZE		(HDRSIZE + BODYSIZE)
+#define RECSPERCALL	16
+
+struct record {
+	char hdr[HDRSIZE];
+	char body[BODYSIZE];
+};
+
+static struct record recs[RECSPERCALL];
+static struct iovec iov[RECSPERCALL * 2];
+
+static
+void
+fillrec(struct record *r, unsigned num)
+{
+	memset(r, 0, sizeof(*r));
+	snprintf(r->hdr, sizeof(r->hdr), "rec %u", num);
+	memset(r->body, 'a' + num % 26, sizeof(r->body));
+}
+
+static
+void
+checkrec(const struct record *r, unsigned num)
+{
+	struct record good;
+
+	fillrec(&good, num);
+	if (memcmp(r, &good, sizeof(good))) {
+		errx(1, "record %u: wrong data", num);
+	}
+}
+
+static
+void
+checklen(const char *op, ssize_t len, size_t want)
+{
+	if (len < 0) {
+		err(1, "%s", op);
+	}
+	if ((size_t)len != want) {
+		errx(1, "%s: short transfer (%ld of %lu bytes)", op,
+		     (long)len, (unsigned long)want);
+	}
+}
+
+/*
+ * Point the iovecs at the header and body of each of N records.
+ */
+static
+void
+setupiov(unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		iov[i*2].iov_base = recs[i].hdr;
+		iov[i*2].iov_len = HDRSIZE;
+		iov[i*2+1].iov_base = recs[i].body;
+		iov[i*2+1].iov_len = BODYSIZE;
+	}
+}
+
+static
+int
+openfile(int flags)
+{
+	int fd;
+
+	fd = open(FILENAME, flags, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	return fd;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long long start;
+	unsigned i, j, n, nrecs;
+	int fd;
+
+	if (argc > 2) {
+		errx(1, "Usage: vecbench [nrecords]");
+	}
+	nrecs = argc == 2 ? (unsigned)atoi(argv[1]) : DEFAULT_NRECS;
+
+	/* write(), two calls per record */
+	fd = openfile(O_WRONLY|O_CREAT|O_TRUNC);
+	start = bench_now();
+	for (i=0; i<nrecs; i++) {
+		fillrec(&recs[0], i);
+		checklen("write", write(fd, recs[0].hdr, HDRSIZE), HDRSIZE);
+		checklen("write", write(fd, recs[0].body, BODYSIZE), BODYSIZE);
+	}
+	bench_report("write", start, 0);
+	close(fd);
+
+	/* writev(), RECSPERCALL records per call */
+	fd = openfile(O_WRONLY|O_CREAT|O_TRUNC);
+	start = bench_now();
+	for (i=0; i<nrecs; i+=n) {
+		n = nrecs - i < RECSPERCALL ? nrecs - i : RECSPERCALL;
+		for (j=0; j<n; j++) {
+			fillrec(&recs[j], i+j);
+		}
+		setupiov(n);
+		checklen("writev", writev(fd, iov, n*2), n*RECSIZE);
+	}
+	bench_report("writev", start, 0);
+	close(fd);
+
+	/* read(), two calls per record */
+	fd = openfile(O_RDONLY);
+	start = bench_now();
+	for (i=0; i<nrecs; i++) {
+		checklen("read", read(fd, recs[0].hdr, HDRSIZE), HDRSIZE);
+		checklen("read", read(fd, recs[0].body, BODYSIZE), BODYSIZE);
+		checkrec(&recs[0], i);
+	}
+	bench_report("read", start, 0);
+	close(fd);
+
+	/* readv(), RECSPERCALL records per call */
+	fd = openfile(O_RDONLY);
+	start = bench_now();
+	for (i=0; i<nrecs; i+=n) {
+		n = nrecs - i < RECSPERCALL ? nrecs - i : RECSPERCALL;
+		setupiov(n);
+		checklen("readv", readv(fd, iov, n*2), n*RECSIZE);
+		for (j=0; j<n; j++) {
+			checkrec(&recs[j], i+j);
+		}
+	}
+	bench_report("readv", start, 0);
+
+	/* backwards with lseek() and read() */
+	start = bench_now();
+	for (i=nrecs; i-- > 0; ) {
+		if (lseek(fd, (off_t)i * RECSIZE, SEEK_SET) < 0) {
+			err(1, "lseek");
+		}
+		checklen("read", read(fd, &recs[0], RECSIZE), RECSIZE);
+		checkrec(&recs[0], i);
+	}
+	bench_report("lseek+read backwards", start, 0);
+
+	/* backwards with pread() */
+	start = bench_now();
+	for (i=nrecs; i-- > 0; ) {
+		checklen("pread", pread(fd, &recs[0], RECSIZE,
+					(off_t)i * RECSIZE), RECSIZE);
+		checkrec(&recs[0], i);
+	}
+	bench_report("pread backwards", start, 0);
+
+	/* pread must not have moved the seek position */
+	if (lseek(fd, 0, SEEK_CUR) != RECSIZE) {
+		errx(1, "pread changed the seek position");
+	}
+	close(fd);
+
+	remove(FILENAME);
+	tprintf("Passed.\n");
+	return 0;
+}